@@ -12,6 +12,7 @@
 #define HAVE_INTTYPES_H 1
 #define HAVE_OPENSSL_SSL_H 1
 #define HAVE_PREAD 1
+#define HAVE_PTHREAD_CREATE 1
 /* #undef HAVE_READLINE_READLINE_H */
 #define HAVE_SOCKET 1
 #define HAVE_SSL_NEW 1
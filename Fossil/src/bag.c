@@ -18,6 +18,10 @@
 ** This file contains code used to implement a "bag" of integers.
 ** A bag is an unordered collection without duplicates.  In this
 ** implementation, all elements must be positive integers.
+**
+** It also implements a "bitmap", which is a bag that is kept in order
+** and that uses little memory even when it holds a large fraction of
+** all the artifacts in a repository.
 */
 #include "config.h"
 #include "bag.h"
@@ -229,3 +233,260 @@ int bag_next(Bag *p, int e){
 int bag_count(Bag *p){
   return p->cnt;
 }
+
+/*
+** Integers in a bitmap are divided into chunks of 65536 that share the
+** same upper bits.  A chunk holding few integers keeps their lower 16
+** bits in a sorted array.  A chunk holding more than BITMAP_ARRAY_MAX
+** integers keeps one bit for each of the 65536 possible integers
+** instead, which takes less space once the array would be larger than
+** 8KB.  A chunk goes back to being an array when it holds no more than
+** half of BITMAP_ARRAY_MAX integers.
+*/
+#define BITMAP_ARRAY_MAX  4096
+#define BITMAP_NWORD      (65536/64)
+
+#if INTERFACE
+/*
+** One chunk of a bitmap.  Exactly one of a[] and aBit[] is not NULL.
+*/
+struct BitmapChunk {
+  int hi;                /* The upper bits shared by all integers here */
+  int n;                 /* Number of integers in the chunk */
+  int nAlloc;            /* Slots allocated in a[] */
+  unsigned short *a;     /* Lower 16 bits of each integer, in order */
+  u64 *aBit;             /* One bit for each possible integer */
+};
+
+/*
+** A bitmap of positive integers.  The chunks are in order of hi.
+*/
+struct Bitmap {
+  int cnt;               /* Number of integers in the bitmap */
+  int nChunk;            /* Number of chunks in aChunk[] */
+  int nAlloc;            /* Slots allocated in aChunk[] */
+  BitmapChunk *aChunk;   /* The chunks */
+};
+#endif
+
+/*
+** Initialize a Bitmap structure
+*/
+void bitmap_init(Bitmap *p){
+  memset(p, 0, sizeof(*p));
+}
+
+/*
+** Destroy a Bitmap.  Delete all of its content.
+*/
+void bitmap_clear(Bitmap *p){
+  int i;
+  for(i=0; i<p->nChunk; i++){
+    fossil_free(p->aChunk[i].a);
+    fossil_free(p->aChunk[i].aBit);
+  }
+  fossil_free(p->aChunk);
+  bitmap_init(p);
+}
+
+/*
+** Return the index in p->aChunk[] of the chunk whose upper bits are hi.
+** If there is no such chunk, return the negative of one more than the
+** index at which it would be inserted.
+*/
+static int bitmap_chunk(Bitmap *p, int hi){
+  int lo = 0, up = p->nChunk-1;
+  while( lo<=up ){
+    int mid = (lo+up)/2;
+    if( p->aChunk[mid].hi==hi ) return mid;
+    if( p->aChunk[mid].hi<hi ){
+      lo = mid+1;
+    }else{
+      up = mid-1;
+    }
+  }
+  return -(lo+1);
+}
+
+/*
+** Return the index in the array of chunk pC of the first value that is
+** greater than or equal to x, or pC->n if there is none.
+*/
+static int bitmap_search(BitmapChunk *pC, int x){
+  int lo = 0, up = pC->n;
+  while( lo<up ){
+    int mid = (lo+up)/2;
+    if( pC->a[mid]<x ){
+      lo = mid+1;
+    }else{
+      up = mid;
+    }
+  }
+  return lo;
+}
+
+/*
+** Change chunk pC from an array into one bit per integer, or back
+*/
+static void bitmap_to_bits(BitmapChunk *pC){
+  int i;
+  pC->aBit = fossil_malloc( sizeof(u64)*BITMAP_NWORD );
+  memset(pC->aBit, 0, sizeof(u64)*BITMAP_NWORD);
+  for(i=0; i<pC->n; i++){
+    pC->aBit[pC->a[i]>>6] |= ((u64)1)<<(pC->a[i]&63);
+  }
+  fossil_free(pC->a);
+  pC->a = 0;
+  pC->nAlloc = 0;
+}
+static void bitmap_to_array(BitmapChunk *pC){
+  int i, j = 0;
+  pC->nAlloc = BITMAP_ARRAY_MAX;
+  pC->a = fossil_malloc( sizeof(pC->a[0])*pC->nAlloc );
+  for(i=0; i<65536; i++){
+    if( pC->aBit[i>>6] & (((u64)1)<<(i&63)) ) pC->a[j++] = i;
+  }
+  assert( j==pC->n );
+  fossil_free(pC->aBit);
+  pC->aBit = 0;
+}
+
+/*
+** Insert element e into the bitmap if it is not there already.
+** Return TRUE if the insert actually occurred.  Return FALSE
+** if the element was already in the bitmap.
+*/
+int bitmap_insert(Bitmap *p, int e){
+  BitmapChunk *pC;
+  int i, x = e & 0xffff;
+  assert( e>0 );
+  i = bitmap_chunk(p, e>>16);
+  if( i<0 ){
+    i = -(i+1);
+    if( p->nChunk>=p->nAlloc ){
+      p->nAlloc = p->nAlloc*2 + 8;
+      p->aChunk = fossil_realloc(p->aChunk, sizeof(p->aChunk[0])*p->nAlloc);
+    }
+    memmove(&p->aChunk[i+1], &p->aChunk[i],
+            sizeof(p->aChunk[0])*(p->nChunk-i));
+    p->nChunk++;
+    memset(&p->aChunk[i], 0, sizeof(p->aChunk[0]));
+    p->aChunk[i].hi = e>>16;
+  }
+  pC = &p->aChunk[i];
+  if( pC->aBit ){
+    u64 m = ((u64)1)<<(x&63);
+    if( pC->aBit[x>>6] & m ) return 0;
+    pC->aBit[x>>6] |= m;
+  }else{
+    int j = bitmap_search(pC, x);
+    if( j<pC->n && pC->a[j]==x ) return 0;
+    if( pC->n>=BITMAP_ARRAY_MAX ){
+      bitmap_to_bits(pC);
+      pC->aBit[x>>6] |= ((u64)1)<<(x&63);
+    }else{
+      if( pC->n>=pC->nAlloc ){
+        pC->nAlloc = pC->nAlloc*2 + 8;
+        if( pC->nAlloc>BITMAP_ARRAY_MAX ) pC->nAlloc = BITMAP_ARRAY_MAX;
+        pC->a = fossil_realloc(pC->a, sizeof(pC->a[0])*pC->nAlloc);
+      }
+      memmove(&pC->a[j+1], &pC->a[j], sizeof(pC->a[0])*(pC->n-j));
+      pC->a[j] = x;
+    }
+  }
+  pC->n++;
+  p->cnt++;
+  return 1;
+}
+
+/*
+** Return true if e in the bitmap.  Return false if it is no.
+*/
+int bitmap_find(Bitmap *p, int e){
+  BitmapChunk *pC;
+  int i, j, x = e & 0xffff;
+  assert( e>0 );
+  i = bitmap_chunk(p, e>>16);
+  if( i<0 ) return 0;
+  pC = &p->aChunk[i];
+  if( pC->aBit ){
+    return (pC->aBit[x>>6] & (((u64)1)<<(x&63)))!=0;
+  }
+  j = bitmap_search(pC, x);
+  return j<pC->n && pC->a[j]==x;
+}
+
+/*
+** Remove element e from the bitmap if it exists in the bitmap.
+** If e is not in the bitmap, this is a no-op.
+*/
+void bitmap_remove(Bitmap *p, int e){
+  BitmapChunk *pC;
+  int i, x = e & 0xffff;
+  assert( e>0 );
+  i = bitmap_chunk(p, e>>16);
+  if( i<0 ) return;
+  pC = &p->aChunk[i];
+  if( pC->aBit ){
+    u64 m = ((u64)1)<<(x&63);
+    if( (pC->aBit[x>>6] & m)==0 ) return;
+    pC->aBit[x>>6] &= ~m;
+    pC->n--;
+    if( pC->n<=BITMAP_ARRAY_MAX/2 ) bitmap_to_array(pC);
+  }else{
+    int j = bitmap_search(pC, x);
+    if( j>=pC->n || pC->a[j]!=x ) return;
+    memmove(&pC->a[j], &pC->a[j+1], sizeof(pC->a[0])*(pC->n-j-1));
+    pC->n--;
+  }
+  p->cnt--;
+  if( pC->n==0 ){
+    fossil_free(pC->a);
+    fossil_free(pC->aBit);
+    memmove(&p->aChunk[i], &p->aChunk[i+1],
+            sizeof(p->aChunk[0])*(p->nChunk-i-1));
+    p->nChunk--;
+  }
+}
+
+/*
+** Return the smallest element in the bitmap that is greater than e, or
+** 0 if there is none.  Use e==0 to get the smallest element.  Unlike
+** the elements of a bag, the elements of a bitmap are visited in order
+** even if elements are inserted or removed along the way.
+*/
+int bitmap_next(Bitmap *p, int e){
+  int i, x;
+  assert( e>=0 );
+  e++;
+  i = bitmap_chunk(p, e>>16);
+  x = e & 0xffff;
+  if( i<0 ){
+    i = -(i+1);
+    x = 0;
+  }
+  for(; i<p->nChunk; i++, x=0){
+    BitmapChunk *pC = &p->aChunk[i];
+    if( pC->aBit ){
+      int w = x>>6;
+      u64 m = pC->aBit[w] & (~(u64)0 << (x&63));
+      while( m==0 && ++w<BITMAP_NWORD ) m = pC->aBit[w];
+      if( m ){
+        int b = 0;
+        while( (m & 1)==0 ){ m >>= 1; b++; }
+        return (pC->hi<<16) + w*64 + b;
+      }
+    }else{
+      int j = bitmap_search(pC, x);
+      if( j<pC->n ) return (pC->hi<<16) + pC->a[j];
+    }
+  }
+  return 0;
+}
+
+/*
+** Return the number of elements in the bitmap.
+*/
+int bitmap_count(Bitmap *p){
+  return p->cnt;
+}
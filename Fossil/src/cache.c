@@ -0,0 +1,417 @@
+/*
+** Copyright (c) 2014 D. Richard Hipp
+**
+** This program is free software; you can redistribute it and/or
+** modify it under the terms of the Simplified BSD License (also
+** known as the "2-Clause License" or "FreeBSD License".)
+
+** This program is distributed in the hope that it will be useful,
+** but without any warranty; without even the implied warranty of
+** merchantability or fitness for a particular purpose.
+**
+** Author contact information:
+**   drh@hwaci.com
+**   http://www.hwaci.com/drh/
+**
+*******************************************************************************
+**
+** This file implements a cache of the ZIP archives and tarballs made by
+** the /zip and /tarball pages.  An archive of a particular check-in never
+** changes, so once it has been built it can be sent again without
+** rebuilding it.
+**
+** The cache is a separate SQLite database with the same name as the
+** repository plus a "-cache" suffix.  It is only used when the
+** "archive-cache-size" setting is more than zero.  When the archives in
+** the cache grow larger than that many megabytes, those least recently
+** used are removed.
+**
+** Archives are stored in pieces of CACHE_CHUNK_SZ bytes, written as the
+** archive is streamed to the client and read back one piece at a time,
+** so the cache never needs a whole archive in memory.
+*/
+#include "config.h"
+#include "cache.h"
+
+/*
+** Size of the pieces in which archives are stored
+*/
+#define CACHE_CHUNK_SZ 1000000
+
+/*
+** An entry in the cache that is still being written is abandoned after
+** this many days, so that the failure of the process writing it does not
+** block the key forever.
+*/
+#define CACHE_STALE_DAYS (1.0/24.0)
+
+/*
+** Schema of the cache database
+*/
+static const char zCacheSchema[] =
+@ CREATE TABLE IF NOT EXISTS archive(
+@   id INTEGER PRIMARY KEY,  -- Archive id
+@   key TEXT UNIQUE NOT NULL,  -- Format, check-in and name of the archive
+@   sz INT,                  -- Size in bytes.  NULL while being written
+@   ctime REAL,              -- Julian day when created
+@   atime REAL,              -- Julian day when last sent
+@   nhit INT DEFAULT 0       -- Number of times sent from the cache
+@ );
+@ CREATE TABLE IF NOT EXISTS chunk(
+@   aid INT,                 -- The archive.id this piece belongs to
+@   seq INT,                 -- Order of this piece within the archive
+@   data BLOB,               -- Content
+@   PRIMARY KEY(aid,seq)
+@ );
+@ CREATE TABLE IF NOT EXISTS stat(
+@   name TEXT PRIMARY KEY,   -- "hit", "miss" or "evict"
+@   n INT                    -- Number of occurrences
+@ );
+;
+
+/*
+** State of the cache
+*/
+static struct {
+  sqlite3 *db;            /* Connection to the cache, or NULL */
+  sqlite3_int64 aid;      /* The archive being written, or 0 */
+  int seq;                /* Number of pieces written so far */
+  sqlite3_int64 sz;       /* Total bytes received so far */
+  Blob chunk;             /* Content not yet written */
+  int isFailed;           /* True if writing the archive failed */
+} cache;
+
+/*
+** Return the name of the cache database.  Space to hold the name is
+** obtained from malloc.
+*/
+static char *cache_filename(void){
+  return mprintf("%s-cache", g.zRepositoryName);
+}
+
+/*
+** Run SQL against the cache.  Return the SQLite result code.
+*/
+static int cache_exec(const char *zFormat, ...){
+  va_list ap;
+  char *zSql;
+  int rc;
+  va_start(ap, zFormat);
+  zSql = sqlite3_vmprintf(zFormat, ap);
+  va_end(ap);
+  rc = sqlite3_exec(cache.db, zSql, 0, 0, 0);
+  sqlite3_free(zSql);
+  return rc;
+}
+
+/*
+** Return the integer result of an SQL query against the cache, or
+** iDflt if the query returns no rows.
+*/
+static sqlite3_int64 cache_int64(sqlite3_int64 iDflt, const char *zFormat, ...){
+  va_list ap;
+  char *zSql;
+  sqlite3_stmt *pStmt = 0;
+  sqlite3_int64 v = iDflt;
+  va_start(ap, zFormat);
+  zSql = sqlite3_vmprintf(zFormat, ap);
+  va_end(ap);
+  if( sqlite3_prepare_v2(cache.db, zSql, -1, &pStmt, 0)==SQLITE_OK
+   && sqlite3_step(pStmt)==SQLITE_ROW
+  ){
+    v = sqlite3_column_int64(pStmt, 0);
+  }
+  sqlite3_finalize(pStmt);
+  sqlite3_free(zSql);
+  return v;
+}
+
+/*
+** Add one to the count of the named event
+*/
+static void cache_count(const char *zName){
+  cache_exec("INSERT OR IGNORE INTO stat VALUES(%Q,0);"
+             "UPDATE stat SET n=n+1 WHERE name=%Q;", zName, zName);
+}
+
+/*
+** Return true if the cache is turned on
+*/
+static int cache_enabled(void){
+  return db_get_int("archive-cache-size", 0)>0;
+}
+
+/*
+** Open the cache database, creating it if necessary.  Return 0 if the
+** cache cannot be used.
+*/
+static sqlite3 *cache_open(void){
+  char *zName;
+  int rc;
+  if( cache.db ) return cache.db;
+  zName = cache_filename();
+  rc = sqlite3_open_v2(zName, &cache.db,
+                       SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE,
+                       g.zVfsName);
+  fossil_free(zName);
+  if( rc==SQLITE_OK ){
+    sqlite3_busy_timeout(cache.db, 5000);
+    rc = sqlite3_exec(cache.db, "PRAGMA journal_mode=WAL;", 0, 0, 0);
+  }
+  if( rc==SQLITE_OK ){
+    rc = sqlite3_exec(cache.db, zCacheSchema, 0, 0, 0);
+  }
+  if( rc!=SQLITE_OK ){
+    sqlite3_close(cache.db);
+    cache.db = 0;
+  }
+  return cache.db;
+}
+
+/*
+** Close the cache database.  The last connection to close folds the
+** write-ahead log back into the database, so the log does not have to
+** be recovered by the next process to open it.
+*/
+static void cache_close(void){
+  if( cache.db ){
+    sqlite3_close(cache.db);
+    cache.db = 0;
+  }
+}
+
+/*
+** Remove an archive from the cache.  Return SQLITE_OK on success.
+*/
+static int cache_delete(sqlite3_int64 aid){
+  int rc = cache_exec("BEGIN;"
+                      "DELETE FROM chunk WHERE aid=%lld;"
+                      "DELETE FROM archive WHERE id=%lld;"
+                      "COMMIT;", aid, aid);
+  if( rc!=SQLITE_OK && !sqlite3_get_autocommit(cache.db) ){
+    cache_exec("ROLLBACK");
+  }
+  return rc;
+}
+
+/*
+** Remove the least recently used archives until the cache is no larger
+** than the "archive-cache-size" setting.  Also remove archives that
+** were abandoned while being written.  Give up if an archive cannot be
+** removed, as it would only be chosen again.
+*/
+static void cache_evict(void){
+  sqlite3_int64 mx = (sqlite3_int64)db_get_int("archive-cache-size", 0)*1000000;
+  sqlite3_int64 aid;
+  while( (aid = cache_int64(0,
+            "SELECT id FROM archive"
+            " WHERE sz IS NULL AND ctime<julianday('now')-%.17g",
+            CACHE_STALE_DAYS))!=0 ){
+    if( cache_delete(aid)!=SQLITE_OK ) return;
+  }
+  while( cache_int64(0, "SELECT total(sz) FROM archive")>mx ){
+    aid = cache_int64(0, "SELECT id FROM archive WHERE sz IS NOT NULL"
+                         " ORDER BY atime LIMIT 1");
+    if( aid==0 || cache_delete(aid)!=SQLITE_OK ) break;
+    cache_count("evict");
+  }
+}
+
+/*
+** If the archive named zKey is in the cache, send it as the reply and
+** return true.  Otherwise return false.  The content type and other
+** headers must already be set.
+*/
+int cache_serve(const char *zKey){
+  sqlite3_stmt *pStmt = 0;
+  sqlite3_int64 aid;
+  int rc;
+
+  if( !cache_enabled() || cache_open()==0 ) return 0;
+  if( cache_exec("BEGIN")!=SQLITE_OK ) return 0;
+  aid = cache_int64(0, "SELECT id FROM archive"
+                       " WHERE key=%Q AND sz IS NOT NULL", zKey);
+  if( aid==0 ){
+    cache_exec("COMMIT");
+    cache_count("miss");
+    cache_close();
+    return 0;
+  }
+  rc = sqlite3_prepare_v2(cache.db,
+          "SELECT data FROM chunk WHERE aid=?1 ORDER BY seq", -1, &pStmt, 0);
+  if( rc!=SQLITE_OK ){
+    cache_exec("COMMIT");
+    cache_close();
+    return 0;
+  }
+  sqlite3_bind_int64(pStmt, 1, aid);
+  cgi_stream_begin();
+  while( sqlite3_step(pStmt)==SQLITE_ROW ){
+    cgi_stream(sqlite3_column_blob(pStmt, 0), sqlite3_column_bytes(pStmt, 0));
+  }
+  sqlite3_finalize(pStmt);
+  cache_exec("COMMIT");
+  cgi_stream_end();
+  cache_exec("UPDATE archive SET atime=julianday('now'), nhit=nhit+1"
+             " WHERE id=%lld", aid);
+  cache_count("hit");
+  cache_close();
+  return 1;
+}
+
+/*
+** Write the content accumulated in cache.chunk to the cache
+*/
+static void cache_write_chunk(void){
+  sqlite3_stmt *pStmt = 0;
+  int rc;
+  if( blob_size(&cache.chunk)==0 || cache.isFailed ) return;
+  rc = sqlite3_prepare_v2(cache.db,
+          "INSERT INTO chunk(aid,seq,data) VALUES(?1,?2,?3)", -1, &pStmt, 0);
+  if( rc==SQLITE_OK ){
+    sqlite3_bind_int64(pStmt, 1, cache.aid);
+    sqlite3_bind_int(pStmt, 2, cache.seq++);
+    sqlite3_bind_blob(pStmt, 3, blob_buffer(&cache.chunk),
+                      blob_size(&cache.chunk), SQLITE_STATIC);
+    rc = sqlite3_step(pStmt);
+  }
+  sqlite3_finalize(pStmt);
+  if( rc!=SQLITE_DONE ) cache.isFailed = 1;
+  blob_reset(&cache.chunk);
+}
+
+/*
+** Receive a copy of the content sent by cgi_stream()
+*/
+static void cache_capture_step(const char *z, int n){
+  blob_append(&cache.chunk, z, n);
+  cache.sz += n;
+  if( blob_size(&cache.chunk)>=CACHE_CHUNK_SZ ) cache_write_chunk();
+}
+
+/*
+** Begin saving the streamed reply as the archive named zKey.  Nothing
+** is saved if the cache is off or if another process is already
+** saving the same archive.
+*/
+void cache_capture_begin(const char *zKey){
+  if( !cache_enabled() || cache_open()==0 ) return;
+  cache_exec("INSERT OR IGNORE INTO archive(key,ctime,atime)"
+             " VALUES(%Q,julianday('now'),julianday('now'))", zKey);
+  if( sqlite3_changes(cache.db)==0 ){
+    cache_close();
+    return;
+  }
+  cache.aid = sqlite3_last_insert_rowid(cache.db);
+  cache.seq = 0;
+  cache.sz = 0;
+  cache.isFailed = 0;
+  blob_zero(&cache.chunk);
+  cgi_stream_tee(cache_capture_step);
+}
+
+/*
+** Finish saving the archive started by cache_capture_begin()
+*/
+void cache_capture_end(void){
+  if( cache.aid==0 ) return;
+  cgi_stream_tee(0);
+  cache_write_chunk();
+  if( cache.isFailed ){
+    cache_delete(cache.aid);
+  }else{
+    cache_exec("UPDATE archive SET sz=%lld WHERE id=%lld", cache.sz, cache.aid);
+  }
+  cache.aid = 0;
+  cache_evict();
+  cache_close();
+}
+
+/*
+** WEBPAGE: cachestat
+**
+** Show the contents and hit rate of the archive cache and allow the
+** administrator to empty it.
+*/
+void cache_page(void){
+  sqlite3_stmt *pStmt = 0;
+  sqlite3_int64 nHit, nMiss, nEvict, sz;
+  int nEntry;
+  char *zName;
+
+  login_check_credentials();
+  if( !g.perm.Setup && !g.perm.Admin ){
+    login_needed();
+    return;
+  }
+  style_header("Archive Cache");
+  zName = cache_filename();
+  if( !file_isfile(zName) ){
+    @ <p>The archive cache is empty.
+    if( !cache_enabled() ){
+      @ It is turned on by setting "archive-cache-size" to the
+      @ maximum size of the cache in megabytes.
+    }
+    @ </p>
+    style_footer();
+    fossil_free(zName);
+    return;
+  }
+  if( cache_open()==0 ){
+    @ <p class="generalError">Cannot open %h(zName)</p>
+    style_footer();
+    fossil_free(zName);
+    return;
+  }
+  if( P("clear")!=0 ){
+    login_verify_csrf_secret();
+    cache_exec("DELETE FROM chunk; DELETE FROM archive; DELETE FROM stat;");
+  }
+  nHit = cache_int64(0, "SELECT n FROM stat WHERE name='hit'");
+  nMiss = cache_int64(0, "SELECT n FROM stat WHERE name='miss'");
+  nEvict = cache_int64(0, "SELECT n FROM stat WHERE name='evict'");
+  nEntry = (int)cache_int64(0, "SELECT count(*) FROM archive"
+                               " WHERE sz IS NOT NULL");
+  sz = cache_int64(0, "SELECT total(sz) FROM archive");
+  @ <table class="label-value">
+  @ <tr><th>Cache&nbsp;File:</th><td>%h(zName)</td></tr>
+  @ <tr><th>Size&nbsp;Limit:</th>
+  if( cache_enabled() ){
+    @ <td>%d(db_get_int("archive-cache-size",0)) MB</td></tr>
+  }else{
+    @ <td>The cache is off</td></tr>
+  }
+  @ <tr><th>Archives:</th><td>%d(nEntry) using %lld(sz) bytes</td></tr>
+  @ <tr><th>Hits:</th><td>%lld(nHit)</td></tr>
+  @ <tr><th>Misses:</th><td>%lld(nMiss)</td></tr>
+  if( nHit+nMiss>0 ){
+    @ <tr><th>Hit&nbsp;Rate:</th><td>%d((int)(nHit*100/(nHit+nMiss)))%%</td></tr>
+  }
+  @ <tr><th>Evictions:</th><td>%lld(nEvict)</td></tr>
+  @ </table>
+  if( nEntry>0 ){
+    @ <table border="1" cellpadding="2" cellspacing="0">
+    @ <tr><th>Archive</th><th>Size</th><th>Created</th>
+    @ <th>Last&nbsp;Used</th><th>Hits</th></tr>
+    sqlite3_prepare_v2(cache.db,
+       "SELECT key, sz, datetime(ctime), datetime(atime), nhit"
+       "  FROM archive WHERE sz IS NOT NULL ORDER BY atime DESC",
+       -1, &pStmt, 0);
+    while( sqlite3_step(pStmt)==SQLITE_ROW ){
+      @ <tr><td>%h(sqlite3_column_text(pStmt,0))</td>
+      @ <td align="right">%lld(sqlite3_column_int64(pStmt,1))</td>
+      @ <td>%h(sqlite3_column_text(pStmt,2))</td>
+      @ <td>%h(sqlite3_column_text(pStmt,3))</td>
+      @ <td align="right">%d(sqlite3_column_int(pStmt,4))</td></tr>
+    }
+    sqlite3_finalize(pStmt);
+    @ </table>
+  }
+  @ <form action="%s(g.zTop)/cachestat" method="post"><div>
+  login_insert_csrf_secret();
+  @ <input type="submit" name="clear" value="Clear the cache" />
+  @ </div></form>
+  style_footer();
+  cache_close();
+  fossil_free(zName);
+}
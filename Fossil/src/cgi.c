@@ -28,15 +28,25 @@
 #else
 # include <sys/socket.h>
 # include <netinet/in.h>
+# include <netinet/tcp.h>
 # include <arpa/inet.h>
 # include <sys/times.h>
 # include <sys/time.h>
 # include <sys/wait.h>
 # include <sys/select.h>
+# include <signal.h>
 #endif
 #ifdef __EMX__
   typedef int socklen_t;
 #endif
+#ifdef __linux__
+# include <sys/epoll.h>
+# include <sys/signalfd.h>
+# include <sys/sendfile.h>
+# include <errno.h>
+# define FOSSIL_HAVE_EPOLL 1
+# define FOSSIL_HAVE_SENDFILE 1
+#endif
 #include <time.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -84,6 +94,18 @@
 static Blob cgiContent[2] = { BLOB_INITIALIZER, BLOB_INITIALIZER };
 static Blob *pContent = &cgiContent[0];
 
+/*
+** Part of a file that is sent as part of the reply content without
+** first being read into memory.  See cgi_append_file().
+*/
+static struct {
+  FILE *in;               /* The file, or NULL if there is none */
+  i64 iOfst;              /* Offset of the first byte to send */
+  i64 nByte;              /* Number of bytes to send */
+  Blob *pAt;              /* Content blob that the bytes are part of */
+  int iAt;                /* Offset in pAt at which the bytes belong */
+} cgiFile;
+
 /*
 ** Set the destination buffer into which to accumulate CGI content.
 */
@@ -118,10 +140,110 @@ void cgi_append_content(const char *zData, int nAmt){
   blob_append(pContent, zData, nAmt);
 }
 
+/*
+** Append nByte bytes of the file in, starting at offset iOfst, to the
+** reply content.  Where the reply can be sent as it is, the bytes are
+** copied straight from the file to the connection when the reply is
+** sent, without passing through memory.  Otherwise they are read into
+** the reply here or when it is sent.  The file is closed afterwards.
+*/
+void cgi_append_file(FILE *in, i64 iOfst, i64 nByte){
+  if( cgiFile.in ){
+    /* Only one part of a file can be held back.  Read others now. */
+    char *z = fossil_malloc(nByte>0 ? nByte : 1);
+    fseek(in, iOfst, SEEK_SET);
+    blob_append(pContent, z, (int)fread(z, 1, (size_t)nByte, in));
+    fossil_free(z);
+    fclose(in);
+    return;
+  }
+  cgiFile.in = in;
+  cgiFile.iOfst = iOfst;
+  cgiFile.nByte = nByte;
+  cgiFile.pAt = pContent;
+  cgiFile.iAt = blob_size(pContent);
+}
+
+/*
+** Forget the file part of the reply, if there is one.
+*/
+static void cgi_file_close(void){
+  if( cgiFile.in ){
+    fclose(cgiFile.in);
+    cgiFile.in = 0;
+  }
+}
+
+/*
+** Read the file part of the reply, if there is one, into the content
+** blob that it belongs to.
+*/
+static void cgi_file_read(void){
+  Blob x;
+  char *z;
+  int n;
+  if( cgiFile.in==0 ) return;
+  z = blob_buffer(cgiFile.pAt);
+  n = blob_size(cgiFile.pAt);
+  blob_zero(&x);
+  blob_append(&x, z, cgiFile.iAt);
+  blob_resize(&x, cgiFile.iAt + (int)cgiFile.nByte);
+  fseek(cgiFile.in, cgiFile.iOfst, SEEK_SET);
+  if( fread(blob_buffer(&x)+cgiFile.iAt, 1, (size_t)cgiFile.nByte,
+            cgiFile.in)!=(size_t)cgiFile.nByte ){
+    blob_resize(&x, cgiFile.iAt);
+  }
+  blob_append(&x, z+cgiFile.iAt, n-cgiFile.iAt);
+  blob_reset(cgiFile.pAt);
+  *cgiFile.pAt = x;
+  cgi_file_close();
+}
+
+/*
+** Copy the file part of the reply to the connection.  The sendfile()
+** system call is used where it is available and works for the
+** connection.  Otherwise the file is copied a piece at a time.
+*/
+static void cgi_file_send(void){
+  i64 iOfst = cgiFile.iOfst;
+  i64 nLeft = cgiFile.nByte;
+  char *zBuf;
+  fflush(g.httpOut);
+#ifdef FOSSIL_HAVE_SENDFILE
+  {
+    int fdOut = fileno(g.httpOut);
+    int fdIn = fileno(cgiFile.in);
+    while( nLeft>0 ){
+      off_t ofst = (off_t)iOfst;
+      ssize_t n = sendfile(fdOut, fdIn, &ofst,
+                           nLeft>0x40000000 ? 0x40000000 : (size_t)nLeft);
+      if( n<0 && errno==EINTR ) continue;
+      if( n<=0 ) break;
+      iOfst += n;
+      nLeft -= n;
+    }
+  }
+#endif
+  if( nLeft>0 ){
+    zBuf = fossil_malloc(65536);
+    fseek(cgiFile.in, iOfst, SEEK_SET);
+    while( nLeft>0 ){
+      size_t n = fread(zBuf, 1, nLeft>65536 ? 65536 : (size_t)nLeft,
+                       cgiFile.in);
+      if( n==0 ) break;
+      fwrite(zBuf, 1, n, g.httpOut);
+      nLeft -= n;
+    }
+    fossil_free(zBuf);
+  }
+  cgi_file_close();
+}
+
 /*
 ** Reset the HTTP reply text to be an empty string.
 */
 void cgi_reset_content(void){
+  cgi_file_close();
   blob_reset(&cgiContent[0]);
   blob_reset(&cgiContent[1]);
 }
@@ -137,7 +259,9 @@ Blob *cgi_output_blob(void){
 ** Combine the header and body of the CGI into a single string.
 */
 static void cgi_combine_header_and_body(void){
-  int size = blob_size(&cgiContent[1]);
+  int size;
+  cgi_file_read();
+  size = blob_size(&cgiContent[1]);
   if( size>0 ){
     blob_append(&cgiContent[0], blob_buffer(&cgiContent[1]), size);
     blob_reset(&cgiContent[1]);
@@ -160,6 +284,27 @@ static char *zReplyStatus = "OK";            /* Reply status description */
 static int iReplyStatus = 200;               /* Reply status code */
 static Blob extraHeader = BLOB_INITIALIZER;  /* Extra header text */
 
+/*
+** Persistent connections.  A reply leaves the connection open only if
+** the server is able to read another request from the same connection
+** (cgi_server_keep_alive()), the client asked for a persistent
+** connection, and the page that made the reply is safe to be followed
+** by another request in the same process (cgi_page_keep_alive()).
+*/
+static int iHttpVersion = 0;     /* Minor version of HTTP/1.x in the request */
+static int keepAliveServer = 0;  /* Server can handle more requests */
+static int keepAliveClient = 0;  /* Client wants a persistent connection */
+static int keepAlivePage = 0;    /* The page permits a persistent connection */
+static int keepAliveReply = 0;   /* The reply left the connection open */
+static int isStreaming = 0;      /* The reply is sent by cgi_stream() */
+static int isChunked = 0;        /* Streaming with chunked encoding */
+static void (*xStreamTee)(const char*,int) = 0;  /* Also gets streamed content */
+
+/*
+** Seconds to wait for the next request on a persistent connection
+*/
+#define CGI_KEEP_ALIVE_TIMEOUT 15
+
 /*
 ** Set the reply content type
 */
@@ -284,30 +429,47 @@ static int is_gzippable(void){
 }
 
 /*
-** Do a normal HTTP reply
+** Called by a server that is able to read further requests from the
+** same connection after the current one.  See cgi_next_http_request().
 */
-void cgi_reply(void){
-  int total_size;
+void cgi_server_keep_alive(void){
+#if !defined(_WIN32)
+  keepAliveServer = 1;
+#endif
+}
+
+/*
+** Called by a page that keeps no state beyond the request, so that the
+** connection may stay open for another request if the client wants.
+*/
+void cgi_page_keep_alive(void){
+  keepAlivePage = 1;
+}
+
+/*
+** Return true if the reply being sent should leave the connection open.
+*/
+static int cgi_reply_keep_alive(void){
+  return g.fullHttpReply && keepAliveServer && keepAliveClient
+      && keepAlivePage && iReplyStatus==200
+      && fossil_strcmp(P("REQUEST_METHOD"),"HEAD")!=0;
+}
+
+/*
+** Write the status line and the headers common to every reply, up to
+** and including the Content-Type header.
+*/
+static void cgi_reply_header(void){
   if( iReplyStatus<=0 ){
     iReplyStatus = 200;
     zReplyStatus = "OK";
   }
-
-#if 0
-  if( iReplyStatus==200 && check_cache_control() ) {
-    /* change the status to "unchanged" and we can skip sending the
-    ** actual response body. Obviously we only do this when we _have_ a
-    ** body (code 200).
-    */
-    iReplyStatus = 304;
-    zReplyStatus = "Not Modified";
-  }
-#endif
-
   if( g.fullHttpReply ){
-    fprintf(g.httpOut, "HTTP/1.0 %d %s\r\n", iReplyStatus, zReplyStatus);
+    fprintf(g.httpOut, "HTTP/1.%d %d %s\r\n",
+            iHttpVersion>0, iReplyStatus, zReplyStatus);
     fprintf(g.httpOut, "Date: %s\r\n", cgi_rfc822_datestamp(time(0)));
-    fprintf(g.httpOut, "Connection: close\r\n");
+    fprintf(g.httpOut, "Connection: %s\r\n",
+            keepAliveReply ? "keep-alive" : "close");
   }else{
     fprintf(g.httpOut, "Status: %d %s\r\n", iReplyStatus, zReplyStatus);
   }
@@ -354,6 +516,32 @@ void cgi_reply(void){
   ** the browser, not some shared location.
   */
   fprintf(g.httpOut, "Content-Type: %s; charset=utf-8\r\n", zContentType);
+}
+
+/*
+** Do a normal HTTP reply
+*/
+void cgi_reply(void){
+  int total_size;
+  if( isStreaming ) return;
+  if( iReplyStatus<=0 ){
+    iReplyStatus = 200;
+    zReplyStatus = "OK";
+  }
+
+#if 0
+  if( iReplyStatus==200 && check_cache_control() ) {
+    /* change the status to "unchanged" and we can skip sending the
+    ** actual response body. Obviously we only do this when we _have_ a
+    ** body (code 200).
+    */
+    iReplyStatus = 304;
+    zReplyStatus = "Not Modified";
+  }
+#endif
+
+  keepAliveReply = cgi_reply_keep_alive();
+  cgi_reply_header();
   if( fossil_strcmp(zContentType,"application/x-fossil")==0 ){
     cgi_combine_header_and_body();
     blob_compress(&cgiContent[0], &cgiContent[0]);
@@ -362,6 +550,7 @@ void cgi_reply(void){
   if( iReplyStatus != 304 ) {
     if( is_gzippable() ){
       int i;
+      cgi_file_read();
       gzip_begin(0);
       for( i=0; i<2; i++ ){
         int size = blob_size(&cgiContent[i]);
@@ -373,20 +562,84 @@ void cgi_reply(void){
       fprintf(g.httpOut, "Vary: Accept-Encoding\r\n");
     }
     total_size = blob_size(&cgiContent[0]) + blob_size(&cgiContent[1]);
+    if( cgiFile.in ) total_size += (int)cgiFile.nByte;
     fprintf(g.httpOut, "Content-Length: %d\r\n", total_size);
   }else{
     total_size = 0;
   }
   fprintf(g.httpOut, "\r\n");
   if( total_size>0 && iReplyStatus != 304 ){
-    int i, size;
+    int i, size, iStart;
     for(i=0; i<2; i++){
       size = blob_size(&cgiContent[i]);
-      if( size>0 ){
-        fwrite(blob_buffer(&cgiContent[i]), 1, size, g.httpOut);
+      iStart = 0;
+      if( cgiFile.in && cgiFile.pAt==&cgiContent[i] ){
+        iStart = cgiFile.iAt;
+        fwrite(blob_buffer(&cgiContent[i]), 1, iStart, g.httpOut);
+        cgi_file_send();
+      }
+      if( size>iStart ){
+        fwrite(blob_buffer(&cgiContent[i])+iStart, 1, size-iStart, g.httpOut);
       }
     }
   }
+  cgi_file_close();
+  fflush(g.httpOut);
+  CGIDEBUG(("DONE\n"));
+}
+
+/*
+** Begin a reply whose content is generated a piece at a time and
+** sent with cgi_stream() as it is made, rather than held in memory.
+** The status, content type and extra headers must already be set.
+** Any content already generated is sent first.  cgi_stream_end()
+** finishes the reply and cgi_reply() does nothing afterwards.
+**
+** An HTTP/1.1 client gets the content with chunked transfer encoding.
+** Otherwise there is no Content-Length and the end of the content is
+** marked by closing the connection.
+*/
+void cgi_stream_begin(void){
+  int i;
+  isChunked = g.fullHttpReply && iHttpVersion>0;
+  keepAliveReply = isChunked && cgi_reply_keep_alive();
+  cgi_reply_header();
+  if( isChunked ){
+    fprintf(g.httpOut, "Transfer-Encoding: chunked\r\n");
+  }
+  fprintf(g.httpOut, "\r\n");
+  isStreaming = 1;
+  cgi_file_read();
+  for(i=0; i<2; i++){
+    cgi_stream(blob_buffer(&cgiContent[i]), blob_size(&cgiContent[i]));
+    blob_reset(&cgiContent[i]);
+  }
+}
+
+/*
+** Send n bytes of content for a reply started by cgi_stream_begin().
+*/
+void cgi_stream(const char *z, int n){
+  if( n<=0 ) return;
+  if( xStreamTee ) xStreamTee(z, n);
+  if( isChunked ) fprintf(g.httpOut, "%x\r\n", n);
+  fwrite(z, 1, n, g.httpOut);
+  if( isChunked ) fprintf(g.httpOut, "\r\n");
+}
+
+/*
+** Arrange for xTee to receive a copy of all content subsequently sent
+** by cgi_stream().  A NULL argument cancels the copying.
+*/
+void cgi_stream_tee(void (*xTee)(const char*,int)){
+  xStreamTee = xTee;
+}
+
+/*
+** Finish a reply started by cgi_stream_begin().
+*/
+void cgi_stream_end(void){
+  if( isChunked ) fprintf(g.httpOut, "0\r\n\r\n");
   fflush(g.httpOut);
   CGIDEBUG(("DONE\n"));
 }
@@ -847,6 +1100,62 @@ void cgi_trace(const char *z){
   fputs(z, pLog);
 }
 
+/*
+** The content of a sync protocol request is not read along with the
+** rest of the request.  It is left for page_xfer() to read a piece at a
+** time, with cgi_read_xfer_content(), as it processes the cards.  These
+** are the number of bytes of that content not yet read and whether or
+** not it is compressed.
+*/
+static int nXferUnread = 0;
+static int xferIsCompressed = 0;
+
+/*
+** Return true if zType is the content type of a sync protocol request.
+** If it is, leave the nByte bytes of its content to be read later.
+*/
+static int cgi_defer_xfer_content(const char *zType, int nByte){
+  if( fossil_strcmp(zType, "application/x-fossil")==0 ){
+    xferIsCompressed = 1;
+  }else if( fossil_strcmp(zType, "application/x-fossil-debug")==0
+         || fossil_strcmp(zType, "application/x-fossil-uncompressed")==0 ){
+    xferIsCompressed = 0;
+  }else{
+    return 0;
+  }
+  nXferUnread = nByte;
+  return 1;
+}
+
+/*
+** Return the number of bytes of content of the current sync protocol
+** request that have not yet been read, and set *pIsCompressed to true
+** if that content is compressed.  Return 0 if there is no such content,
+** or it has been read into g.cgiIn.
+*/
+int cgi_xfer_content(int *pIsCompressed){
+  *pIsCompressed = xferIsCompressed;
+  return nXferUnread;
+}
+
+/*
+** Read up to N more bytes of the content of the current sync protocol
+** request into zBuf.  Return the number of bytes read, 0 once all of
+** the content has been read, or -1 if the input ends before that.
+*/
+int cgi_read_xfer_content(void *NotUsed, char *zBuf, int N){
+  int got;
+  if( N>nXferUnread ) N = nXferUnread;
+  if( N<=0 ) return 0;
+  got = (int)fread(zBuf, 1, N, g.httpIn);
+  if( got<=0 ){
+    nXferUnread = 0;
+    return -1;
+  }
+  nXferUnread -= got;
+  return got;
+}
+
 /* Forward declaration */
 static NORETURN void malformed_request(const char *zMsg);
 
@@ -920,6 +1229,7 @@ void cgi_init(void){
   len = atoi(PD("CONTENT_LENGTH", "0"));
   g.zContentType = zType = P("CONTENT_TYPE");
   blob_zero(&g.cgiIn);
+  nXferUnread = 0;
   if( len>0 && zType ){
     if( fossil_strcmp(zType,"application/x-www-form-urlencoded")==0 
          || strncmp(zType,"multipart/form-data",19)==0 ){
@@ -932,13 +1242,8 @@ void cgi_init(void){
       }else{
         process_multipart_form_data(z, len);
       }
-    }else if( fossil_strcmp(zType, "application/x-fossil")==0 ){
-      blob_read_from_channel(&g.cgiIn, g.httpIn, len);
-      blob_uncompress(&g.cgiIn, &g.cgiIn);
-    }else if( fossil_strcmp(zType, "application/x-fossil-debug")==0 ){
-      blob_read_from_channel(&g.cgiIn, g.httpIn, len);
-    }else if( fossil_strcmp(zType, "application/x-fossil-uncompressed")==0 ){
-      blob_read_from_channel(&g.cgiIn, g.httpIn, len);
+    }else if( cgi_defer_xfer_content(zType, len) ){
+      /* Read by page_xfer() */
     }
 #ifdef FOSSIL_ENABLE_JSON
     else if( fossil_strcmp(zType, "application/json")
@@ -1298,6 +1603,13 @@ void cgi_handle_http_request(const char *zIpAddr){
   if( zToken[i] ) zToken[i++] = 0;
   cgi_setenv("PATH_INFO", zToken);
   cgi_setenv("QUERY_STRING", &zToken[i]);
+  zToken = extract_token(z, &z);
+  if( zToken && fossil_strnicmp(zToken, "HTTP/1.", 7)==0 ){
+    iHttpVersion = atoi(&zToken[7]);
+  }else{
+    iHttpVersion = 0;
+  }
+  keepAliveClient = iHttpVersion>0;
   if( zIpAddr==0 &&
         getpeername(fileno(g.httpIn), (struct sockaddr*)&remoteName, 
                                 &size)>=0
@@ -1328,6 +1640,12 @@ void cgi_handle_http_request(const char *zIpAddr){
     }
     if( fossil_strcmp(zFieldName,"accept-encoding:")==0 ){
       cgi_setenv("HTTP_ACCEPT_ENCODING", zVal);
+    }else if( fossil_strcmp(zFieldName,"connection:")==0 ){
+      if( fossil_stricmp(zVal, "close")==0 ){
+        keepAliveClient = 0;
+      }else if( fossil_stricmp(zVal, "keep-alive")==0 ){
+        keepAliveClient = 1;
+      }
     }else if( fossil_strcmp(zFieldName,"content-length:")==0 ){
       cgi_setenv("CONTENT_LENGTH", zVal);
     }else if( fossil_strcmp(zFieldName,"content-type:")==0 ){
@@ -1360,6 +1678,64 @@ void cgi_handle_http_request(const char *zIpAddr){
   cgi_trace(0);
 }
 
+#if !defined(_WIN32)
+/*
+** SIGALRM handler used while waiting for the next request.  It does
+** nothing.  Its only purpose is to interrupt the blocking read.
+*/
+static void cgi_keep_alive_timeout(int iSig){
+}
+#endif
+
+/*
+** Called by a server after each reply.  Return true if that reply left
+** the connection open and the client sends another request within
+** CGI_KEEP_ALIVE_TIMEOUT seconds.  In that case the state left over
+** from the previous request is cleared, ready for the next call to
+** cgi_handle_http_request().  Return false if the connection should
+** be closed.
+*/
+int cgi_next_http_request(void){
+#if defined(_WIN32)
+  return 0;
+#else
+  struct sigaction sa, saOld;
+  int c;
+
+  if( !keepAliveReply ) return 0;
+  if( nXferUnread>0 ) return 0;  /* Content of the last request is unread */
+  fflush(g.httpOut);
+  memset(&sa, 0, sizeof(sa));
+  sa.sa_handler = cgi_keep_alive_timeout;
+  sigaction(SIGALRM, &sa, &saOld);
+  alarm(CGI_KEEP_ALIVE_TIMEOUT);
+  c = getc(g.httpIn);
+  alarm(0);
+  sigaction(SIGALRM, &saOld, 0);
+  if( c==EOF ) return 0;
+  ungetc(c, g.httpIn);
+
+  nUsedQP = 0;
+  sortQP = 0;
+  cgi_reset_content();
+  cgi_destination(CGI_BODY);
+  blob_reset(&extraHeader);
+  zContentType = "text/html";
+  zReplyStatus = "OK";
+  iReplyStatus = 200;
+  keepAliveClient = keepAlivePage = keepAliveReply = 0;
+  isStreaming = isChunked = 0;
+  xStreamTee = 0;
+  blob_reset(&g.httpHeader);
+  blob_reset(&g.cgiIn);
+  g.isConst = 0;
+  g.xferPanic = 0;
+  g.rcvid = 0;
+  login_reset();
+  return 1;
+#endif
+}
+
 /*
 ** This routine handles a single HTTP request from an SSH client which is
 ** coming in on g.httpIn and which replies on g.httpOut
@@ -1495,16 +1871,10 @@ void cgi_handle_ssh_http_request(const char *zIpAddr){
   cgi_reset_content();
   cgi_destination(CGI_BODY);
 
+  blob_zero(&g.cgiIn);
+  nXferUnread = 0;
   if( content_length>0 && zType ){
-    blob_zero(&g.cgiIn);
-    if( fossil_strcmp(zType, "application/x-fossil")==0 ){
-      blob_read_from_channel(&g.cgiIn, g.httpIn, content_length);
-      blob_uncompress(&g.cgiIn, &g.cgiIn);
-    }else if( fossil_strcmp(zType, "application/x-fossil-debug")==0 ){
-      blob_read_from_channel(&g.cgiIn, g.httpIn, content_length);
-    }else if( fossil_strcmp(zType, "application/x-fossil-uncompressed")==0 ){
-      blob_read_from_channel(&g.cgiIn, g.httpIn, content_length);
-    }
+    cgi_defer_xfer_content(zType, content_length);
   }
   cgi_trace(0);
   nCycles++;
@@ -1639,6 +2009,248 @@ void cgi_handle_scgi_request(void){
 */
 #define MAX_PARALLEL 2
 
+#if !defined(_WIN32)
+/*
+** Make the socket "connection" the standard input and output, and
+** also the standard error unless tracing, of the current process.
+** Return the number of errors.
+*/
+static int cgi_connection_to_stdio(int connection){
+  int nErr = 0, fd;
+  int opt = 1;
+  /* Replies are written in one piece, so there is nothing for the Nagle
+  ** algorithm to combine.  It would only hold back the tail of each
+  ** reply on a persistent connection. */
+  setsockopt(connection, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
+  close(0);
+  fd = dup(connection);
+  if( fd!=0 ) nErr++;
+  close(1);
+  fd = dup(connection);
+  if( fd!=1 ) nErr++;
+  if( !g.fHttpTrace && !g.fSqlTrace ){
+    close(2);
+    fd = dup(connection);
+    if( fd!=2 ) nErr++;
+  }
+  close(connection);
+  return nErr;
+}
+#endif
+
+#ifdef FOSSIL_HAVE_EPOLL
+/*
+** One slot in the pool of pre-forked workers used by cgi_prefork_server().
+*/
+struct PreforkWorker {
+  pid_t pid;        /* Process id of the worker, or 0 if the slot is free */
+  int fd;           /* Socket to the worker while it is idle.  Else -1 */
+};
+
+/*
+** Send the open file descriptor fd to the process at the other end of
+** the unix-domain socket sock.  Return 0 on success.
+*/
+static int cgi_send_fd(int sock, int fd){
+  struct msghdr msg;
+  struct iovec iov;
+  struct cmsghdr *pCmsg;
+  union {
+    struct cmsghdr hdr;
+    char aBuf[CMSG_SPACE(sizeof(int))];
+  } ctrl;
+  char c = 0;
+
+  memset(&msg, 0, sizeof(msg));
+  memset(&ctrl, 0, sizeof(ctrl));
+  iov.iov_base = &c;
+  iov.iov_len = 1;
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = ctrl.aBuf;
+  msg.msg_controllen = sizeof(ctrl.aBuf);
+  pCmsg = CMSG_FIRSTHDR(&msg);
+  pCmsg->cmsg_level = SOL_SOCKET;
+  pCmsg->cmsg_type = SCM_RIGHTS;
+  pCmsg->cmsg_len = CMSG_LEN(sizeof(int));
+  memcpy(CMSG_DATA(pCmsg), &fd, sizeof(int));
+  return sendmsg(sock, &msg, MSG_NOSIGNAL)==1 ? 0 : 1;
+}
+
+/*
+** Wait for a file descriptor sent by cgi_send_fd() on socket sock.
+** Return the descriptor, or -1 if the other end has gone away.
+*/
+static int cgi_recv_fd(int sock){
+  struct msghdr msg;
+  struct iovec iov;
+  struct cmsghdr *pCmsg;
+  union {
+    struct cmsghdr hdr;
+    char aBuf[CMSG_SPACE(sizeof(int))];
+  } ctrl;
+  char c;
+  int fd = -1;
+  ssize_t n;
+
+  memset(&msg, 0, sizeof(msg));
+  iov.iov_base = &c;
+  iov.iov_len = 1;
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = ctrl.aBuf;
+  msg.msg_controllen = sizeof(ctrl.aBuf);
+  do{
+    n = recvmsg(sock, &msg, 0);
+  }while( n<0 && errno==EINTR );
+  if( n!=1 ) return -1;
+  pCmsg = CMSG_FIRSTHDR(&msg);
+  if( pCmsg && pCmsg->cmsg_level==SOL_SOCKET
+   && pCmsg->cmsg_type==SCM_RIGHTS ){
+    memcpy(&fd, CMSG_DATA(pCmsg), sizeof(int));
+  }
+  return fd;
+}
+
+/*
+** The event loop for an HTTP server with a pool of pre-forked workers.
+**
+** The parent keeps mxWorker worker processes alive.  Each new worker
+** runs xWarmup(), which opens the repository, and then waits for the
+** parent to hand it a connection.  The parent waits in epoll_wait() for
+** new connections and for SIGCHLD.  Each connection is accepted by the
+** parent and passed to an idle worker over a unix-domain socket.  That
+** worker returns out of this routine with the connection on its
+** standard input and output and handles one request, just as a
+** fork-per-connection child does.  When a worker exits, the parent
+** starts a new one in its slot.  While every worker is busy, the
+** listener is left out of the epoll set and new connections wait in
+** the listen queue.
+**
+** Return 0 in each worker.  The parent never returns.
+*/
+static int cgi_prefork_server(
+  int listener,             /* The listening socket */
+  int mxWorker,             /* Number of worker processes */
+  void (*xWarmup)(void)     /* Get a new worker ready for a request */
+){
+  struct PreforkWorker *aWorker;
+  struct epoll_event ev, aEv[4];
+  sigset_t mask;
+  int epfd, sigfd;
+  int nIdle = 0;              /* Number of workers waiting for a connection */
+  int isListening = 0;        /* True if listener is in the epoll set */
+  time_t tmNoSpawn = 0;       /* Do not start workers before this time */
+  pid_t pid;
+  int i, n;
+
+  aWorker = fossil_malloc( sizeof(aWorker[0])*mxWorker );
+  for(i=0; i<mxWorker; i++){
+    aWorker[i].pid = 0;
+    aWorker[i].fd = -1;
+  }
+  sigemptyset(&mask);
+  sigaddset(&mask, SIGCHLD);
+  sigprocmask(SIG_BLOCK, &mask, 0);
+  sigfd = signalfd(-1, &mask, SFD_NONBLOCK|SFD_CLOEXEC);
+  epfd = epoll_create1(EPOLL_CLOEXEC);
+  if( sigfd<0 || epfd<0 ){
+    fossil_fatal("unable to start the event loop: errno %d", errno);
+  }
+  memset(&ev, 0, sizeof(ev));
+  ev.events = EPOLLIN;
+  ev.data.fd = sigfd;
+  epoll_ctl(epfd, EPOLL_CTL_ADD, sigfd, &ev);
+
+  while( 1 ){
+    /* Bury dead workers */
+    while( (pid = waitpid(-1, 0, WNOHANG))>0 ){
+      for(i=0; i<mxWorker && aWorker[i].pid!=pid; i++){}
+      if( i>=mxWorker ) continue;
+      if( aWorker[i].fd>=0 ){
+        /* The worker died before it was given a connection, probably
+        ** because it could not open the repository.  Do not start
+        ** replacements in a tight loop. */
+        close(aWorker[i].fd);
+        nIdle--;
+        tmNoSpawn = time(0)+1;
+      }
+      aWorker[i].pid = 0;
+      aWorker[i].fd = -1;
+    }
+
+    /* Fill empty slots with new workers */
+    for(i=0; i<mxWorker && time(0)>=tmNoSpawn; i++){
+      int aSock[2];
+      if( aWorker[i].pid ) continue;
+      if( socketpair(AF_UNIX, SOCK_STREAM, 0, aSock) ) break;
+      pid = fork();
+      if( pid==0 ){
+        int j, connection;
+        close(listener);
+        close(epfd);
+        close(sigfd);
+        close(aSock[0]);
+        for(j=0; j<mxWorker; j++){
+          if( aWorker[j].fd>=0 ) close(aWorker[j].fd);
+        }
+        fossil_free(aWorker);
+        sigprocmask(SIG_UNBLOCK, &mask, 0);
+        if( xWarmup ) xWarmup();
+        connection = cgi_recv_fd(aSock[1]);
+        if( connection<0 ) fossil_exit(0);
+        close(aSock[1]);
+        return cgi_connection_to_stdio(connection);
+      }
+      close(aSock[1]);
+      if( pid<0 ){
+        close(aSock[0]);
+        break;
+      }
+      aWorker[i].pid = pid;
+      aWorker[i].fd = aSock[0];
+      nIdle++;
+    }
+
+    /* Only accept connections while some worker is free to take them */
+    if( nIdle>0 && !isListening ){
+      ev.events = EPOLLIN;
+      ev.data.fd = listener;
+      epoll_ctl(epfd, EPOLL_CTL_ADD, listener, &ev);
+      isListening = 1;
+    }else if( nIdle==0 && isListening ){
+      epoll_ctl(epfd, EPOLL_CTL_DEL, listener, &ev);
+      isListening = 0;
+    }
+
+    n = epoll_wait(epfd, aEv, sizeof(aEv)/sizeof(aEv[0]),
+                   time(0)<tmNoSpawn ? 1000 : -1);
+    for(i=0; i<n; i++){
+      if( aEv[i].data.fd==sigfd ){
+        struct signalfd_siginfo info;
+        while( read(sigfd, &info, sizeof(info))==sizeof(info) ){}
+      }else if( aEv[i].data.fd==listener && nIdle>0 ){
+        int connection = accept(listener, 0, 0);
+        int j;
+        if( connection<0 ) continue;
+        for(j=0; j<mxWorker && nIdle>0; j++){
+          int rc;
+          if( aWorker[j].fd<0 ) continue;
+          rc = cgi_send_fd(aWorker[j].fd, connection);
+          close(aWorker[j].fd);
+          aWorker[j].fd = -1;
+          nIdle--;
+          if( rc==0 ) break;
+        }
+        close(connection);
+      }
+    }
+  }
+  /* NOT REACHED */
+  return 1;
+}
+#endif /* FOSSIL_HAVE_EPOLL */
+
 /*
 ** Implement an HTTP server daemon listening on port iPort.
 **
@@ -1646,6 +2258,11 @@ void cgi_handle_scgi_request(void){
 ** out of this procedure call.  The child will handle the request.
 ** The parent never returns from this procedure.
 **
+** If mxWorker is positive and the platform supports it, serve requests
+** from a pool of mxWorker pre-forked processes instead.  See
+** cgi_prefork_server() for details.  xWarmup, if not NULL, is run by
+** each pre-forked process before it is given a connection.
+**
 ** Return 0 to each child as it runs.  If unable to establish a
 ** listening socket, return non-zero.
 */
@@ -1653,7 +2270,9 @@ int cgi_http_server(
   int mnPort, int mxPort,   /* Range of TCP ports to try */
   const char *zBrowser,     /* Run this browser, if not NULL */
   const char *zIpAddr,      /* Bind to this IP address, if not null */
-  int flags                 /* HTTP_SERVER_* flags */
+  int flags,                /* HTTP_SERVER_* flags */
+  int mxWorker,             /* Size of the pre-forked pool.  0 for none */
+  void (*xWarmup)(void)     /* Prepare a pre-forked process for a request */
 ){
 #if defined(_WIN32)
   /* Use win32_http_server() instead */
@@ -1670,6 +2289,10 @@ int cgi_http_server(
   int opt = 1;                 /* setsockopt flag */
   int iPort = mnPort;
 
+#ifndef FOSSIL_HAVE_EPOLL
+  mxWorker = 0;
+#endif
+
   while( iPort<=mxPort ){
     memset(&inaddr, 0, sizeof(inaddr));
     inaddr.sin_family = AF_INET;
@@ -1709,7 +2332,7 @@ int cgi_http_server(
     }
   }
   if( iPort>mxPort ) return 1;
-  listen(listener,10);
+  listen(listener, mxWorker>0 ? 128 : 10);
   if( iPort>mnPort ){
     fossil_print("Listening for %s requests on TCP port %d\n",
        (flags & HTTP_SERVER_SCGI)!=0?"SCGI":"HTTP",  iPort);
@@ -1731,6 +2354,11 @@ int cgi_http_server(
       fossil_warning("cannot start browser: %s\n", zBrowser);
     }
   }
+#ifdef FOSSIL_HAVE_EPOLL
+  if( mxWorker>0 ){
+    return cgi_prefork_server(listener, mxWorker, xWarmup);
+  }
+#endif
   while( 1 ){
     if( nchildren>MAX_PARALLEL ){
       /* Slow down if connections are arriving too fast */
@@ -1751,20 +2379,7 @@ int cgi_http_server(
           if( child>0 ) nchildren++;
           close(connection);
         }else{
-          int nErr = 0, fd;
-          close(0);
-          fd = dup(connection);
-          if( fd!=0 ) nErr++;
-          close(1);
-          fd = dup(connection);
-          if( fd!=1 ) nErr++;
-          if( !g.fHttpTrace && !g.fSqlTrace ){
-            close(2);
-            fd = dup(connection);
-            if( fd!=2 ) nErr++;
-          }
-          close(connection);
-          return nErr;
+          return cgi_connection_to_stdio(connection);
         }
       }
     }
@@ -1882,6 +2497,28 @@ void cgi_modified_since(time_t objectTime){
   fossil_exit(0);
 }
 
+/*
+** Send zETag as the ETag of the reply.  If the request has an
+** If-None-Match header naming the same tag, immediately send back a
+** 304 reply and exit.
+*/
+void cgi_check_etag(const char *zETag){
+  const char *zIf = P("HTTP_IF_NONE_MATCH");
+  char *zQuoted = mprintf("\"%s\"", zETag);
+  char *zLine = mprintf("ETag: %s\r\n", zQuoted);
+  int isMatch;
+  cgi_append_header(zLine);
+  fossil_free(zLine);
+  isMatch = zIf!=0
+         && (strstr(zIf, zQuoted)!=0 || fossil_strcmp(zIf,"*")==0);
+  fossil_free(zQuoted);
+  if( !isMatch ) return;
+  cgi_set_status(304,"Not Modified");
+  cgi_reset_content();
+  cgi_reply();
+  fossil_exit(0);
+}
+
 /*
 ** Check to see if the remote client is SSH and return
 ** its IP or return default
@@ -105,10 +105,15 @@ void delete_private_content(void){
 ** admin user. This can be overridden using the -A|--admin-user
 ** parameter.
 **
+** A clone over the network commits what it has received every few
+** seconds.  If it is interrupted, run the same command again with the
+** --resume option to continue from where it stopped.
+**
 ** Options:
 **    --admin-user|-A USERNAME   Make USERNAME the administrator
 **    --once                     Don't save url.
 **    --private                  Also clone private branches 
+**    --resume                   Continue an interrupted clone into FILENAME
 **    --ssl-identity=filename    Use the SSL identity if requested by the server
 **    --ssh-command|-c 'command' Use this SSH command
 **
@@ -119,9 +124,12 @@ void clone_cmd(void){
   const char *zDefaultUser;   /* Optional name of the default user */
   int nErr = 0;
   int bPrivate = 0;           /* Also clone private branches */
+  int bResume = 0;            /* Continue an interrupted clone */
+  int configRcvMask = CONFIGSET_ALL;  /* Configuration to request */
   int urlFlags = URL_PROMPT_PW | URL_REMEMBER;
 
   if( find_option("private",0,0)!=0 ) bPrivate = SYNC_PRIVATE;
+  bResume = find_option("resume",0,0)!=0;
   if( find_option("once",0,0)!=0) urlFlags &= ~URL_REMEMBER;
   zDefaultUser = find_option("admin-user","A",1);
   clone_ssh_find_options();
@@ -130,12 +138,19 @@ void clone_cmd(void){
     usage("?OPTIONS? FILE-OR-URL NEW-REPOSITORY");
   }
   db_open_config(0);
-  if( file_size(g.argv[3])>0 ){
+  if( bResume ){
+    if( file_size(g.argv[3])<=0 ){
+      fossil_fatal("no clone to resume: %s", g.argv[3]);
+    }
+  }else if( file_size(g.argv[3])>0 ){
     fossil_fatal("file already exists: %s", g.argv[3]);
   }
 
   url_parse(g.argv[2], urlFlags);
   if( zDefaultUser==0 && g.urlUser!=0 ) zDefaultUser = g.urlUser;
+  if( bResume && g.urlIsFile ){
+    fossil_fatal("a clone from a file cannot be resumed");
+  }
   if( g.urlIsFile ){
     file_copy(g.urlName, g.argv[3]);
     db_close(1);
@@ -152,46 +167,74 @@ void clone_cmd(void){
     }
     fossil_print("Repository cloned into %s\n", g.argv[3]);
   }else{
-    db_create_repository(g.argv[3]);
-    db_open_repository(g.argv[3]);
-    db_begin_transaction();
-    db_record_repository_filename(g.argv[3]);
-    db_initial_setup(0, 0, zDefaultUser, 0);
-    user_select();
-    db_set("content-schema", CONTENT_SCHEMA, 0);
-    db_set("aux-schema", AUX_SCHEMA, 0);
-    db_set("rebuilt", get_version(), 0);
-    url_remember();
-    if( g.zSSLIdentity!=0 ){
-      /* If the --ssl-identity option was specified, store it as a setting */
-      Blob fn;
-      blob_zero(&fn);
-      file_canonical_name(g.zSSLIdentity, &fn, 0);
-      db_set("ssl-identity", blob_str(&fn), 0);
-      blob_reset(&fn);
+    if( bResume ){
+      /* Pick up an interrupted clone.  The configuration was received
+      ** before its progress was first recorded. */
+      db_open_repository(g.argv[3]);
+      if( db_get_int("clone-seqno", -1)<0 ){
+        fossil_fatal("not an interrupted clone: %s", g.argv[3]);
+      }
+      db_begin_transaction();
+      db_record_repository_filename(g.argv[3]);
+      if( zDefaultUser ){
+        g.zLogin = zDefaultUser;
+      }else{
+        g.zLogin = db_text(0, "SELECT login FROM user WHERE cap LIKE '%%s%%'");
+      }
+      url_remember();
+      configRcvMask = 0;
+    }else{
+      db_create_repository(g.argv[3]);
+      db_open_repository(g.argv[3]);
+      db_begin_transaction();
+      db_record_repository_filename(g.argv[3]);
+      db_initial_setup(0, 0, zDefaultUser, 0);
+      user_select();
+      db_set("content-schema", CONTENT_SCHEMA, 0);
+      db_set("aux-schema", AUX_SCHEMA, 0);
+      db_set("rebuilt", get_version(), 0);
+      url_remember();
+      if( g.zSSLIdentity!=0 ){
+        /* If the --ssl-identity option was specified, store it as a setting */
+        Blob fn;
+        blob_zero(&fn);
+        file_canonical_name(g.zSSLIdentity, &fn, 0);
+        db_set("ssl-identity", blob_str(&fn), 0);
+        blob_reset(&fn);
+      }
+      db_multi_exec(
+        "REPLACE INTO config(name,value,mtime)"
+        " VALUES('server-code', lower(hex(randomblob(20))), now());"
+      );
     }
-    db_multi_exec(
-      "REPLACE INTO config(name,value,mtime)"
-      " VALUES('server-code', lower(hex(randomblob(20))), now());"
-    );
     url_enable_proxy(0);
     clone_ssh_db_set_options();
     url_get_password_if_needed();
-    g.xlinkClusterOnly = 1;
-    nErr = client_sync(SYNC_CLONE | bPrivate,CONFIGSET_ALL,0);
-    g.xlinkClusterOnly = 0;
+    if( db_get_int("clone-seqno", 1)!=0 ){
+      g.xlinkClusterOnly = 1;
+      nErr = client_sync(SYNC_CLONE | bPrivate, configRcvMask, 0);
+      g.xlinkClusterOnly = 0;
+    }
     verify_cancel();
     db_end_transaction(0);
-    db_close(1);
     if( nErr ){
+      if( bResume || db_get_int("clone-seqno", 0)>1 ){
+        db_close(1);
+        fossil_fatal("clone interrupted - continue with:"
+                     " %s clone --resume %s %s",
+                     g.argv[0], g.argv[2], g.argv[3]);
+      }
+      db_close(1);
       file_delete(g.argv[3]);
       fossil_fatal("server returned an error - clone aborted");
     }
+    db_close(1);
     db_open_repository(g.argv[3]);
   }
   db_begin_transaction();
   fossil_print("Rebuilding repository meta-data...\n");
   rebuild_db(0, 1, 0);
+  db_unset("clone-seqno", 0);
   fossil_print("project-id: %s\n", db_get("project-code", 0));
   zPassword = db_text(0, "SELECT pw FROM user WHERE login=%Q", g.zLogin);
   fossil_print("admin-user: %s (password is \"%s\")\n", g.zLogin, zPassword);
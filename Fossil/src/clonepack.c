@@ -0,0 +1,446 @@
+/*
+** Copyright (c) 2014 D. Richard Hipp
+**
+** This program is free software; you can redistribute it and/or
+** modify it under the terms of the Simplified BSD License (also
+** known as the "2-Clause License" or "FreeBSD License".)
+
+** This program is distributed in the hope that it will be useful,
+** but without any warranty; without even the implied warranty of
+** merchantability or fitness for a particular purpose.
+**
+** Author contact information:
+**   drh@hwaci.com
+**   http://www.hwaci.com/drh/
+**
+*******************************************************************************
+**
+** This file implements the "clone pack" of a server.
+**
+** A new clone is sent every artifact of the repository, in rid order, as
+** "cfile" cards that hold the artifacts exactly as they are stored in the
+** BLOB table.  Those cards are the same for every clone, so the server
+** can keep them in a file and send them straight from the file, rather
+** than build them again from the repository for each clone.
+**
+** The clone pack is a file with the same name as the repository plus a
+** "-clonepack" suffix.  It holds the cards for all artifacts up to some
+** rid, and it is extended as the repository grows.  The cards for
+** artifacts newer than the pack are built from the repository as usual.
+** An index of where the card for each artifact begins is kept in a
+** separate SQLite database with a "-clonepack-idx" suffix.
+**
+** The pack is only used when the "clone-pack" setting is on.  Anything
+** that removes an artifact or changes which artifacts are private, and
+** so changes the cards that a clone is sent, calls clone_pack_invalidate()
+** and the pack is begun again.
+*/
+#include "config.h"
+#include "clonepack.h"
+
+/*
+** Schema of the index of the clone pack
+*/
+static const char zClonePackSchema[] =
+@ CREATE TABLE IF NOT EXISTS pack(
+@   nonce TEXT,              -- Random tag, also on the first line of the pack
+@   packid TEXT,             -- "clone-pack-id" of the repository
+@   nrid INT,                -- Cards for all rids less than this are in the pack
+@   sz INT,                  -- Size of the pack in bytes
+@   lastuuid TEXT,           -- Artifact nrid-1 when the pack was extended
+@   shunsum TEXT             -- Checksum of the shunned artifacts
+@ );
+@ CREATE TABLE IF NOT EXISTS mark(
+@   rid INTEGER PRIMARY KEY, -- An artifact
+@   off INT                  -- Offset in the pack of the card for rid
+@ );
+@ CREATE INDEX IF NOT EXISTS markoff ON mark(off);
+;
+
+/*
+** Connection to the index of the clone pack, or NULL
+*/
+static sqlite3 *packDb = 0;
+
+/*
+** Return the name of the clone pack, or of its index if zSuffix is
+** "-idx".  Space to hold the name is obtained from malloc.
+*/
+static char *clone_pack_filename(const char *zSuffix){
+  return mprintf("%s-clonepack%s", g.zRepositoryName, zSuffix);
+}
+
+/*
+** Run SQL against the index.  Return the SQLite result code.
+*/
+static int clone_pack_exec(const char *zFormat, ...){
+  va_list ap;
+  char *zSql;
+  int rc;
+  va_start(ap, zFormat);
+  zSql = sqlite3_vmprintf(zFormat, ap);
+  va_end(ap);
+  rc = sqlite3_exec(packDb, zSql, 0, 0, 0);
+  sqlite3_free(zSql);
+  return rc;
+}
+
+/*
+** Return the integer result of an SQL query against the index, or
+** iDflt if the query returns no rows.
+*/
+static i64 clone_pack_int64(i64 iDflt, const char *zFormat, ...){
+  va_list ap;
+  char *zSql;
+  sqlite3_stmt *pStmt = 0;
+  i64 v = iDflt;
+  va_start(ap, zFormat);
+  zSql = sqlite3_vmprintf(zFormat, ap);
+  va_end(ap);
+  if( sqlite3_prepare_v2(packDb, zSql, -1, &pStmt, 0)==SQLITE_OK
+   && sqlite3_step(pStmt)==SQLITE_ROW
+  ){
+    v = sqlite3_column_int64(pStmt, 0);
+  }
+  sqlite3_finalize(pStmt);
+  sqlite3_free(zSql);
+  return v;
+}
+
+/*
+** Return the text result of an SQL query against the index, or NULL if
+** the query returns no rows or a NULL.  Space to hold the result is
+** obtained from malloc.
+*/
+static char *clone_pack_text(const char *zFormat, ...){
+  va_list ap;
+  char *zSql;
+  sqlite3_stmt *pStmt = 0;
+  char *z = 0;
+  va_start(ap, zFormat);
+  zSql = sqlite3_vmprintf(zFormat, ap);
+  va_end(ap);
+  if( sqlite3_prepare_v2(packDb, zSql, -1, &pStmt, 0)==SQLITE_OK
+   && sqlite3_step(pStmt)==SQLITE_ROW
+   && sqlite3_column_type(pStmt, 0)!=SQLITE_NULL
+  ){
+    z = mprintf("%s", sqlite3_column_text(pStmt, 0));
+  }
+  sqlite3_finalize(pStmt);
+  sqlite3_free(zSql);
+  return z;
+}
+
+/*
+** Return true if the clone pack is turned on
+*/
+static int clone_pack_enabled(void){
+  return db_get_boolean("clone-pack", 0);
+}
+
+/*
+** Open the index, creating it if necessary.  Return 0 if the clone pack
+** cannot be used.
+*/
+static sqlite3 *clone_pack_open(void){
+  char *zName;
+  int rc;
+  if( packDb ) return packDb;
+  zName = clone_pack_filename("-idx");
+  rc = sqlite3_open_v2(zName, &packDb,
+                       SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE,
+                       g.zVfsName);
+  fossil_free(zName);
+  if( rc==SQLITE_OK ){
+    sqlite3_busy_timeout(packDb, 5000);
+    rc = sqlite3_exec(packDb, "PRAGMA journal_mode=WAL;", 0, 0, 0);
+  }
+  if( rc==SQLITE_OK ){
+    rc = sqlite3_exec(packDb, zClonePackSchema, 0, 0, 0);
+  }
+  if( rc!=SQLITE_OK ){
+    sqlite3_close(packDb);
+    packDb = 0;
+  }
+  return packDb;
+}
+
+/*
+** Close the index
+*/
+static void clone_pack_close(void){
+  if( packDb ){
+    sqlite3_close(packDb);
+    packDb = 0;
+  }
+}
+
+/*
+** Cause the clone pack to be begun again the next time it is used.
+** This is called whenever artifacts are removed from the repository
+** or stop being private.
+*/
+void clone_pack_invalidate(void){
+  db_unset("clone-pack-id", 0);
+}
+
+/*
+** Return a checksum of the list of shunned artifacts.  Shunned artifacts
+** are left out of the pack, so the pack must be begun again whenever
+** the list changes.  Space to hold the result is obtained from malloc.
+*/
+static char *clone_pack_shunsum(void){
+  Stmt q;
+  Blob cksum;
+  void *pCtx = sha1sum_ctx_new();
+  db_prepare(&q, "SELECT uuid FROM shun ORDER BY uuid");
+  while( db_step(&q)==SQLITE_ROW ){
+    sha1sum_ctx_step(pCtx, db_column_text(&q, 0), db_column_bytes(&q, 0));
+  }
+  db_finalize(&q);
+  sha1sum_ctx_finish(pCtx, &cksum);
+  return blob_str(&cksum);
+}
+
+/*
+** Return true if the pack described by the index was made from this
+** repository and is still correct for it.  The caller must hold a
+** transaction on the index.
+*/
+static int clone_pack_valid(void){
+  char *zPackId = clone_pack_text("SELECT packid FROM pack");
+  char *zLast = clone_pack_text("SELECT lastuuid FROM pack");
+  char *zShun = clone_pack_text("SELECT shunsum FROM pack");
+  char *zId = db_get("clone-pack-id", 0);
+  char *zUuid, *zSum;
+  int nRid = (int)clone_pack_int64(0, "SELECT nrid FROM pack");
+  int isValid;
+  zUuid = db_text(0, "SELECT uuid FROM blob WHERE rid=%d", nRid-1);
+  zSum = clone_pack_shunsum();
+  isValid = nRid>0 && zId!=0 && fossil_strcmp(zId, zPackId)==0
+            && fossil_strcmp(zUuid, zLast)==0
+            && fossil_strcmp(zSum, zShun)==0;
+  fossil_free(zPackId);
+  fossil_free(zLast);
+  fossil_free(zShun);
+  fossil_free(zId);
+  fossil_free(zUuid);
+  fossil_free(zSum);
+  return isValid;
+}
+
+/*
+** Open the pack and check that it begins with zNonce.  Return NULL if
+** it does not.
+*/
+static FILE *clone_pack_fopen(const char *zNonce){
+  char *zName = clone_pack_filename("");
+  FILE *in = fossil_fopen(zName, "rb");
+  char zLine[100];
+  char *zWant = mprintf("# clone-pack %s\n", zNonce);
+  fossil_free(zName);
+  if( in
+   && (fgets(zLine, sizeof(zLine), in)==0 || strcmp(zLine, zWant)!=0)
+  ){
+    fclose(in);
+    in = 0;
+  }
+  fossil_free(zWant);
+  return in;
+}
+
+/*
+** Discard the clone pack and begin an empty one.  The caller must hold
+** a write transaction on the index.  Return non-zero on failure.
+*/
+static int clone_pack_reset(void){
+  char *zName = clone_pack_filename("");
+  char *zId = db_get("clone-pack-id", 0);
+  char *zNonce = db_text(0, "SELECT lower(hex(randomblob(12)))");
+  char *zSum = clone_pack_shunsum();
+  FILE *out;
+  int sz;
+  if( zId==0 ){
+    zId = db_text(0, "SELECT lower(hex(randomblob(20)))");
+    db_set("clone-pack-id", zId, 0);
+  }
+  /* Readers may still be sending from the old pack, so it is replaced
+  ** by a new file rather than overwritten */
+  file_delete(zName);
+  out = fossil_fopen(zName, "wb");
+  fossil_free(zName);
+  if( out ){
+    sz = fprintf(out, "# clone-pack %s\n", zNonce);
+    fclose(out);
+    clone_pack_exec("DELETE FROM pack; DELETE FROM mark;"
+                    "INSERT INTO pack VALUES(%Q,%Q,1,%d,NULL,%Q);",
+                    zNonce, zId, sz, zSum);
+  }
+  fossil_free(zId);
+  fossil_free(zNonce);
+  fossil_free(zSum);
+  return out==0;
+}
+
+/*
+** Add the cards of up to about mxByte bytes of artifacts to the clone
+** pack, beginning it again first if it is not valid.  Artifacts are
+** only added up to the first phantom, so that the pack never has gaps.
+** Return the number of artifacts added, or -1 if the pack could not be
+** extended.
+**
+** If noWait is true, give up at once if another process is extending
+** the pack.
+*/
+static int clone_pack_extend(int mxByte, int noWait){
+  char *zName;
+  FILE *out;
+  Blob card;
+  int rid, mxRid, rc;
+  i64 sz, nAdded = 0;
+  int nRid = 0;
+
+  if( clone_pack_open()==0 ) return -1;
+  if( noWait ) sqlite3_busy_timeout(packDb, 0);
+  rc = clone_pack_exec("BEGIN IMMEDIATE");
+  if( noWait ) sqlite3_busy_timeout(packDb, 5000);
+  if( rc!=SQLITE_OK ) return -1;
+  if( !clone_pack_valid() && clone_pack_reset() ){
+    clone_pack_exec("ROLLBACK");
+    return -1;
+  }
+  rid = (int)clone_pack_int64(1, "SELECT nrid FROM pack");
+  sz = clone_pack_int64(0, "SELECT sz FROM pack");
+  mxRid = db_int(0, "SELECT max(rid) FROM blob");
+  mxRid = db_int(0, "SELECT coalesce(min(rid),%d) FROM phantom"
+                    " WHERE rid>=%d", mxRid+1, rid) - 1;
+  if( rid>mxRid ){
+    clone_pack_exec("COMMIT");
+    return 0;
+  }
+  zName = clone_pack_filename("");
+  out = fossil_fopen(zName, "r+b");
+  fossil_free(zName);
+  if( out==0 || fseek(out, sz, SEEK_SET)!=0 ){
+    if( out ) fclose(out);
+    clone_pack_exec("ROLLBACK");
+    return -1;
+  }
+  blob_zero(&card);
+  while( rid<=mxRid && nAdded<mxByte ){
+    clone_pack_exec("INSERT OR REPLACE INTO mark VALUES(%d,%lld)", rid, sz);
+    xfer_clone_card(&card, rid);
+    if( blob_size(&card)>0 ){
+      fwrite(blob_buffer(&card), 1, blob_size(&card), out);
+      sz += blob_size(&card);
+      nAdded += blob_size(&card);
+      blob_reset(&card);
+    }
+    rid++;
+    nRid++;
+  }
+  if( fclose(out)!=0 ){
+    clone_pack_exec("ROLLBACK");
+    return -1;
+  }
+  zName = db_text(0, "SELECT uuid FROM blob WHERE rid=%d", rid-1);
+  clone_pack_exec("UPDATE pack SET nrid=%d, sz=%lld, lastuuid=%Q",
+                  rid, sz, zName);
+  fossil_free(zName);
+  clone_pack_exec("COMMIT");
+  return nRid;
+}
+
+/*
+** Called by the server while replying to a "clone" request that asks
+** for artifacts beginning with rid *pSeqno.  Append to the reply the
+** cards of the clone pack for as many of those artifacts as fit in
+** mxByte bytes.  The cards are copied from the pack to the connection
+** when the reply is sent.  Set *pSeqno to the first rid whose card
+** was not sent and return the number of bytes added to the reply.
+**
+** The pack is extended first, so that it keeps up with the repository
+** as clones are made.
+*/
+int clone_pack_send(int *pSeqno, int mxByte){
+  char *zNonce;
+  FILE *in = 0;
+  int seqno = *pSeqno;
+  int nRid, ridEnd;
+  i64 sz, iStart, iEnd;
+
+  if( mxByte<=0 || !clone_pack_enabled() ) return 0;
+  if( clone_pack_extend(mxByte, 1)<0 || clone_pack_exec("BEGIN")!=SQLITE_OK ){
+    clone_pack_close();
+    return 0;
+  }
+  nRid = (int)clone_pack_int64(0, "SELECT nrid FROM pack");
+  sz = clone_pack_int64(0, "SELECT sz FROM pack");
+  iStart = clone_pack_int64(-1, "SELECT off FROM mark WHERE rid=%d", seqno);
+  if( seqno>=nRid || iStart<0 || !clone_pack_valid() ){
+    clone_pack_exec("COMMIT");
+    clone_pack_close();
+    return 0;
+  }
+  if( sz-iStart<=mxByte ){
+    ridEnd = nRid;
+    iEnd = sz;
+  }else{
+    ridEnd = (int)clone_pack_int64(0,
+        "SELECT rid FROM mark WHERE off<=%lld ORDER BY off DESC, rid DESC",
+        iStart+mxByte);
+    iEnd = clone_pack_int64(0, "SELECT off FROM mark WHERE rid=%d", ridEnd);
+  }
+  if( iEnd>iStart ){
+    zNonce = clone_pack_text("SELECT nonce FROM pack");
+    if( zNonce ) in = clone_pack_fopen(zNonce);
+    fossil_free(zNonce);
+  }
+  clone_pack_exec("COMMIT");
+  clone_pack_close();
+  if( in==0 ) return 0;
+  cgi_append_file(in, iStart, iEnd-iStart);
+  *pSeqno = ridEnd;
+  return (int)(iEnd-iStart);
+}
+
+/*
+** COMMAND: clone-pack
+** %fossil clone-pack ?OPTIONS?
+**
+** Bring the clone pack of the repository up to date.  The clone pack is
+** a file beside the repository holding the artifacts in the form in
+** which they are sent to new clones.  When the "clone-pack" setting is
+** on, a server sends clones as much as it can straight from the pack.
+** The server extends the pack by itself as clones are made, so this
+** command is only needed to build all of it in advance.
+**
+** Options:
+**   -R|--repository FILE       Use the repository FILE
+**   --reset                    Build the clone pack again from the start
+*/
+void clone_pack_cmd(void){
+  int bReset = find_option("reset",0,0)!=0;
+  int n;
+  int nRid = 0;
+  db_find_and_open_repository(0, 0);
+  verify_all_options();
+  db_begin_transaction();
+  if( bReset ) clone_pack_invalidate();
+  while( (n = clone_pack_extend(10000000, 0))>0 ){
+    nRid += n;
+  }
+  db_end_transaction(0);
+  if( n<0 ){
+    fossil_fatal("cannot write the clone pack");
+  }
+  fossil_print("%d artifacts added.  The pack holds artifacts 1 through %d"
+               " in %lld bytes.\n", nRid,
+               (int)clone_pack_int64(1, "SELECT nrid FROM pack")-1,
+               clone_pack_int64(0, "SELECT sz FROM pack"));
+  if( !clone_pack_enabled() ){
+    fossil_print("The pack is not used until the \"clone-pack\""
+                 " setting is turned on.\n");
+  }
+  clone_pack_close();
+}
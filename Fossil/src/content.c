@@ -23,18 +23,43 @@
 
 /*
 ** The artifact retrieval cache
+**
+** Cache entries live in the a[] array and are located by rid using a
+** chained hash table, aHash[].  Entries are also threaded onto a doubly
+** linked list in order of last use so that the least recently used
+** entry can be found and evicted in constant time.  All links are
+** indices into a[] (or -1 for "none") so that a[] can be reallocated
+** freely.  Unused slots of a[] are kept on a free list that is threaded
+** through the iHashNext field.
+**
+** The total size of cached content is limited by the "content-cache-size"
+** setting, in megabytes.  When space is needed, the least recently used
+** entry is evicted unless it has been hit since it last reached the old
+** end of the list, in which case it gets a second chance.  Hence entries
+** that are hit often, such as checkpoints partway down a long delta chain,
+** tend to stay in the cache even when many other artifacts pass through.
 */
 static struct {
   i64 szTotal;         /* Total size of all entries in the cache */
+  i64 szLimit;         /* Size limit.  0 if not yet read from settings */
   int n;               /* Current number of cache entries */
   int nAlloc;          /* Number of slots allocated in a[] */
-  int nextAge;         /* Age counter for implementing LRU */
+  int iFree;           /* First unused slot in a[].  -1 if none */
+  int iNewest;         /* Most recently used entry.  -1 if cache is empty */
+  int iOldest;         /* Least recently used entry.  -1 if cache is empty */
+  int nHash;           /* Number of slots in aHash[].  Always a power of 2 */
+  int *aHash;          /* Hash table of cache entries, keyed by rid */
   struct cacheLine {   /* One instance of this for each cache entry */
     int rid;                  /* Artifact id */
-    int age;                  /* Age.  Newer is larger */
+    int iHashNext;            /* Next entry on the same hash chain */
+    int iNewer;               /* Next more recently used entry */
+    int iOlder;               /* Next less recently used entry */
+    int nUse;                 /* Hits since last reaching the old end */
     Blob content;             /* Content of the artifact */
   } *a;                /* The positive cache */
-  Bag inCache;         /* Set of artifacts currently in cache */
+  int nHit;            /* Number of content_get() calls served from cache */
+  int nMiss;           /* Number of content_get() calls not in the cache */
+  int nEvict;          /* Number of entries evicted to stay within szLimit */
 
   /*
   ** The missing artifact cache.
@@ -47,27 +72,119 @@ static struct {
   */
   Bag missing;         /* Cache of artifacts that are incomplete */
   Bag available;       /* Cache of artifacts that are complete */
-} contentCache;
+
+  /*
+  ** Artifacts that content_get() has reconstructed or passed through
+  ** while walking a delta chain.  A chain walk that reaches one of these
+  ** again has found a point shared by more than one request (a branch
+  ** point of the delta tree, or the target of the previous request) and
+  ** so keeps that point in the cache.
+  */
+  Bag walked;
+} contentCache = { 0, 0, 0, 0, -1, -1, -1 };
 
 /*
-** Remove the oldest element from the content cache
+** The hash function for the content cache
+*/
+#define content_cache_hash(rid)  (((unsigned)(rid)*101)&(contentCache.nHash-1))
+
+/*
+** Return the index in contentCache.a[] of the entry for artifact rid,
+** or -1 if rid is not in the cache.
+*/
+static int content_cache_find(int rid){
+  int i;
+  if( contentCache.nHash==0 ) return -1;
+  i = contentCache.aHash[content_cache_hash(rid)];
+  while( i>=0 && contentCache.a[i].rid!=rid ){
+    i = contentCache.a[i].iHashNext;
+  }
+  return i;
+}
+
+/*
+** Remove entry i from the LRU list.
+*/
+static void content_cache_unlink(int i){
+  struct cacheLine *p = &contentCache.a[i];
+  if( p->iNewer>=0 ){
+    contentCache.a[p->iNewer].iOlder = p->iOlder;
+  }else{
+    contentCache.iNewest = p->iOlder;
+  }
+  if( p->iOlder>=0 ){
+    contentCache.a[p->iOlder].iNewer = p->iNewer;
+  }else{
+    contentCache.iOldest = p->iNewer;
+  }
+}
+
+/*
+** Put entry i at the most-recently-used end of the LRU list.
+*/
+static void content_cache_link_newest(int i){
+  struct cacheLine *p = &contentCache.a[i];
+  p->iNewer = -1;
+  p->iOlder = contentCache.iNewest;
+  if( contentCache.iNewest>=0 ){
+    contentCache.a[contentCache.iNewest].iNewer = i;
+  }else{
+    contentCache.iOldest = i;
+  }
+  contentCache.iNewest = i;
+}
+
+/*
+** Resize the hash table so that it has nNew slots and rehash every
+** entry currently in the cache.
+*/
+static void content_cache_rehash(int nNew){
+  int i;
+  fossil_free(contentCache.aHash);
+  contentCache.nHash = nNew;
+  contentCache.aHash = fossil_malloc( sizeof(int)*nNew );
+  memset(contentCache.aHash, 0xff, sizeof(int)*nNew);
+  for(i=contentCache.iNewest; i>=0; i=contentCache.a[i].iOlder){
+    unsigned h = content_cache_hash(contentCache.a[i].rid);
+    contentCache.a[i].iHashNext = contentCache.aHash[h];
+    contentCache.aHash[h] = i;
+  }
+}
+
+/*
+** Remove entry i from the content cache and free its content.
+*/
+static void content_cache_remove(int i){
+  int *pi;
+  content_cache_unlink(i);
+  pi = &contentCache.aHash[content_cache_hash(contentCache.a[i].rid)];
+  while( *pi!=i ){
+    pi = &contentCache.a[*pi].iHashNext;
+  }
+  *pi = contentCache.a[i].iHashNext;
+  contentCache.szTotal -= blob_size(&contentCache.a[i].content);
+  blob_reset(&contentCache.a[i].content);
+  contentCache.a[i].iHashNext = contentCache.iFree;
+  contentCache.iFree = i;
+  contentCache.n--;
+}
+
+/*
+** Remove the oldest element from the content cache.  Entries that have
+** been used since they were last considered are moved back to the new
+** end of the list, with their use count halved, rather than evicted.
 */
 static void content_cache_expire_oldest(void){
   int i;
-  int mnAge = contentCache.nextAge;
-  int mn = -1;
-  for(i=0; i<contentCache.n; i++){
-    if( contentCache.a[i].age<mnAge ){
-      mnAge = contentCache.a[i].age;
-      mn = i;
-    }
+  while( (i = contentCache.iOldest)>=0 && contentCache.a[i].nUse>0 ){
+    contentCache.a[i].nUse /= 2;
+    if( contentCache.iNewest==i ) break;
+    content_cache_unlink(i);
+    content_cache_link_newest(i);
   }
-  if( mn>=0 ){
-    bag_remove(&contentCache.inCache, contentCache.a[mn].rid);
-    contentCache.szTotal -= blob_size(&contentCache.a[mn].content);
-    blob_reset(&contentCache.a[mn].content);
-    contentCache.n--;
-    contentCache.a[mn] = contentCache.a[contentCache.n];
+  if( i>=0 ){
+    content_cache_remove(i);
+    contentCache.nEvict++;
   }
 }
 
@@ -79,40 +196,78 @@ static void content_cache_expire_oldest(void){
 */
 void content_cache_insert(int rid, Blob *pBlob){
   struct cacheLine *p;
-  if( contentCache.n>500 || contentCache.szTotal>50000000 ){
-    i64 szBefore;
-    do{
-      szBefore = contentCache.szTotal;
-      content_cache_expire_oldest();
-    }while( contentCache.szTotal>50000000 && contentCache.szTotal<szBefore );
-  }
-  if( contentCache.n>=contentCache.nAlloc ){
+  int i;
+  unsigned h;
+  if( contentCache.szLimit==0 ){
+    int mx = db_get_int("content-cache-size", 50);
+    contentCache.szLimit = mx>0 ? (i64)mx*1000000 : 1;
+  }
+  if( (i = content_cache_find(rid))>=0 ){
+    /* Already cached.  Replace the old content with the new. */
+    p = &contentCache.a[i];
+    contentCache.szTotal += blob_size(pBlob) - blob_size(&p->content);
+    blob_reset(&p->content);
+    p->content = *pBlob;
+    blob_zero(pBlob);
+    content_cache_unlink(i);
+    content_cache_link_newest(i);
+    return;
+  }
+  while( contentCache.n>0
+      && contentCache.szTotal+blob_size(pBlob)>contentCache.szLimit ){
+    content_cache_expire_oldest();
+  }
+  if( contentCache.iFree<0 ){
+    int nOld = contentCache.nAlloc;
     contentCache.nAlloc = contentCache.nAlloc*2 + 10;
     contentCache.a = fossil_realloc(contentCache.a,
                              contentCache.nAlloc*sizeof(contentCache.a[0]));
+    for(i=contentCache.nAlloc-1; i>=nOld; i--){
+      contentCache.a[i].iHashNext = contentCache.iFree;
+      contentCache.iFree = i;
+    }
+  }
+  if( contentCache.n>=contentCache.nHash ){
+    content_cache_rehash(contentCache.nHash ? contentCache.nHash*2 : 64);
   }
-  p = &contentCache.a[contentCache.n++];
+  i = contentCache.iFree;
+  p = &contentCache.a[i];
+  contentCache.iFree = p->iHashNext;
   p->rid = rid;
-  p->age = contentCache.nextAge++;
+  p->nUse = 0;
+  h = content_cache_hash(rid);
+  p->iHashNext = contentCache.aHash[h];
+  contentCache.aHash[h] = i;
+  content_cache_link_newest(i);
+  contentCache.n++;
   contentCache.szTotal += blob_size(pBlob);
   p->content = *pBlob;
   blob_zero(pBlob);
-  bag_insert(&contentCache.inCache, rid);
 }
 
 /*
 ** Clear the content cache.
 */
 void content_clear_cache(void){
-  int i;
-  for(i=0; i<contentCache.n; i++){
-    blob_reset(&contentCache.a[i].content);
+  while( contentCache.iOldest>=0 ){
+    content_cache_remove(contentCache.iOldest);
   }
   bag_clear(&contentCache.missing);
   bag_clear(&contentCache.available);
-  bag_clear(&contentCache.inCache);
-  contentCache.n = 0;
-  contentCache.szTotal = 0;
+  bag_clear(&contentCache.walked);
+  contentCache.szLimit = 0;
+}
+
+/*
+** Write a one-line summary of the content cache statistics into pOut.
+*/
+void content_cache_stats(Blob *pOut){
+  i64 mx = contentCache.szLimit;
+  if( mx==0 ) mx = (i64)db_get_int("content-cache-size", 50)*1000000;
+  blob_appendf(pOut, "%d hits, %d misses, %d evictions, "
+                     "%lld of %lld bytes in %d entries",
+               contentCache.nHit, contentCache.nMiss, contentCache.nEvict,
+               contentCache.szTotal, mx, contentCache.n);
 }
 
 /*
@@ -222,6 +377,14 @@ static int content_of_blob(int rid, Blob *pBlob){
   return rc;
 }
 
+/*
+** When content_get() reconstructs an artifact by applying a chain of
+** deltas, every CONTENT_CHECKPOINT_SPACING-th intermediate result is
+** added to the cache so that later requests for artifacts further along
+** the same chain need to apply at most that many deltas.
+*/
+#define CONTENT_CHECKPOINT_SPACING 8
+
 /*
 ** Extract the content for ID rid and put it into the
 ** uninitialized blob.  Return 1 on success.  If the record
@@ -242,15 +405,15 @@ int content_get(int rid, Blob *pBlob){
   }
 
   /* Look for the artifact in the cache first */
-  if( bag_find(&contentCache.inCache, rid) ){
-    for(i=0; i<contentCache.n; i++){
-      if( contentCache.a[i].rid==rid ){
-        blob_copy(pBlob, &contentCache.a[i].content);
-        contentCache.a[i].age = contentCache.nextAge++;
-        return 1;
-      }
-    }
+  if( (i = content_cache_find(rid))>=0 ){
+    blob_copy(pBlob, &contentCache.a[i].content);
+    content_cache_unlink(i);
+    content_cache_link_newest(i);
+    contentCache.a[i].nUse++;
+    contentCache.nHit++;
+    return 1;
   }
+  contentCache.nMiss++;
 
   nextRid = findSrcid(rid);
   if( nextRid==0 ){
@@ -260,13 +423,14 @@ int content_get(int rid, Blob *pBlob){
     int nAlloc = 10;
     int *a = 0;
     int mx;
+    int iHot = -1;      /* a[iHot] is shared with an earlier chain walk */
     Blob delta, next;
 
     a = fossil_malloc( sizeof(a[0])*nAlloc );
     a[0] = rid;
     a[1] = nextRid;
     n = 1;
-    while( !bag_find(&contentCache.inCache, nextRid)
+    while( content_cache_find(nextRid)<0
         && (nextRid = findSrcid(nextRid))>0 ){
       n++;
       if( n>=nAlloc ){
@@ -279,6 +443,16 @@ int content_get(int rid, Blob *pBlob){
       a[n] = nextRid;
     }
     mx = n;
+
+    /* Besides the regularly spaced checkpoints, keep the nearest point on
+    ** this chain that an earlier walk also reconstructed, which may be
+    ** rid itself.  Repeated requests that share a prefix of the chain
+    ** then only replay the part that differs.
+    */
+    for(n=0; n<mx; n++){
+      if( !bag_insert(&contentCache.walked, a[n]) && iHot<0 ) iHot = n;
+    }
+    n = mx;
     rc = content_get(a[n], pBlob);
     n--;
     while( rc && n>=0 ){
@@ -286,7 +460,7 @@ int content_get(int rid, Blob *pBlob){
       if( rc ){
         blob_delta_apply(pBlob, &delta, &next);
         blob_reset(&delta);
-        if( (mx-n)%8==0 ){
+        if( (mx-n)%CONTENT_CHECKPOINT_SPACING==0 || n+1==iHot ){
           content_cache_insert(a[n+1], pBlob);
         }else{
           blob_reset(pBlob);
@@ -296,7 +470,12 @@ int content_get(int rid, Blob *pBlob){
       n--;
     }
     free(a);
-    if( !rc ) blob_reset(pBlob);
+    if( !rc ){
+      blob_reset(pBlob);
+    }else if( iHot==0 ){
+      blob_copy(&next, pBlob);
+      content_cache_insert(rid, &next);
+    }
   }
   if( rc==0 ){
     bag_insert(&contentCache.missing, rid);
@@ -452,6 +631,20 @@ void content_enable_dephantomize(int onoff){
   ignoreDephantomizations = !onoff;
 }
 
+/*
+** Construct a received-from ID if we do not already have one
+*/
+static void content_need_rcvid(void){
+  if( g.rcvid==0 ){
+    db_multi_exec(
+       "INSERT INTO rcvfrom(uid, mtime, nonce, ipaddr)"
+       "VALUES(%d, julianday('now'), %Q, %Q)",
+       g.userUid, g.zNonce, g.zIpAddr
+    );
+    g.rcvid = db_last_insert_rowid();
+  }
+}
+
 /*
 ** Write content into the database.  Return the record ID.  If the
 ** content is already in the database, just return the record ID.
@@ -528,16 +721,7 @@ int content_put_ex(
   }
   db_finalize(&s1);
 
-  /* Construct a received-from ID if we do not already have one */
-  if( g.rcvid==0 ){
-    db_multi_exec(
-       "INSERT INTO rcvfrom(uid, mtime, nonce, ipaddr)"
-       "VALUES(%d, julianday('now'), %Q, %Q)",
-       g.userUid, g.zNonce, g.zIpAddr
-    );
-    g.rcvid = db_last_insert_rowid();
-  }
-
+  content_need_rcvid();
   if( nBlob ){
     cmpr = pBlob[0];
   }else{
@@ -664,6 +848,337 @@ int content_new(const char *zUuid, int isPrivate){
 }
 
 
+/*
+** Artifacts that arrive in bulk, as during a clone, pull or import, are
+** queued by content_batch_put() and written together by
+** content_batch_flush().  The queued artifacts are compressed on worker
+** threads while their hashes are checked several at a time, and those
+** that are new to the repository are then added by a few multi-row
+** INSERT statements per batch rather than several statements each.
+**
+** An artifact that fills in a phantom is still written by
+** content_put_ex(), as dephantomizing has to be done one artifact at
+** a time.
+*/
+#define CONTENT_BATCH_N    200               /* Most artifacts per batch */
+#define CONTENT_BATCH_SZ   (8*1024*1024)     /* Most bytes per batch */
+
+#if INTERFACE
+/*
+** Allowed values for the mFlags argument to content_batch_put()
+*/
+#define CBATCH_VERIFY     0x01  /* The content must hash to zUuid */
+#define CBATCH_PUBLIC     0x02  /* Remove from the private table once stored */
+#define CBATCH_CROSSLINK  0x04  /* Crosslink the artifact once stored */
+#endif
+
+static struct {
+  int isActive;            /* True between content_batch_begin() and _end() */
+  ThreadPool *pPool;       /* Worker threads for compression */
+  void (*xStored)(void*,int,int);  /* Called for each artifact stored */
+  void *pArg;              /* First argument to xStored */
+  int n;                   /* Number of artifacts in a[] */
+  int sz;                  /* Total size of the content in a[] */
+  int nPending;            /* Number of new artifacts not yet inserted */
+  int aPending[CONTENT_BATCH_N];   /* Indices in a[] of those artifacts */
+  struct batchEntry {      /* One instance for each queued artifact */
+    Blob content;             /* Content as received */
+    Blob cmpr;                /* Compressed content */
+    char zUuid[UUID_SIZE+1];  /* Hash of the artifact */
+    char zSrc[UUID_SIZE+1];   /* Delta source, or an empty string */
+    int nBlob;                /* Original size if content is compressed */
+    int size;                 /* Value for the blob.size column */
+    int isPrivate;            /* True if the artifact is private */
+    int mFlags;               /* CBATCH_* flags */
+    int isBad;                /* True if the content does not match zUuid */
+    int srcid;                /* Record ID of zSrc */
+    int rid;                  /* Record ID of the artifact, once stored */
+  } a[CONTENT_BATCH_N];
+} contentBatch;
+
+/*
+** Begin queuing artifacts with content_batch_put().  Once each artifact
+** has been stored, xStored(pArg, RID, isBad) is called, where isBad is
+** true if the content of the artifact did not match its hash.
+*/
+void content_batch_begin(void (*xStored)(void*,int,int), void *pArg){
+  int nThread;
+  assert( !contentBatch.isActive );
+  memset(&contentBatch, 0, sizeof(contentBatch));
+  contentBatch.isActive = 1;
+  contentBatch.xStored = xStored;
+  contentBatch.pArg = pArg;
+  nThread = threadpool_size(0);
+  if( nThread>1 ) contentBatch.pPool = threadpool_new(nThread);
+}
+
+/*
+** Queue an artifact to be written into the database.  The arguments
+** have the same meaning as for content_put_ex(), except that zUuid is
+** required and the delta source, if any, is given by its hash zSrc,
+** which becomes a phantom if it is not in the repository.  This routine
+** takes over responsibility for pBlob, which it leaves empty.
+**
+** If mFlags contains CBATCH_VERIFY, then zUuid is only what the sender
+** says the hash of pBlob is.  The artifact is stored under its real
+** hash and reported as bad if that is different.  CBATCH_CROSSLINK
+** requires that pBlob be the full, uncompressed artifact.
+*/
+void content_batch_put(
+  Blob *pBlob,              /* Content to add to the repository */
+  const char *zUuid,        /* SHA1 hash of reconstructed pBlob */
+  const char *zSrc,         /* pBlob is a delta from this artifact */
+  int nBlob,                /* pBlob is compressed. Original size is this */
+  int isPrivate,            /* The content should be marked private */
+  int mFlags                /* CBATCH_* flags */
+){
+  struct batchEntry *p;
+  assert( contentBatch.isActive );
+  assert( zSrc==0 || (mFlags & (CBATCH_VERIFY|CBATCH_CROSSLINK))==0 );
+  if( contentBatch.n>=CONTENT_BATCH_N ) content_batch_flush();
+  p = &contentBatch.a[contentBatch.n++];
+  memset(p, 0, sizeof(*p));
+  if( pBlob->xRealloc==blobReallocMalloc ){
+    p->content = *pBlob;
+    blob_zero(pBlob);
+  }else{
+    blob_copy(&p->content, pBlob);
+    blob_reset(pBlob);
+  }
+  sqlite3_snprintf(sizeof(p->zUuid), p->zUuid, "%s", zUuid);
+  sqlite3_snprintf(sizeof(p->zSrc), p->zSrc, "%s", zSrc ? zSrc : "");
+  p->nBlob = nBlob;
+  if( nBlob ){
+    p->size = nBlob;
+  }else if( zSrc ){
+    p->size = delta_output_size(blob_buffer(&p->content),
+                                blob_size(&p->content));
+  }else{
+    p->size = blob_size(&p->content);
+  }
+  p->isPrivate = isPrivate;
+  p->mFlags = mFlags;
+  contentBatch.sz += blob_size(&p->content);
+  if( contentBatch.sz>=CONTENT_BATCH_SZ ) content_batch_flush();
+}
+
+/*
+** Return true if an artifact with hash zUuid is queued and not yet
+** written.  Anything that needs the content of that artifact must call
+** content_batch_flush() first.
+*/
+int content_batch_pending(const char *zUuid){
+  int i;
+  for(i=0; i<contentBatch.n; i++){
+    if( fossil_strcmp(contentBatch.a[i].zUuid, zUuid)==0 ) return 1;
+  }
+  return 0;
+}
+
+/*
+** Compress the content of one queued artifact.  This runs on a worker
+** thread.
+*/
+static void content_batch_compress(void *pArg){
+  struct batchEntry *p = (struct batchEntry*)pArg;
+  blob_compress(&p->content, &p->cmpr);
+}
+
+/*
+** Insert the new artifacts listed in contentBatch.aPending[], whose
+** record IDs have already been chosen.
+*/
+static void content_batch_insert(void){
+  Blob sql, priv, uncl, delta;
+  Stmt q;
+  int i;
+  if( contentBatch.nPending==0 ) return;
+  content_need_rcvid();
+  blob_zero(&sql);
+  blob_zero(&priv);
+  blob_zero(&uncl);
+  blob_zero(&delta);
+  for(i=0; i<contentBatch.nPending; i++){
+    struct batchEntry *p = &contentBatch.a[contentBatch.aPending[i]];
+    blob_appendf(&sql, "%s(%d,%d,%d,'%s',:c%d)", i ? "," : "",
+                 p->rid, g.rcvid, p->size, p->zUuid, i);
+    if( g.markPrivate || p->isPrivate ){
+      blob_appendf(&priv, "%s(%d)", blob_size(&priv) ? "," : "", p->rid);
+    }else{
+      blob_appendf(&uncl, "%s(%d)", blob_size(&uncl) ? "," : "", p->rid);
+    }
+    if( p->srcid ){
+      blob_appendf(&delta, "%s(%d,%d)", blob_size(&delta) ? "," : "",
+                   p->rid, p->srcid);
+    }
+  }
+  db_prepare(&q, "INSERT INTO blob(rid,rcvid,size,uuid,content) VALUES%s",
+             blob_str(&sql));
+  for(i=0; i<contentBatch.nPending; i++){
+    char zName[20];
+    sqlite3_snprintf(sizeof(zName), zName, ":c%d", i);
+    db_bind_blob(&q, zName, &contentBatch.a[contentBatch.aPending[i]].cmpr);
+  }
+  db_exec(&q);
+  db_finalize(&q);
+  if( blob_size(&priv) ){
+    db_multi_exec("INSERT INTO private VALUES%s", blob_str(&priv));
+  }
+  if( blob_size(&uncl) ){
+    db_multi_exec("INSERT OR IGNORE INTO unclustered VALUES%s",
+                  blob_str(&uncl));
+  }
+  if( blob_size(&delta) ){
+    db_multi_exec("REPLACE INTO delta(rid,srcid) VALUES%s", blob_str(&delta));
+  }
+  for(i=0; i<contentBatch.nPending; i++){
+    verify_before_commit(contentBatch.a[contentBatch.aPending[i]].rid);
+  }
+  blob_reset(&sql);
+  blob_reset(&priv);
+  blob_reset(&uncl);
+  blob_reset(&delta);
+  contentBatch.nPending = 0;
+}
+
+/*
+** Find the record ID of the artifact with hash zUuid in the repository
+** or among the artifacts a[0..n-1] of the batch that have already been
+** given one.  Return 0 if there is none.  *pSize is set to the size of
+** the artifact, which is -1 for a phantom.
+*/
+static int content_batch_find(const char *zUuid, int n, int *pSize){
+  static Stmt q;
+  int i;
+  int rid = 0;
+  for(i=0; i<n; i++){
+    struct batchEntry *p = &contentBatch.a[i];
+    if( p->rid && fossil_strcmp(p->zUuid, zUuid)==0 ){
+      *pSize = p->size;
+      return p->rid;
+    }
+  }
+  db_static_prepare(&q, "SELECT rid, size FROM blob WHERE uuid=:uuid");
+  db_bind_text(&q, ":uuid", zUuid);
+  if( db_step(&q)==SQLITE_ROW ){
+    rid = db_column_int(&q, 0);
+    *pSize = db_column_int(&q, 1);
+  }
+  db_reset(&q);
+  return rid;
+}
+
+/*
+** Write all queued artifacts into the database.
+*/
+void content_batch_flush(void){
+  int i, n;
+  int nextRid = 0;
+  int nHash = 0;
+  Blob *aIn, *aHash;
+  int *aiHash;
+
+  n = contentBatch.n;
+  if( n==0 ) return;
+
+  /* Compress the artifacts on the worker threads while checking the
+  ** hashes of those that need it here */
+  aIn = fossil_malloc( sizeof(Blob)*2*n + sizeof(int)*n );
+  aHash = &aIn[n];
+  aiHash = (int*)&aHash[n];
+  for(i=0; i<n; i++){
+    struct batchEntry *p = &contentBatch.a[i];
+    if( p->nBlob ){
+      blob_init(&p->cmpr, blob_buffer(&p->content), blob_size(&p->content));
+    }else if( contentBatch.pPool ){
+      threadpool_add(contentBatch.pPool, content_batch_compress, p);
+    }else{
+      content_batch_compress(p);
+    }
+    if( p->mFlags & CBATCH_VERIFY ){
+      aIn[nHash] = p->content;
+      aiHash[nHash++] = i;
+    }
+  }
+  if( nHash>0 ){
+    sha1sum_blobs(nHash, aIn, aHash);
+    for(i=0; i<nHash; i++){
+      struct batchEntry *p = &contentBatch.a[aiHash[i]];
+      if( fossil_strcmp(p->zUuid, blob_str(&aHash[i]))!=0 ){
+        p->isBad = 1;
+        sqlite3_snprintf(sizeof(p->zUuid), p->zUuid, "%s",
+                         blob_str(&aHash[i]));
+      }
+      blob_reset(&aHash[i]);
+    }
+  }
+  fossil_free(aIn);
+  if( contentBatch.pPool ) threadpool_wait(contentBatch.pPool);
+
+  /* Give each new artifact the record ID that SQLite would choose, so
+  ** that they can be inserted together.  Anything else that might add
+  ** a record first writes the artifacts already given an ID. */
+  db_begin_transaction();
+  for(i=0; i<n; i++){
+    struct batchEntry *p = &contentBatch.a[i];
+    int size = 0;
+    int rid = content_batch_find(p->zUuid, i, &size);
+    if( rid && size>=0 ){
+      p->rid = rid;
+      continue;
+    }
+    if( p->zSrc[0] ){
+      int srcSize;
+      p->srcid = content_batch_find(p->zSrc, i, &srcSize);
+      if( p->srcid==0 ){
+        content_batch_insert();
+        nextRid = 0;
+        p->srcid = content_new(p->zSrc, p->isPrivate);
+      }
+    }
+    if( rid ){
+      content_batch_insert();
+      nextRid = 0;
+      p->rid = content_put_ex(&p->content, p->zUuid, p->srcid, p->nBlob,
+                              p->isPrivate);
+      continue;
+    }
+    if( nextRid==0 ){
+      nextRid = db_int(0, "SELECT max(rid) FROM blob") + 1;
+    }
+    p->rid = nextRid++;
+    contentBatch.aPending[contentBatch.nPending++] = i;
+  }
+  content_batch_insert();
+
+  /* Finish each artifact in the order it arrived */
+  for(i=0; i<n; i++){
+    struct batchEntry *p = &contentBatch.a[i];
+    if( p->mFlags & CBATCH_PUBLIC ) content_make_public(p->rid);
+    if( p->mFlags & CBATCH_CROSSLINK ){
+      manifest_crosslink(p->rid, &p->content, MC_NONE);
+    }
+    if( contentBatch.xStored ){
+      contentBatch.xStored(contentBatch.pArg, p->rid, p->isBad);
+    }
+    blob_reset(&p->content);
+    blob_reset(&p->cmpr);
+  }
+  contentBatch.n = 0;
+  contentBatch.sz = 0;
+  db_end_transaction(0);
+}
+
+/*
+** Write any queued artifacts and stop queuing them.
+*/
+void content_batch_end(void){
+  if( !contentBatch.isActive ) return;
+  content_batch_flush();
+  if( contentBatch.pPool ) threadpool_free(contentBatch.pPool);
+  memset(&contentBatch, 0, sizeof(contentBatch));
+}
+
 /*
 ** COMMAND:  test-content-put
 **
@@ -742,6 +1257,7 @@ void content_make_public(int rid){
   );
   db_bind_int(&s1, ":rid", rid);
   db_exec(&s1);
+  if( db_changes()>0 ) clone_pack_invalidate();
 }
 
 /*
@@ -839,6 +1355,11 @@ static int looks_like_control_artifact(Blob *p){
   return 1;
 }
 
+/*
+** Number of artifacts that test-integrity hashes at once
+*/
+#define INTEGRITY_BATCH 16
+
 /*
 ** COMMAND: test-integrity ?OPTIONS?
 **
@@ -853,8 +1374,13 @@ static int looks_like_control_artifact(Blob *p){
 */
 void test_integrity(void){
   Stmt q;
-  Blob content;
-  Blob cksum;
+  Blob aContent[INTEGRITY_BATCH];
+  Blob aCksum[INTEGRITY_BATCH];
+  int aRid[INTEGRITY_BATCH];
+  int aSize[INTEGRITY_BATCH];
+  char *azUuid[INTEGRITY_BATCH];
+  int nBatch = 0;
+  int isDone = 0;
   int n1 = 0;
   int n2 = 0;
   int nErr = 0;
@@ -886,62 +1412,85 @@ void test_integrity(void){
   }
   db_finalize(&q);
     
+  /* Artifacts are loaded INTEGRITY_BATCH at a time so that they can be
+  ** hashed together by sha1sum_blobs() */
   db_prepare(&q, "SELECT rid, uuid, size FROM blob ORDER BY rid");
   total = db_int(0, "SELECT max(rid) FROM blob");
-  while( db_step(&q)==SQLITE_ROW ){
-    int rid = db_column_int(&q, 0);
-    const char *zUuid = db_column_text(&q, 1);
-    int size = db_column_int(&q, 2);
-    n1++;
-    fossil_print("  %d/%d\r", n1, total);
-    fflush(stdout);
-    if( size<0 ){
-      fossil_print("skip phantom %d %s\n", rid, zUuid);
-      continue;  /* Ignore phantoms */
-    }
-    content_get(rid, &content);
-    if( blob_size(&content)!=size ){
-      fossil_print("size mismatch on artifact %d: wanted %d but got %d\n",
-                     rid, size, blob_size(&content));
-      nErr++;
-    }
-    sha1sum_blob(&content, &cksum);
-    if( fossil_strcmp(blob_str(&cksum), zUuid)!=0 ){
-      fossil_print("checksum mismatch on artifact %d: wanted %s but got %s\n",
-                   rid, zUuid, blob_str(&cksum));
-      nErr++;
+  while( !isDone ){
+    int k;
+    if( db_step(&q)==SQLITE_ROW ){
+      aRid[nBatch] = db_column_int(&q, 0);
+      azUuid[nBatch] = fossil_strdup(db_column_text(&q, 1));
+      aSize[nBatch] = db_column_int(&q, 2);
+      if( aSize[nBatch]<0 ){
+        blob_zero(&aContent[nBatch]);
+      }else{
+        content_get(aRid[nBatch], &aContent[nBatch]);
+      }
+      if( ++nBatch<INTEGRITY_BATCH ) continue;
+    }else{
+      isDone = 1;
     }
-    if( bParse && looks_like_control_artifact(&content) ){
-      Blob err;
-      int i, n;
-      char *z;
-      Manifest *p;
-      char zFirstLine[400];
-      blob_zero(&err);
-
-      z = blob_buffer(&content);
-      n = blob_size(&content);
-      for(i=0; i<n && z[i] && z[i]!='\n' && i<sizeof(zFirstLine)-1; i++){}
-      memcpy(zFirstLine, z, i);
-      zFirstLine[i] = 0;
-      p = manifest_parse(&content, 0, &err);
-      if( p==0 ){
-        fossil_print("manifest_parse failed for %s:\n%s\n",
-               blob_str(&cksum), blob_str(&err));
-        if( strncmp(blob_str(&err), "line 1:", 7)==0 ){
-          fossil_print("\"%s\"\n", zFirstLine);
+    sha1sum_blobs(nBatch, aContent, aCksum);
+    for(k=0; k<nBatch; k++){
+      int rid = aRid[k];
+      const char *zUuid = azUuid[k];
+      int size = aSize[k];
+      Blob *pContent = &aContent[k];
+      Blob *pCksum = &aCksum[k];
+      n1++;
+      fossil_print("  %d/%d\r", n1, total);
+      fflush(stdout);
+      if( size<0 ){
+        fossil_print("skip phantom %d %s\n", rid, zUuid);
+        blob_reset(pCksum);
+        fossil_free(azUuid[k]);
+        continue;  /* Ignore phantoms */
+      }
+      if( blob_size(pContent)!=size ){
+        fossil_print("size mismatch on artifact %d: wanted %d but got %d\n",
+                       rid, size, blob_size(pContent));
+        nErr++;
+      }
+      if( fossil_strcmp(blob_str(pCksum), zUuid)!=0 ){
+        fossil_print("checksum mismatch on artifact %d: "
+                     "wanted %s but got %s\n", rid, zUuid, blob_str(pCksum));
+        nErr++;
+      }
+      if( bParse && looks_like_control_artifact(pContent) ){
+        Blob err;
+        int i, n;
+        char *z;
+        Manifest *p;
+        char zFirstLine[400];
+        blob_zero(&err);
+
+        z = blob_buffer(pContent);
+        n = blob_size(pContent);
+        for(i=0; i<n && z[i] && z[i]!='\n' && i<sizeof(zFirstLine)-1; i++){}
+        memcpy(zFirstLine, z, i);
+        zFirstLine[i] = 0;
+        p = manifest_parse(pContent, 0, &err);
+        if( p==0 ){
+          fossil_print("manifest_parse failed for %s:\n%s\n",
+                 blob_str(pCksum), blob_str(&err));
+          if( strncmp(blob_str(&err), "line 1:", 7)==0 ){
+            fossil_print("\"%s\"\n", zFirstLine);
+          }
+        }else{
+          anCA[p->type]++;
+          manifest_destroy(p);
+          nCA++;
         }
+        blob_reset(&err);
       }else{
-        anCA[p->type]++;
-        manifest_destroy(p);
-        nCA++;
+        blob_reset(pContent);
       }
-      blob_reset(&err);
-    }else{
-      blob_reset(&content);
+      blob_reset(pCksum);
+      fossil_free(azUuid[k]);
+      n2++;
     }
-    blob_reset(&cksum);
-    n2++;
+    nBatch = 0;
   }
   db_finalize(&q);
   fossil_print("%d non-phantom blobs (out of %d total) checked:  %d errors\n",
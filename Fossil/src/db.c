@@ -184,6 +184,27 @@ void db_end_transaction(int rollbackFlag){
   }
 }
 
+/*
+** Commit everything done so far by the pending transaction and begin
+** a new one at the same nesting depth.  A long-running operation can
+** use this to save its progress without unwinding its callers.
+*/
+void db_commit_and_continue(void){
+  int n = db.nBegin;
+  if( n<=0 ) return;
+  db.nBegin = 1;
+  db_end_transaction(0);
+  while( n-- > 0 ) db_begin_transaction();
+}
+
+/*
+** Return the nesting depth of the current transaction, or 0 if no
+** transaction is pending.
+*/
+int db_transaction_nesting_depth(void){
+  return db.nBegin;
+}
+
 /*
 ** Force a rollback and shutdown the database
 */
@@ -1200,6 +1221,13 @@ void db_close(int reportErrors){
     sqlite3_status(SQLITE_STATUS_PAGECACHE_OVERFLOW, &cur, &hiwtr, 0);
     fprintf(stderr, "-- PCACHE_OVFLOW          %10d %10d\n", cur, hiwtr);
     fprintf(stderr, "-- prepared statements    %10d\n", db.nPrepare);
+    if( g.repositoryOpen ){
+      Blob x;
+      blob_zero(&x);
+      content_cache_stats(&x);
+      fprintf(stderr, "-- content cache: %s\n", blob_str(&x));
+      blob_reset(&x);
+    }
   }
   while( db.pAllStmt ){
     db_finalize(db.pAllStmt);
@@ -1208,7 +1236,15 @@ void db_close(int reportErrors){
   pStmt = 0;
   if( reportErrors ){
     while( (pStmt = sqlite3_next_stmt(g.db, pStmt))!=0 ){
-      fossil_warning("unfinalized SQL statement: [%s]", sqlite3_sql(pStmt));
+      const char *zSql = sqlite3_sql(pStmt);
+      /* The FTS module keeps statements against the shadow tables of the
+      ** full-text index until sqlite3_close().  Those are not leaks. */
+      if( sqlite3_strglob("*'ftsidx_*", zSql)==0
+       || sqlite3_strglob("PRAGMA *data_version", zSql)==0
+      ){
+        continue;
+      }
+      fossil_warning("unfinalized SQL statement: [%s]", zSql);
     }
   }
   g.repositoryOpen = 0;
@@ -2109,6 +2145,7 @@ struct stControlSettings {
 struct stControlSettings const ctrlSettings[] = {
   { "access-log",    0,                0, 0, "off"                 },
   { "allow-symlinks",0,                0, 1, "off"                 },
+  { "archive-cache-size",0,           10, 0, "0"                   },
   { "auto-captcha",  "autocaptcha",    0, 0, "on"                  },
   { "auto-hyperlink",0,                0, 0, "on",                 },
   { "auto-shun",     0,                0, 0, "on"                  },
@@ -2121,10 +2158,14 @@ struct stControlSettings const ctrlSettings[] = {
   { "case-sensitive",0,                0, 0, "on"                  },
 #endif
   { "clean-glob",    0,               40, 1, ""                    },
+  { "clone-pack",    0,                0, 0, "off"                 },
+  { "content-cache-size", 0,          10, 0, "50"                  },
   { "crnl-glob",     0,               40, 1, ""                    },
   { "default-perms", 0,               16, 0, "u"                   },
   { "diff-binary",   0,                0, 0, "on"                  },
   { "diff-command",  0,               40, 0, ""                    },
+  { "diff-limit",    0,               10, 0, "100"                 },
+  { "diff-page-limit",0,              10, 0, "500"                 },
   { "dont-push",     0,                0, 0, "off"                 },
   { "editor",        0,               32, 0, ""                    },
   { "empty-dirs",    0,               40, 1, ""                    },
@@ -2144,6 +2185,7 @@ struct stControlSettings const ctrlSettings[] = {
   { "proxy",         0,               32, 0, "off"                 },
   { "relative-paths",0,                0, 0, "on"                  },
   { "repo-cksum",    0,                0, 0, "on"                  },
+  { "search-doc-glob",0,              40, 0, ""                    },
   { "self-register", 0,                0, 0, "off"                 },
   { "ssh-command",   0,               40, 0, ""                    },
   { "ssl-ca-location",0,              40, 0, ""                    },
@@ -2154,6 +2196,7 @@ struct stControlSettings const ctrlSettings[] = {
 #endif
   { "th1-setup",     0,               40, 0, ""                    },
   { "th1-uri-regexp",0,               40, 0, ""                    },
+  { "threads",       0,                5, 0, "1"                   },
   { "web-browser",   0,               32, 0, ""                    },
   { "white-foreground", 0,             0, 0, "off"                 },
   { 0,0,0,0,0 }
@@ -2186,6 +2229,12 @@ struct stControlSettings const ctrlSettings[] = {
 **                     plain-text files with link destination path inside).
 **                     Default: off
 **
+**    archive-cache-size  Keep up to this many megabytes of the ZIP archives
+**                     and tarballs made by the /zip and /tarball pages in
+**                     a cache file next to the repository, and send them
+**                     again from there when they are requested again.
+**                     Zero turns the cache off.  Default: 0
+**
 **    auto-captcha     If enabled, the Login page provides a button to
 **                     fill in the captcha password.  Default: on
 **
@@ -2222,6 +2271,21 @@ struct stControlSettings const ctrlSettings[] = {
 **                     with gpg.  When disabled (the default), commits will
 **                     be unsigned.  Default: off
 **
+**    clone-pack       If enabled, a server sends new clones the artifacts
+**                     they need straight from a file kept beside the
+**                     repository, rather than reading them from the
+**                     repository one at a time.  The file is extended as
+**                     clones are made, or by the "clone-pack" command.
+**                     Default: off
+**
+**    content-cache-size
+**                     The maximum amount of memory, in megabytes, used to
+**                     cache reconstructed artifacts while walking delta
+**                     chains.  Larger values speed up rebuild, annotate and
+**                     similar operations on large repositories.  The
+**                     --sqlstats option shows how well the cache did for
+**                     any one command.  Default: 50
+**
 **    crnl-glob        A comma or newline-separated list of GLOB patterns for
 **     (versionable)   text files in which it is ok to have CR, CR+NL or mixed
 **                     line endings. Set to "*" to disable CR+NL checking.
@@ -2237,6 +2301,17 @@ struct stControlSettings const ctrlSettings[] = {
 **    diff-command     External command to run when performing a diff.
 **                     If undefined, the internal text diff will be used.
 **
+**    diff-limit       The most work, in millions of lines examined, that
+**                     the internal text diff may do to find the lines two
+**                     versions of a file have in common.  Lines not yet
+**                     matched when the limit is reached are shown as
+**                     changed, and the diff is marked as approximate.
+**                     0 means no limit.  Default: 100
+**
+**    diff-page-limit  Like diff-limit, but for all of the diffs shown on
+**                     one web page, such as /vdiff or /info.  0 means no
+**                     limit.  Default: 500
+**
 **    dont-push        Prevent this repository from pushing from client to
 **                     server.  Useful when setting up a private branch.
 **
@@ -2310,6 +2385,11 @@ struct stControlSettings const ctrlSettings[] = {
 **                     Disable on large repositories for a performance
 **                     improvement.
 **
+**    search-doc-glob  The VALUE is a comma or newline-separated list of GLOB
+**                     patterns naming files on the tip of trunk whose text
+**                     is added to the full-text index built by
+**                     "fossil fts-config rebuild".  Default: none
+**
 **    self-register    Allow users to register themselves through the HTTP UI.
 **                     This is useful if you want to see other names than
 **                     "Anonymous" in e.g. ticketing system. On the other hand
@@ -2355,6 +2435,14 @@ struct stControlSettings const ctrlSettings[] = {
 **                     TH1 scripts.  If empty, no HTTP requests are allowed
 **                     whatsoever.  The default is an empty string.
 **
+**    threads          The number of worker threads used by operations that
+**                     can run in parallel, such as "rebuild", scanning
+**                     the check-out for "status" and "changes",
+**                     compressing ZIP and tarball downloads, and diffs of
+**                     many files by "diff", /vdiff and /info.  0 means
+**                     one per CPU.  Ignored when Fossil is built without
+**                     thread support.  Default: 1
+**
 **    web-browser      A shell command used to launch your preferred
 **                     web browser when given a URL as an argument.
 **                     Defaults to "start" on windows, "open" on Mac,
@@ -28,6 +28,9 @@
 #include <stdlib.h>
 #include <string.h>
 #include "delta.h"
+#if defined(__GNUC__) && defined(__SSE2__)
+# include <emmintrin.h>
+#endif
 
 /*
 ** Macros for turning debugging printfs on and off
@@ -81,22 +84,18 @@ typedef unsigned short int u16;
 #define NHASH 16
 
 /*
-** The current state of the rolling hash.
+** The current state of the rolling hash over a window z[0..NHASH-1].
 **
-** z[] holds the values that have been hashed.  z[] is a circular buffer.
-** z[i] is the first entry and z[(i+NHASH-1)%NHASH] is the last entry of 
-** the window.
+** Hash.a is the sum of all elements of z[].  Hash.b is a weighted
+** sum.  Hash.b is z[0]*NHASH + z[1]*(NHASH-1) + ... + z[NHASH-1]*1.
 **
-** Hash.a is the sum of all elements of hash.z[].  Hash.b is a weighted
-** sum.  Hash.b is z[i]*NHASH + z[i+1]*(NHASH-1) + ... + z[i+NHASH-1]*1.
-** (Each index for z[] should be module NHASH, of course.  The %NHASH operator
-** is omitted in the prior expression for brevity.)
+** The window itself is not stored in the hash.  The caller always has
+** the text being hashed at hand and passes the character that leaves
+** the window to hash_next() along with the character that enters it.
 */
 typedef struct hash hash;
 struct hash {
   u16 a, b;         /* Hash values */
-  u16 i;            /* Start of the hash window */
-  char z[NHASH];    /* The values that have been hashed */
 };
 
 /*
@@ -108,20 +107,16 @@ static void hash_init(hash *pHash, const char *z){
   for(i=0; i<NHASH; i++){
     a += z[i];
     b += (NHASH-i)*z[i];
-    pHash->z[i] = z[i];
   }
   pHash->a = a & 0xffff;
   pHash->b = b & 0xffff;
-  pHash->i = 0;
 }
 
 /*
-** Advance the rolling hash by a single character "c"
+** Advance the rolling hash by a single character.  Character "old" drops
+** off the front of the window and "c" is added to the end.
 */
-static void hash_next(hash *pHash, int c){
-  u16 old = pHash->z[pHash->i];
-  pHash->z[pHash->i] = c;
-  pHash->i = (pHash->i+1)&(NHASH-1);
+static void hash_next(hash *pHash, int old, int c){
   pHash->a = pHash->a - old + c;
   pHash->b = pHash->b - NHASH*old + pHash->a;
 }
@@ -193,6 +188,68 @@ static int digit_count(int v){
   return i;
 }
 
+/*
+** Return the number of leading bytes that are the same in zA[] and zB[],
+** examining at most N bytes.
+**
+** Matching sections are often long, so compare 16 bytes at a time using
+** SSE2 where available, or 8 bytes at a time on other little-endian
+** machines, before finishing off one byte at a time.
+*/
+static int match_forward(const char *zA, const char *zB, int N){
+  int i = 0;
+#if defined(__GNUC__) && defined(__SSE2__)
+  while( i+16<=N ){
+    __m128i a = _mm_loadu_si128((const __m128i*)&zA[i]);
+    __m128i b = _mm_loadu_si128((const __m128i*)&zB[i]);
+    unsigned m = _mm_movemask_epi8(_mm_cmpeq_epi8(a, b)) ^ 0xffff;
+    if( m ) return i + __builtin_ctz(m);
+    i += 16;
+  }
+#elif defined(__GNUC__) && defined(__BYTE_ORDER__) \
+      && __BYTE_ORDER__==__ORDER_LITTLE_ENDIAN__
+  while( i+8<=N ){
+    unsigned long long a, b;
+    memcpy(&a, &zA[i], 8);
+    memcpy(&b, &zB[i], 8);
+    if( a!=b ) return i + __builtin_ctzll(a^b)/8;
+    i += 8;
+  }
+#endif
+  while( i<N && zA[i]==zB[i] ) i++;
+  return i;
+}
+
+/*
+** Return the number of bytes immediately before zA[0] and zB[0] that are
+** the same in both buffers, examining at most N bytes.  In other words,
+** count how many of zA[-1]==zB[-1], zA[-2]==zB[-2], ... hold before the
+** first difference.
+*/
+static int match_backward(const char *zA, const char *zB, int N){
+  int i = 0;
+#if defined(__GNUC__) && defined(__SSE2__)
+  while( i+16<=N ){
+    __m128i a = _mm_loadu_si128((const __m128i*)&zA[-i-16]);
+    __m128i b = _mm_loadu_si128((const __m128i*)&zB[-i-16]);
+    unsigned m = _mm_movemask_epi8(_mm_cmpeq_epi8(a, b)) ^ 0xffff;
+    if( m ) return i + __builtin_clz(m) - 16;
+    i += 16;
+  }
+#elif defined(__GNUC__) && defined(__BYTE_ORDER__) \
+      && __BYTE_ORDER__==__ORDER_LITTLE_ENDIAN__
+  while( i+8<=N ){
+    unsigned long long a, b;
+    memcpy(&a, &zA[-i-8], 8);
+    memcpy(&b, &zB[-i-8], 8);
+    if( a!=b ) return i + __builtin_clzll(a^b)/8;
+    i += 8;
+  }
+#endif
+  while( i<N && zA[-i-1]==zB[-i-1] ) i++;
+  return i;
+}
+
 /*
 ** Compute a 32-bit checksum on the N-byte buffer.  Return the result.
 */
@@ -373,23 +430,22 @@ int delta_create(
         ** copy command is less than the amount of literal text to be copied.
         */
         int cnt, ofst, litsz;
-        int j, k, x, y;
+        int j, k, mx;
         int sz;
 
         /* Beginning at iSrc, match forwards as far as we can.  j counts
-        ** the number of characters that match */
+        ** the number of characters that match, less one */
         iSrc = iBlock*NHASH;
-        for(j=0, x=iSrc, y=base+i; x<lenSrc && y<lenOut; j++, x++, y++){
-          if( zSrc[x]!=zOut[y] ) break;
-        }
-        j--;
+        mx = lenSrc-iSrc;
+        if( mx>lenOut-(base+i) ) mx = lenOut-(base+i);
+        j = match_forward(&zSrc[iSrc], &zOut[base+i], mx) - 1;
 
         /* Beginning at iSrc-1, match backwards as far as we can.  k counts
-        ** the number of characters that match */
-        for(k=1; k<iSrc && k<=i; k++){
-          if( zSrc[iSrc-k]!=zOut[base+i-k] ) break;
-        }
-        k--;
+        ** the number of characters that match.  The first character of
+        ** zSrc is never included. */
+        mx = iSrc-1;
+        if( mx>i ) mx = i;
+        k = mx>0 ? match_backward(&zSrc[iSrc], &zOut[base+i], mx) : 0;
 
         /* Compute the offset and size of the matching region */
         ofst = iSrc-k;
@@ -453,7 +509,7 @@ int delta_create(
       }
 
       /* Advance the hash by one character.  Keep looking for a match */
-      hash_next(&h, zOut[base+i+NHASH]);
+      hash_next(&h, zOut[base+i], zOut[base+i+NHASH]);
       i++;
     }
   }
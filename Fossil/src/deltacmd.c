@@ -150,3 +150,204 @@ void cmd_test_delta(void){
   }
   fossil_print("ok\n");
 }
+
+/*
+** Make pTarget a lightly edited copy of pSrc.  Roughly one edit is
+** made per 1000 bytes.  Each edit replaces, inserts or deletes a few
+** bytes.  *pX is the state of a simple pseudo-random number generator.
+*/
+void delta_bench_mutate(Blob *pSrc, Blob *pTarget, unsigned *pX){
+  const char *z = blob_buffer(pSrc);
+  int n = blob_size(pSrc);
+  int i = 0;
+  blob_zero(pTarget);
+  while( i<n ){
+    int nCopy, nEdit;
+    *pX = *pX*1103515245 + 12345;
+    nCopy = (*pX>>8)%2000;
+    if( nCopy>n-i ) nCopy = n-i;
+    blob_append(pTarget, &z[i], nCopy);
+    i += nCopy;
+    nEdit = 1 + (*pX>>4)%8;
+    switch( *pX%3 ){
+      case 0:  i += nEdit;            /* Delete */
+               break;
+      case 1:  blob_append(pTarget, "0123456789", nEdit);  /* Insert */
+               break;
+      default: blob_append(pTarget, "abcdefghij", nEdit);  /* Replace */
+               i += nEdit;
+               break;
+    }
+  }
+}
+
+/*
+** Create and apply deltas from aSrc[i] to aTarget[i] for 0<=i<nPair,
+** nIter times over, and report the throughput relative to the total
+** size of the targets.
+*/
+static void delta_bench_run(
+  const char *zLabel,     /* Label for this line of output */
+  Blob *aSrc,             /* Sources */
+  Blob *aTarget,          /* Targets */
+  int nPair,              /* Number of entries in aSrc[] and aTarget[] */
+  int nIter               /* Number of times to repeat */
+){
+  int i, j;
+  int iTimer;
+  i64 nByte = 0;
+  i64 nDelta = 0;
+  sqlite3_uint64 tmCreate, tmApply;
+  Blob *aDelta;
+
+  if( nPair==0 ) return;
+  aDelta = fossil_malloc( sizeof(Blob)*nPair );
+  for(i=0; i<nPair; i++){
+    nByte += blob_size(&aTarget[i]);
+    blob_zero(&aDelta[i]);
+  }
+  iTimer = fossil_timer_start();
+  for(j=0; j<nIter; j++){
+    for(i=0; i<nPair; i++){
+      blob_reset(&aDelta[i]);
+      blob_delta_create(&aSrc[i], &aTarget[i], &aDelta[i]);
+    }
+  }
+  tmCreate = fossil_timer_reset(iTimer);
+  for(j=0; j<nIter; j++){
+    for(i=0; i<nPair; i++){
+      Blob out;
+      if( blob_delta_apply(&aSrc[i], &aDelta[i], &out)<0
+       || blob_compare(&out, &aTarget[i]) ){
+        fossil_fatal("%s: delta %d does not reproduce its target",
+                     zLabel, i);
+      }
+      blob_reset(&out);
+    }
+  }
+  tmApply = fossil_timer_stop(iTimer);
+  for(i=0; i<nPair; i++){
+    nDelta += blob_size(&aDelta[i]);
+    blob_reset(&aDelta[i]);
+  }
+  fossil_free(aDelta);
+  if( tmCreate==0 ) tmCreate = 1;
+  if( tmApply==0 ) tmApply = 1;
+  fossil_print("%-10s %6d %12lld  %9.1f MB/s  %9.1f MB/s  %6.2f%%\n",
+     zLabel, nPair, nByte,
+     (double)nByte*nIter/(double)tmCreate,
+     (double)nByte*nIter/(double)tmApply,
+     100.0*(double)nDelta/(double)nByte);
+}
+
+/*
+** COMMAND:  test-delta-bench
+**
+** Usage: %fossil test-delta-bench ?OPTIONS? ?FILE1 FILE2 ...?
+**
+** Measure the speed of the delta encoder and decoder.  Throughput is
+** reported in megabytes of target per second of CPU time, along with
+** the size of the deltas as a percentage of the size of the targets.
+**
+** Deltas are computed for synthetic text and binary content, for each
+** consecutive pair of files named on the command-line, and, when run
+** from within a repository, for artifacts that are stored as deltas in
+** that repository.
+**
+** Options:
+**    --size N         Size of each synthetic input.  Default: 1000000
+**    --iterations N   Repeat each measurement N times.  Default: 5
+**    --limit N        Use at most N deltas from the repository. Default: 200
+*/
+void delta_bench_cmd(void){
+  const char *zSize = find_option("size",0,1);
+  const char *zIter = find_option("iterations",0,1);
+  const char *zLimit = find_option("limit","n",1);
+  int sz = zSize ? atoi(zSize) : 1000000;
+  int nIter = zIter ? atoi(zIter) : 5;
+  int nLimit = zLimit ? atoi(zLimit) : 200;
+  unsigned x = 1;
+  int i, n;
+  Blob *aSrc, *aTarget;
+  Blob src, target;
+
+  db_find_and_open_repository(OPEN_ANY_SCHEMA | OPEN_OK_NOT_FOUND, 0);
+  verify_all_options();
+  if( nIter<1 ) nIter = 1;
+  fossil_print("%-10s %6s %12s  %14s  %14s  %7s\n",
+               "input", "pairs", "bytes", "create", "apply", "delta");
+
+  /* Synthetic text: random words and line breaks */
+  blob_zero(&src);
+  while( blob_size(&src)<sz ){
+    x = x*1103515245 + 12345;
+    blob_append(&src, &"abcdefghijklmnopqrstuvwxyz"[(x>>8)%20],
+                1+(x>>4)%6);
+    blob_append(&src, (x>>16)%8==0 ? "\n" : " ", 1);
+  }
+  delta_bench_mutate(&src, &target, &x);
+  delta_bench_run("text", &src, &target, 1, nIter);
+  blob_reset(&src);
+  blob_reset(&target);
+
+  /* Synthetic binary: uniformly random bytes */
+  blob_zero(&src);
+  while( blob_size(&src)<sz ){
+    char c;
+    x = x*1103515245 + 12345;
+    c = (char)(x>>16);
+    blob_append(&src, &c, 1);
+  }
+  delta_bench_mutate(&src, &target, &x);
+  delta_bench_run("binary", &src, &target, 1, nIter);
+  blob_reset(&src);
+  blob_reset(&target);
+
+  /* Files named on the command-line */
+  if( g.argc>=4 ){
+    n = g.argc-3;
+    aSrc = fossil_malloc( sizeof(Blob)*n*2 );
+    aTarget = &aSrc[n];
+    for(i=0; i<n; i++){
+      if( blob_read_from_file(&aSrc[i], g.argv[i+2])<0 ){
+        fossil_fatal("cannot read %s", g.argv[i+2]);
+      }
+      if( blob_read_from_file(&aTarget[i], g.argv[i+3])<0 ){
+        fossil_fatal("cannot read %s", g.argv[i+3]);
+      }
+    }
+    delta_bench_run("files", aSrc, aTarget, n, nIter);
+    for(i=0; i<n; i++){
+      blob_reset(&aSrc[i]);
+      blob_reset(&aTarget[i]);
+    }
+    fossil_free(aSrc);
+  }
+
+  /* Deltas stored in the repository */
+  if( g.repositoryOpen && nLimit>0 ){
+    Stmt q;
+    aSrc = fossil_malloc( sizeof(Blob)*nLimit*2 );
+    aTarget = &aSrc[nLimit];
+    n = 0;
+    db_prepare(&q, "SELECT srcid, rid FROM delta ORDER BY rid DESC");
+    while( n<nLimit && db_step(&q)==SQLITE_ROW ){
+      blob_zero(&aSrc[n]);
+      blob_zero(&aTarget[n]);
+      if( content_get(db_column_int(&q, 0), &aSrc[n])
+       && content_get(db_column_int(&q, 1), &aTarget[n]) ){
+        n++;
+      }else{
+        blob_reset(&aSrc[n]);
+        blob_reset(&aTarget[n]);
+      }
+    }
+    db_finalize(&q);
+    delta_bench_run("repository", aSrc, aTarget, n, nIter);
+    for(i=0; i<n; i++){
+      blob_reset(&aSrc[i]);
+      blob_reset(&aTarget[i]);
+    }
+    fossil_free(aSrc);
+  }
+}
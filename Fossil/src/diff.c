@@ -21,6 +21,11 @@
 #include "config.h"
 #include "diff.h"
 #include <assert.h>
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP>=2)
+# include <emmintrin.h>
+# define DIFF_USE_SSE2 1
+#endif
 
 
 #if INTERFACE
@@ -42,6 +47,7 @@
 #define DIFF_INVERT       (((u64)0x02)<<32) /* Invert the diff (debug) */
 #define DIFF_CONTEXT_EX   (((u64)0x04)<<32) /* Use context even if zero */
 #define DIFF_NOTTOOBIG    (((u64)0x08)<<32) /* Only display if not too big */
+#define DIFF_HISTOGRAM    (((u64)0x10)<<32) /* Use the histogram algorithm */
 
 /*
 ** These error messages are shared in multiple locations.  They are defined
@@ -56,6 +62,9 @@
 #define DIFF_TOO_MANY_CHANGES \
     "more than 10,000 changes\n"
 
+#define DIFF_APPROXIMATE \
+    "approximate diff: some unchanged lines may be shown as changed\n"
+
 /*
 ** Maximum length of a line in a text file, in bytes.  (2**13 = 8192 bytes)
 */
@@ -110,8 +119,80 @@ struct DContext {
   int nFrom;         /* Number of lines in aFrom[] */
   DLine *aTo;        /* File on right side of the diff */
   int nTo;           /* Number of lines in aTo[] */
+  int useHistogram;  /* True to use the histogram algorithm */
+  i64 nCost;         /* Work done so far, in lines examined */
+  i64 mxCost;        /* Most work allowed, or -1 for no limit */
+  int isApprox;      /* True if mxCost was reached */
 };
 
+/*
+** Charge n lines examined to the budget of p.  Return true if the budget
+** is exhausted, in which case the caller should stop looking for lines
+** in common and show the rest of its range as deleted and inserted.
+** The result is a coarser diff, which is still correct.
+*/
+static int diff_over_budget(DContext *p, int n){
+  p->nCost += n;
+  if( p->mxCost>=0 && p->nCost>p->mxCost ){
+    p->isApprox = 1;
+    return 1;
+  }
+  return 0;
+}
+
+/*
+** Return the offset of the first newline or NUL character in z[i..n-1],
+** or n if there is neither.  Where SSE2 is available, 16 bytes are
+** checked at a time.
+*/
+static int find_line_end(const char *z, int i, int n){
+#ifdef DIFF_USE_SSE2
+  const __m128i nl = _mm_set1_epi8('\n');
+  const __m128i nul = _mm_setzero_si128();
+  while( i+16<=n ){
+    __m128i v = _mm_loadu_si128((const __m128i*)&z[i]);
+    __m128i m = _mm_or_si128(_mm_cmpeq_epi8(v, nl), _mm_cmpeq_epi8(v, nul));
+    if( _mm_movemask_epi8(m) ) break;
+    i += 16;
+  }
+#endif
+  while( i<n && z[i]!='\n' && z[i]!=0 ){ i++; }
+  return i;
+}
+
+/*
+** Return a hash of the n bytes in z[].  This is the hash that Fossil has
+** always used:  h = h ^ (h<<2) ^ c for each byte c in turn.  The hash
+** decides which lines share a hash chain, and longestCommonSequence()
+** follows only a few links of each chain, so any other hash would give
+** different diffs of repetitive text.
+**
+** Each step multiplies h by 1+x^2 in GF(2)[x], and (1+x^2)^8 is 1+x^16,
+** so the bytes are taken eight at a time and combined as a tree instead
+** of one after another.
+*/
+#define HASH_M1(X)  ((X)^((X)<<2))   /* One step of the hash */
+#define HASH_M2(X)  ((X)^((X)<<4))   /* Two steps */
+#define HASH_M4(X)  ((X)^((X)<<8))   /* Four steps */
+static unsigned int hash_line(const char *z, int n){
+  unsigned int h = 0;
+  while( n>=8 ){
+    unsigned int p0 = HASH_M1((unsigned int)z[0]) ^ (unsigned int)z[1];
+    unsigned int p1 = HASH_M1((unsigned int)z[2]) ^ (unsigned int)z[3];
+    unsigned int p2 = HASH_M1((unsigned int)z[4]) ^ (unsigned int)z[5];
+    unsigned int p3 = HASH_M1((unsigned int)z[6]) ^ (unsigned int)z[7];
+    h = h ^ (h<<16) ^ HASH_M4(HASH_M2(p0) ^ p1) ^ HASH_M2(p2) ^ p3;
+    z += 8;
+    n -= 8;
+  }
+  while( n>0 ){
+    h = h ^ (h<<2) ^ z[0];
+    z++;
+    n--;
+  }
+  return h;
+}
+
 /*
 ** Return an array of DLine objects containing a pointer to the
 ** start of each line and a hash of that line.  The lower
@@ -125,53 +206,66 @@ struct DContext {
 ** too long.
 **
 ** Profiling show that in most cases this routine consumes the bulk of
-** the CPU time on a diff.
+** the CPU time on a diff.  So the ends of lines are found with
+** find_line_end(), which checks many bytes at once, and each line is
+** hashed eight bytes at a time.  The hash covers the character that follows
+** the line as well, so that a last line without a newline does not
+** match the same line with one.
 */
 static DLine *break_into_lines(const char *z, int n, int *pnLine, int ignoreWS){
-  int nLine, i, j, k, x;
+  int nLine, nAlloc, i, j, k;
   unsigned int h, h2;
   DLine *a;
 
-  /* Count the number of lines.  Allocate space to hold
-  ** the returned array.
+  if( n==0 ){
+    *pnLine = 0;
+    a = fossil_malloc( sizeof(a[0]) );
+    memset(a, 0, sizeof(a[0]));
+    return a;
+  }
+
+  /* Find the start and the length of each line.  The length is held
+  ** in a[].h until the hash is computed.  A newline that ends the
+  ** file does not begin another line.
   */
-  for(i=j=0, nLine=1; i<n; i++, j++){
-    int c = z[i];
-    if( c==0 ){
+  nAlloc = n/32 + 10;
+  a = fossil_malloc( nAlloc*sizeof(a[0]) );
+  for(i=nLine=0; ; nLine++){
+    int iEnd = find_line_end(z, i, n);
+    int nExtra;               /* Quirks of the original length check */
+    if( iEnd<n && z[iEnd]==0 ){
+      fossil_free(a);
       return 0;
     }
-    if( c=='\n' && z[i+1]!=0 ){
-      nLine++;
-      if( j>LENGTH_MASK ){
-        return 0;
-      }
-      j = 0;
+    nExtra = (nLine>0) + (iEnd==n-1);
+    if( iEnd-i+nExtra>LENGTH_MASK ){
+      fossil_free(a);
+      return 0;
     }
+    if( nLine>=nAlloc ){
+      nAlloc = nAlloc*2;
+      a = fossil_realloc(a, nAlloc*sizeof(a[0]));
+    }
+    a[nLine].z = &z[i];
+    a[nLine].h = iEnd-i;
+    a[nLine].iNext = a[nLine].iHash = 0;
+    if( iEnd>=n-1 ) break;
+    i = iEnd+1;
   }
-  if( j>LENGTH_MASK ){
-    return 0;
-  }
-  a = fossil_malloc( nLine*sizeof(a[0]) );
-  memset(a, 0, nLine*sizeof(a[0]) );
-  if( n==0 ){
-    *pnLine = 0;
-    return a;
-  }
+  nLine++;
 
-  /* Fill in the array */
+  /* Compute the hash of each line and link the lines into hash
+  ** chains.
+  */
   for(i=0; i<nLine; i++){
-    a[i].z = z;
-    for(j=0; z[j] && z[j]!='\n'; j++){}
+    const char *zLine = a[i].z;
+    j = a[i].h;
     k = j;
-    while( ignoreWS && k>0 && fossil_isspace(z[k-1]) ){ k--; }
-    for(h=0, x=0; x<=k; x++){
-      h = h ^ (h<<2) ^ z[x];
-    }
-    a[i].h = h = (h<<LENGTH_MASK_SZ) | k;;
+    while( ignoreWS && k>0 && fossil_isspace(zLine[k-1]) ){ k--; }
+    a[i].h = h = (hash_line(zLine, k+1)<<LENGTH_MASK_SZ) | k;
     h2 = h % nLine;
     a[i].iNext = a[h2].iHash;
     a[h2].iHash = i+1;
-    z += j+1;
   }
 
   /* Return results */
@@ -935,7 +1029,8 @@ static int match_dline(DLine *pA, DLine *pB){
 */
 static unsigned char *sbsAlignment(
    DLine *aLeft, int nLeft,       /* Text on the left */
-   DLine *aRight, int nRight      /* Text on the right */
+   DLine *aRight, int nRight,     /* Text on the right */
+   int bQuick                     /* Skip the search for similar lines */
 ){
   int i, j, k;                 /* Loop counters */
   int *a;                      /* One row of the Wagner matrix */
@@ -946,25 +1041,20 @@ static unsigned char *sbsAlignment(
   int mxLen;                   /* MAX(nLeft, nRight) */
   int aBuf[100];               /* Stack space for a[] if nRight not to big */
 
-  aM = fossil_malloc( (nLeft+1)*(nRight+1) );
-  if( nLeft==0 ){
-    memset(aM, 2, nRight);
-    return aM;
-  }
-  if( nRight==0 ){
-    memset(aM, 1, nLeft);
-    return aM;
-  }
+  if( nLeft==0 || nRight==0 ) bQuick = 1;
 
-  /* This algorithm is O(N**2).  So if N is too big, bail out with a
-  ** simple (but stupid and ugly) result that doesn't take too long. */
+  /* This algorithm is O(N**2).  So if N is too big, or if the caller
+  ** cannot afford it, bail out with a simple (but stupid and ugly)
+  ** result that doesn't take too long. */
   mnLen = nLeft<nRight ? nLeft : nRight;
-  if( nLeft*nRight>100000 ){
+  if( bQuick ){
+    aM = fossil_malloc( nLeft+nRight+1 );
     memset(aM, 4, mnLen);
     if( nLeft>mnLen )  memset(aM+mnLen, 1, nLeft-mnLen);
     if( nRight>mnLen ) memset(aM+mnLen, 2, nRight-mnLen);
     return aM;
   }
+  aM = fossil_malloc( (nLeft+1)*(nRight+1) );
 
   if( nRight < (sizeof(aBuf)/sizeof(aBuf[0]))-1 ){
     pToFree = 0;
@@ -1223,7 +1313,8 @@ static void sbsDiff(
         mb += R[r+i*3+2] + m;
       }
 
-      alignment = sbsAlignment(&A[a], ma, &B[b], mb);
+      alignment = sbsAlignment(&A[a], ma, &B[b], mb,
+           (i64)ma*mb>100000 || diff_over_budget(p, ma*mb));
       for(j=0; ma+mb>0; j++){
         if( alignment[j]==1 ){
           /* Delete one line from the left */
@@ -1456,7 +1547,7 @@ static void longestCommonSequence(
       iEYp = iEY;
     }
   }
-  if( iSXb==iEXb && (iE1-iS1)*(iE2-iS2)<400 ){
+  if( iSXb==iEXb && (i64)(iE1-iS1)*(iE2-iS2)<400 ){
     /* If no common sequence is found using the hashing heuristic and
     ** the input is not too big, use the expensive exact solution */
     optimalLCS(p, iS1, iE1, iS2, iE2, piSX, piEX, piSY, piEY);
@@ -1538,6 +1629,10 @@ static void diff_step(DContext *p, int iS1, int iE1, int iS2, int iE2){
   }
 
   /* Find the longest matching segment between the two sequences */
+  if( diff_over_budget(p, (iE1-iS1)+(iE2-iS2)) ){
+    appendTriple(p, 0, iE1-iS1, iE2-iS2);
+    return;
+  }
   longestCommonSequence(p, iS1, iE1, iS2, iE2, &iSX, &iEX, &iSY, &iEY);
 
   if( iEX>iSX ){
@@ -1555,6 +1650,172 @@ static void diff_step(DContext *p, int iS1, int iE1, int iS2, int iE2){
   }
 }
 
+/*
+** Lines that occur more often than this within the range being compared
+** are not used to anchor a match by the histogram algorithm, unless no
+** line occurs less often.  In that case the rarest lines are used, as
+** long as that takes no more than about HISTOGRAM_MAX_WORK comparisons.
+*/
+#define HISTOGRAM_MAX_OCCUR 64
+#define HISTOGRAM_MAX_WORK  10000000
+
+/*
+** Compare lines iS1 through iE1-1 of the aFrom[] file and lines iS2
+** through iE2-1 of the aTo[] file using the histogram heuristic, and
+** return the bounds of a sequence of lines common to both.
+**
+** The number of times each distinct line occurs in the aFrom[] range
+** is counted first.  Then common sequences are grown around each line
+** of the aTo[] range that also occurs in the aFrom[] range, but only
+** around lines that are rarer than the rarest line of the best sequence
+** found so far, or as rare.  The sequence whose rarest line occurs the
+** fewest times wins, or the longest such sequence if there is a tie, or
+** the one nearest the middle of the ranges if there is still a tie.
+** Preferring the middle splits the ranges evenly, so that the recursion
+** of histogram_step() is only about log(N) deep when there are many
+** equally good sequences, as when every other line has changed.
+** Lines that are very common, such as blank lines and lone braces,
+** therefore never anchor a match by themselves, which is what leads the
+** heuristic of longestCommonSequence() astray on repetitive text.
+**
+** Return false if the two ranges have no line in common, or if all
+** common lines are so frequent that the search would take too long.
+*/
+static int histogramLCS(
+  DContext *p,               /* Two files being compared */
+  int iS1, int iE1,          /* Range of lines in p->aFrom[] */
+  int iS2, int iE2,          /* Range of lines in p->aTo[] */
+  int *piSX, int *piEX,      /* Write p->aFrom[] common segment here */
+  int *piSY, int *piEY       /* Write p->aTo[] common segment here */
+){
+  int n = iE1 - iS1;         /* Number of lines in the aFrom[] range */
+  int nHash;                 /* Number of hash buckets.  A power of two */
+  int *aBucket;              /* Hash buckets.  1+index of first distinct line */
+  int *aLast;                /* 1+index of last occurrence of distinct line */
+  int *aCnt;                 /* Number of occurrences of distinct line */
+  int *aChain;               /* 1+index of next distinct line in the bucket */
+  int *aPrev;                /* 1+index of previous occurrence of a line */
+  int *aRec;                 /* The distinct line of each line */
+  int *aMatch;               /* 1+distinct line of each line of aTo[] range */
+  int nRec = 0;              /* Number of distinct lines */
+  int mnCnt = 0;             /* Occurrences of the rarest common line */
+  int nAtMn = 0;             /* Lines of aTo[] range that are that rare */
+  int bestCnt;               /* Occurrences of rarest line in best match */
+  int bestLen = 0;           /* Length of best match */
+  i64 bestDist = 0;          /* Distance of best match from the middle */
+  int i, j, jNext, r;
+
+  for(nHash=1; nHash<n; nHash*=2){}
+  aBucket = fossil_malloc( sizeof(int)*(nHash + n*5 + (iE2-iS2)) );
+  memset(aBucket, 0, sizeof(int)*nHash);
+  aLast = &aBucket[nHash];
+  aCnt = &aLast[n];
+  aChain = &aCnt[n];
+  aPrev = &aChain[n];
+  aRec = &aPrev[n];
+  aMatch = &aRec[n];
+
+  /* Count the occurrences of each distinct line of the aFrom[] range */
+  for(i=iS1; i<iE1; i++){
+    DLine *pA = &p->aFrom[i];
+    int h = (pA->h ^ (pA->h>>LENGTH_MASK_SZ)) & (nHash-1);
+    for(r=aBucket[h]; r>0 && !same_dline(&p->aFrom[aLast[r-1]-1], pA);
+        r=aChain[r-1]){}
+    if( r==0 ){
+      r = ++nRec;
+      aLast[r-1] = 0;
+      aCnt[r-1] = 0;
+      aChain[r-1] = aBucket[h];
+      aBucket[h] = r;
+    }
+    aPrev[i-iS1] = aLast[r-1];
+    aLast[r-1] = i+1;
+    aCnt[r-1]++;
+    aRec[i-iS1] = r-1;
+  }
+
+  /* Find each line of the aTo[] range in the aFrom[] range, and how
+  ** often the rarest of them occurs */
+  for(j=iS2; j<iE2; j++){
+    DLine *pB = &p->aTo[j];
+    int h = (pB->h ^ (pB->h>>LENGTH_MASK_SZ)) & (nHash-1);
+    for(r=aBucket[h]; r>0 && !same_dline(&p->aFrom[aLast[r-1]-1], pB);
+        r=aChain[r-1]){}
+    aMatch[j-iS2] = r;
+    if( r==0 ) continue;
+    if( mnCnt==0 || aCnt[r-1]<mnCnt ){
+      mnCnt = aCnt[r-1];
+      nAtMn = 0;
+    }
+    if( aCnt[r-1]==mnCnt ) nAtMn++;
+  }
+  bestCnt = HISTOGRAM_MAX_OCCUR;
+  if( mnCnt>bestCnt ){
+    if( (i64)mnCnt*nAtMn>HISTOGRAM_MAX_WORK ) mnCnt = 0;
+    bestCnt = mnCnt;
+  }
+
+  /* Grow a common sequence around each occurrence in the aFrom[] range
+  ** of each sufficiently rare line of the aTo[] range */
+  for(j=iS2; mnCnt>0 && j<iE2; j=jNext){
+    jNext = j+1;
+    r = aMatch[j-iS2];
+    if( r==0 || aCnt[r-1]>bestCnt ) continue;
+    for(i=aLast[r-1]; i>0; i=aPrev[i-1-iS1]){
+      int iSX = i-1, iEX = i;
+      int iSY = j, iEY = j+1;
+      int nRare = aCnt[r-1];
+      i64 dist;              /* Distance of the sequence from the middle */
+      while( iSX>iS1 && iSY>iS2
+          && same_dline(&p->aFrom[iSX-1], &p->aTo[iSY-1]) ){
+        iSX--;
+        iSY--;
+        if( aCnt[aRec[iSX-iS1]]<nRare ) nRare = aCnt[aRec[iSX-iS1]];
+      }
+      while( iEX<iE1 && iEY<iE2 && same_dline(&p->aFrom[iEX], &p->aTo[iEY]) ){
+        if( aCnt[aRec[iEX-iS1]]<nRare ) nRare = aCnt[aRec[iEX-iS1]];
+        iEX++;
+        iEY++;
+      }
+      if( iEY>jNext ) jNext = iEY;
+      dist = (i64)abs((iSX+iEX)-(iS1+iE1)) + abs((iSY+iEY)-(iS2+iE2));
+      if( iEX-iSX>bestLen || nRare<bestCnt
+       || (iEX-iSX==bestLen && nRare==bestCnt && dist<bestDist)
+      ){
+        *piSX = iSX;
+        *piEX = iEX;
+        *piSY = iSY;
+        *piEY = iEY;
+        bestLen = iEX-iSX;
+        bestCnt = nRare;
+        bestDist = dist;
+      }
+    }
+  }
+  fossil_free(aBucket);
+  return bestLen>0;
+}
+
+/*
+** Do a single step in the difference using the histogram algorithm.
+** This is like diff_step() except that common sequences are found using
+** histogramLCS().  Ranges in which histogramLCS() finds no common
+** sequence are passed to diff_step().
+*/
+static void histogram_step(DContext *p, int iS1, int iE1, int iS2, int iE2){
+  int iSX, iEX, iSY, iEY;
+
+  while( iE1>iS1 && iE2>iS2
+      && !diff_over_budget(p, (iE1-iS1)+(iE2-iS2))
+      && histogramLCS(p, iS1, iE1, iS2, iE2, &iSX, &iEX, &iSY, &iEY) ){
+    histogram_step(p, iS1, iSX, iS2, iSY);
+    appendTriple(p, iEX - iSX, 0, 0);
+    iS1 = iEX;
+    iS2 = iEY;
+  }
+  diff_step(p, iS1, iE1, iS2, iE2);
+}
+
 /*
 ** Compute the differences between two files already loaded into
 ** the DContext structure.
@@ -1587,7 +1848,11 @@ static void diff_all(DContext *p){
   if( iS>0 ){
     appendTriple(p, iS, 0, 0);
   }
-  diff_step(p, iS, iE1, iS, iE2);
+  if( p->useHistogram ){
+    histogram_step(p, iS, iE1, iS, iE2);
+  }else{
+    diff_step(p, iS, iE1, iS, iE2);
+  }
   if( iE1<p->nFrom ){
     appendTriple(p, p->nFrom - iE1, 0, 0);
   }
@@ -1735,28 +2000,79 @@ void diff_errmsg(Blob *pOut, const char *msg, int diffFlags){
 }
 
 /*
-** Generate a report of the differences between files pA and pB.
-** If pOut is not NULL then a unified diff is appended there.  It
-** is assumed that pOut has already been initialized.  If pOut is
-** NULL, then a pointer to an array of integers is returned.
-** The integers come in triples.  For each triple,
-** the elements are the number of lines copied, the number of
-** lines deleted, and the number of lines inserted.  The vector
-** is terminated by a triple of all zeros.
+** Limits on the work done by text_diff() to render a diff, in lines
+** examined.  See the "diff-limit" and "diff-page-limit" settings.
+*/
+static struct {
+  int isInit;        /* True once the settings have been read */
+  i64 mxDiff;        /* Most work for a single diff.  0 for no limit */
+  i64 mxPage;        /* Most work for all diffs on a page.  0 for no limit */
+  i64 nPageLeft;     /* Work left for the current page, or -1 */
+} diffLimit = { 0, 0, 0, -1 };
+
+/*
+** Read the limits on the work done to render diffs from the settings,
+** if that has not already been done.
+*/
+static void diff_limit_init(void){
+  if( diffLimit.isInit ) return;
+  diffLimit.isInit = 1;
+  diffLimit.mxDiff = (i64)db_get_int("diff-limit", 100)*1000000;
+  diffLimit.mxPage = (i64)db_get_int("diff-page-limit", 500)*1000000;
+  if( diffLimit.mxDiff<0 ) diffLimit.mxDiff = 0;
+  if( diffLimit.mxPage<0 ) diffLimit.mxPage = 0;
+}
+
+/*
+** Begin a web page that shows diffs.  The work done to render all of
+** the diffs from here on is limited by the "diff-page-limit" setting,
+** and once that is used up the rest of the diffs are approximate.
+*/
+void diff_begin_page(void){
+  diff_limit_init();
+  diffLimit.nPageLeft = diffLimit.mxPage>0 ? diffLimit.mxPage : -1;
+}
+
+/*
+** Return the work allowed for the next diff to be rendered, or -1 if
+** there is no limit.
+*/
+static i64 diff_limit_next(void){
+  i64 mxCost = -1;
+  diff_limit_init();
+  if( diffLimit.mxDiff>0 ) mxCost = diffLimit.mxDiff;
+  if( diffLimit.nPageLeft>=0 && (mxCost<0 || diffLimit.nPageLeft<mxCost) ){
+    mxCost = diffLimit.nPageLeft;
+  }
+  return mxCost;
+}
+
+/*
+** Charge the work done to render a diff to the budget of the page.
+*/
+static void diff_limit_charge(i64 nCost){
+  if( diffLimit.nPageLeft>=0 ){
+    diffLimit.nPageLeft -= nCost;
+    if( diffLimit.nPageLeft<0 ) diffLimit.nPageLeft = 0;
+  }
+}
+
+/*
+** Find the differences between pA_Blob and pB_Blob and leave them in *p.
+** mxCost is the most work allowed, or -1 for no limit.  Return NULL on
+** success, or else the message to show in place of the diff, in which
+** case *p holds no memory that needs to be freed.
 **
-** This diff utility does not work on binary files.  If a binary
-** file is encountered, 0 is returned and pOut is written with
-** text "cannot compute difference between binary files".
+** This routine uses no global state, so it can run on a worker thread.
 */
-int *text_diff(
+static const char *diff_compute(
+  DContext *p,     /* Write the differences here */
   Blob *pA_Blob,   /* FROM file */
   Blob *pB_Blob,   /* TO file */
-  Blob *pOut,      /* Write diff here if not NULL */
-  ReCompiled *pRe, /* Only output changes where this Regexp matches */
-  u64 diffFlags    /* DIFF_* flags defined above */
+  u64 diffFlags,   /* DIFF_* flags defined above */
+  i64 mxCost       /* Most work allowed, or -1 */
 ){
   int ignoreEolWs; /* Ignore whitespace at the end of lines */
-  DContext c;
 
   if( diffFlags & DIFF_INVERT ){
     Blob *pTemp = pA_Blob;
@@ -1766,64 +2082,329 @@ int *text_diff(
   ignoreEolWs = (diffFlags & DIFF_IGNORE_EOLWS)!=0;
 
   /* Prepare the input files */
-  memset(&c, 0, sizeof(c));
-  c.aFrom = break_into_lines(blob_str(pA_Blob), blob_size(pA_Blob),
-                             &c.nFrom, ignoreEolWs);
-  c.aTo = break_into_lines(blob_str(pB_Blob), blob_size(pB_Blob),
-                           &c.nTo, ignoreEolWs);
-  if( c.aFrom==0 || c.aTo==0 ){
-    fossil_free(c.aFrom);
-    fossil_free(c.aTo);
-    if( pOut ){
-      diff_errmsg(pOut, DIFF_CANNOT_COMPUTE_BINARY, diffFlags);
-    }
-    return 0;
+  memset(p, 0, sizeof(*p));
+  p->useHistogram = (diffFlags & DIFF_HISTOGRAM)!=0;
+  p->mxCost = mxCost;
+  p->aFrom = break_into_lines(blob_str(pA_Blob), blob_size(pA_Blob),
+                              &p->nFrom, ignoreEolWs);
+  p->aTo = break_into_lines(blob_str(pB_Blob), blob_size(pB_Blob),
+                            &p->nTo, ignoreEolWs);
+  if( p->aFrom==0 || p->aTo==0 ){
+    fossil_free(p->aFrom);
+    fossil_free(p->aTo);
+    p->aFrom = p->aTo = 0;
+    return DIFF_CANNOT_COMPUTE_BINARY;
   }
 
   /* Compute the difference */
-  diff_all(&c);
+  diff_all(p);
   if( (diffFlags & DIFF_NOTTOOBIG)!=0 ){
     int i, m, n;
-    int *a = c.aEdit;
-    int mx = c.nEdit;
+    int *a = p->aEdit;
+    int mx = p->nEdit;
     for(i=m=n=0; i<mx; i+=3){ m += a[i]; n += a[i+1]+a[i+2]; }
     if( n>10000 ){
-      fossil_free(c.aFrom);
-      fossil_free(c.aTo);
-      fossil_free(c.aEdit);
-      diff_errmsg(pOut, DIFF_TOO_MANY_CHANGES, diffFlags);
-      return 0;
+      fossil_free(p->aFrom);
+      fossil_free(p->aTo);
+      fossil_free(p->aEdit);
+      p->aFrom = p->aTo = 0;
+      p->aEdit = 0;
+      return DIFF_TOO_MANY_CHANGES;
     }
   }
   if( (diffFlags & DIFF_NOOPT)==0 ){
-    diff_optimize(&c);
+    diff_optimize(p);
   }
+  return 0;
+}
 
-  if( pOut ){
-    /* Compute a context or side-by-side diff into pOut */
-    if( diffFlags & DIFF_SIDEBYSIDE ){
-      sbsDiff(&c, pOut, pRe, diffFlags);
-    }else{
-      contextDiff(&c, pOut, pRe, diffFlags);
-    }
-    fossil_free(c.aFrom);
-    fossil_free(c.aTo);
-    fossil_free(c.aEdit);
-    return 0;
+/*
+** Write the differences found by diff_compute() into pOut as a context
+** or side-by-side diff, or write zErr if diff_compute() failed.  Free
+** the memory held by *p.
+*/
+static void diff_render(
+  DContext *p,      /* Differences found by diff_compute() */
+  const char *zErr, /* Value returned by diff_compute() */
+  Blob *pOut,       /* Write the diff here */
+  ReCompiled *pRe,  /* Only output changes where this Regexp matches */
+  u64 diffFlags     /* DIFF_* flags defined above */
+){
+  if( zErr ){
+    diff_errmsg(pOut, zErr, diffFlags);
+    return;
+  }
+  if( p->isApprox ){
+    diff_errmsg(pOut, DIFF_APPROXIMATE, diffFlags);
+  }
+  if( diffFlags & DIFF_SIDEBYSIDE ){
+    sbsDiff(p, pOut, pRe, diffFlags);
   }else{
+    contextDiff(p, pOut, pRe, diffFlags);
+  }
+  fossil_free(p->aFrom);
+  fossil_free(p->aTo);
+  fossil_free(p->aEdit);
+}
+
+/*
+** Generate a report of the differences between files pA and pB.
+** If pOut is not NULL then a unified diff is appended there.  It
+** is assumed that pOut has already been initialized.  If pOut is
+** NULL, then a pointer to an array of integers is returned.
+** The integers come in triples.  For each triple,
+** the elements are the number of lines copied, the number of
+** lines deleted, and the number of lines inserted.  The vector
+** is terminated by a triple of all zeros.
+**
+** This diff utility does not work on binary files.  If a binary
+** file is encountered, 0 is returned and pOut is written with
+** text "cannot compute difference between binary files".
+**
+** When a diff is written to pOut, the search for lines in common stops
+** once the work allowed by the "diff-limit" setting, or what is left of
+** the budget set by diff_begin_page(), has been done.  Lines not yet
+** matched by then are shown as changed, and the diff is preceded by a
+** note that it is approximate.
+*/
+int *text_diff(
+  Blob *pA_Blob,   /* FROM file */
+  Blob *pB_Blob,   /* TO file */
+  Blob *pOut,      /* Write diff here if not NULL */
+  ReCompiled *pRe, /* Only output changes where this Regexp matches */
+  u64 diffFlags    /* DIFF_* flags defined above */
+){
+  DContext c;
+  const char *zErr;
+
+  if( pOut==0 ){
     /* If a context diff is not requested, then return the
     ** array of COPY/DELETE/INSERT triples.
     */
-    free(c.aFrom);
-    free(c.aTo);
+    if( diff_compute(&c, pA_Blob, pB_Blob, diffFlags, -1) ) return 0;
+    fossil_free(c.aFrom);
+    fossil_free(c.aTo);
     return c.aEdit;
   }
+
+  /* Compute a context or side-by-side diff into pOut */
+  zErr = diff_compute(&c, pA_Blob, pB_Blob, diffFlags, diff_limit_next());
+  diff_render(&c, zErr, pOut, pRe, diffFlags);
+  diff_limit_charge(c.nCost);
+  return 0;
+}
+
+/*
+** Bytes of input to queue for each worker thread before a batch of
+** diffs is computed.
+*/
+#define DIFF_BATCH_PER_THREAD 4000000
+
+/*
+** A diff queued by diff_print_text() to be computed on a worker thread
+*/
+struct DiffJob {
+  Blob from, to;        /* The files to compare */
+  ReCompiled *pRe;      /* Only show changes that match this, if not NULL */
+  u64 diffFlags;        /* Flags for text_diff() */
+  char *zHead;          /* Written before the diff, if it is not empty */
+  char *zTail;          /* Written after the diff, if it is not empty */
+  int iAt;              /* Offset in the output at which the diff belongs */
+  i64 mxCost;           /* Work allowed on the worker thread, or -1 */
+  DContext c;           /* Differences found on the worker thread */
+  const char *zErr;     /* Message to show instead, or NULL */
+};
+
+/*
+** Diffs computed on worker threads.  While any are queued, output that
+** follows them is held in memory, either in the CGI reply or in the
+** "held" blob for standard output.  Once a batch of diffs is complete,
+** each is inserted into the output where it was queued, so the result
+** is the same as if the diffs had been computed one after another.
+*/
+static struct {
+  ThreadPool *pPool;    /* The worker threads, or NULL if not in use */
+  Blob *pOut;           /* Output into which the diffs are inserted */
+  Blob held;            /* Standard output held back while diffs are queued */
+  struct DiffJob *aJob; /* Queued diffs, in order */
+  int nJob;             /* Number of entries used in aJob[] */
+  int nJobAlloc;        /* Number of entries allocated for aJob[] */
+  i64 szBatch;          /* Bytes of input queued */
+  i64 mxBatch;          /* Compute the queued diffs when szBatch reaches this */
+} diffPool;
+
+/*
+** Find the differences for a queued diff.  This runs on a worker thread.
+*/
+static void diff_job_run(void *pArg){
+  struct DiffJob *p = (struct DiffJob*)pArg;
+  p->zErr = diff_compute(&p->c, &p->from, &p->to, p->diffFlags, p->mxCost);
+}
+
+/*
+** Render a queued diff whose differences have been found and append it,
+** surrounded by its head and tail, to pOut.
+*/
+static void diff_job_write(struct DiffJob *p, i64 mxCost, Blob *pOut){
+  Blob out;
+  blob_zero(&out);
+  p->c.mxCost = mxCost;
+  diff_render(&p->c, p->zErr, &out, p->pRe, p->diffFlags);
+  diff_limit_charge(p->c.nCost);
+  if( blob_size(&out) ){
+    if( p->zHead ) blob_append(pOut, p->zHead, -1);
+    blob_append(pOut, blob_buffer(&out), blob_size(&out));
+    if( p->zTail ) blob_append(pOut, p->zTail, -1);
+  }
+  blob_reset(&out);
+}
+
+/*
+** Find the differences for all queued diffs on the worker threads, then
+** render them and insert them into the output in order.  Rendering is
+** done here so that the anchors of HTML diffs are numbered in order.
+**
+** The work allowed for each diff was fixed when it was queued, before
+** the diffs ahead of it had charged theirs to the budget of the page.
+** If one turns out to have done more work than it would have been
+** allowed had the diffs been computed one after another, it is computed
+** again here with the smaller allowance.  This only happens once the
+** budget of the page is almost used up.
+*/
+static void diff_flush_queue(void){
+  Blob x;
+  int i, iPrev = 0;
+  if( diffPool.nJob==0 ) return;
+  for(i=0; i<diffPool.nJob; i++){
+    threadpool_add(diffPool.pPool, diff_job_run, &diffPool.aJob[i]);
+  }
+  threadpool_wait(diffPool.pPool);
+  blob_zero(&x);
+  for(i=0; i<diffPool.nJob; i++){
+    struct DiffJob *p = &diffPool.aJob[i];
+    i64 mxCost = diff_limit_next();
+    if( mxCost>=0 && p->c.nCost>mxCost ){
+      if( p->zErr==0 ){
+        fossil_free(p->c.aFrom);
+        fossil_free(p->c.aTo);
+        fossil_free(p->c.aEdit);
+      }
+      p->zErr = diff_compute(&p->c, &p->from, &p->to, p->diffFlags, mxCost);
+    }
+    blob_append(&x, blob_buffer(diffPool.pOut)+iPrev, p->iAt-iPrev);
+    diff_job_write(p, mxCost, &x);
+    iPrev = p->iAt;
+    blob_reset(&p->from);
+    blob_reset(&p->to);
+    fossil_free(p->zHead);
+    fossil_free(p->zTail);
+  }
+  blob_append(&x, blob_buffer(diffPool.pOut)+iPrev,
+              blob_size(diffPool.pOut)-iPrev);
+  blob_reset(diffPool.pOut);
+  *diffPool.pOut = x;
+  if( diffPool.pOut==&diffPool.held ){
+    fossil_hold_stdout(0);
+    fossil_print("%s", blob_str(&diffPool.held));
+    blob_reset(&diffPool.held);
+  }
+  diffPool.nJob = 0;
+  diffPool.szBatch = 0;
+}
+
+/*
+** Compute the diffs written by diff_print_text() on nThread worker
+** threads, until diff_end_threads() is called.  Nothing changes if
+** nThread is less than 2.
+*/
+void diff_begin_threads(int nThread){
+  if( nThread>1 && diffPool.pPool==0 ){
+    diff_limit_init();
+    blob_zero(&diffPool.held);
+    diffPool.pPool = threadpool_new(nThread);
+    diffPool.mxBatch = (i64)nThread*DIFF_BATCH_PER_THREAD;
+  }
+}
+
+/*
+** Write out all diffs that are still queued and stop the worker threads.
+*/
+void diff_end_threads(void){
+  if( diffPool.pPool==0 ) return;
+  diff_flush_queue();
+  threadpool_free(diffPool.pPool);
+  diffPool.pPool = 0;
+  fossil_free(diffPool.aJob);
+  diffPool.aJob = 0;
+  diffPool.nJobAlloc = 0;
+}
+
+/*
+** Write the differences between pFrom and pTo, as computed by
+** text_diff(), to the CGI reply or to standard output.  zHead and zTail,
+** if not NULL, are written before and after the diff, but only if the
+** diff is not empty.
+**
+** After diff_begin_threads() the diff is computed later, on a worker
+** thread, and the output that follows it is held back until then.  The
+** caller may change or free pFrom and pTo as soon as this returns.
+*/
+void diff_print_text(
+  Blob *pFrom,          /* Compare this file... */
+  Blob *pTo,            /* ...to this one */
+  ReCompiled *pRe,      /* Only show changes that match this, if not NULL */
+  u64 diffFlags,        /* Flags for text_diff() */
+  const char *zHead,    /* Written before a diff that is not empty */
+  const char *zTail     /* Written after a diff that is not empty */
+){
+  struct DiffJob *p;
+  Blob *pOut;
+  if( diffPool.pPool==0 ){
+    Blob out;
+    blob_zero(&out);
+    text_diff(pFrom, pTo, &out, pRe, diffFlags);
+    if( blob_size(&out) ){
+      fossil_print("%s%s%s", zHead ? zHead : "", blob_str(&out),
+                   zTail ? zTail : "");
+    }
+    blob_reset(&out);
+    return;
+  }
+  if( g.cgiOutput ){
+    pOut = cgi_output_blob();
+  }else{
+    pOut = &diffPool.held;
+    if( diffPool.nJob==0 ) fossil_hold_stdout(pOut);
+  }
+  if( diffPool.nJob>0 && pOut!=diffPool.pOut ){
+    diff_flush_queue();
+    if( pOut==&diffPool.held ) fossil_hold_stdout(pOut);
+  }
+  if( diffPool.nJob>=diffPool.nJobAlloc ){
+    diffPool.nJobAlloc = diffPool.nJobAlloc*2 + 20;
+    diffPool.aJob = fossil_realloc(diffPool.aJob,
+                                   sizeof(diffPool.aJob[0])*diffPool.nJobAlloc);
+  }
+  p = &diffPool.aJob[diffPool.nJob++];
+  memset(p, 0, sizeof(*p));
+  blob_copy(&p->from, pFrom);
+  blob_copy(&p->to, pTo);
+  p->pRe = pRe;
+  p->diffFlags = diffFlags;
+  p->zHead = zHead ? fossil_strdup(zHead) : 0;
+  p->zTail = zTail ? fossil_strdup(zTail) : 0;
+  p->iAt = blob_size(pOut);
+  p->mxCost = diff_limit_next();
+  diffPool.pOut = pOut;
+  diffPool.szBatch += blob_size(pFrom) + blob_size(pTo);
+  if( diffPool.szBatch>=diffPool.mxBatch ) diff_flush_queue();
 }
 
 /*
 ** Process diff-related command-line options and return an appropriate
 ** "diffFlags" integer.
 **
+**   --algorithm NAME       "histogram" or default DIFF_HISTOGRAM
 **   --brief                Show filenames only    DIFF_BRIEF
 **   --context|-c N         N lines of context.    DIFF_CONTEXT_MASK
 **   --html                 Format for HTML        DIFF_HTML
@@ -1854,6 +2435,14 @@ u64 diff_options(void){
   if( find_option("noopt",0,0)!=0 ) diffFlags |= DIFF_NOOPT;
   if( find_option("invert",0,0)!=0 ) diffFlags |= DIFF_INVERT;
   if( find_option("brief",0,0)!=0 ) diffFlags |= DIFF_BRIEF;
+  if( (z = find_option("algorithm",0,1))!=0 ){
+    if( fossil_strcmp(z, "histogram")==0 ){
+      diffFlags |= DIFF_HISTOGRAM;
+    }else if( fossil_strcmp(z, "default")!=0 ){
+      fossil_fatal("unknown diff algorithm \"%s\": use \"default\""
+                   " or \"histogram\"", z);
+    }
+  }
   return diffFlags;
 }
 
@@ -1916,6 +2505,154 @@ void test_diff_cmd(void){
   re_free(pRe);
 }
 
+/*
+** Split each of the nFile inputs in aIn[] into lines, and compute the
+** difference between consecutive inputs using both the default and the
+** histogram algorithms, nIter times over.  Report the throughput
+** relative to the total size of the inputs, and the number of lines
+** inserted or deleted by each algorithm.
+*/
+static void diff_bench_run(
+  const char *zLabel,     /* Label for this line of output */
+  Blob *aIn,              /* Inputs */
+  int nFile,              /* Number of entries in aIn[] */
+  int nIter,              /* Number of times to repeat */
+  u64 diffFlags           /* DIFF_* flags */
+){
+  static const struct {
+    const char *zName;    /* Name of the algorithm */
+    u64 flag;             /* Flag that selects it */
+  } aAlg[] = {
+    { "default",    0              },
+    { "histogram",  DIFF_HISTOGRAM },
+  };
+  int i, j, k, nLine;
+  int iTimer;
+  i64 nByte = 0;
+  i64 nTotalLine = 0;
+  int ignoreWS = (diffFlags & DIFF_IGNORE_EOLWS)!=0;
+  sqlite3_uint64 tmSplit, tmDiff;
+
+  if( nFile<2 ) return;
+  for(i=0; i<nFile; i++) nByte += blob_size(&aIn[i]);
+  iTimer = fossil_timer_start();
+  for(j=0; j<nIter; j++){
+    for(i=0; i<nFile; i++){
+      DLine *a = break_into_lines(blob_str(&aIn[i]), blob_size(&aIn[i]),
+                                  &nLine, ignoreWS);
+      if( a==0 ) fossil_fatal("%s: input %d is binary", zLabel, i);
+      if( j==0 ) nTotalLine += nLine;
+      fossil_free(a);
+    }
+  }
+  tmSplit = fossil_timer_stop(iTimer);
+  if( tmSplit==0 ) tmSplit = 1;
+  for(k=0; k<count(aAlg); k++){
+    i64 nChng = 0;
+    u64 f = (diffFlags & ~DIFF_HISTOGRAM) | aAlg[k].flag;
+    iTimer = fossil_timer_start();
+    for(j=0; j<nIter; j++){
+      for(i=1; i<nFile; i++){
+        int *R = text_diff(&aIn[i-1], &aIn[i], 0, 0, f);
+        int r;
+        for(r=0; j==0 && R && (R[r] || R[r+1] || R[r+2]); r+=3){
+          nChng += R[r+1] + R[r+2];
+        }
+        fossil_free(R);
+      }
+    }
+    tmDiff = fossil_timer_stop(iTimer);
+    if( tmDiff==0 ) tmDiff = 1;
+    fossil_print("%-10s %-10s %6d %10lld %12lld  %9.1f MB/s  %9.1f MB/s"
+                 " %10lld\n",
+       zLabel, aAlg[k].zName, nFile, nTotalLine, nByte,
+       (double)nByte*nIter/(double)tmSplit,
+       (double)nByte*nIter/(double)tmDiff, nChng);
+  }
+}
+
+/*
+** COMMAND: test-diff-bench
+**
+** Usage: %fossil test-diff-bench ?OPTIONS? ?FILE1 FILE2 ...?
+**
+** Measure the speed of the difference engine and compare its
+** algorithms.  Two throughputs are reported, in megabytes of input per
+** second of CPU time:  "split" is the time spent breaking the inputs
+** into lines and hashing them and "diff" is the time to compute the
+** differences, splitting included.  The last column is the number of
+** lines inserted or deleted, where smaller is better.
+**
+** Synthetic inputs are always measured, each with a lightly edited copy
+** of itself:  "text" is random words and "table" is made of a few
+** distinct lines repeated over and over, like generated code.  Files
+** named on the command-line are compared each to the next.
+**
+** Options:
+**    --size N         Size of the synthetic input.  Default: 10000000
+**    --iterations N   Repeat each measurement N times.  Default: 5
+**    -w               Ignore whitespace at the end of lines
+*/
+void test_diff_bench_cmd(void){
+  const char *zSize = find_option("size",0,1);
+  const char *zIter = find_option("iterations",0,1);
+  u64 diffFlags = find_option("w",0,0)!=0 ? DIFF_IGNORE_EOLWS : 0;
+  int sz = zSize ? atoi(zSize) : 10000000;
+  int nIter = zIter ? atoi(zIter) : 5;
+  unsigned x = 1;
+  int i, n;
+  Blob aIn[2];
+  Blob *aFile;
+
+  verify_all_options();
+  if( nIter<1 ) nIter = 1;
+  fossil_print("%-10s %-10s %6s %10s %12s  %14s  %14s %10s\n",
+               "input", "algorithm", "files", "lines", "bytes",
+               "split", "diff", "changes");
+
+  /* Synthetic text: lines of random words, some with trailing spaces */
+  blob_zero(&aIn[0]);
+  while( blob_size(&aIn[0])<sz ){
+    x = x*1103515245 + 12345;
+    blob_append(&aIn[0], &"abcdefghijklmnopqrstuvwxyz"[(x>>8)%20],
+                1+(x>>4)%6);
+    switch( (x>>16)%16 ){
+      case 0:  blob_append(&aIn[0], "\n", 1);     break;
+      case 1:  blob_append(&aIn[0], "  \n", 3);   break;
+      default: blob_append(&aIn[0], " ", 1);      break;
+    }
+  }
+  delta_bench_mutate(&aIn[0], &aIn[1], &x);
+  diff_bench_run("text", aIn, 2, nIter, diffFlags);
+  blob_reset(&aIn[0]);
+  blob_reset(&aIn[1]);
+
+  /* Synthetic table: a few distinct lines, repeated */
+  blob_zero(&aIn[0]);
+  while( blob_size(&aIn[0])<sz ){
+    x = x*1103515245 + 12345;
+    blob_appendf(&aIn[0], "  { %d, %d },\n", (x>>8)%100, (x>>16)%20);
+  }
+  delta_bench_mutate(&aIn[0], &aIn[1], &x);
+  diff_bench_run("table", aIn, 2, nIter, diffFlags);
+  blob_reset(&aIn[0]);
+  blob_reset(&aIn[1]);
+
+  /* Files named on the command-line */
+  if( g.argc>=4 ){
+    n = g.argc-2;
+    aFile = fossil_malloc( sizeof(Blob)*n );
+    for(i=0; i<n; i++){
+      if( blob_read_from_file(&aFile[i], g.argv[i+2])<0 ){
+        fossil_fatal("cannot read %s", g.argv[i+2]);
+      }
+    }
+    diff_bench_run("files", aFile, n, nIter, diffFlags);
+    for(i=0; i<n; i++) blob_reset(&aFile[i]);
+    fossil_free(aFile);
+  }
+}
+
 /**************************************************************************
 ** The basic difference engine is above.  What follows is the annotation
 ** engine.  Both are in the same file since they share many components.
@@ -1931,7 +2668,7 @@ struct Annotator {
   struct AnnLine {  /* Lines of the original files... */
     const char *z;       /* The text of the line */
     short int n;         /* Number of bytes (omitting trailing space and \n) */
-    short int iVers;     /* Level at which tag was set */
+    int iVers;           /* Level at which tag was set */
   } *aOrig;
   int nOrig;        /* Number of elements in aOrig[] */
   int nVers;        /* Number of versions analyzed */
@@ -1943,6 +2680,8 @@ struct Annotator {
     const char *zBgColor; /* Suggested background color */
     const char *zUser;    /* Name of user who did the check-in */
     unsigned cnt;         /* Number of lines contributed by this check-in */
+    int fid;              /* Artifact ID of the file */
+    int mid;              /* Artifact ID of the check-in */
   } *aVers;         /* For each check-in analyzed */
   char **azVers;    /* Names of versions analyzed */
 };
@@ -1956,6 +2695,7 @@ static int annotation_start(Annotator *p, Blob *pInput){
   int i;
 
   memset(p, 0, sizeof(*p));
+  p->c.mxCost = -1;
   p->c.aTo = break_into_lines(blob_str(pInput), blob_size(pInput),&p->c.nTo,1);
   if( p->c.aTo==0 ){
     return 1;
@@ -1971,63 +2711,257 @@ static int annotation_start(Annotator *p, Blob *pInput){
 }
 
 /*
-** The input pParent is the next most recent ancestor of the file
-** being annotated.  Do another step of the annotation.  Return true
-** if additional annotation is required.  zPName is the tag to insert
-** on each line of the file being annotated that was contributed by
-** pParent.  Memory to hold zPName is leaked.
+** Lines of version iVers of the file being annotated, whose text is
+** loaded into pText.  The lines of the file being annotated itself
+** belong to p and must not be freed.  The content of a version that
+** cannot be broken into lines is treated as having no lines.
 */
-static int annotation_step(Annotator *p, Blob *pParent, int iVers){
+static DLine *annotation_lines(
+  Annotator *p,        /* The annotator */
+  int iVers,           /* The version whose lines are wanted */
+  Blob *pText,         /* Write the text of that version here */
+  int *pnLine          /* Write the number of lines here */
+){
+  DLine *a;
+  blob_zero(pText);
+  if( iVers==0 ){
+    *pnLine = p->c.nTo;
+    return p->c.aTo;
+  }
+  content_get(p->aVers[iVers].fid, pText);
+  a = break_into_lines(blob_str(pText), blob_size(pText), pnLine, 1);
+  if( a==0 ){
+    *pnLine = 0;
+    a = fossil_malloc( sizeof(a[0]) );
+    memset(a, 0, sizeof(a[0]));
+  }
+  return a;
+}
+
+/*
+** The difference from a version of the file to the next more recent
+** version is in *pC.  aParent[] holds the origin of each line of the
+** older version, as an index into Annotator.aVers[].  Write the origin
+** of each line of the newer version into aChild[].  Lines copied from
+** the older version keep their origin.  Inserted lines originate in
+** iVers.
+*/
+static void annotation_step(
+  DContext *pC,        /* Difference between the two versions */
+  const int *aParent,  /* Origin of each line of the older version */
+  int *aChild,         /* Origin of each line of the newer version */
+  int iVers            /* Index of the newer version in aVers[] */
+){
   int i, j;
-  int lnTo;
+  int lnFrom, lnTo;
 
-  /* Prepare the parent file to be diffed */
-  p->c.aFrom = break_into_lines(blob_str(pParent), blob_size(pParent),
-                                &p->c.nFrom, 1);
-  if( p->c.aFrom==0 ){
+  for(i=lnFrom=lnTo=0; i<pC->nEdit; i+=3){
+    int nCopy = pC->aEdit[i];
+    int nDel = pC->aEdit[i+1];
+    int nIns = pC->aEdit[i+2];
+    for(j=0; j<nCopy; j++) aChild[lnTo++] = aParent[lnFrom++];
+    lnFrom += nDel;
+    for(j=0; j<nIns; j++) aChild[lnTo++] = iVers;
+  }
+}
+
+/* Annotation flags */
+#define ANN_FILE_VERS    0x01   /* Show file vers rather than commit vers */
+#define ANN_FILE_ANCEST  0x02   /* Prefer check-ins in the ANCESTOR table */
+
+/* Annotation flags that change which versions of the file are compared */
+#define ANN_CACHE_MASK   ANN_FILE_ANCEST
+
+/*
+** The annotation cache.  Once every line of a version of a file has
+** been traced to its origin, those origins are saved here so that a
+** later annotation of that version, or of a more recent version
+** descended from it, can start from there instead of comparing every
+** older version of the file.  Results are kept apart by the annotation
+** flags in ANN_CACHE_MASK, since those change which older versions are
+** compared.
+**
+** The content of the ORIGIN column is a list of integers separated by
+** spaces.  The first is the number of distinct versions from which the
+** lines of the file originate.  Then comes the FID, MID and GEN of each
+** of those versions, most recent first, where GEN is the number of older
+** versions of the file.  The rest are pairs of a number of consecutive
+** lines and the index of the version in which they originate.
+**
+** The table is derived from other tables of the repository and is
+** dropped by "fossil rebuild".
+*/
+static const char zAnnotationSchema[] =
+@ CREATE TABLE IF NOT EXISTS %s.annotation(
+@   fid INTEGER,            -- The version of the file annotated
+@   pid INTEGER,            -- The previous version it was compared to
+@   flags INTEGER,          -- Annotation flags in ANN_CACHE_MASK
+@   gen INTEGER,            -- Number of older versions of the file
+@   origin TEXT,            -- Origin of every line of the file
+@   PRIMARY KEY(fid,pid,flags)
+@ );
+;
+
+/*
+** Create the annotation cache if it does not already exist and the
+** repository can be written.  A cache without the FLAGS column, as made
+** by earlier versions of this code, is replaced.  Return true if the
+** cache exists.
+*/
+static int annotation_cache_init(void){
+  const char *zRepo = db_name("repository");
+  if( db_is_writeable("repository") ){
+    if( db_exists("SELECT 1 FROM %s.sqlite_master WHERE name='annotation'"
+                  " AND sql NOT GLOB '* flags *'", zRepo) ){
+      db_multi_exec("DROP TABLE %s.annotation", zRepo);
+    }
+    db_multi_exec(zAnnotationSchema, zRepo);
     return 1;
   }
+  return db_exists("SELECT 1 FROM %s.sqlite_master WHERE name='annotation'"
+                   " AND sql GLOB '* flags *'", zRepo);
+}
 
-  /* Compute the differences going from pParent to the file being
-  ** annotated. */
-  diff_all(&p->c);
+/*
+** Read the next integer from the cached origins in *pz.  Return -1 if
+** there are no more.
+*/
+static int annotation_cache_int(const char **pz){
+  const char *z = *pz;
+  int v = 0;
+  while( z[0]==' ' ) z++;
+  if( !fossil_isdigit(z[0]) ) return -1;
+  while( fossil_isdigit(z[0]) ){ v = v*10 + z[0] - '0'; z++; }
+  *pz = z;
+  return v;
+}
 
-  /* Where new lines are inserted on this difference, record the
-  ** iVers as the source of the new line.
-  */
-  for(i=lnTo=0; i<p->c.nEdit; i+=3){
-    int nCopy = p->c.aEdit[i];
-    int nIns = p->c.aEdit[i+2];
-    lnTo += nCopy;
-    for(j=0; j<nIns; j++, lnTo++){
-      if( p->aOrig[lnTo].iVers<0 ){
-        p->aOrig[lnTo].iVers = iVers;
+/*
+** Look in the annotation cache for the origins of the nLine lines of
+** version iVers in p->aVers[], whose previous version is pid, as found
+** with the annotation flags annFlags in ANN_CACHE_MASK.  The
+** origins are returned in an array obtained from fossil_malloc(), as
+** indexes into p->aVers[], or -1 for lines that originate in versions
+** older than those in p->aVers[] when bLimit is true.  NULL is returned
+** if the origins are not in the cache or do not fit p->aVers[].
+*/
+static int *annotation_cache_load(
+  Annotator *p,        /* The annotator */
+  int iVers,           /* The version whose origins are wanted */
+  int pid,             /* Previous version of iVers */
+  int annFlags,        /* Annotation flags in ANN_CACHE_MASK */
+  int nLine,           /* Number of lines in version iVers */
+  int bLimit           /* True if p->aVers[] stops short of the first */
+){
+  char *zOrigin;
+  const char *z;
+  int nOld, nRun, gen, i, j, v;
+  int *aOld = 0;
+  int *aOrigin = 0;
+
+  zOrigin = db_text(0, "SELECT gen||' '||origin FROM annotation"
+                       " WHERE fid=%d AND pid=%d AND flags=%d",
+                       p->aVers[iVers].fid, pid, annFlags);
+  if( zOrigin==0 ) return 0;
+  z = zOrigin;
+  gen = annotation_cache_int(&z);
+  if( !bLimit && gen!=p->nVers-1-iVers ) goto cache_invalid;
+  nOld = annotation_cache_int(&z);
+  if( nOld<=0 ) goto cache_invalid;
+
+  /* Find each version from which lines originate in p->aVers[] */
+  aOld = fossil_malloc( sizeof(aOld[0])*nOld );
+  for(i=0; i<nOld; i++){
+    int fid = annotation_cache_int(&z);
+    int mid = annotation_cache_int(&z);
+    int iOld = annotation_cache_int(&z);
+    if( iOld<0 || iOld>gen ) goto cache_invalid;
+    iOld = iVers + gen - iOld;
+    if( iOld<p->nVers ){
+      if( p->aVers[iOld].fid!=fid || p->aVers[iOld].mid!=mid ){
+        goto cache_invalid;
       }
+      aOld[i] = iOld;
+    }else if( bLimit ){
+      aOld[i] = -1;
+    }else{
+      goto cache_invalid;
     }
   }
 
-  /* Clear out the diff results */
-  fossil_free(p->c.aEdit);
-  p->c.aEdit = 0;
-  p->c.nEdit = 0;
-  p->c.nEditAlloc = 0;
-
-  /* Clear out the from file */
-  free(p->c.aFrom);
+  aOrigin = fossil_malloc( sizeof(aOrigin[0])*(nLine+1) );
+  for(i=0; (nRun = annotation_cache_int(&z))>=0; i+=nRun){
+    v = annotation_cache_int(&z);
+    if( v<0 || v>=nOld || i+nRun>nLine ) goto cache_invalid;
+    for(j=0; j<nRun; j++) aOrigin[i+j] = aOld[v];
+  }
+  if( i!=nLine ) goto cache_invalid;
+  fossil_free(aOld);
+  fossil_free(zOrigin);
+  return aOrigin;
 
-  /* Return no errors */
+cache_invalid:
+  fossil_free(aOrigin);
+  fossil_free(aOld);
+  fossil_free(zOrigin);
   return 0;
 }
 
-
-/* Annotation flags */
-#define ANN_FILE_VERS    0x01   /* Show file vers rather than commit vers */
-#define ANN_FILE_ANCEST  0x02   /* Prefer check-ins in the ANCESTOR table */
+/*
+** Save in the annotation cache the origins aOrigin[] of the nLine lines
+** of the version of the file in p->aVers[0], whose previous version is
+** pid, as found with the annotation flags annFlags in ANN_CACHE_MASK.
+** p->aVers[] must reach back to the first version of the file.
+*/
+static void annotation_cache_save(
+  Annotator *p,        /* The annotator */
+  int pid,             /* The previous version of the file */
+  int annFlags,        /* Annotation flags in ANN_CACHE_MASK */
+  const int *aOrigin,  /* Origin of each line, as an index into p->aVers[] */
+  int nLine            /* Number of lines */
+){
+  Blob origin;
+  int *aMap;           /* Index of each entry of p->aVers[] in the cache */
+  int i, j, nOld;
+
+  aMap = fossil_malloc( sizeof(aMap[0])*p->nVers );
+  for(i=0; i<p->nVers; i++) aMap[i] = -1;
+  for(i=0; i<nLine; i++) aMap[aOrigin[i]] = 0;
+  for(i=nOld=0; i<p->nVers; i++){
+    if( aMap[i]==0 ) aMap[i] = nOld++;
+  }
+  blob_zero(&origin);
+  blob_appendf(&origin, "%d", nOld);
+  for(i=0; i<p->nVers; i++){
+    if( aMap[i]<0 ) continue;
+    blob_appendf(&origin, " %d %d %d",
+                 p->aVers[i].fid, p->aVers[i].mid, p->nVers-1-i);
+  }
+  for(i=0; i<nLine; i=j){
+    for(j=i+1; j<nLine && aOrigin[j]==aOrigin[i]; j++){}
+    blob_appendf(&origin, " %d %d", j-i, aMap[aOrigin[i]]);
+  }
+  db_multi_exec(
+    "REPLACE INTO annotation(fid,pid,flags,gen,origin)"
+    " VALUES(%d,%d,%d,%d,%B)",
+    p->aVers[0].fid, pid, annFlags, p->nVers-1, &origin
+  );
+  blob_reset(&origin);
+  fossil_free(aMap);
+}
 
 /*
 ** Compute a complete annotation on a file.  The file is identified
 ** by its filename number (filename.fnid) and the baseline in which
 ** it was checked in (mlink.mid).
+**
+** Ancestors of the file are listed, most recent first, until the first
+** version of the file is reached or iLimit versions have been listed.
+** Then, starting from the most recent ancestor whose annotation is in
+** the annotation cache, or from the oldest ancestor listed if there is
+** none, the origin of each line is traced forward one version at a time
+** to the file being annotated.  A result that reaches back to the first
+** version of the file is saved in the cache.
 */
 static void annotate_file(
   Annotator *p,        /* The annotator */
@@ -2037,11 +2971,21 @@ static void annotate_file(
   int annFlags         /* Flags to alter the annotation */
 ){
   Blob toAnnotate;     /* Text of the final (mid) version of the file */
-  Blob step;           /* Text of previous revision */
+  Blob text;           /* Text of the version whose lines are in aLine[] */
+  Blob next;           /* Text of the next more recent version */
   int rid;             /* Artifact ID of the file being annotated */
+  int pidTop = 0;      /* Previous version of the file being annotated */
+  int pidCached = 0;   /* Previous version of p->aVers[iCached] */
+  int iCached = -1;    /* Most recent version in the annotation cache */
   Stmt q;              /* Query returning all ancestor versions */
   Stmt ins;            /* Inserts into the temporary VSEEN table */
   int cnt = 0;         /* Number of versions examined */
+  int hasCache;        /* True if the annotation cache exists */
+  int *aOrigin = 0;    /* Origin of each line in aLine[] */
+  DLine *aLine = 0;    /* Lines of the version being traced */
+  int nLine = 0;       /* Number of entries in aLine[] */
+  int iStart;          /* Index in p->aVers[] of the version traced first */
+  int i;
 
   /* Initialize the annotation */
   rid = db_int(0, "SELECT fid FROM mlink WHERE mid=%d AND fnid=%d",mid,fnid);
@@ -2058,6 +3002,7 @@ static void annotate_file(
      "CREATE TEMP TABLE IF NOT EXISTS vseen(rid INTEGER PRIMARY KEY);"
      "DELETE FROM vseen;"
   );
+  hasCache = p->c.aTo!=0 && annotation_cache_init();
 
   db_prepare(&ins, "INSERT OR IGNORE INTO vseen(rid) VALUES(:rid)");
   db_prepare(&q,
@@ -2065,7 +3010,8 @@ static void annotate_file(
     "       (SELECT uuid FROM blob WHERE rid=mlink.mid),"
     "       date(event.mtime),"
     "       coalesce(event.euser,event.user),"
-    "       mlink.pid"
+    "       mlink.pid,"
+    "       mlink.mid"
     "  FROM mlink, event"
     " WHERE mlink.fid=:rid"
     "   AND event.objid=mlink.mid"
@@ -2076,7 +3022,6 @@ static void annotate_file(
   );
 
   db_bind_int(&q, ":rid", rid);
-  if( iLimit==0 ) iLimit = 1000000000;
   while( rid && iLimit>cnt && db_step(&q)==SQLITE_ROW ){
     int prevId = db_column_int(&q, 4);
     p->aVers = fossil_realloc(p->aVers, (p->nVers+1)*sizeof(p->aVers[0]));
@@ -2084,10 +3029,16 @@ static void annotate_file(
     p->aVers[p->nVers].zMUuid = fossil_strdup(db_column_text(&q, 1));
     p->aVers[p->nVers].zDate = fossil_strdup(db_column_text(&q, 2));
     p->aVers[p->nVers].zUser = fossil_strdup(db_column_text(&q, 3));
-    if( p->nVers ){
-      content_get(rid, &step);
-      annotation_step(p, &step, p->nVers-1);
-      blob_reset(&step);
+    p->aVers[p->nVers].fid = rid;
+    p->aVers[p->nVers].mid = db_column_int(&q, 5);
+    if( p->nVers==0 ) pidTop = prevId;
+    if( hasCache && iCached<0
+     && db_exists("SELECT 1 FROM annotation"
+                  " WHERE fid=%d AND pid=%d AND flags=%d",
+                  rid, prevId, annFlags & ANN_CACHE_MASK)
+    ){
+      iCached = p->nVers;
+      pidCached = prevId;
     }
     p->nVers++;
     db_bind_int(&ins, ":rid", rid);
@@ -2101,6 +3052,71 @@ static void annotate_file(
   p->bLimit = iLimit==cnt;
   db_finalize(&q);
   db_finalize(&ins);
+  if( p->c.aTo==0 || p->nVers==0 ){
+    db_end_transaction(0);
+    return;
+  }
+
+  /* Find the origin of each line of the version traced first.  If it
+  ** is not in the cache and it is the first version of the file, every
+  ** line originates there.  If the limit was reached first, the origins
+  ** are not known.
+  */
+  if( iCached>=0 ){
+    aLine = annotation_lines(p, iCached, &text, &nLine);
+    aOrigin = annotation_cache_load(p, iCached, pidCached,
+                                    annFlags & ANN_CACHE_MASK, nLine,
+                                    p->bLimit);
+    if( aOrigin==0 ){
+      if( aLine!=p->c.aTo ) fossil_free(aLine);
+      blob_reset(&text);
+    }
+  }
+  if( aOrigin ){
+    iStart = iCached;
+  }else{
+    iStart = p->nVers-1;
+    aLine = annotation_lines(p, iStart, &text, &nLine);
+    aOrigin = fossil_malloc( sizeof(aOrigin[0])*(nLine+1) );
+    for(i=0; i<nLine; i++) aOrigin[i] = p->bLimit ? -1 : iStart;
+  }
+
+  /* Trace the origins forward to the file being annotated */
+  for(i=iStart-1; i>=0; i--){
+    DContext c;
+    int *aNext;
+    memset(&c, 0, sizeof(c));
+    c.mxCost = -1;
+    c.aFrom = aLine;
+    c.nFrom = nLine;
+    c.aTo = aLine = annotation_lines(p, i, &next, &nLine);
+    c.nTo = nLine;
+    diff_all(&c);
+    aNext = fossil_malloc( sizeof(aNext[0])*(nLine+1) );
+    annotation_step(&c, aOrigin, aNext, i);
+    fossil_free(c.aEdit);
+    fossil_free(c.aFrom);
+    fossil_free(aOrigin);
+    aOrigin = aNext;
+    blob_reset(&text);
+    text = next;
+  }
+  blob_reset(&text);
+
+  /* Save a complete result in the cache.  Then forget the origin of
+  ** lines added by the oldest version listed, as it is not known
+  ** whether that version added them or inherited them. */
+  if( hasCache && !p->bLimit && nLine>0 && iStart>0
+   && db_is_writeable("repository")
+  ){
+    annotation_cache_save(p, pidTop, annFlags & ANN_CACHE_MASK,
+                          aOrigin, nLine);
+  }
+  for(i=0; i<nLine; i++){
+    int v = aOrigin[i];
+    p->aOrig[i].iVers = p->bLimit && v==p->nVers-1 ? -1 : v;
+  }
+  fossil_free(aOrigin);
   db_end_transaction(0);
 }
 
@@ -2254,7 +3270,6 @@ void annotation_page(void){
     int n = ann.aOrig[i].n;
     char zPrefix[300];
     z[n] = 0;
-    if( iLimit>ann.nVers && iVers<0 ) iVers = ann.nVers-1;
 
     if( bBlame ){
       if( iVers>=0 ){
@@ -2370,7 +3385,6 @@ void annotate_cmd(void){
     char *z = (char*)ann.aOrig[i].z;
     int n = ann.aOrig[i].n;
     struct AnnVers *p;
-    if( iLimit>ann.nVers && iVers<0 ) iVers = ann.nVers-1;
     p = ann.aVers + iVers;
     if( bBlame ){
       if( iVers>=0 ){
@@ -42,9 +42,11 @@ void diff_print_index(const char *zFile, u64 diffFlags){
 }
 
 /*
-** Print the +++/--- filename lines for a diff operation.
+** Return the +++/--- filename lines for a diff operation, in memory
+** obtained from fossil_malloc(), or NULL if there are none.
 */
-void diff_print_filenames(const char *zLeft, const char *zRight, u64 diffFlags){
+static char *diff_filenames(const char *zLeft, const char *zRight,
+                            u64 diffFlags){
   char *z = 0;
   if( diffFlags & DIFF_BRIEF ){
     /* no-op */
@@ -59,6 +61,14 @@ void diff_print_filenames(const char *zLeft, const char *zRight, u64 diffFlags){
   }else{
     z = mprintf("--- %s\n+++ %s\n", zLeft, zRight);
   }
+  return z;
+}
+
+/*
+** Print the +++/--- filename lines for a diff operation.
+*/
+void diff_print_filenames(const char *zLeft, const char *zRight, u64 diffFlags){
+  char *z = diff_filenames(zLeft, zRight, diffFlags);
   fossil_print("%s", z);
   fossil_free(z);
 }
@@ -87,7 +97,6 @@ void diff_file(
   u64 diffFlags             /* Flags to control the diff */
 ){
   if( zDiffCmd==0 ){
-    Blob out;                 /* Diff output text */
     Blob file2;               /* Content of zFile2 */
     const char *zName2;       /* Name of zFile2 for display */
 
@@ -110,13 +119,9 @@ void diff_file(
         fossil_print("CHANGED  %s\n", zName);
       }
     }else{
-      blob_zero(&out);
-      text_diff(pFile1, &file2, &out, 0, diffFlags);
-      if( blob_size(&out) ){
-        diff_print_filenames(zName, zName2, diffFlags);
-        fossil_print("%s\n", blob_str(&out));
-      }
-      blob_reset(&out);
+      char *zHead = diff_filenames(zName, zName2, diffFlags);
+      diff_print_text(pFile1, &file2, 0, diffFlags, zHead, "\n");
+      fossil_free(zHead);
     }
 
     /* Release memory resources */
@@ -209,15 +214,9 @@ void diff_file_mem(
 ){
   if( diffFlags & DIFF_BRIEF ) return;
   if( zDiffCmd==0 ){
-    Blob out;      /* Diff output text */
-
-    blob_zero(&out);
-    text_diff(pFile1, pFile2, &out, 0, diffFlags);
     diff_print_filenames(zName, zName, diffFlags);
-    fossil_print("%s\n", blob_str(&out));
-
-    /* Release memory resources */
-    blob_reset(&out);
+    diff_print_text(pFile1, pFile2, 0, diffFlags, 0, 0);
+    fossil_print("\n");
   }else{
     Blob cmd;
     char zTemp1[300];
@@ -1014,6 +1013,8 @@ const char *diff_get_binary_glob(void){
 ** This option overrides the "binary-glob" setting.
 **
 ** Options:
+**   --algorithm NAME    Use the "histogram" difference algorithm, or the
+**                       "default" one
 **   --binary PATTERN    Treat files that match the glob PATTERN as binary
 **   --branch BRANCH     Show diff of all changes on BRANCH
 **   --brief             Show filenames only
@@ -1022,6 +1023,9 @@ const char *diff_get_binary_glob(void){
 **   --from|-r VERSION   select VERSION as source for the diff
 **   --internal|-i       use internal diff logic
 **   --side-by-side|-y   side-by-side diff
+**   --threads N         Compute the diffs of N files at once with the
+**                       internal diff logic.  0 means one per CPU.  The
+**                       default comes from the "threads" setting.
 **   --tk                Launch a Tcl/Tk GUI for display
 **   --to VERSION        select VERSION as target for the diff
 **   --unified           unified diff
@@ -1039,6 +1043,7 @@ void diff_cmd(void){
   const char *zBinGlob = 0;  /* Treat file names matching this as binary */
   int fIncludeBinary = 0;    /* Include binary files for external diff */
   u64 diffFlags = 0;         /* Flags to control the DIFF */
+  const char *zThreads;      /* Value of the --threads option, if any */
   int f;
 
   if( find_option("tk",0,0)!=0 ){
@@ -1050,6 +1055,7 @@ void diff_cmd(void){
   zFrom = find_option("from", "r", 1);
   zTo = find_option("to", 0, 1);
   zBranch = find_option("branch", 0, 1);
+  zThreads = find_option("threads", 0, 1);
   diffFlags = diff_options();
   verboseFlag = find_option("verbose","v",0)!=0;
   if( !verboseFlag ){
@@ -1072,6 +1078,7 @@ void diff_cmd(void){
     zBinGlob = diff_get_binary_glob();
     fIncludeBinary = diff_include_binary_files();
     verify_all_options();
+    if( zDiffCmd==0 ) diff_begin_threads(threadpool_size(zThreads));
     if( g.argc>=3 ){
       for(f=2; f<g.argc; ++f){
         diff_one_against_disk(zFrom, zDiffCmd, zBinGlob, fIncludeBinary,
@@ -1091,6 +1098,7 @@ void diff_cmd(void){
     zBinGlob = diff_get_binary_glob();
     fIncludeBinary = diff_include_binary_files();
     verify_all_options();
+    if( zDiffCmd==0 ) diff_begin_threads(threadpool_size(zThreads));
     if( g.argc>=3 ){
       for(f=2; f<g.argc; ++f){
         diff_one_two_versions(zFrom, zTo, zDiffCmd, zBinGlob, fIncludeBinary,
@@ -1101,6 +1109,7 @@ void diff_cmd(void){
                             diffFlags);
     }
   }
+  diff_end_threads();
 }
 
 /*
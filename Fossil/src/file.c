@@ -163,6 +163,34 @@ int file_wd_isfile_or_link(const char *zFilename){
                                      S_ISLNK(fileStat.st_mode);
 }
 
+/*
+** Return the size, modification time and type of a file in the working
+** directory, taking symlinks into account.  The size and mtime are -1
+** if the file does not exist.  *pType is set to 1 for an ordinary file,
+** 2 for a symlink and 0 for anything else, including a missing file.
+**
+** Unlike file_wd_size() and friends, this routine does not use or
+** change the cached stat buffer, so it is safe to call from a worker
+** thread.
+*/
+void file_wd_stat(
+  const char *zFilename,  /* Name of the file */
+  i64 *pSize,             /* OUT: Size in bytes */
+  i64 *pMtime,            /* OUT: Modification time */
+  int *pType              /* OUT: 1 for file, 2 for symlink, else 0 */
+){
+  struct fossilStat buf;
+  if( fossil_stat(zFilename, &buf, 1)!=0 ){
+    *pSize = -1;
+    *pMtime = -1;
+    *pType = 0;
+  }else{
+    *pSize = buf.st_size;
+    *pMtime = buf.st_mtime;
+    *pType = S_ISREG(buf.st_mode) ? 1 : S_ISLNK(buf.st_mode) ? 2 : 0;
+  }
+}
+
 /*
 ** Return TRUE if the named file is an ordinary file.  Return false
 ** for directories, devices, fifos, symlinks, etc.
@@ -20,12 +20,37 @@
 **
 ** State information is stored in static variables, so this implementation
 ** can only be building up a single GZIP file at a time.
+**
+** A file started with gzip_begin_parallel() is compressed in the style of
+** pigz: the input is cut into blocks that are deflated independently on
+** worker threads, each primed with the last 32KiB of the block before it,
+** and the compressed blocks are joined into a single deflate stream.  The
+** result is an ordinary GZIP file.
 */
 #include "config.h"
 #include <assert.h>
 #include <zlib.h>
 #include "gzip.h"
 
+/*
+** Size of the input blocks for parallel compression, and of the
+** dictionary that each block is primed with.
+*/
+#define GZIP_BLOCK_SZ  131072
+#define GZIP_DICT_SZ   32768
+
+/*
+** One block of input for parallel compression
+*/
+struct gzip_block {
+  Blob in;              /* Uncompressed input */
+  Blob out;             /* Raw deflate output */
+  const char *zDict;    /* Preset dictionary.  Input preceding this block */
+  int nDict;            /* Bytes in zDict */
+  int isLast;           /* True for the final block of the file */
+  unsigned int iCRC;    /* CRC of the input */
+};
+
 /*
 ** State information for the GZIP file under construction.
 */
@@ -34,6 +59,14 @@ struct gzip_state {
   int iCRC;             /* The checksum */
   z_stream stream;      /* The working compressor */
   Blob out;             /* Results stored here */
+  ThreadPool *pPool;    /* Worker threads.  NULL for serial compression */
+  Blob pending;         /* Input not yet assigned to a block */
+  struct gzip_block *aBlock;  /* Blocks waiting to be compressed */
+  int nBlock;           /* Number of entries used in aBlock[] */
+  int mxBlock;          /* Compress when this many blocks are waiting */
+  char aDict[GZIP_DICT_SZ];  /* The last input before aBlock[0] */
+  int nDict;            /* Bytes used in aDict[] */
+  i64 nIn;              /* Total bytes of input compressed */
 } gzip;
 
 /*
@@ -68,6 +101,116 @@ void gzip_begin(sqlite3_int64 now){
   gzip.eState = 1;
 }
 
+/*
+** Begin constructing a gzip file that is compressed using nThread
+** worker threads.  If nThread is 1 or less this is the same as
+** gzip_begin().
+*/
+void gzip_begin_parallel(sqlite3_int64 now, int nThread){
+  gzip_begin(now);
+  if( nThread>1 ){
+    gzip.pPool = threadpool_new(nThread);
+    gzip.mxBlock = nThread*2;
+    gzip.aBlock = fossil_malloc( sizeof(gzip.aBlock[0])*gzip.mxBlock );
+    gzip.nBlock = 0;
+    gzip.nDict = 0;
+    gzip.nIn = 0;
+    blob_zero(&gzip.pending);
+  }
+}
+
+/*
+** Compress one block.  This runs on a worker thread.
+*/
+static void gzip_deflate_block(void *pArg){
+  struct gzip_block *p = (struct gzip_block*)pArg;
+  z_stream stream;
+  int nOut;
+
+  memset(&stream, 0, sizeof(stream));
+  deflateInit2(&stream, 9, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY);
+  if( p->nDict>0 ){
+    deflateSetDictionary(&stream, (unsigned char*)p->zDict, p->nDict);
+  }
+  stream.avail_in = blob_size(&p->in);
+  stream.next_in = (unsigned char*)blob_buffer(&p->in);
+  nOut = deflateBound(&stream, blob_size(&p->in)) + 16;
+  blob_zero(&p->out);
+  blob_resize(&p->out, nOut);
+  for(;;){
+    stream.avail_out = nOut - stream.total_out;
+    stream.next_out = (unsigned char*)blob_buffer(&p->out) + stream.total_out;
+    deflate(&stream, p->isLast ? Z_FINISH : Z_SYNC_FLUSH);
+    if( stream.avail_out>0 ) break;
+    nOut *= 2;
+    blob_resize(&p->out, nOut);
+  }
+  blob_resize(&p->out, stream.total_out);
+  deflateEnd(&stream);
+  p->iCRC = crc32(0, (unsigned char*)blob_buffer(&p->in), blob_size(&p->in));
+}
+
+/*
+** Compress all waiting blocks on the worker threads, then append the
+** results to the output in order.
+*/
+static void gzip_run_blocks(void){
+  int i;
+  for(i=0; i<gzip.nBlock; i++){
+    struct gzip_block *p = &gzip.aBlock[i];
+    if( i==0 ){
+      p->zDict = gzip.aDict;
+      p->nDict = gzip.nDict;
+    }else{
+      Blob *pPrev = &gzip.aBlock[i-1].in;
+      p->nDict = blob_size(pPrev)<GZIP_DICT_SZ ? blob_size(pPrev) : GZIP_DICT_SZ;
+      p->zDict = blob_buffer(pPrev) + blob_size(pPrev) - p->nDict;
+    }
+    threadpool_add(gzip.pPool, gzip_deflate_block, p);
+  }
+  threadpool_wait(gzip.pPool);
+  for(i=0; i<gzip.nBlock; i++){
+    struct gzip_block *p = &gzip.aBlock[i];
+    int n = blob_size(&p->in);
+    blob_append(&gzip.out, blob_buffer(&p->out), blob_size(&p->out));
+    gzip.iCRC = crc32_combine(gzip.iCRC, p->iCRC, n);
+    gzip.nIn += n;
+    if( i==gzip.nBlock-1 && n>=GZIP_DICT_SZ ){
+      memcpy(gzip.aDict, blob_buffer(&p->in)+n-GZIP_DICT_SZ, GZIP_DICT_SZ);
+      gzip.nDict = GZIP_DICT_SZ;
+    }
+    blob_reset(&p->in);
+    blob_reset(&p->out);
+  }
+  gzip.nBlock = 0;
+}
+
+/*
+** Make the pending input into a new block.
+*/
+static void gzip_add_block(int isLast){
+  struct gzip_block *p = &gzip.aBlock[gzip.nBlock++];
+  p->in = gzip.pending;
+  blob_zero(&gzip.pending);
+  p->isLast = isLast;
+  if( gzip.nBlock>=gzip.mxBlock ) gzip_run_blocks();
+}
+
+/*
+** Add nIn bytes of content to a gzip file that is being compressed in
+** parallel.
+*/
+static void gzip_step_parallel(const char *pIn, int nIn){
+  while( nIn>0 ){
+    int n = GZIP_BLOCK_SZ - blob_size(&gzip.pending);
+    if( n>nIn ) n = nIn;
+    blob_append(&gzip.pending, pIn, n);
+    pIn += n;
+    nIn -= n;
+    if( blob_size(&gzip.pending)>=GZIP_BLOCK_SZ ) gzip_add_block(0);
+  }
+}
+
 /*
 ** Add nIn bytes of content from pIn to the gzip file.
 */
@@ -75,7 +218,11 @@ void gzip_begin(sqlite3_int64 now){
 void gzip_step(const char *pIn, int nIn){
   char *zOutBuf;
   int nOut;
-  
+
+  if( gzip.pPool ){
+    gzip_step_parallel(pIn, nIn);
+    return;
+  }
   nOut = nIn + nIn/10 + 100;
   if( nOut<100000 ) nOut = 100000;
   zOutBuf = fossil_malloc(nOut);
@@ -100,16 +247,40 @@ void gzip_step(const char *pIn, int nIn){
   fossil_free(zOutBuf);
 }
 
+/*
+** Move the compressed output generated so far into *pOut, which must
+** be uninitialized.  The gzip file continues with the next gzip_step().
+** This lets the file be sent in pieces without holding all of it in
+** memory.
+*/
+void gzip_take(Blob *pOut){
+  assert( gzip.eState>0 );
+  *pOut = gzip.out;
+  blob_zero(&gzip.out);
+}
+
 /*
 ** Finish the gzip file and put the content in *pOut
 */
 void gzip_finish(Blob *pOut){
   char aTrailer[8];
+  i64 nIn;
   assert( gzip.eState>0 );
-  gzip_step("", 0);
-  deflateEnd(&gzip.stream);
+  if( gzip.pPool ){
+    gzip_add_block(1);
+    gzip_run_blocks();
+    threadpool_free(gzip.pPool);
+    gzip.pPool = 0;
+    fossil_free(gzip.aBlock);
+    gzip.aBlock = 0;
+    nIn = gzip.nIn;
+  }else{
+    gzip_step("", 0);
+    deflateEnd(&gzip.stream);
+    nIn = gzip.stream.total_in;
+  }
   put32(aTrailer, gzip.iCRC);
-  put32(&aTrailer[4], gzip.stream.total_in);
+  put32(&aTrailer[4], (int)(nIn & 0xffffffff));
   blob_append(&gzip.out, aTrailer, 8);
   *pOut = gzip.out;
   blob_zero(&gzip.out);
@@ -100,7 +100,7 @@ static void http_build_header(Blob *pPayload, Blob *pHdr){
   }else{
     zSep = "/";
   }
-  blob_appendf(pHdr, "POST %s%sxfer/xfer HTTP/1.0\r\n", g.urlPath, zSep);
+  blob_appendf(pHdr, "POST %s%sxfer/xfer HTTP/1.1\r\n", g.urlPath, zSep);
   if( g.urlProxyAuth ){
     blob_appendf(pHdr, "Proxy-Authorization: %s\r\n", g.urlProxyAuth);
   }
@@ -122,29 +122,107 @@ static void http_build_header(Blob *pPayload, Blob *pHdr){
   blob_appendf(pHdr, "Content-Length: %d\r\n\r\n", blob_size(pPayload));
 }
 
+/*
+** State of the content of the reply being read by http_read_content()
+*/
+static int isChunkedReply = 0;    /* True if chunked transfer encoding */
+static int nContentLeft = 0;      /* Bytes left in the content or chunk */
+static int closeAfterReply = 0;   /* Close the connection after the reply */
+static int replyDone = 1;         /* True when all content has been read */
+static int replyCut = 0;          /* True if the connection failed early */
+
+/*
+** True if the request most recently sent by http_exchange_begin() went
+** over a persistent connection left open by an earlier request.
+*/
+static int wasOpen = 0;
+
+/*
+** Timing of the most recent exchange, for http_exchange_stats()
+*/
+static sqlite3_int64 msSent = 0;     /* When the request was sent */
+static sqlite3_int64 msHeader = 0;   /* When the reply header arrived */
+static sqlite3_int64 msDone = 0;     /* When the reply content arrived */
+static int nReplyWire = 0;           /* Size of the content as sent */
+
+/*
+** Called once all content of the reply has been read.  Close the
+** connection to the server if appropriate.
+*/
+static void http_reply_done(void){
+  if( replyDone ) return;
+  replyDone = 1;
+  msDone = fossil_wallclock_ms();
+  if( closeAfterReply ){
+    transport_close(GLOBAL_URL());
+  }else{
+    transport_rewind(GLOBAL_URL());
+  }
+}
+
+/*
+** Read up to N more bytes of the content of the reply into zBuf, undoing
+** any chunked transfer encoding.  Return the number of bytes read, 0
+** once all the content has been read, or -1 if the connection failed
+** before the end of the content.
+**
+** The reply is finished with as soon as its last byte has been read, so
+** that the connection can carry the next request while the end of this
+** reply is still being processed.
+*/
+static int http_read_content(void *NotUsed, char *zBuf, int N){
+  int got;
+  if( replyDone ) return replyCut ? -1 : 0;
+  if( nContentLeft<=0 ){
+    http_reply_done();
+    return 0;
+  }
+  if( N>nContentLeft ) N = nContentLeft;
+  got = transport_receive(GLOBAL_URL(), zBuf, N);
+  if( got<=0 ){
+    closeAfterReply = 1;
+    replyCut = 1;
+    http_reply_done();
+    return -1;
+  }
+  nContentLeft -= got;
+  nReplyWire += got;
+  if( nContentLeft==0 && isChunkedReply ){
+    /* The server sends the size of the next chunk right after this one,
+    ** and a size of zero after the last one */
+    char *zLine;
+    transport_receive_line(GLOBAL_URL());   /* CRLF after the chunk */
+    zLine = transport_receive_line(GLOBAL_URL());
+    if( zLine==0 ){
+      closeAfterReply = 1;
+      replyCut = 1;
+    }
+    nContentLeft = zLine ? (int)strtol(zLine, 0, 16) : 0;
+    if( nContentLeft<=0 ){
+      /* Skip any trailer headers up to the final blank line */
+      while( zLine && (zLine = transport_receive_line(GLOBAL_URL()))!=0
+             && zLine[0]!=0 ){}
+    }
+  }
+  if( nContentLeft<=0 ) http_reply_done();
+  return got;
+}
+
 /*
 ** Sign the content in pSend, compress it, and send it to the server
-** via HTTP or HTTPS.  Get a reply, uncompress the reply, and store the reply
-** in pRecv.  pRecv is assumed to be uninitialized when
-** this routine is called - this routine will initialize it.
+** via HTTP or HTTPS, without waiting for the reply.  The reply is
+** collected later by http_exchange_end().  Return 0 on success.
 **
-** The server address is contain in the "g" global structure.  The
-** url_parse() routine should have been called prior to this routine
-** in order to fill this structure appropriately.
+** Sending the next request before the reply to the current one has
+** been processed lets the server work on it in the meantime.  Requests
+** are answered in the order they were sent.
 */
-int http_exchange(Blob *pSend, Blob *pReply, int useLogin, int maxRedirect){
+int http_exchange_begin(Blob *pSend, int useLogin){
   Blob login;           /* The login card */
   Blob payload;         /* The complete payload including login card */
   Blob hdr;             /* The HTTP request header */
-  int closeConnection;  /* True to close the connection when done */
-  int iLength;          /* Length of the reply payload */
-  int rc = 0;           /* Result code */
-  int iHttpVersion;     /* Which version of HTTP protocol server uses */
-  char *zLine;          /* A single line of the reply header */
-  int i;                /* Loop counter */
-  int isError = 0;      /* True if the reply is an error message */
-  int isCompressed = 1; /* True if the reply is compressed */
 
+  wasOpen = transport_is_open();
   if( transport_open(GLOBAL_URL()) ){
     fossil_warning(transport_errmsg(GLOBAL_URL()));
     return 1;
@@ -190,19 +268,56 @@ int http_exchange(Blob *pSend, Blob *pReply, int useLogin, int maxRedirect){
   }
 
   /*
-  ** Send the request to the server.
+  ** Send the request to the server.  The header and payload go out in a
+  ** single write:  on a persistent connection, a small header sent by
+  ** itself would be held back by the Nagle algorithm until the server
+  ** acknowledges it, which it delays in the hope of replying first.
   */
+  blob_append(&hdr, blob_buffer(&payload), blob_size(&payload));
   transport_send(GLOBAL_URL(), &hdr);
-  transport_send(GLOBAL_URL(), &payload);
   blob_reset(&hdr);
   blob_reset(&payload);
+  msSent = fossil_wallclock_ms();
   transport_flip(GLOBAL_URL());
-  
+  return 0;
+}
+
+/*
+** Get the reply to the request pSend that was sent by
+** http_exchange_begin() and prepare pReply for reading its content,
+** which is uncompressed as it arrives.  pReply is assumed to be
+** uninitialized when this routine is called - this routine will
+** initialize it.  If the server redirects the request or has closed the
+** connection, pSend is sent again.
+**
+** The connection is closed or made ready for the next request when the
+** last of the content has been read.  xferin_close() must be called on
+** pReply even if its content is not wanted.
+*/
+int http_exchange_end(
+  Blob *pSend,
+  XferIn *pReply,
+  int useLogin,
+  int maxRedirect
+){
+  int closeConnection;  /* True to close the connection when done */
+  int iLength;          /* Length of the reply payload */
+  int rc = 0;           /* Result code */
+  int iHttpVersion;     /* Which version of HTTP protocol server uses */
+  char *zLine;          /* A single line of the reply header */
+  int i;                /* Loop counter */
+  int isError = 0;      /* True if the reply is an error message */
+  int isCompressed = 1; /* True if the reply is compressed */
+  int isChunked = 0;    /* True if the reply uses chunked encoding */
+
+  xferin_init_blob(pReply, 0);
+
   /*
   ** Read and interpret the server reply
   */
   closeConnection = 1;
   iLength = -1;
+  iHttpVersion = -1;
   while( (zLine = transport_receive_line(GLOBAL_URL()))!=0 && zLine[0]!=0 ){
     /* printf("[%s]\n", zLine); fflush(stdout); */
     if( fossil_strnicmp(zLine, "http/1.", 7)==0 ){
@@ -232,6 +347,9 @@ int http_exchange(Blob *pSend, Blob *pReply, int useLogin, int maxRedirect){
     }else if( fossil_strnicmp(zLine, "content-length:", 15)==0 ){
       for(i=15; fossil_isspace(zLine[i]); i++){}
       iLength = atoi(&zLine[i]);
+    }else if( fossil_strnicmp(zLine, "transfer-encoding:", 18)==0 ){
+      for(i=18; fossil_isspace(zLine[i]); i++){}
+      isChunked = fossil_strnicmp(&zLine[i], "chunked", 7)==0;
     }else if( fossil_strnicmp(zLine, "connection:", 11)==0 ){
       char c;
       for(i=11; fossil_isspace(zLine[i]); i++){}
@@ -269,7 +387,13 @@ int http_exchange(Blob *pSend, Blob *pReply, int useLogin, int maxRedirect){
       }
     }
   }
-  if( iLength<0 ){
+  if( iHttpVersion<0 && rc==0 && wasOpen ){
+    /* The server closed a persistent connection while it was idle.
+    ** Open a new connection and try again. */
+    transport_close(GLOBAL_URL());
+    return http_exchange(pSend, pReply, useLogin, maxRedirect);
+  }
+  if( iLength<0 && !isChunked ){
     fossil_fatal("server did not reply");
     goto write_err;
   }
@@ -281,14 +405,30 @@ int http_exchange(Blob *pSend, Blob *pReply, int useLogin, int maxRedirect){
   /*
   ** Extract the reply payload that follows the header
   */
-  blob_zero(pReply);
-  blob_resize(pReply, iLength);
-  iLength = transport_receive(GLOBAL_URL(), blob_buffer(pReply), iLength);
-  blob_resize(pReply, iLength);
+  msHeader = fossil_wallclock_ms();
+  nReplyWire = 0;
+  isChunkedReply = isChunked;
+  nContentLeft = iLength;
+  closeAfterReply = closeConnection;
+  replyDone = 0;
+  replyCut = 0;
+  if( isChunked ){
+    zLine = transport_receive_line(GLOBAL_URL());
+    nContentLeft = zLine ? (int)strtol(zLine, 0, 16) : 0;
+    if( nContentLeft<=0 ){
+      while( zLine && (zLine = transport_receive_line(GLOBAL_URL()))!=0
+             && zLine[0]!=0 ){}
+    }
+  }
   if( isError ){
-    char *z;
-    int i, j;
-    z = blob_str(pReply);
+    Blob err;
+    char *z, zBuf[16384];
+    int i, j, got;
+    blob_zero(&err);
+    while( (got = http_read_content(0, zBuf, sizeof(zBuf)))>0 ){
+      blob_append(&err, zBuf, got);
+    }
+    z = blob_str(&err);
     for(i=j=0; z[i]; i++, j++){
       if( z[i]=='<' ){
         while( z[i] && z[i]!='>' ) i++;
@@ -299,23 +439,8 @@ int http_exchange(Blob *pSend, Blob *pReply, int useLogin, int maxRedirect){
     z[j] = 0;
     fossil_fatal("server sends error: %s", z);
   }
-  if( isCompressed ) blob_uncompress(pReply, pReply);
-
-  /*
-  ** Close the connection to the server if appropriate.
-  **
-  ** FIXME:  There is some bug in the lower layers that prevents the
-  ** connection from remaining open.  The easiest fix for now is to
-  ** simply close and restart the connection for each round-trip.
-  **
-  ** For SSH we will leave the connection open.
-  */
-  if( ! g.urlIsSsh ) closeConnection = 1; /* FIX ME */
-  if( closeConnection ){
-    transport_close(GLOBAL_URL());
-  }else{
-    transport_rewind(GLOBAL_URL());
-  }
+  xferin_init(pReply, http_read_content, 0, isChunked ? -1 : iLength,
+              isCompressed);
   return 0;
 
   /* 
@@ -325,3 +450,29 @@ write_err:
   transport_close(GLOBAL_URL());
   return 1;  
 }
+
+/*
+** Report on the most recent exchange.  *pmsWait is the number of
+** milliseconds from sending the request until the reply header arrived,
+** *pmsXfer is the milliseconds spent receiving the content of the reply,
+** and *pnByte is the size of that content as sent.
+*/
+void http_exchange_stats(int *pmsWait, int *pmsXfer, int *pnByte){
+  *pmsWait = (int)(msHeader - msSent);
+  *pmsXfer = (int)(msDone - msHeader);
+  *pnByte = nReplyWire;
+}
+
+/*
+** Sign the content in pSend, compress it, and send it to the server
+** via HTTP or HTTPS.  Get a reply and prepare pReply for reading it, as
+** described for http_exchange_end().
+**
+** The server address is contain in the "g" global structure.  The
+** url_parse() routine should have been called prior to this routine
+** in order to fill this structure appropriately.
+*/
+int http_exchange(Blob *pSend, XferIn *pReply, int useLogin, int maxRedirect){
+  if( http_exchange_begin(pSend, useLogin) ) return 1;
+  return http_exchange_end(pSend, pReply, useLogin, maxRedirect);
+}
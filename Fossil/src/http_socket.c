@@ -33,6 +33,7 @@
 #  include <ws2tcpip.h>
 #else
 #  include <netinet/in.h>
+#  include <netinet/tcp.h>
 #  include <arpa/inet.h>
 #  include <sys/socket.h>
 #  include <netdb.h>
@@ -174,6 +175,12 @@ int socket_open(UrlData *pUrlData){
     socket_close();
     return 1;
   }
+  {
+    /* Each request is sent with a single write.  Do not let the Nagle
+    ** algorithm hold it back on a persistent connection. */
+    int opt = 1;
+    setsockopt(iSocket, IPPROTO_TCP, TCP_NODELAY, (char*)&opt, sizeof(opt));
+  }
 #if !defined(_WIN32)
   signal(SIGPIPE, SIG_IGN);
 #endif
@@ -197,9 +204,11 @@ size_t socket_send(void *NotUsed, void *pContent, size_t N){
 }
 
 /*
-** Receive content back from the open socket connection.
+** Receive content back from the open socket connection.  If bPartial
+** is true, return as soon as some content has arrived rather than
+** waiting for all N bytes.
 */
-size_t socket_receive(void *NotUsed, void *pContent, size_t N){
+size_t socket_receive(void *NotUsed, void *pContent, size_t N, int bPartial){
   ssize_t got;
   size_t total = 0;
   while( N>0 ){
@@ -209,6 +218,7 @@ size_t socket_receive(void *NotUsed, void *pContent, size_t N){
     total += (size_t)got;
     N -= (size_t)got;
     pContent = (void*)&((char*)pContent)[got];
+    if( bPartial ) break;
   }
   return total;
 }
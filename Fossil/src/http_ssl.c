@@ -390,9 +390,11 @@ size_t ssl_send(void *NotUsed, void *pContent, size_t N){
 }
 
 /*
-** Receive content back from the SSL connection.
+** Receive content back from the SSL connection.  If bPartial is true,
+** return as soon as some content has arrived rather than waiting for
+** all N bytes.
 */
-size_t ssl_receive(void *NotUsed, void *pContent, size_t N){
+size_t ssl_receive(void *NotUsed, void *pContent, size_t N, int bPartial){
   size_t got;
   size_t total = 0;
   while( N>0 ){
@@ -401,6 +403,7 @@ size_t ssl_receive(void *NotUsed, void *pContent, size_t N){
     total += got;
     N -= got;
     pContent = (void*)&((char*)pContent)[got];
+    if( bPartial ) break;
   }
   return total;
 }
@@ -182,6 +182,13 @@ int transport_open(UrlData *pUrlData){
   return rc;
 }
 
+/*
+** Return true if a connection to the server is currently open
+*/
+int transport_is_open(void){
+  return transport.isOpen;
+}
+
 /*
 ** Close the current connection
 */
@@ -292,9 +299,12 @@ void transport_rewind(UrlData *pUrlData){
 
 /*
 ** Read N bytes of content directly from the wire and write into
-** the buffer.
+** the buffer.  If bPartial is true, return as soon as some content has
+** arrived, which might be less than N bytes.  A persistent connection
+** does not end after the reply, so waiting for more content than the
+** server is sending would block forever.
 */
-static int transport_fetch(UrlData *pUrlData, char *zBuf, int N){
+static int transport_fetch(UrlData *pUrlData, char *zBuf, int N, int bPartial){
   int got;
   if( sshIn ){
     int x;
@@ -305,17 +315,18 @@ static int transport_fetch(UrlData *pUrlData, char *zBuf, int N){
       if( x<=0 ) break;
       got += x;
       wanted -= x;
+      if( bPartial ) break;
     }
   }else if( pUrlData->isHttps ){
     #ifdef FOSSIL_ENABLE_SSL
-    got = ssl_receive(0, zBuf, N);
+    got = ssl_receive(0, zBuf, N, bPartial);
     #else
     got = 0;
     #endif
   }else if( pUrlData->isFile ){
     got = fread(zBuf, 1, N, transport.pFile);
   }else{
-    got = socket_receive(0, zBuf, N);
+    got = socket_receive(0, zBuf, N, bPartial);
   }
   /* printf("received %d of %d bytes\n", got, N); fflush(stdout); */
   if( transport.pLog ){
@@ -353,7 +364,7 @@ int transport_receive(UrlData *pUrlData, char *zBuf, int N){
     nByte += toMove;
   }
   if( N>0 ){
-    int got = transport_fetch(pUrlData, zBuf, N);
+    int got = transport_fetch(pUrlData, zBuf, N, 0);
     if( got>0 ){
       nByte += got;
       transport.nRcvd += got;
@@ -390,7 +401,7 @@ static void transport_load_buffer(UrlData *pUrlData, int N){
     transport.pBuf = pNew;
   }
   if( N>0 ){
-    i = transport_fetch(pUrlData, &transport.pBuf[transport.nUsed], N);
+    i = transport_fetch(pUrlData, &transport.pBuf[transport.nUsed], N, 1);
     if( i>0 ){
       transport.nRcvd += i;
       transport.nUsed += i;
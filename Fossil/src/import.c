@@ -129,38 +129,26 @@ static void import_reset(int freeAll){
 **
 ** If saveUuid is true, then pContent is a commit record.  Record its
 ** UUID in gg.zPrevCheckin.
+**
+** The artifact is queued by content_batch_put(), which takes over
+** pContent, so the xmark.trid field is not filled in until the import
+** is finished.
 */
-static int fast_insert_content(Blob *pContent, const char *zMark, int saveUuid){
+static void fast_insert_content(Blob *pContent, const char *zMark, int saveUuid){
   Blob hash;
-  Blob cmpr;
-  int rid;
 
   sha1sum_blob(pContent, &hash);
-  rid = db_int(0, "SELECT rid FROM blob WHERE uuid=%B", &hash);
-  if( rid==0 ){
-    static Stmt ins;
-    db_static_prepare(&ins,
-        "INSERT INTO blob(uuid, size, content) VALUES(:uuid, :size, :content)"
-    );
-    db_bind_text(&ins, ":uuid", blob_str(&hash));
-    db_bind_int(&ins, ":size", gg.nData);
-    blob_compress(pContent, &cmpr);
-    db_bind_blob(&ins, ":content", &cmpr);
-    db_step(&ins);
-    db_reset(&ins);
-    blob_reset(&cmpr);
-    rid = db_last_insert_rowid();
-  }
+  content_batch_put(pContent, blob_str(&hash), 0, 0, 0, 0);
   if( zMark ){
     db_multi_exec(
-        "INSERT OR IGNORE INTO xmark(tname, trid, tuuid)"
-        "VALUES(%Q,%d,%B)",
-        zMark, rid, &hash
+        "INSERT OR IGNORE INTO xmark(tname, tuuid)"
+        "VALUES(%Q,%B)",
+        zMark, &hash
     );
     db_multi_exec(
-        "INSERT OR IGNORE INTO xmark(tname, trid, tuuid)"
-        "VALUES(%B,%d,%B)",
-        &hash, rid, &hash
+        "INSERT OR IGNORE INTO xmark(tname, tuuid)"
+        "VALUES(%B,%B)",
+        &hash, &hash
     );
   }
   if( saveUuid ){
@@ -168,7 +156,6 @@ static int fast_insert_content(Blob *pContent, const char *zMark, int saveUuid){
     gg.zPrevCheckin = fossil_strdup(blob_str(&hash));
   }
   blob_reset(&hash);
-  return rid;
 }
 
 /*
@@ -419,6 +406,7 @@ static void import_prior_files(void){
      gg.zPrevCheckin = 0;
   }
   if( gg.zFrom==0 ) return;
+  content_batch_flush();
   rid = fast_uuid_to_rid(gg.zFrom);
   if( rid==0 ) return;
   p = manifest_get(rid, CFTYPE_MANIFEST, 0);
@@ -793,6 +781,7 @@ void git_import_cmd(void){
 
   db_begin_transaction();
   if( !incrFlag ) db_initial_setup(0, 0, 0, 1);
+  content_batch_begin(0, 0);
   git_fast_import(pIn);
   db_prepare(&q, "SELECT tcontent FROM xtag");
   while( db_step(&q)==SQLITE_ROW ){
@@ -802,6 +791,12 @@ void git_import_cmd(void){
     import_reset(0);
   }
   db_finalize(&q);
+  content_batch_end();
+  db_multi_exec(
+    "UPDATE xmark SET trid=(SELECT rid FROM blob WHERE uuid=tuuid)"
+  );
+  /* The rebuild that follows reads every artifact anyway */
+  verify_cancel();
   db_end_transaction(0);
   db_begin_transaction();
   fossil_print("Rebuilding repository meta-data...\n");
@@ -302,7 +302,7 @@ static void append_diff(
 ){
   int fromid;
   int toid;
-  Blob from, to, out;
+  Blob from, to;
   if( zFrom ){
     fromid = uuid_to_rid(zFrom, 0);
     content_get(fromid, &from);
@@ -315,20 +315,19 @@ static void append_diff(
   }else{
     blob_zero(&to);
   }
-  blob_zero(&out);
   if( diffFlags & DIFF_SIDEBYSIDE ){
-    text_diff(&from, &to, &out, pRe, diffFlags | DIFF_HTML | DIFF_NOTTOOBIG);
-    @ %s(blob_str(&out))
+    diff_print_text(&from, &to, pRe, diffFlags | DIFF_HTML | DIFF_NOTTOOBIG,
+                    0, 0);
+    @
   }else{
-    text_diff(&from, &to, &out, pRe,
-           diffFlags | DIFF_LINENO | DIFF_HTML | DIFF_NOTTOOBIG);
     @ <pre class="udiff">
-    @ %s(blob_str(&out))
+    diff_print_text(&from, &to, pRe,
+           diffFlags | DIFF_LINENO | DIFF_HTML | DIFF_NOTTOOBIG, 0, 0);
+    @
     @ </pre>
   }
   blob_reset(&from);
   blob_reset(&to);
-  blob_reset(&out);
 }
 
 /*
@@ -452,6 +451,11 @@ u64 construct_diff_flags(int verboseFlag, int sideBySide){
 
     /* The "noopt" parameter disables diff optimization */
     if( PD("noopt",0)!=0 ) diffFlags |= DIFF_NOOPT;
+
+    /* "algorithm=histogram" selects the histogram diff algorithm */
+    if( fossil_strcmp(PD("algorithm",""),"histogram")==0 ){
+      diffFlags |= DIFF_HISTOGRAM;
+    }
   }
   return diffFlags;
 }
@@ -708,6 +712,8 @@ void ci_page(void){
        rid, rid
     );
     diffFlags = construct_diff_flags(verboseFlag, sideBySide);
+    diff_begin_page();
+    if( diffFlags ) diff_begin_threads(threadpool_size(0));
     while( db_step(&q3)==SQLITE_ROW ){
       const char *zName = db_column_text(&q3,0);
       int mperm = db_column_int(&q3, 1);
@@ -716,6 +722,7 @@ void ci_page(void){
       const char *zOldName = db_column_text(&q3, 4);
       append_file_change_line(zName, zOld, zNew, zOldName, diffFlags,pRe,mperm);
     }
+    diff_end_threads();
     db_finalize(&q3);
   }
   append_diff_javascript(sideBySide);
@@ -1004,6 +1011,8 @@ void vdiff_page(void){
   manifest_file_rewind(pTo);
   pFileTo = manifest_file_next(pTo, 0);
   diffFlags = construct_diff_flags(verboseFlag, sideBySide);
+  diff_begin_page();
+  if( diffFlags ) diff_begin_threads(threadpool_size(0));
   while( pFileFrom || pFileTo ){
     int cmp;
     if( pFileFrom==0 ){
@@ -1035,6 +1044,7 @@ void vdiff_page(void){
       pFileTo = manifest_file_next(pTo, 0);
     }
   }
+  diff_end_threads();
   manifest_destroy(pFrom);
   manifest_destroy(pTo);
   append_diff_javascript(sideBySide);
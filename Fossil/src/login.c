@@ -1069,6 +1069,20 @@ void login_replace_capabilities(const char *zCap, unsigned flags){
   login_anon_once = 1;
 }
 
+/*
+** Forget the login and capabilities of the current request, so that
+** login_check_credentials() runs again for the next request on a
+** persistent connection.
+*/
+void login_reset(void){
+  memset(&g.perm, 0, sizeof(g.perm));
+  g.userUid = 0;
+  g.zLogin = 0;
+  g.isHuman = 0;
+  g.noPswd = 0;
+  login_anon_once = 1;
+}
+
 /*
 ** If the current login lacks any of the capabilities listed in
 ** the input, then return 0.  If all capabilities are present, then
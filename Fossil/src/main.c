@@ -1731,6 +1731,25 @@ static void find_server_repository(int disallowDir){
   }
 }
 
+/*
+** Process all requests on a single HTTP connection.  The connection
+** is kept open between requests only when a single repository is being
+** served.  When serving a directory of repositories, each request might
+** open a different repository, so the connection is closed after the
+** first reply.
+*/
+static void http_request_loop(
+  const char *zIpAddr,
+  const char *zNotFound,
+  Glob *pFileGlob
+){
+  if( g.repositoryOpen ) cgi_server_keep_alive();
+  do{
+    cgi_handle_http_request(zIpAddr);
+    process_one_web_page(zNotFound, pFileGlob);
+  }while( cgi_next_http_request() );
+}
+
 /*
 ** undocumented format:
 **
@@ -1837,7 +1856,8 @@ void cmd_http(void){
   }else if( g.fSshClient & CGI_SSH_CLIENT ){
     ssh_request_loop(zIpAddr, glob_create(zFileGlob));
   }else{
-    cgi_handle_http_request(zIpAddr);
+    http_request_loop(zIpAddr, zNotFound, glob_create(zFileGlob));
+    return;
   }
   process_one_web_page(zNotFound, glob_create(zFileGlob));
 }
@@ -1908,6 +1928,26 @@ static int binaryOnPath(const char *zBinary){
 #endif
 #endif
 
+/*
+** True if "fossil server" or "fossil ui" should refuse to serve a
+** directory of repositories.  Used by webserver_warmup().
+*/
+static int webserverDisallowDir = 0;
+
+/*
+** Find and open the repository for a "fossil server" or "fossil ui"
+** process and, when running as root, enter the chroot jail.  A process
+** from the pre-forked pool does this before it is handed a connection.
+** Later calls are no-ops.
+*/
+static void webserver_warmup(void){
+  static int isWarm = 0;
+  if( isWarm ) return;
+  isWarm = 1;
+  find_server_repository(webserverDisallowDir);
+  g.zRepositoryName = enter_chroot_jail(g.zRepositoryName);
+}
+
 /*
 ** COMMAND: server*
 ** COMMAND: ui
@@ -1956,6 +1996,10 @@ static int binaryOnPath(const char *zBinary){
 **   --notfound URL      Redirect
 **   --files GLOBLIST    Comma-separated list of glob patterns for static files
 **   --scgi              Accept SCGI rather than HTTP
+**   --workers N         Serve requests from a pool of N pre-forked worker
+**                       processes that open the repository before each
+**                       request arrives.  Linux only.  Default: fork a new
+**                       process for each connection.
 **
 ** See also: cgi, http, winsrv
 */
@@ -1970,6 +2014,8 @@ void cmd_webserver(void){
   const char *zAltBase;     /* Argument to the --baseurl option */
   const char *zFileGlob;    /* Static content must match this */
   char *zIpAddr = 0;        /* Bind to this IP address */
+  const char *zWorkers;     /* Value of the --workers option */
+  int nWorker = 0;          /* Size of the pre-forked worker pool */
 
 #if defined(_WIN32)
   const char *zStopperFile;    /* Name of file used to terminate server */
@@ -1983,6 +2029,11 @@ void cmd_webserver(void){
   zNotFound = find_option("notfound", 0, 1);
   zAltBase = find_option("baseurl", 0, 1);
   if( find_option("scgi", 0, 0)!=0 ) flags |= HTTP_SERVER_SCGI;
+  zWorkers = find_option("workers", 0, 1);
+  if( zWorkers ){
+    nWorker = atoi(zWorkers);
+    if( nWorker<0 ) fossil_fatal("--workers must not be negative");
+  }
   if( zAltBase ){
     set_base_url(zAltBase);
   }
@@ -2035,7 +2086,9 @@ void cmd_webserver(void){
     }
   }
   db_close(1);
-  if( cgi_http_server(iPort, mxPort, zBrowserCmd, zIpAddr, flags) ){
+  webserverDisallowDir = isUiCmd && zNotFound==0;
+  if( cgi_http_server(iPort, mxPort, zBrowserCmd, zIpAddr, flags,
+                      nWorker, webserver_warmup) ){
     fossil_fatal("unable to listen on TCP socket %d", iPort);
   }
   g.sslNotAvailable = 1;
@@ -2045,14 +2098,13 @@ void cmd_webserver(void){
     fprintf(stderr, "====== SERVER pid %d =======\n", getpid());
   }
   g.cgiOutput = 1;
-  find_server_repository(isUiCmd && zNotFound==0);
-  g.zRepositoryName = enter_chroot_jail(g.zRepositoryName);
+  webserver_warmup();
   if( flags & HTTP_SERVER_SCGI ){
     cgi_handle_scgi_request();
+    process_one_web_page(zNotFound, glob_create(zFileGlob));
   }else{
-    cgi_handle_http_request(0);
+    http_request_loop(0, zNotFound, glob_create(zFileGlob));
   }
-  process_one_web_page(zNotFound, glob_create(zFileGlob));
 #else
   /* Win32 implementation */
   if( isUiCmd ){
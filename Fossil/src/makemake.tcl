@@ -26,12 +26,14 @@ set src {
   blob
   branch
   browse
+  cache
   captcha
   cgi
   checkin
   checkout
   clearsign
   clone
+  clonepack
   comformat
   configure
   content
@@ -81,6 +83,7 @@ set src {
   merge
   merge3
   moderate
+  monitor
   name
   path
   pivot
@@ -105,6 +108,7 @@ set src {
   tag
   tar
   th_main
+  threadpool
   timeline
   tkt
   tktsetup
@@ -123,6 +127,7 @@ set src {
   winhttp
   wysiwyg
   xfer
+  xferin
   xfersetup
   zip
   http_ssl
@@ -137,8 +142,8 @@ set SQLITE_OPTIONS {
   -DSQLITE_DEFAULT_FILE_FORMAT=4
   -DSQLITE_OMIT_DEPRECATED
   -DSQLITE_ENABLE_EXPLAIN_COMMENTS
+  -DSQLITE_ENABLE_FTS4
 }
-#lappend SQLITE_OPTIONS -DSQLITE_ENABLE_FTS3=1
 #lappend SQLITE_OPTIONS -DSQLITE_ENABLE_STAT4
 #lappend SQLITE_OPTIONS -DSQLITE_WIN32_NO_ANSI
 #lappend SQLITE_OPTIONS -DSQLITE_WINNT_MAX_PATH_CHARS=4096
@@ -1822,6 +1822,7 @@ int manifest_crosslink(int rid, Blob *pContent, int flags){
     sqlite3_snprintf(sizeof(zLength), zLength, "%d", nWiki);
     tag_insert(zTag, 1, zLength, rid, p->rDate, rid);
     free(zTag);
+    search_doc_touch('w', rid, p->zWikiTitle);
     prior = db_int(0,
       "SELECT rid FROM tagxref"
       " WHERE tagid=%d AND mtime<%.17g"
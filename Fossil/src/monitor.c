@@ -0,0 +1,613 @@
+/*
+** Copyright (c) 2013 D. Richard Hipp
+**
+** This program is free software; you can redistribute it and/or
+** modify it under the terms of the Simplified BSD License (also
+** known as the "2-Clause License" or "FreeBSD License".)
+
+** This program is distributed in the hope that it will be useful,
+** but without any warranty; without even the implied warranty of
+** merchantability or fitness for a particular purpose.
+**
+** Author contact information:
+**   drh@hwaci.com
+**   http://www.hwaci.com/drh/
+**
+*******************************************************************************
+**
+** This file implements the "monitor" command, a long-running process
+** that watches a check-out for changes using Linux inotify, and the
+** routines that let vfile_check_signature() use what it records.
+**
+** The monitor keeps these things in the check-out database:
+**
+**    vvar 'monitor'          "PID TOKEN" of the running monitor.  TOKEN
+**                            is different every time a monitor starts.
+**
+**    vvar 'monitor-synced'   The TOKEN of the monitor that has been
+**                            running since the last complete scan.
+**
+**    vvar 'monitor-cookie'   Name of the last cookie file seen.
+**
+**    VDIRTY                  Pathnames that have changed on disk since
+**                            they were last checked.  A directory name
+**                            stands for everything beneath it.
+**
+**    VMONITOR                A copy of the VFILE columns that affect
+**                            vfile_check_signature(), as they were when
+**                            each entry was last checked.  Entries that
+**                            differ from VFILE were changed by some other
+**                            command and need to be checked again.
+**
+** Inotify events are delivered in order.  So a command that wants to know
+** about every change up to now creates a cookie file in the root of the
+** check-out and waits for the monitor to record its name.  Once that
+** happens, all earlier changes are in VDIRTY.
+**
+** If the monitor is not running, is too slow to answer, or lost events
+** because the kernel queue overflowed, the full scan is used instead.
+*/
+#include "config.h"
+#include "monitor.h"
+
+#ifdef __linux__
+# include <errno.h>
+# include <sys/inotify.h>
+# include <poll.h>
+# include <signal.h>
+# include <dirent.h>
+# include <sys/stat.h>
+# include <unistd.h>
+#endif
+
+/*
+** The names of cookie files start with this prefix.
+*/
+#define MONITOR_COOKIE  ".fslmonitor-"
+
+/*
+** How long to wait for the monitor to acknowledge a cookie, in
+** milliseconds, before falling back to a full scan.
+*/
+#define MONITOR_SYNC_TIMEOUT  2000
+
+/*
+** SQL code to implement the tables used by the monitor.
+*/
+static const char zMonitorInit[] =
+@ CREATE TABLE IF NOT EXISTS %s.vdirty(
+@   id INTEGER PRIMARY KEY,          -- Order in which changes were seen
+@   pathname TEXT                    -- File or directory that changed
+@ );
+@ CREATE TABLE IF NOT EXISTS %s.vmonitor(
+@   id INTEGER PRIMARY KEY,          -- VFILE.ID
+@   vid INTEGER,                     -- VFILE columns when last checked
+@   rid INTEGER,
+@   mrid INTEGER,
+@   deleted BOOLEAN,
+@   chnged INT,
+@   mtime INTEGER,
+@   pathname TEXT
+@ );
+;
+
+/*
+** The value of vvar 'monitor' seen by monitor_sync(), or NULL.
+*/
+static char *zSyncToken = 0;
+
+#ifdef __linux__
+/*
+** Names of the check-out database files
+*/
+static const char *const azDbName[] = { "_FOSSIL_", ".fslckout", ".fos" };
+
+/*
+** Remove everything the monitor stores in the check-out database.
+*/
+static void monitor_reset(void){
+  db_multi_exec(
+    "DELETE FROM vvar WHERE name GLOB 'monitor*';"
+    "DROP TABLE IF EXISTS vdirty;"
+    "DROP TABLE IF EXISTS vmonitor;"
+  );
+}
+
+/*
+** Return the process ID of the running monitor or 0 if there is none.
+** Forget about a monitor that went away without cleaning up.
+*/
+static int monitor_pid(void){
+  int pid = db_lget_int("monitor", 0);
+  if( pid>0 && kill(pid, 0)!=0 && errno==ESRCH ){
+    monitor_reset();
+    pid = 0;
+  }
+  return pid;
+}
+#endif /* __linux__ */
+
+/*
+** Wait for the monitor to record every change made to the check-out up
+** to this point.  Return the largest VDIRTY.ID that may be cleared once
+** the files have been checked, or -1 if the monitor cannot be used and
+** every file must be checked.
+**
+** This must be called outside of a transaction, since the monitor
+** needs to write to the database while we wait.
+*/
+int monitor_sync(void){
+#ifdef __linux__
+  char *zCookie;
+  char *zName;
+  FILE *out;
+  int i;
+  int iDirty = -1;
+
+  fossil_free(zSyncToken);
+  zSyncToken = 0;
+  if( !g.localOpen || db_transaction_nesting_depth()>0 ) return -1;
+  if( monitor_pid()==0 ) return -1;
+  zSyncToken = db_lget("monitor", 0);
+  zName = mprintf("%s%d", MONITOR_COOKIE, getpid());
+  zCookie = mprintf("%s%s", g.zLocalRoot, zName);
+  out = fossil_fopen(zCookie, "wb");
+  if( out ){
+    fclose(out);
+    for(i=0; i<MONITOR_SYNC_TIMEOUT; i+=5){
+      char *zSeen = db_lget("monitor-cookie", 0);
+      int done = fossil_strcmp(zSeen, zName)==0;
+      fossil_free(zSeen);
+      if( done ){
+        iDirty = db_int(0, "SELECT max(id) FROM vdirty");
+        break;
+      }
+      sqlite3_sleep(5);
+    }
+    file_delete(zCookie);
+  }
+  fossil_free(zCookie);
+  fossil_free(zName);
+  return iDirty;
+#else
+  return -1;
+#endif
+}
+
+/*
+** Fill the temporary table VMONITOR_ID with the VFILE.ID of every entry
+** of check-out vid that might have changed according to the monitor.
+** Return 1 if only those entries need to be checked, or 0 if every
+** entry must be checked because the monitor has not yet seen a complete
+** scan.
+**
+** This must follow a successful call to monitor_sync() and run inside
+** the same transaction as the check.
+*/
+int monitor_select_changed(int vid){
+  char *zSynced = db_lget("monitor-synced", 0);
+  int isPartial = zSyncToken!=0 && fossil_strcmp(zSynced, zSyncToken)==0;
+  fossil_free(zSynced);
+  if( !isPartial ) return 0;
+  db_multi_exec(
+    "CREATE TEMP TABLE IF NOT EXISTS vmonitor_id(id INTEGER PRIMARY KEY);"
+    "DELETE FROM vmonitor_id;"
+    "INSERT OR IGNORE INTO vmonitor_id"
+    " SELECT id FROM vfile WHERE vid=%d AND NOT EXISTS("
+    "   SELECT 1 FROM vmonitor m WHERE m.id=vfile.id"
+    "      AND m.vid IS vfile.vid AND m.rid IS vfile.rid"
+    "      AND m.mrid IS vfile.mrid AND m.deleted IS vfile.deleted"
+    "      AND m.chnged IS vfile.chnged AND m.mtime IS vfile.mtime"
+    "      AND m.pathname IS vfile.pathname);"
+    "INSERT OR IGNORE INTO vmonitor_id"
+    " SELECT vfile.id FROM vdirty CROSS JOIN vfile"
+    "  WHERE vfile.pathname=vdirty.pathname AND vfile.vid=%d;"
+    "INSERT OR IGNORE INTO vmonitor_id"
+    " SELECT vfile.id FROM vdirty CROSS JOIN vfile"
+    "  WHERE vfile.pathname>vdirty.pathname||'/'"
+    "    AND vfile.pathname<vdirty.pathname||'0' AND +vfile.vid=%d;",
+    vid, vid, vid
+  );
+  return 1;
+}
+
+/*
+** Record that the entries of check-out vid have been checked, either
+** all of them or, if isPartial is true, those in VMONITOR_ID.  Changes
+** numbered iDirty or less are no longer needed.
+*/
+void monitor_checked(int vid, int iDirty, int isPartial){
+  static const char zCols[] =
+     "id, vid, rid, mrid, deleted, chnged, mtime, pathname";
+  char *zCurrent;
+  if( isPartial ){
+    db_multi_exec(
+      "REPLACE INTO vmonitor SELECT %s FROM vfile WHERE id IN vmonitor_id;",
+      zCols
+    );
+  }else{
+    db_multi_exec(
+      "DELETE FROM vmonitor WHERE vid=%d;"
+      "REPLACE INTO vmonitor SELECT %s FROM vfile WHERE vid=%d;",
+      vid, zCols, vid
+    );
+  }
+  db_multi_exec(
+    "DELETE FROM vmonitor WHERE id NOT IN (SELECT id FROM vfile);"
+    "DELETE FROM vdirty WHERE id<=%d;",
+    iDirty
+  );
+  zCurrent = db_lget("monitor", 0);
+  if( fossil_strcmp(zCurrent, zSyncToken)==0 ){
+    db_lset("monitor-synced", zSyncToken);
+  }
+  fossil_free(zCurrent);
+}
+
+#ifdef __linux__
+/*
+** State of the running monitor
+*/
+static struct {
+  int fd;                  /* The inotify file descriptor */
+  int nWatch;              /* Number of slots in azWatch[] */
+  char **azWatch;          /* Directory for each watch, relative to root */
+  char *zDbFile;           /* Full name of the check-out database */
+  int isPending;           /* True if MONITOR_PENDING holds anything */
+  int isOverflow;          /* True if events were lost */
+  char *zCookie;           /* Cookie to acknowledge, or NULL */
+  volatile int isStopped;  /* Set by a signal to stop the monitor */
+} mon;
+
+/*
+** Names of the check-out database files, which change all the time and
+** are of no interest.
+*/
+static int monitor_is_dbfile(const char *zName){
+  int i;
+  for(i=0; i<count(azDbName); i++){
+    int n = strlen(azDbName[i]);
+    if( strncmp(zName, azDbName[i], n)==0
+     && (zName[n]==0 || zName[n]=='-') ){
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/*
+** Signal handler that stops the monitor.
+*/
+static void monitor_stop_handler(int sig){
+  mon.isStopped = 1;
+}
+
+/*
+** Remember that zPath, relative to the root of the check-out, changed.
+*/
+static void monitor_mark(const char *zPath){
+  db_multi_exec("INSERT OR IGNORE INTO monitor_pending VALUES(%Q)", zPath);
+  mon.isPending = 1;
+}
+
+/*
+** Start watching directory zDir, relative to the root of the check-out,
+** and all directories beneath it.
+*/
+static void monitor_watch_tree(const char *zDir){
+  static const unsigned int mask =
+      IN_CREATE | IN_DELETE | IN_MODIFY | IN_ATTRIB | IN_CLOSE_WRITE
+    | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | IN_MOVE_SELF
+    | IN_ONLYDIR | IN_DONT_FOLLOW;
+  char *zFull = mprintf("%s%s", g.zLocalRoot, zDir);
+  DIR *d;
+  struct dirent *pEntry;
+  int wd;
+
+  wd = inotify_add_watch(mon.fd, zFull, mask);
+  if( wd<0 ){
+    if( errno==ENOSPC ){
+      fossil_fatal("out of inotify watches - increase "
+                   "/proc/sys/fs/inotify/max_user_watches");
+    }
+    fossil_free(zFull);
+    return;
+  }
+  if( wd>=mon.nWatch ){
+    int n = wd*2 + 100;
+    mon.azWatch = fossil_realloc(mon.azWatch, sizeof(mon.azWatch[0])*n);
+    memset(&mon.azWatch[mon.nWatch], 0, sizeof(mon.azWatch[0])*(n-mon.nWatch));
+    mon.nWatch = n;
+  }
+  fossil_free(mon.azWatch[wd]);
+  mon.azWatch[wd] = fossil_strdup(zDir);
+  d = opendir(zFull);
+  if( d ){
+    while( (pEntry = readdir(d))!=0 ){
+      const char *zName = pEntry->d_name;
+      int isDir = pEntry->d_type==DT_DIR;
+      char *zSub;
+      if( zName[0]=='.' && (zName[1]==0 || (zName[1]=='.' && zName[2]==0)) ){
+        continue;
+      }
+      zSub = zDir[0] ? mprintf("%s/%s", zDir, zName) : mprintf("%s", zName);
+      if( pEntry->d_type==DT_UNKNOWN ){
+        struct stat sStat;
+        char *zPath = mprintf("%s%s", g.zLocalRoot, zSub);
+        isDir = lstat(zPath, &sStat)==0 && S_ISDIR(sStat.st_mode);
+        fossil_free(zPath);
+      }
+      if( isDir ) monitor_watch_tree(zSub);
+      fossil_free(zSub);
+    }
+    closedir(d);
+  }
+  fossil_free(zFull);
+}
+
+/*
+** Stop watching directory zDir and everything beneath it.
+*/
+static void monitor_unwatch_tree(const char *zDir){
+  int n = strlen(zDir);
+  int i;
+  for(i=0; i<mon.nWatch; i++){
+    const char *z = mon.azWatch[i];
+    if( z && strncmp(z, zDir, n)==0 && (z[n]==0 || z[n]=='/') ){
+      inotify_rm_watch(mon.fd, i);
+      fossil_free(mon.azWatch[i]);
+      mon.azWatch[i] = 0;
+    }
+  }
+}
+
+/*
+** Handle a single inotify event.
+*/
+static void monitor_event(struct inotify_event *pEv){
+  const char *zDir;
+  char *zPath;
+  if( mon.isStopped ) return;
+  if( pEv->mask & IN_Q_OVERFLOW ){
+    /* Events were lost.  Pick up any new directories and insist on a
+    ** full scan next time. */
+    mon.isOverflow = 1;
+    monitor_watch_tree("");
+    return;
+  }
+  if( pEv->wd<0 || pEv->wd>=mon.nWatch || mon.azWatch[pEv->wd]==0 ) return;
+  zDir = mon.azWatch[pEv->wd];
+  if( pEv->mask & IN_IGNORED ){
+    fossil_free(mon.azWatch[pEv->wd]);
+    mon.azWatch[pEv->wd] = 0;
+    return;
+  }
+  if( pEv->mask & (IN_DELETE_SELF|IN_MOVE_SELF) ){
+    if( zDir[0]==0 ) mon.isStopped = 1;
+    return;
+  }
+  if( pEv->len==0 ) return;
+  if( zDir[0]==0 ){
+    if( monitor_is_dbfile(pEv->name) ){
+      if( (pEv->mask & (IN_DELETE|IN_MOVED_FROM))!=0
+       && file_size(mon.zDbFile)<0 ){
+        /* The check-out has been closed */
+        mon.isStopped = 1;
+      }
+      return;
+    }
+    if( strncmp(pEv->name, MONITOR_COOKIE, sizeof(MONITOR_COOKIE)-1)==0 ){
+      if( pEv->mask & IN_CREATE ){
+        fossil_free(mon.zCookie);
+        mon.zCookie = fossil_strdup(pEv->name);
+      }
+      return;
+    }
+    zPath = mprintf("%s", pEv->name);
+  }else{
+    zPath = mprintf("%s/%s", zDir, pEv->name);
+  }
+  if( pEv->mask & IN_ISDIR ){
+    if( pEv->mask & IN_MOVED_FROM ){
+      monitor_unwatch_tree(zPath);
+    }else if( pEv->mask & (IN_CREATE|IN_MOVED_TO) ){
+      monitor_watch_tree(zPath);
+    }
+  }
+  monitor_mark(zPath);
+  fossil_free(zPath);
+}
+
+/*
+** Copy pending changes into the database.  Return 0 on success or 1
+** if the database is busy and this should be tried again later.
+*/
+static int monitor_flush(void){
+  Blob sql;
+  int rc;
+  if( !mon.isPending && !mon.isOverflow && mon.zCookie==0 ) return 0;
+  blob_zero(&sql);
+  blob_append(&sql,
+    "INSERT INTO vdirty(pathname) SELECT pathname FROM monitor_pending;", -1);
+  if( mon.isOverflow ){
+    blob_append(&sql, "DELETE FROM vvar WHERE name='monitor-synced';", -1);
+  }
+  if( mon.zCookie ){
+    blob_appendf(&sql,
+      "REPLACE INTO vvar(name,value) VALUES('monitor-cookie',%Q);",
+      mon.zCookie);
+  }
+  /* Use sqlite3_exec() directly so that a busy database is not fatal */
+  rc = sqlite3_exec(g.db, "BEGIN IMMEDIATE", 0, 0, 0);
+  if( rc==SQLITE_OK ){
+    rc = sqlite3_exec(g.db, blob_str(&sql), 0, 0, 0);
+    if( rc==SQLITE_OK ) rc = sqlite3_exec(g.db, "COMMIT", 0, 0, 0);
+    if( rc!=SQLITE_OK ) sqlite3_exec(g.db, "ROLLBACK", 0, 0, 0);
+  }
+  blob_reset(&sql);
+  if( rc!=SQLITE_OK ) return 1;
+  db_multi_exec("DELETE FROM monitor_pending");
+  mon.isPending = 0;
+  mon.isOverflow = 0;
+  fossil_free(mon.zCookie);
+  mon.zCookie = 0;
+  return 0;
+}
+
+/*
+** Run the monitor until it is told to stop.
+*/
+static void monitor_run(int verboseFlag){
+  char *zToken;
+  int needFlush = 0;
+  int i;
+
+  mon.fd = inotify_init();
+  if( mon.fd<0 ){
+    fossil_fatal("cannot initialize inotify: %s", strerror(errno));
+  }
+  for(i=0; i<count(azDbName); i++){
+    mon.zDbFile = mprintf("%s%s", g.zLocalRoot, azDbName[i]);
+    if( file_size(mon.zDbFile)>=0 ) break;
+    fossil_free(mon.zDbFile);
+    mon.zDbFile = 0;
+  }
+  db_multi_exec(
+    "CREATE TEMP TABLE monitor_pending(pathname TEXT PRIMARY KEY);"
+  );
+  monitor_watch_tree("");
+
+  /* Changes made before the watches were in place are unknown, so the
+  ** first check after this must look at every file. */
+  db_begin_transaction();
+  monitor_reset();
+  db_multi_exec(zMonitorInit, db_name("localdb"), db_name("localdb"));
+  zToken = db_text(0, "SELECT '%d ' || lower(hex(randomblob(8)))", getpid());
+  db_lset("monitor", zToken);
+  db_end_transaction(0);
+  if( verboseFlag ){
+    int nDir = 0;
+    for(i=0; i<mon.nWatch; i++){
+      if( mon.azWatch[i] ) nDir++;
+    }
+    fossil_print("monitoring %d directories in %s\n", nDir, g.zLocalRoot);
+  }
+
+  signal(SIGINT, monitor_stop_handler);
+  signal(SIGTERM, monitor_stop_handler);
+  signal(SIGHUP, monitor_stop_handler);
+  while( !mon.isStopped ){
+    struct pollfd p;
+    int rc;
+    p.fd = mon.fd;
+    p.events = POLLIN;
+    rc = poll(&p, 1, needFlush ? 100 : -1);
+    if( rc>0 ){
+      char aBuf[65536]
+        __attribute__ ((aligned(__alignof__(struct inotify_event))));
+      int n = read(mon.fd, aBuf, sizeof(aBuf));
+      char *z;
+      for(z=aBuf; z<aBuf+n; ){
+        struct inotify_event *pEv = (struct inotify_event*)z;
+        if( verboseFlag && pEv->len>0 ){
+          fossil_print("%s%s%s\n",
+             pEv->wd>=0 && pEv->wd<mon.nWatch && mon.azWatch[pEv->wd]
+                ? mon.azWatch[pEv->wd] : "",
+             pEv->wd>=0 && pEv->wd<mon.nWatch && mon.azWatch[pEv->wd]
+                && mon.azWatch[pEv->wd][0] ? "/" : "",
+             pEv->name);
+        }
+        monitor_event(pEv);
+        z += sizeof(struct inotify_event) + pEv->len;
+      }
+    }
+    if( !mon.isStopped ) needFlush = monitor_flush();
+  }
+
+  /* Leave nothing behind unless another monitor has taken over */
+  if( file_size(mon.zDbFile)>=0 ){
+    char *zCurrent = db_lget("monitor", 0);
+    if( fossil_strcmp(zCurrent, zToken)==0 ) monitor_reset();
+    fossil_free(zCurrent);
+  }
+  close(mon.fd);
+}
+#endif /* __linux__ */
+
+/*
+** COMMAND: monitor
+**
+** Usage: %fossil monitor ?OPTIONS?
+**
+** Watch the current check-out for changes and record which files might
+** have been edited, so that "fossil status", "fossil changes" and other
+** commands that look for edited files only need to examine those files
+** rather than every file in the check-out.
+**
+** The monitor runs until it is interrupted, or until the check-out is
+** closed.  Commands fall back to examining every file whenever the
+** monitor is not running.
+**
+** This command is only available on Linux.
+**
+** Options:
+**    --detach         Run the monitor in the background
+**    --status         Report whether or not a monitor is running
+**    --stop           Stop a monitor that is running in the background
+**    -v|--verbose     Show each change as it happens
+*/
+void monitor_cmd(void){
+#ifdef __linux__
+  int detachFlag = find_option("detach", 0, 0)!=0;
+  int statusFlag = find_option("status", 0, 0)!=0;
+  int stopFlag = find_option("stop", 0, 0)!=0;
+  int verboseFlag = find_option("verbose", "v", 0)!=0;
+  int pid;
+
+  db_must_be_within_tree();
+  verify_all_options();
+  if( g.argc!=2 ) usage("?OPTIONS?");
+  pid = monitor_pid();
+  if( statusFlag ){
+    if( pid==0 ){
+      fossil_print("no monitor is running\n");
+    }else{
+      char *zSynced = db_lget("monitor-synced", 0);
+      char *zToken = db_lget("monitor", 0);
+      fossil_print("monitor running as process %d\n", pid);
+      if( fossil_strcmp(zSynced, zToken)==0 ){
+        fossil_print("%d changes pending\n",
+                     db_int(0, "SELECT count(*) FROM vdirty"));
+      }else{
+        fossil_print("waiting for the next full scan\n");
+      }
+    }
+    return;
+  }
+  if( stopFlag ){
+    if( pid==0 ) fossil_fatal("no monitor is running");
+    kill(pid, SIGTERM);
+    return;
+  }
+  if( pid ){
+    fossil_fatal("a monitor is already running as process %d", pid);
+  }
+  if( detachFlag ){
+    pid = fork();
+    if( pid<0 ) fossil_fatal("cannot fork: %s", strerror(errno));
+    if( pid>0 ){
+      fossil_print("monitor started as process %d\n", pid);
+      fflush(stdout);
+      _exit(0);
+    }
+    setsid();
+    freopen("/dev/null", "r", stdin);
+    freopen("/dev/null", "w", stdout);
+    freopen("/dev/null", "w", stderr);
+    verboseFlag = 0;
+  }
+  monitor_run(verboseFlag);
+#else
+  fossil_fatal("the monitor command requires Linux inotify");
+#endif
+}
@@ -623,8 +623,8 @@ int vxprintf(
         }else if( xtype==etDYNSTRING ){
           zExtra = bufpt;
         }
+        if( precision>=0 && (limit<0 || precision<limit) ) limit = precision;
         length = StrNLen32(bufpt, limit);
-        if( precision>=0 && precision<length ) length = precision;
         break;
       }
       case etBLOB: {
@@ -839,6 +839,22 @@ void fossil_error_reset(void){
 */
 static int stdoutAtBOL = 1;
 
+/*
+** If not NULL, text written to standard output is appended to this
+** blob instead.  See fossil_hold_stdout().
+*/
+static Blob *pStdoutHold = 0;
+
+/*
+** Hold back text written to standard output by fossil_puts() and the
+** routines that use it, by appending it to pBlob instead, until this
+** routine is called again with a NULL argument.  The caller decides
+** what becomes of the text.
+*/
+void fossil_hold_stdout(Blob *pBlob){
+  pStdoutHold = pBlob;
+}
+
 /*
 ** Write to standard output or standard error.
 **
@@ -850,6 +866,10 @@ void fossil_puts(const char *z, int toStdErr){
   int n = (int)strlen(z);
   if( n==0 ) return;
   if( toStdErr==0 ) stdoutAtBOL = (z[n-1]=='\n');
+  if( toStdErr==0 && pStdoutHold ){
+    blob_append(pStdoutHold, z, n);
+    return;
+  }
 #if defined(_WIN32)
   if( fossil_utf8_to_console(z, n, toStdErr) >= 0 ){
     return;
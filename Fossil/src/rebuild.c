@@ -168,6 +168,7 @@ static Bag bagDone;         /* Bag of records rebuilt */
 
 static char *zFNameFormat;  /* Format string for filenames on deconstruct */
 static int prefixLength;    /* Length of directory prefix for deconstruct */
+static const char *zThreads;  /* Value of the --threads option, if any */
 
 
 /*
@@ -198,6 +199,34 @@ static void rebuild_step_done(int rid){
   }
 }
 
+/*
+** Process a single artifact whose full content is pContent:  crosslink
+** it for "fossil rebuild" or write it out for "fossil deconstruct".
+** This routine takes over and clears the content buffer.
+*/
+static void rebuild_one(int rid, int size, Blob *pContent){
+  /* Fix up the "blob.size" field if needed. */
+  if( size!=blob_size(pContent) ){
+    db_multi_exec(
+       "UPDATE blob SET size=%d WHERE rid=%d", blob_size(pContent), rid
+    );
+  }
+  if( zFNameFormat==0 ){
+    /* We are doing "fossil rebuild" */
+    manifest_crosslink(rid, pContent, MC_NONE);
+  }else{
+    /* We are doing "fossil deconstruct" */
+    char *zUuid = db_text(0, "SELECT uuid FROM blob WHERE rid=%d", rid);
+    char *zFile = mprintf(zFNameFormat, zUuid, zUuid+prefixLength);
+    blob_write_to_file(pContent,zFile);
+    free(zFile);
+    free(zUuid);
+    blob_reset(pContent);
+  }
+  assert( blob_is_reset(pContent) );
+  rebuild_step_done(rid);
+}
+
 /*
 ** Rebuild cross-referencing information for the artifact
 ** rid with content pBase and all of its descendants.  This
@@ -223,13 +252,6 @@ static void rebuild_step(int rid, int size, Blob *pBase){
 
   while( rid>0 ){
 
-    /* Fix up the "blob.size" field if needed. */
-    if( size!=blob_size(pBase) ){
-      db_multi_exec(
-         "UPDATE blob SET size=%d WHERE rid=%d", blob_size(pBase), rid
-      );
-    }
-  
     /* Find all children of artifact rid */
     db_static_prepare(&q1, "SELECT rid FROM delta WHERE srcid=:rid");
     db_bind_int(&q1, ":rid", rid);
@@ -250,20 +272,7 @@ static void rebuild_step(int rid, int size, Blob *pBase){
       blob_copy(&copy, pBase);
       pUse = &copy;
     }
-    if( zFNameFormat==0 ){
-      /* We are doing "fossil rebuild" */
-      manifest_crosslink(rid, pUse, MC_NONE);
-    }else{
-      /* We are doing "fossil deconstruct" */
-      char *zUuid = db_text(0, "SELECT uuid FROM blob WHERE rid=%d", rid);
-      char *zFile = mprintf(zFNameFormat, zUuid, zUuid+prefixLength);
-      blob_write_to_file(pUse,zFile);
-      free(zFile);
-      free(zUuid);
-      blob_reset(pUse);
-    }
-    assert( blob_is_reset(pUse) );
-    rebuild_step_done(rid);
+    rebuild_one(rid, size, pUse);
   
     /* Call all children recursively */
     rid = 0;
@@ -276,7 +285,7 @@ static void rebuild_step(int rid, int size, Blob *pBase){
         Blob delta, next;
         db_ephemeral_blob(&q2, 0, &delta);
         blob_uncompress(&delta, &delta);
-        blob_delta_apply(pBase, &delta, &next);
+        if( blob_delta_apply(pBase, &delta, &next)<0 ) blob_zero(&next);
         blob_reset(&delta);
         db_reset(&q2);
         if( i<nChild ){
@@ -297,6 +306,272 @@ static void rebuild_step(int rid, int size, Blob *pBase){
   }
 }
 
+/*
+** The content of every artifact in a delta tree is needed exactly once,
+** in a fixed order, by rebuild_step().  Inflating the blobs and applying
+** the deltas is pure computation that can be done in parallel for
+** independent trees.  So when more than one thread is requested, the
+** delta trees are read into memory a batch at a time, expanded by a
+** pool of worker threads, and then handed to manifest_crosslink() by the
+** main thread in exactly the order that rebuild_step() would have used.
+** All database access stays on the main thread.
+**
+** Each RebuildTree holds one delta tree.  Every node comes after its
+** delta source in a[], which is all the worker needs.  aOrder[] lists
+** the nodes in the order that rebuild_step() would visit them.
+*/
+typedef struct RebuildNode RebuildNode;
+typedef struct RebuildTree RebuildTree;
+struct RebuildNode {
+  int rid;          /* Artifact id */
+  int size;         /* Value of blob.size */
+  int iParent;      /* Index of the delta source in the tree.  -1 for root */
+  Blob content;     /* Compressed blob.content, replaced by the full text */
+};
+struct RebuildTree {
+  int nNode;        /* Number of nodes used in a[] */
+  int nAlloc;       /* Number of slots allocated in a[] and aOrder[] */
+  RebuildNode *a;   /* The nodes of the tree */
+  int *aOrder;      /* Indices into a[] in rebuild_step() order */
+};
+static struct {
+  ThreadPool *pPool;   /* Worker threads.  NULL for a serial rebuild */
+  i64 szLimit;         /* Maximum total uncompressed size of a batch */
+  i64 sz;              /* Total uncompressed size of the current batch */
+  int nTree;           /* Number of trees in the current batch */
+  int nAlloc;          /* Slots allocated in aTree[] */
+  RebuildTree *aTree;  /* The current batch */
+} rebuildBatch;
+
+/*
+** Uncompressed bytes of content per thread allowed in one batch.  A delta
+** tree larger than the whole batch is processed serially instead.
+*/
+#define REBUILD_BATCH_PER_THREAD 25000000
+
+/*
+** Worker thread task:  Replace the compressed content of every node of
+** a tree with its full text.  This mirrors what content_get() and
+** rebuild_step() do for a serial rebuild.  A delta that cannot be
+** applied leaves its node empty.
+*/
+static void rebuild_expand_tree(void *pArg){
+  RebuildTree *p = (RebuildTree*)pArg;
+  int i;
+  for(i=0; i<p->nNode; i++){
+    RebuildNode *pNode = &p->a[i];
+    if( pNode->iParent<0 ){
+      blob_uncompress(&pNode->content, &pNode->content);
+    }else{
+      Blob delta = pNode->content;
+      blob_zero(&pNode->content);
+      blob_uncompress(&delta, &delta);
+      if( blob_delta_apply(&p->a[pNode->iParent].content, &delta,
+                           &pNode->content)<0 ){
+        blob_reset(&pNode->content);
+      }
+      blob_reset(&delta);
+    }
+  }
+}
+
+/*
+** Append a node to tree p.  The compressed content is taken from
+** column 0 of statement pQ.  Return the index of the new node.
+*/
+static int rebuild_add_node(
+  RebuildTree *p,
+  int rid,
+  int size,
+  int iParent,
+  Stmt *pQ
+){
+  RebuildNode *pNode;
+  if( p->nNode>=p->nAlloc ){
+    p->nAlloc = p->nAlloc*2 + 10;
+    p->a = fossil_realloc(p->a, sizeof(p->a[0])*p->nAlloc);
+    p->aOrder = fossil_realloc(p->aOrder, sizeof(p->aOrder[0])*p->nAlloc);
+  }
+  pNode = &p->a[p->nNode];
+  pNode->rid = rid;
+  pNode->size = size;
+  pNode->iParent = iParent;
+  blob_zero(&pNode->content);
+  db_column_blob(pQ, 0, &pNode->content);
+  return p->nNode++;
+}
+
+/*
+** Free the nodes of a tree.
+*/
+static void rebuild_free_tree(RebuildTree *p){
+  int i;
+  for(i=0; i<p->nNode; i++) blob_reset(&p->a[i].content);
+  fossil_free(p->a);
+  fossil_free(p->aOrder);
+  memset(p, 0, sizeof(*p));
+}
+
+/*
+** Read the delta tree rooted at rid into p.  Children are added in the
+** same order that rebuild_step() would visit them.
+**
+** Return 0 on success.  Return 1, with p empty, if the tree would not
+** fit in a batch.
+*/
+static int rebuild_read_tree(RebuildTree *p, int rid){
+  static Stmt q1, q2;
+  int nStack = 0;
+  int nStackAlloc = 0;
+  int nOrder = 0;
+  int *aStack = 0;
+  i64 sz = 0;
+
+  db_static_prepare(&q1, "SELECT rid FROM delta WHERE srcid=:rid");
+  db_static_prepare(&q2, "SELECT content, size FROM blob WHERE rid=:rid");
+  db_bind_int(&q2, ":rid", rid);
+  if( db_step(&q2)==SQLITE_ROW ){
+    rebuild_add_node(p, rid, db_column_int(&q2, 1), -1, &q2);
+  }
+  db_reset(&q2);
+  if( p->nNode==0 ) return 0;
+  sz = p->a[0].size;
+  nStackAlloc = 20;
+  aStack = fossil_malloc( sizeof(aStack[0])*nStackAlloc );
+  aStack[nStack++] = 0;
+  while( nStack>0 ){
+    int iParent = aStack[--nStack];
+    int nChild = 0;
+    int cid;
+    Bag children;
+    int nFirst = nStack;
+
+    p->aOrder[nOrder++] = iParent;
+
+    /* Same child selection and order as rebuild_step() */
+    bag_init(&children);
+    db_bind_int(&q1, ":rid", p->a[iParent].rid);
+    while( db_step(&q1)==SQLITE_ROW ){
+      cid = db_column_int(&q1, 0);
+      if( !bag_find(&bagDone, cid) ) bag_insert(&children, cid);
+    }
+    db_reset(&q1);
+    for(cid=bag_first(&children); cid; cid=bag_next(&children, cid)){
+      int csz;
+      db_bind_int(&q2, ":rid", cid);
+      if( db_step(&q2)==SQLITE_ROW && (csz = db_column_int(&q2,1))>=0 ){
+        if( nStack>=nStackAlloc ){
+          nStackAlloc = nStackAlloc*2 + 20;
+          aStack = fossil_realloc(aStack, sizeof(aStack[0])*nStackAlloc);
+        }
+        aStack[nStack++] = rebuild_add_node(p, cid, csz, iParent, &q2);
+        sz += csz;
+        nChild++;
+      }
+      db_reset(&q2);
+    }
+    bag_clear(&children);
+
+    /* Children are visited depth-first in bag order, so reverse them
+    ** on the stack such that the first child is popped first. */
+    if( nChild>1 ){
+      int i, j;
+      for(i=nFirst, j=nStack-1; i<j; i++, j--){
+        int t = aStack[i]; aStack[i] = aStack[j]; aStack[j] = t;
+      }
+    }
+    if( sz>rebuildBatch.szLimit ){
+      rebuild_free_tree(p);
+      fossil_free(aStack);
+      return 1;
+    }
+  }
+  fossil_free(aStack);
+  return 0;
+}
+
+/*
+** Expand every tree in the current batch on the worker threads, then
+** process the artifacts in order on the main thread.
+*/
+static void rebuild_flush_batch(void){
+  int i, j;
+  for(i=0; i<rebuildBatch.nTree; i++){
+    threadpool_add(rebuildBatch.pPool, rebuild_expand_tree,
+                   &rebuildBatch.aTree[i]);
+  }
+  threadpool_wait(rebuildBatch.pPool);
+  for(i=0; i<rebuildBatch.nTree; i++){
+    RebuildTree *p = &rebuildBatch.aTree[i];
+    for(j=0; j<p->nNode; j++){
+      RebuildNode *pNode = &p->a[p->aOrder[j]];
+      rebuild_one(pNode->rid, pNode->size, &pNode->content);
+    }
+    rebuild_free_tree(p);
+  }
+  rebuildBatch.nTree = 0;
+  rebuildBatch.sz = 0;
+}
+
+/*
+** Rebuild the delta tree whose root is artifact rid, using the worker
+** threads if there are any.
+*/
+static void rebuild_tree(int rid, int size){
+  RebuildTree *p;
+  i64 sz;
+  int i;
+  if( rebuildBatch.pPool ){
+    if( rebuildBatch.nTree>=rebuildBatch.nAlloc ){
+      rebuildBatch.nAlloc = rebuildBatch.nAlloc*2 + 100;
+      rebuildBatch.aTree = fossil_realloc(rebuildBatch.aTree,
+                        sizeof(rebuildBatch.aTree[0])*rebuildBatch.nAlloc);
+    }
+    p = &rebuildBatch.aTree[rebuildBatch.nTree];
+    memset(p, 0, sizeof(*p));
+    if( rebuild_read_tree(p, rid)==0 ){
+      for(i=0, sz=0; i<p->nNode; i++) sz += p->a[i].size;
+      if( rebuildBatch.sz+sz>rebuildBatch.szLimit && rebuildBatch.nTree>0 ){
+        /* Start a new batch with this tree */
+        RebuildTree x = *p;
+        rebuild_flush_batch();
+        rebuildBatch.aTree[0] = x;
+      }
+      rebuildBatch.nTree++;
+      rebuildBatch.sz += sz;
+      return;
+    }
+    /* Too big for a batch.  Do it serially. */
+    rebuild_flush_batch();
+  }
+  {
+    Blob content;
+    content_get(rid, &content);
+    rebuild_step(rid, size, &content);
+  }
+}
+
+/*
+** Start or finish the parallel processing of delta trees.  nThread
+** is the number of worker threads to use.  When nThread is 1 or less
+** rebuild_tree() works serially and these routines do nothing.
+*/
+static void rebuild_begin_threads(int nThread){
+  memset(&rebuildBatch, 0, sizeof(rebuildBatch));
+  if( nThread>1 ){
+    rebuildBatch.pPool = threadpool_new(nThread);
+    rebuildBatch.szLimit = (i64)nThread*REBUILD_BATCH_PER_THREAD;
+  }
+}
+static void rebuild_end_threads(void){
+  if( rebuildBatch.pPool ){
+    rebuild_flush_batch();
+    threadpool_free(rebuildBatch.pPool);
+    fossil_free(rebuildBatch.aTree);
+    memset(&rebuildBatch, 0, sizeof(rebuildBatch));
+  }
+}
+
 /*
 ** Check to see if the "sym-trunk" tag exists.  If not, create it
 ** and attach it to the very first check-in.
@@ -335,6 +610,7 @@ int rebuild_db(int randomize, int doOut, int doClustering){
   int errCnt = 0;
   char *zTable;
   int incrSize;
+  int hasFts;
 
   bag_init(&bagDone);
   ttyOutput = doOut;
@@ -343,6 +619,8 @@ int rebuild_db(int randomize, int doOut, int doClustering){
     percent_complete(0);
   }
   rebuild_update_schema();
+  hasFts = search_index_exists();
+  if( hasFts ) search_drop_index();
   for(;;){
     zTable = db_text(0,
        "SELECT name FROM sqlite_master /*scan*/"
@@ -385,16 +663,16 @@ int rebuild_db(int randomize, int doOut, int doClustering){
      "   AND NOT EXISTS(SELECT 1 FROM delta WHERE rid=blob.rid)"
   );
   manifest_crosslink_begin();
+  rebuild_begin_threads(threadpool_size(zThreads));
   while( db_step(&s)==SQLITE_ROW ){
     int rid = db_column_int(&s, 0);
     int size = db_column_int(&s, 1);
     if( size>=0 ){
-      Blob content;
-      content_get(rid, &content);
-      rebuild_step(rid, size, &content);
+      rebuild_tree(rid, size);
     }
   }
   db_finalize(&s);
+  rebuild_end_threads();
   db_prepare(&s,
      "SELECT rid, size FROM blob"
      " WHERE NOT EXISTS(SELECT 1 FROM shun WHERE uuid=blob.uuid)"
@@ -416,6 +694,7 @@ int rebuild_db(int randomize, int doOut, int doClustering){
   db_finalize(&s);
   manifest_crosslink_end(MC_NONE);
   rebuild_tag_trunk();
+  if( hasFts ) search_rebuild_index();
   if( ttyOutput && !g.fQuiet && totalSize>0 ){
     processCnt += incrSize;
     percent_complete((processCnt*1000)/totalSize);
@@ -530,6 +809,8 @@ static void reconstruct_private_table(void){
 **   --analyze     Run ANALYZE on the database after rebuilding
 **   --wal         Set Write-Ahead-Log journalling mode on the database
 **   --stats       Show artifact statistics after rebuilding
+**   --threads N   Use N threads to expand deltas.  0 means one per CPU.
+**                 The default comes from the "threads" setting.
 **
 ** See also: deconstruct, reconstruct
 */
@@ -558,6 +839,7 @@ void rebuild_database(void){
   runCompress = find_option("compress",0,0)!=0;
   zPagesize = find_option("pagesize",0,1);
   showStats = find_option("stats",0,0)!=0;
+  zThreads = find_option("threads",0,1);
   if( zPagesize ){
     newPagesize = atoi(zPagesize);
     if( newPagesize<512 || newPagesize>65536
@@ -950,6 +1232,7 @@ void reconstruct_cmd(void) {
 **   -L|--prefixlength N         set the length of the names of the DESTINATION
 **                               subdirectories to N
 **   --private                   Include private artifacts.
+**   --threads N                 Use N threads to expand deltas
 **
 ** See also: rebuild, reconstruct
 */
@@ -973,6 +1256,7 @@ void deconstruct_cmd(void){
   /* open repository and open query for all artifacts */
   db_find_and_open_repository(OPEN_ANY_SCHEMA, 0);
   privateFlag = find_option("private",0,0)!=0;
+  zThreads = find_option("threads",0,1);
   verify_all_options();
   /* check number of arguments */
   if( g.argc!=3 ){
@@ -1012,16 +1296,16 @@ void deconstruct_cmd(void){
      "   AND NOT EXISTS(SELECT 1 FROM delta WHERE rid=blob.rid) %s",
      privateFlag==0 ? "AND rid NOT IN private" : ""
   );
+  rebuild_begin_threads(threadpool_size(zThreads));
   while( db_step(&s)==SQLITE_ROW ){
     int rid = db_column_int(&s, 0);
     int size = db_column_int(&s, 1);
     if( size>=0 ){
-      Blob content;
-      content_get(rid, &content);
-      rebuild_step(rid, size, &content);
+      rebuild_tree(rid, size);
     }
   }
   db_finalize(&s);
+  rebuild_end_threads();
   db_prepare(&s,
      "SELECT rid, size FROM blob"
      " WHERE NOT EXISTS(SELECT 1 FROM shun WHERE uuid=blob.uuid) %s",
@@ -165,6 +165,484 @@ void search_sql_setup(Search *p){
      search_score_sqlfunc, 0, 0);
 }
 
+/*
+** The full-text index.
+**
+** FTSIDX is an FTS4 (or FTS5) virtual table holding the text of every
+** indexed document.  FTSDOCS has one row for each document that is, or
+** is about to be, in FTSIDX.  The rowid of FTSDOCS is the docid used
+** in FTSIDX.  Documents are:
+**
+**    type='c'    An entry in the EVENT table:  check-in comments and the
+**                comments on wiki, ticket and tag changes.  RID is
+**                event.objid.
+**
+**    type='w'    The latest version of a wiki page.  RID is the artifact
+**                holding that version and NAME is the page name.
+**
+**    type='t'    A ticket.  RID is the tagid of the "tkt-UUID" tag and
+**                NAME is the ticket UUID.
+**
+**    type='d'    A file on the tip of the main branch whose name matches
+**                the "search-doc-glob" setting.  RID is the file artifact
+**                and NAME is the filename.
+**
+** IDXED is false for documents that have changed since they were last
+** indexed.  The triggers below and search_doc_touch() clear IDXED as
+** new artifacts are crosslinked, and search_update_index() then brings
+** FTSIDX up to date just before the index is used.
+*/
+static const char zFtsSchema[] =
+@ CREATE TABLE %s.ftsdocs(
+@   rowid INTEGER PRIMARY KEY,       -- docid in FTSIDX
+@   type CHAR(1),                    -- 'c', 'w', 't' or 'd'
+@   rid INTEGER,                     -- See above
+@   name TEXT NOT NULL DEFAULT '',   -- Wiki page, ticket UUID or filename
+@   idxed BOOLEAN,                   -- True if FTSIDX is up to date
+@   label TEXT,                      -- Description shown in results
+@   mtime DATETIME,                  -- Date shown in results
+@   UNIQUE(type,rid,name)
+@ );
+@ CREATE TRIGGER %s.ftsdocs_event_ins AFTER INSERT ON event BEGIN
+@   INSERT OR IGNORE INTO ftsdocs(type,rid,idxed) VALUES('c',new.objid,0);
+@   UPDATE ftsdocs SET idxed=0 WHERE type='c' AND rid=new.objid;
+@ END;
+@ CREATE TRIGGER %s.ftsdocs_event_upd
+@   AFTER UPDATE OF objid, mtime, comment, ecomment ON event BEGIN
+@   INSERT OR IGNORE INTO ftsdocs(type,rid,idxed) VALUES('c',new.objid,0);
+@   UPDATE ftsdocs SET idxed=0 WHERE type='c' AND rid IN (old.objid,new.objid);
+@ END;
+@ CREATE TRIGGER %s.ftsdocs_event_del AFTER DELETE ON event BEGIN
+@   UPDATE ftsdocs SET idxed=0 WHERE type='c' AND rid=old.objid;
+@ END;
+;
+
+/*
+** Which full-text module holds FTSIDX:  0 for none (there is no index),
+** 4 for FTS4 or 5 for FTS5.  Negative if not yet known.
+*/
+static int ftsModule = -1;
+
+/*
+** Return 0 if there is no full-text index in the repository.  Otherwise
+** return 4 or 5 for the version of the FTS module that holds it.
+*/
+int search_index_exists(void){
+  if( ftsModule<0 ){
+    char *zSql = db_text(0,
+       "SELECT sql FROM %s.sqlite_master WHERE name='ftsidx'",
+       db_name("repository"));
+    if( zSql==0 ){
+      ftsModule = 0;
+    }else{
+      ftsModule = sqlite3_strglob("*fts5*", zSql)==0 ? 5 : 4;
+      fossil_free(zSql);
+    }
+  }
+  return ftsModule;
+}
+
+/*
+** Remove the full-text index from the repository.
+*/
+void search_drop_index(void){
+  db_multi_exec(
+    "DROP TRIGGER IF EXISTS %s.ftsdocs_event_ins;"
+    "DROP TRIGGER IF EXISTS %s.ftsdocs_event_upd;"
+    "DROP TRIGGER IF EXISTS %s.ftsdocs_event_del;"
+    "DROP TABLE IF EXISTS %s.ftsidx;"
+    "DROP TABLE IF EXISTS %s.ftsdocs;",
+    db_name("repository"), db_name("repository"), db_name("repository"),
+    db_name("repository"), db_name("repository")
+  );
+  db_unset("fts-doc-version", 0);
+  ftsModule = 0;
+}
+
+/*
+** Create an empty full-text index.  FTS4 is preferred.  FTS5 is used
+** when Fossil is linked against an SQLite that lacks FTS4.
+*/
+static void search_create_index(void){
+  const char *zRepo = db_name("repository");
+  char *zSql;
+  int rc;
+
+  db_multi_exec(zFtsSchema, zRepo, zRepo, zRepo, zRepo);
+  ftsModule = 4;
+  zSql = mprintf("CREATE VIRTUAL TABLE %s.ftsidx USING fts4(title, body)",
+                 zRepo);
+  rc = sqlite3_exec(g.db, zSql, 0, 0, 0);
+  fossil_free(zSql);
+  if( rc!=SQLITE_OK ){
+    ftsModule = 5;
+    zSql = mprintf("CREATE VIRTUAL TABLE %s.ftsidx USING fts5(title, body)",
+                   zRepo);
+    rc = sqlite3_exec(g.db, zSql, 0, 0, 0);
+    fossil_free(zSql);
+    if( rc!=SQLITE_OK ){
+      fossil_fatal("this build of SQLite supports neither FTS4 nor FTS5");
+    }
+  }
+}
+
+/*
+** Mark a wiki page ('w') or ticket ('t') as needing to be reindexed.
+** This is called as artifacts are crosslinked.  For wiki, every older
+** version of the same page is marked too, so that it gets removed.
+*/
+void search_doc_touch(char cType, int rid, const char *zName){
+  char zType[2];
+  if( !search_index_exists() ) return;
+  zType[0] = cType;
+  zType[1] = 0;
+  db_multi_exec(
+    "INSERT OR IGNORE INTO ftsdocs(type,rid,name,idxed)"
+    " VALUES(%Q,%d,%Q,0);"
+    "UPDATE ftsdocs SET idxed=0 WHERE type=%Q AND (rid=%d OR name=%Q);",
+    zType, rid, zName, zType, rid, cType=='w' ? zName : ""
+  );
+}
+
+/*
+** Load the text of ticket zUuid from the TICKET table.  The "title"
+** field, if there is one, goes into pTitle and all other user fields
+** into pBody.  Return false if there is no such ticket.
+*/
+static int search_ticket_text(
+  const char *zUuid,      /* The ticket */
+  Blob *pTitle,           /* Write the title here */
+  Blob *pBody,            /* Write the other fields here */
+  double *pMtime          /* Write the time of the last change here */
+){
+  Stmt q;
+  int found = 0;
+  if( !db_exists("SELECT 1 FROM %s.sqlite_master WHERE name='ticket'",
+                 db_name("repository")) ){
+    return 0;
+  }
+  db_prepare(&q, "SELECT * FROM ticket WHERE tkt_uuid=%Q", zUuid);
+  if( db_step(&q)==SQLITE_ROW ){
+    int i;
+    found = 1;
+    for(i=0; i<db_column_count(&q); i++){
+      const char *zCol = db_column_name(&q, i);
+      const char *zVal;
+      if( strncmp(zCol, "tkt_", 4)==0 ){
+        if( fossil_strcmp(zCol, "tkt_mtime")==0 ){
+          *pMtime = db_column_double(&q, i);
+        }
+        continue;
+      }
+      zVal = db_column_text(&q, i);
+      if( zVal==0 || zVal[0]==0 ) continue;
+      if( fossil_strcmp(zCol, "title")==0 ){
+        blob_append(pTitle, zVal, -1);
+      }else{
+        blob_appendf(pBody, "%s\n", zVal);
+      }
+    }
+  }
+  db_finalize(&q);
+  return found;
+}
+
+/*
+** Work out which files of the tip of the main branch belong in the
+** index and record them in the TEMP table FTSDOCCUR.  Files that have
+** been added, changed or removed since the last time are marked
+** for reindexing in FTSDOCS.  FTSDOCCUR is left empty if nothing
+** has changed and no document is waiting to be indexed.
+*/
+static void search_update_docs(void){
+  char *zGlob = db_get("search-doc-glob", 0);
+  int vid = 0;
+  char *zVersion;
+  char *zPrior;
+
+  db_multi_exec(
+    "CREATE TEMP TABLE IF NOT EXISTS ftsdoccur(name TEXT PRIMARY KEY, rid);"
+    "DELETE FROM ftsdoccur;"
+  );
+  if( zGlob && zGlob[0] ){
+    vid = symbolic_name_to_rid(db_get("main-branch", "trunk"), "ci");
+  }
+  if( vid<=0 ){
+    vid = 0;
+    zVersion = mprintf("");
+  }else{
+    zVersion = mprintf("%d %s", vid, zGlob);
+  }
+  zPrior = db_get("fts-doc-version", 0);
+  if( fossil_strcmp(zVersion, zPrior ? zPrior : "")!=0
+   || db_exists("SELECT 1 FROM ftsdocs WHERE type='d' AND NOT idxed")
+  ){
+    if( vid ){
+      Glob *pGlob = glob_create(zGlob);
+      Manifest *pManifest = manifest_get(vid, CFTYPE_MANIFEST, 0);
+      ManifestFile *pFile;
+      Stmt ins;
+      db_prepare(&ins, "INSERT OR IGNORE INTO ftsdoccur(name,rid)"
+                       " SELECT :name, rid FROM blob WHERE uuid=:uuid");
+      if( pManifest ){
+        manifest_file_rewind(pManifest);
+        while( (pFile = manifest_file_next(pManifest, 0))!=0 ){
+          if( pFile->zUuid==0 || !glob_match(pGlob, pFile->zName) ) continue;
+          db_bind_text(&ins, ":name", pFile->zName);
+          db_bind_text(&ins, ":uuid", pFile->zUuid);
+          db_step(&ins);
+          db_reset(&ins);
+        }
+        manifest_destroy(pManifest);
+      }
+      db_finalize(&ins);
+      glob_free(pGlob);
+    }
+    db_multi_exec(
+      "UPDATE ftsdocs SET idxed=0 WHERE type='d' AND NOT EXISTS("
+      "  SELECT 1 FROM ftsdoccur"
+      "   WHERE ftsdoccur.name=ftsdocs.name AND ftsdoccur.rid=ftsdocs.rid);"
+      "INSERT OR IGNORE INTO ftsdocs(type,rid,name,idxed)"
+      "  SELECT 'd', rid, name, 0 FROM ftsdoccur;"
+    );
+    db_set("fts-doc-version", zVersion, 0);
+  }
+  fossil_free(zPrior);
+  fossil_free(zVersion);
+  fossil_free(zGlob);
+}
+
+/*
+** Bring the full-text index up to date.  Every document in FTSDOCS
+** whose IDXED flag is false is removed from FTSIDX and then, if the
+** document still exists, indexed again.  Documents that no longer
+** exist are removed from FTSDOCS.
+**
+** Return the number of documents that were reindexed.
+*/
+int search_update_index(void){
+  Stmt q, ins, upd, del;
+  int nDoc = 0;
+  int nIdx = 0;
+  int *aDoc = 0;
+  int i;
+
+  if( !search_index_exists() ) return 0;
+  db_begin_transaction();
+  search_update_docs();
+  db_prepare(&q, "SELECT rowid FROM ftsdocs WHERE NOT idxed");
+  while( db_step(&q)==SQLITE_ROW ){
+    if( (nDoc & (nDoc-1))==0 ){
+      aDoc = fossil_realloc(aDoc, sizeof(aDoc[0])*(nDoc ? nDoc*2 : 16));
+    }
+    aDoc[nDoc++] = db_column_int(&q, 0);
+  }
+  db_finalize(&q);
+  if( nDoc==0 ){
+    db_end_transaction(0);
+    return 0;
+  }
+  db_prepare(&q, "SELECT type, rid, name FROM ftsdocs WHERE rowid=:id");
+  db_prepare(&ins,
+     "INSERT INTO ftsidx(rowid,title,body) VALUES(:id,:title,:body)");
+  db_prepare(&upd,
+     "UPDATE ftsdocs SET idxed=1, label=:label, mtime=:mtime"
+     " WHERE rowid=:id");
+  db_prepare(&del, "DELETE FROM ftsdocs WHERE rowid=:id");
+  for(i=0; i<nDoc; i++){
+    Blob title, body, label;
+    double rMtime = 0.0;
+    int found = 0;
+    int rid;
+    char cType;
+    const char *zName;
+
+    db_bind_int(&q, ":id", aDoc[i]);
+    if( db_step(&q)!=SQLITE_ROW ){
+      db_reset(&q);
+      continue;
+    }
+    cType = db_column_text(&q, 0)[0];
+    rid = db_column_int(&q, 1);
+    zName = db_column_text(&q, 2);
+    blob_zero(&title);
+    blob_zero(&body);
+    blob_zero(&label);
+    db_multi_exec("DELETE FROM ftsidx WHERE rowid=%d", aDoc[i]);
+    switch( cType ){
+      case 'c': {
+        Stmt ev;
+        db_prepare(&ev,
+           "SELECT coalesce(ecomment,comment), mtime FROM event"
+           " WHERE objid=%d", rid);
+        if( db_step(&ev)==SQLITE_ROW ){
+          found = 1;
+          db_column_blob(&ev, 0, &body);
+          rMtime = db_column_double(&ev, 1);
+          blob_append(&label, blob_buffer(&body), blob_size(&body));
+        }
+        db_finalize(&ev);
+        break;
+      }
+      case 'w': {
+        Manifest *pWiki;
+        if( rid!=db_int(0, "SELECT rid FROM tagxref"
+                           " WHERE tagid=(SELECT tagid FROM tag"
+                           "               WHERE tagname='wiki-%q')"
+                           " ORDER BY mtime DESC", zName) ){
+          break;
+        }
+        pWiki = manifest_get(rid, CFTYPE_WIKI, 0);
+        if( pWiki==0 ) break;
+        if( pWiki->zWiki && pWiki->zWiki[0] ){
+          found = 1;
+          blob_append(&title, zName, -1);
+          blob_append(&body, pWiki->zWiki, -1);
+          rMtime = pWiki->rDate;
+          blob_appendf(&label, "Wiki page [%s]", zName);
+        }
+        manifest_destroy(pWiki);
+        break;
+      }
+      case 't': {
+        found = search_ticket_text(zName, &title, &body, &rMtime);
+        blob_appendf(&label, "Ticket [%.10s] \"%s\"", zName, blob_str(&title));
+        break;
+      }
+      case 'd': {
+        if( !db_exists("SELECT 1 FROM ftsdoccur WHERE name=%Q AND rid=%d",
+                       zName, rid)
+         || content_get(rid, &body)==0
+        ){
+          break;
+        }
+        found = 1;
+        if( looks_like_binary(&body) ) blob_reset(&body);
+        blob_append(&title, zName, -1);
+        rMtime = db_double(0.0, "SELECT mtime FROM event WHERE objid=%d",
+                  symbolic_name_to_rid(db_get("main-branch","trunk"), "ci"));
+        blob_appendf(&label, "File [%s]", zName);
+        break;
+      }
+    }
+    db_reset(&q);
+    if( found ){
+      db_bind_int(&ins, ":id", aDoc[i]);
+      db_bind_text(&ins, ":title", blob_str(&title));
+      db_bind_text(&ins, ":body", blob_str(&body));
+      db_step(&ins);
+      db_reset(&ins);
+      db_bind_int(&upd, ":id", aDoc[i]);
+      db_bind_text(&upd, ":label", blob_str(&label));
+      db_bind_double(&upd, ":mtime", rMtime);
+      db_step(&upd);
+      db_reset(&upd);
+      nIdx++;
+    }else{
+      db_bind_int(&del, ":id", aDoc[i]);
+      db_step(&del);
+      db_reset(&del);
+    }
+    blob_reset(&title);
+    blob_reset(&body);
+    blob_reset(&label);
+  }
+  db_finalize(&q);
+  db_finalize(&ins);
+  db_finalize(&upd);
+  db_finalize(&del);
+  fossil_free(aDoc);
+  db_end_transaction(0);
+  return nIdx;
+}
+
+/*
+** Discard the full-text index, if any, and build a new one that
+** covers the entire repository.
+*/
+void search_rebuild_index(void){
+  db_begin_transaction();
+  search_drop_index();
+  search_create_index();
+  db_multi_exec(
+    "INSERT OR IGNORE INTO ftsdocs(type,rid,idxed)"
+    "  SELECT 'c', objid, 0 FROM event;"
+    "INSERT OR IGNORE INTO ftsdocs(type,rid,name,idxed)"
+    "  SELECT 'w', (SELECT rid FROM tagxref WHERE tagid=tag.tagid"
+    "                ORDER BY mtime DESC), substr(tagname,6), 0"
+    "    FROM tag WHERE tagname GLOB 'wiki-*';"
+    "DELETE FROM ftsdocs WHERE rid IS NULL;"
+  );
+  if( db_exists("SELECT 1 FROM %s.sqlite_master WHERE name='ticket'",
+                db_name("repository")) ){
+    db_multi_exec(
+      "INSERT OR IGNORE INTO ftsdocs(type,rid,name,idxed)"
+      "  SELECT 't', tag.tagid, tkt_uuid, 0"
+      "    FROM ticket, tag WHERE tag.tagname=('tkt-' || tkt_uuid);"
+    );
+  }
+  search_update_index();
+  db_end_transaction(0);
+}
+
+/*
+** This is an SQL function used to rank the results of an FTS4 query.
+** The argument is matchinfo(ftsidx,'pcx').  Each hit counts in
+** proportion to how rare the hit is in the whole index, and hits in
+** the title count double.
+*/
+static void search_rank_sqlfunc(
+  sqlite3_context *context,
+  int argc,
+  sqlite3_value **argv
+){
+  const unsigned int *aMatch;
+  int nPhrase, nCol;
+  int i, j;
+  double rScore = 0.0;
+
+  aMatch = (const unsigned int*)sqlite3_value_blob(argv[0]);
+  if( sqlite3_value_bytes(argv[0])<(int)sizeof(aMatch[0])*2 ){
+    sqlite3_result_double(context, 0.0);
+    return;
+  }
+  nPhrase = aMatch[0];
+  nCol = aMatch[1];
+  if( sqlite3_value_bytes(argv[0])
+        < (int)sizeof(aMatch[0])*(2+3*nPhrase*nCol) ){
+    sqlite3_result_double(context, 0.0);
+    return;
+  }
+  for(i=0; i<nPhrase; i++){
+    for(j=0; j<nCol; j++){
+      const unsigned int *aX = &aMatch[2+3*(i*nCol+j)];
+      if( aX[0]>0 && aX[1]>0 ){
+        rScore += (j==0 ? 2.0 : 1.0)*(double)aX[0]/(double)aX[1];
+      }
+    }
+  }
+  sqlite3_result_double(context, rScore*1000.0);
+}
+
+/*
+** Turn the search pattern p into an FTS query that matches documents
+** containing every term, each as a word prefix.
+*/
+static char *search_fts_query(Search *p){
+  Blob x;
+  int i, j;
+  blob_zero(&x);
+  for(i=0; i<p->nTerm; i++){
+    if( i ) blob_append(&x, " ", 1);
+    for(j=0; j<p->a[i].n; j++){
+      char c = fossil_tolower(p->a[i].z[j]);
+      blob_append(&x, &c, 1);
+    }
+    blob_append(&x, "*", 1);
+  }
+  return blob_str(&x);
+}
+
 /*
 ** Testing the search function.
 **
@@ -182,6 +660,11 @@ void search_sql_setup(Search *p){
 ** of entries returned.  The -width option can be
 ** used to set the output width used when printing
 ** matches.
+**
+** If the repository has a full-text index (see the "fts-config"
+** command) then wiki pages, tickets and documents are searched too,
+** and the index is used to find and rank the results.  All matches
+** are then shown, best first, subject to the -limit option.
 */
 void search_cmd(void){
   Search *p;
@@ -189,7 +672,9 @@ void search_cmd(void){
   int i;
   Blob sql = empty_blob;
   Stmt q;
-  int iBest;
+  double rBest;
+  const char *zRank;          /* SQL expression for the rank of an FTS hit */
+  const char *zSnippet;       /* SQL expression for an FTS snippet */
   char fAll = NULL != find_option("all", "a", 0); /* If set, do not lop
                                                      off the end of the
                                                      results. */
@@ -215,25 +700,57 @@ void search_cmd(void){
   }
   p = search_init(blob_str(&pattern));
   blob_reset(&pattern);
-  search_sql_setup(p);
 
   db_multi_exec(
      "CREATE TEMP TABLE srch(rid,uuid,date,comment,x);"
      "CREATE INDEX srch_idx1 ON srch(x);"
-     "INSERT INTO srch(rid,uuid,date,comment,x)"
-     "   SELECT blob.rid, uuid, datetime(event.mtime%s),"
-     "          coalesce(ecomment,comment),"
-     "          score(coalesce(ecomment,comment)) AS y"
-     "     FROM event, blob"
-     "    WHERE blob.rid=event.objid AND y>0;",
-     timeline_utc()
   );
-  iBest = db_int(0, "SELECT max(x) FROM srch");
+  if( p->nTerm==0 ){
+    /* Nothing to look for */
+  }else if( search_index_exists() ){
+    char *zQuery = search_fts_query(p);
+    search_update_index();
+    if( search_index_exists()==5 ){
+      zRank = "-bm25(ftsidx,2.0,1.0)";
+      zSnippet = "snippet(ftsidx,1,'','','...',12)";
+    }else{
+      sqlite3_create_function(g.db, "search_rank", 1, SQLITE_UTF8, 0,
+         search_rank_sqlfunc, 0, 0);
+      zRank = "search_rank(matchinfo(ftsidx,'pcx'))";
+      zSnippet = "snippet(ftsidx,'','','...',1,12)";
+    }
+    db_multi_exec(
+       "INSERT INTO srch(rid,uuid,date,comment,x)"
+       "   SELECT d.rid,"
+       "          CASE WHEN d.type='t' THEN d.name"
+       "               ELSE (SELECT uuid FROM blob WHERE rid=d.rid) END,"
+       "          datetime(d.mtime%s),"
+       "          CASE WHEN d.type='c' THEN d.label"
+       "               ELSE d.label || ': ' || %s END,"
+       "          %s"
+       "     FROM ftsidx, ftsdocs AS d"
+       "    WHERE ftsidx MATCH %Q AND d.rowid=ftsidx.rowid;",
+       timeline_utc(), zSnippet, zRank, zQuery
+    );
+    fossil_free(zQuery);
+  }else{
+    search_sql_setup(p);
+    db_multi_exec(
+       "INSERT INTO srch(rid,uuid,date,comment,x)"
+       "   SELECT blob.rid, uuid, datetime(event.mtime%s),"
+       "          coalesce(ecomment,comment),"
+       "          score(coalesce(ecomment,comment)) AS y"
+       "     FROM event, blob"
+       "    WHERE blob.rid=event.objid AND y>0;",
+       timeline_utc()
+    );
+  }
+  rBest = db_double(0.0, "SELECT max(x) FROM srch");
   blob_append(&sql,
               "SELECT rid, uuid, date, comment, 0, 0 FROM srch "
               "WHERE 1 ", -1);
-  if(!fAll){
-    blob_appendf(&sql,"AND x>%d ", iBest/3);
+  if( !fAll && !search_index_exists() ){
+    blob_appendf(&sql,"AND x>%.17g ", rBest/3.0);
   }
   blob_append(&sql, "ORDER BY x DESC, date DESC ", -1);
   db_prepare(&q, blob_str(&sql));
@@ -241,3 +758,63 @@ void search_cmd(void){
   print_timeline(&q, nLimit, width, 0);
   db_finalize(&q);
 }
+
+/*
+** COMMAND: fts-config
+**
+** Usage: %fossil fts-config ?SUBCOMMAND?
+**
+** Manage the full-text index used by the "search" command.  Without a
+** full-text index, "search" scans the comment of every timeline entry.
+** With one, it also covers wiki pages, tickets and the files on the
+** tip of the main branch that match the "search-doc-glob" setting,
+** and it ranks the results using the index.
+**
+** Once built, the index is kept up to date as new artifacts arrive.
+** Available subcommands are:
+**
+**    (none)        Show whether there is an index and what is in it.
+**
+**    rebuild       Build the index, discarding any existing one.
+**
+**    off           Remove the index.
+*/
+void fts_config_cmd(void){
+  const char *zCmd;
+  db_find_and_open_repository(0, 0);
+  verify_all_options();
+  if( g.argc>3 ) usage("?rebuild|off?");
+  zCmd = g.argc==3 ? g.argv[2] : "";
+  if( zCmd[0]==0 ){
+    /* Show the current status */
+  }else if( strncmp(zCmd, "rebuild", strlen(zCmd))==0 ){
+    search_rebuild_index();
+  }else if( strncmp(zCmd, "off", strlen(zCmd))==0 ){
+    db_begin_transaction();
+    search_drop_index();
+    db_end_transaction(0);
+  }else{
+    usage("?rebuild|off?");
+  }
+  if( !search_index_exists() ){
+    fossil_print("full-text index: off\n");
+  }else{
+    Stmt q;
+    fossil_print("full-text index: FTS%d\n", search_index_exists());
+    db_prepare(&q,
+       "SELECT CASE type WHEN 'c' THEN 'timeline entries'"
+       "                 WHEN 'w' THEN 'wiki pages'"
+       "                 WHEN 't' THEN 'tickets'"
+       "                 ELSE 'documents' END,"
+       "       sum(idxed), sum(NOT idxed)"
+       "  FROM ftsdocs GROUP BY type ORDER BY type"
+    );
+    while( db_step(&q)==SQLITE_ROW ){
+      int nPending = db_column_int(&q, 2);
+      fossil_print("%-17s %d", db_column_text(&q, 0), db_column_int(&q, 1));
+      if( nPending ) fossil_print(" (%d pending)", nPending);
+      fossil_print("\n");
+    }
+    db_finalize(&q);
+  }
+}
@@ -109,6 +109,8 @@ void setup_page(void){
     "A record of login attempts");
   setup_menu_entry("Stats", "stat",
     "Display repository statistics");
+  setup_menu_entry("Archive-Cache", "cachestat",
+    "Show the hit rate of the cache of ZIP archives and tarballs");
   setup_menu_entry("SQL", "admin_sql",
     "Enter raw SQL commands");
   setup_menu_entry("TH1", "admin_th1",
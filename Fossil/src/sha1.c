@@ -135,6 +135,277 @@ void SHA1Transform(unsigned int state[5], const unsigned char buffer[64])
   state[3] += d;
   state[4] += e;
 }
+#undef a
+#undef b
+#undef c
+#undef d
+#undef e
+
+/*
+** Hash nBlock consecutive 64-byte blocks using the portable code above.
+*/
+static void sha1_blocks_portable(
+  unsigned int state[5],
+  const unsigned char *data,
+  unsigned int nBlock
+){
+  while( nBlock-- > 0 ){
+    SHA1Transform(state, data);
+    data += 64;
+  }
+}
+
+/*
+** On x86 processors, use the SHA extensions (SHA-NI) when the processor
+** has them.  Otherwise, batches of blobs are hashed four at a time, one
+** per 32-bit lane of an SSE register, using SSSE3.  Both are compiled
+** with function-specific target attributes and chosen at run-time, so
+** the binary still runs on processors that have neither.
+*/
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) \
+    && (__GNUC__>=5 || defined(__clang__))
+# include <immintrin.h>
+# include <cpuid.h>
+# define SHA1_HAVE_X86 1
+#endif
+
+#ifdef SHA1_HAVE_X86
+/*
+** One group of four rounds using the SHA extensions.  g is the group
+** number, 0 through 19.  E1 receives the next value of E and E2 is
+** overwritten with the ABCD state for the following group.  M0 holds the
+** message words for this group and M1, M2 and M3 those of the next three.
+*/
+#define SHA1_NI_ROUNDS(g, E1, E2, M0, M1, M2, M3)              \
+  if( g==0 ){                                                  \
+    E1 = _mm_add_epi32(E1, M0);                                \
+  }else{                                                       \
+    E1 = _mm_sha1nexte_epu32(E1, M0);                          \
+  }                                                            \
+  E2 = abcd;                                                   \
+  if( g>=3 && g<=18 ) M1 = _mm_sha1msg2_epu32(M1, M0);         \
+  abcd = _mm_sha1rnds4_epu32(abcd, E1, (g)/5);                 \
+  if( g>=1 && g<=16 ) M3 = _mm_sha1msg1_epu32(M3, M0);         \
+  if( g>=2 && g<=17 ) M2 = _mm_xor_si128(M2, M0);
+
+/*
+** Hash nBlock consecutive 64-byte blocks using the SHA extensions.
+*/
+__attribute__((target("sha,sse4.1,ssse3")))
+static void sha1_blocks_shani(
+  unsigned int state[5],
+  const unsigned char *data,
+  unsigned int nBlock
+){
+  const __m128i mask = _mm_set_epi64x(0x0001020304050607LL,
+                                      0x08090a0b0c0d0e0fLL);
+  __m128i abcd, e0, e1, abcdSave, eSave;
+  __m128i m0, m1, m2, m3;
+
+  abcd = _mm_loadu_si128((const __m128i*)state);
+  abcd = _mm_shuffle_epi32(abcd, 0x1b);
+  e0 = _mm_set_epi32(state[4], 0, 0, 0);
+  while( nBlock-- > 0 ){
+    abcdSave = abcd;
+    eSave = e0;
+    m0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)data), mask);
+    m1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data+16)), mask);
+    m2 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data+32)), mask);
+    m3 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(data+48)), mask);
+    SHA1_NI_ROUNDS( 0, e0, e1, m0, m1, m2, m3)
+    SHA1_NI_ROUNDS( 1, e1, e0, m1, m2, m3, m0)
+    SHA1_NI_ROUNDS( 2, e0, e1, m2, m3, m0, m1)
+    SHA1_NI_ROUNDS( 3, e1, e0, m3, m0, m1, m2)
+    SHA1_NI_ROUNDS( 4, e0, e1, m0, m1, m2, m3)
+    SHA1_NI_ROUNDS( 5, e1, e0, m1, m2, m3, m0)
+    SHA1_NI_ROUNDS( 6, e0, e1, m2, m3, m0, m1)
+    SHA1_NI_ROUNDS( 7, e1, e0, m3, m0, m1, m2)
+    SHA1_NI_ROUNDS( 8, e0, e1, m0, m1, m2, m3)
+    SHA1_NI_ROUNDS( 9, e1, e0, m1, m2, m3, m0)
+    SHA1_NI_ROUNDS(10, e0, e1, m2, m3, m0, m1)
+    SHA1_NI_ROUNDS(11, e1, e0, m3, m0, m1, m2)
+    SHA1_NI_ROUNDS(12, e0, e1, m0, m1, m2, m3)
+    SHA1_NI_ROUNDS(13, e1, e0, m1, m2, m3, m0)
+    SHA1_NI_ROUNDS(14, e0, e1, m2, m3, m0, m1)
+    SHA1_NI_ROUNDS(15, e1, e0, m3, m0, m1, m2)
+    SHA1_NI_ROUNDS(16, e0, e1, m0, m1, m2, m3)
+    SHA1_NI_ROUNDS(17, e1, e0, m1, m2, m3, m0)
+    SHA1_NI_ROUNDS(18, e0, e1, m2, m3, m0, m1)
+    SHA1_NI_ROUNDS(19, e1, e0, m3, m0, m1, m2)
+    e0 = _mm_sha1nexte_epu32(e0, eSave);
+    abcd = _mm_add_epi32(abcd, abcdSave);
+    data += 64;
+  }
+  abcd = _mm_shuffle_epi32(abcd, 0x1b);
+  _mm_storeu_si128((__m128i*)state, abcd);
+  state[4] = _mm_extract_epi32(e0, 3);
+}
+
+/*
+** Rotate each 32-bit lane of x left by k bits.
+*/
+#define SHA1_X4_ROL(x,k) \
+  _mm_or_si128(_mm_slli_epi32(x,k), _mm_srli_epi32(x,32-(k)))
+
+/*
+** Hash one 64-byte block for each of four independent messages.  The
+** state of message k is in st[0][k] through st[4][k], and its next
+** block is at apBlk[k].
+*/
+__attribute__((target("ssse3")))
+static void sha1_x4_ssse3(unsigned int st[5][4], const unsigned char *apBlk[4]){
+  const __m128i bswap = _mm_set_epi8(12,13,14,15, 8,9,10,11,
+                                     4,5,6,7, 0,1,2,3);
+  __m128i w[16];
+  __m128i va, vb, vc, vd, ve, t, f, k;
+  int i;
+
+  /* Load the blocks and transpose them so that w[i] holds word i of
+  ** every message */
+  for(i=0; i<16; i+=4){
+    __m128i r0, r1, r2, r3, t0, t1, t2, t3;
+    r0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(apBlk[0]+i*4)),
+                          bswap);
+    r1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(apBlk[1]+i*4)),
+                          bswap);
+    r2 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(apBlk[2]+i*4)),
+                          bswap);
+    r3 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)(apBlk[3]+i*4)),
+                          bswap);
+    t0 = _mm_unpacklo_epi32(r0, r1);
+    t1 = _mm_unpacklo_epi32(r2, r3);
+    t2 = _mm_unpackhi_epi32(r0, r1);
+    t3 = _mm_unpackhi_epi32(r2, r3);
+    w[i]   = _mm_unpacklo_epi64(t0, t1);
+    w[i+1] = _mm_unpackhi_epi64(t0, t1);
+    w[i+2] = _mm_unpacklo_epi64(t2, t3);
+    w[i+3] = _mm_unpackhi_epi64(t2, t3);
+  }
+  va = _mm_loadu_si128((const __m128i*)st[0]);
+  vb = _mm_loadu_si128((const __m128i*)st[1]);
+  vc = _mm_loadu_si128((const __m128i*)st[2]);
+  vd = _mm_loadu_si128((const __m128i*)st[3]);
+  ve = _mm_loadu_si128((const __m128i*)st[4]);
+  for(i=0; i<80; i++){
+    if( i>=16 ){
+      t = _mm_xor_si128(_mm_xor_si128(w[(i+13)&15], w[(i+8)&15]),
+                        _mm_xor_si128(w[(i+2)&15], w[i&15]));
+      w[i&15] = SHA1_X4_ROL(t, 1);
+    }
+    if( i<20 ){
+      f = _mm_xor_si128(vd, _mm_and_si128(vb, _mm_xor_si128(vc, vd)));
+      k = _mm_set1_epi32(0x5A827999);
+    }else if( i<40 ){
+      f = _mm_xor_si128(_mm_xor_si128(vb, vc), vd);
+      k = _mm_set1_epi32(0x6ED9EBA1);
+    }else if( i<60 ){
+      f = _mm_or_si128(_mm_and_si128(vb, vc),
+                       _mm_and_si128(vd, _mm_or_si128(vb, vc)));
+      k = _mm_set1_epi32(0x8F1BBCDC);
+    }else{
+      f = _mm_xor_si128(_mm_xor_si128(vb, vc), vd);
+      k = _mm_set1_epi32(0xCA62C1D6);
+    }
+    t = _mm_add_epi32(_mm_add_epi32(SHA1_X4_ROL(va, 5), f),
+                      _mm_add_epi32(_mm_add_epi32(ve, k), w[i&15]));
+    ve = vd;
+    vd = vc;
+    vc = SHA1_X4_ROL(vb, 30);
+    vb = va;
+    va = t;
+  }
+  _mm_storeu_si128((__m128i*)st[0],
+                   _mm_add_epi32(va, _mm_loadu_si128((const __m128i*)st[0])));
+  _mm_storeu_si128((__m128i*)st[1],
+                   _mm_add_epi32(vb, _mm_loadu_si128((const __m128i*)st[1])));
+  _mm_storeu_si128((__m128i*)st[2],
+                   _mm_add_epi32(vc, _mm_loadu_si128((const __m128i*)st[2])));
+  _mm_storeu_si128((__m128i*)st[3],
+                   _mm_add_epi32(vd, _mm_loadu_si128((const __m128i*)st[3])));
+  _mm_storeu_si128((__m128i*)st[4],
+                   _mm_add_epi32(ve, _mm_loadu_si128((const __m128i*)st[4])));
+}
+#endif /* SHA1_HAVE_X86 */
+
+/*
+** The implementations of SHA1 that this build and processor support.
+** The best available is chosen by sha1_init().
+*/
+#define SHA1_IMPL_PORTABLE  0   /* Portable C code */
+#define SHA1_IMPL_SSSE3     1   /* Four-way SSSE3 for batches */
+#define SHA1_IMPL_SHANI     2   /* SHA extensions */
+
+static const char *const azSha1Impl[] = { "portable", "ssse3", "sha-ni" };
+
+static void sha1_blocks_init(unsigned int[5], const unsigned char*,
+                             unsigned int);
+
+/*
+** The routine used to hash consecutive blocks of a single message, and
+** the implementation currently selected.
+*/
+static void (*xSha1Blocks)(unsigned int*, const unsigned char*, unsigned int)
+     = sha1_blocks_init;
+static int iSha1Impl = -1;
+
+/*
+** Return the best implementation of SHA1 this processor supports.
+*/
+static int sha1_best_impl(void){
+#ifdef SHA1_HAVE_X86
+  unsigned int eax, ebx, ecx, edx;
+  int hasSsse3 = 0, hasSse41 = 0, hasSha = 0;
+  if( __get_cpuid(1, &eax, &ebx, &ecx, &edx) ){
+    hasSsse3 = (ecx & (1<<9))!=0;
+    hasSse41 = (ecx & (1<<19))!=0;
+  }
+  if( __get_cpuid_max(0, 0)>=7 ){
+    __cpuid_count(7, 0, eax, ebx, ecx, edx);
+    hasSha = (ebx & (1<<29))!=0;
+  }
+  if( hasSha && hasSsse3 && hasSse41 ) return SHA1_IMPL_SHANI;
+  if( hasSsse3 ) return SHA1_IMPL_SSSE3;
+#endif
+  return SHA1_IMPL_PORTABLE;
+}
+
+/*
+** Select implementation iImpl, which must be no better than what
+** sha1_best_impl() returns.
+*/
+static void sha1_set_impl(int iImpl){
+#ifdef SHA1_HAVE_X86
+  if( iImpl==SHA1_IMPL_SHANI ){
+    xSha1Blocks = sha1_blocks_shani;
+  }else
+#endif
+  {
+    xSha1Blocks = sha1_blocks_portable;
+  }
+  iSha1Impl = iImpl;
+}
+
+/*
+** Select the best implementation of SHA1, unless that has been done
+** already.  This happens the first time anything is hashed, but it must
+** also be done before any worker thread that might hash is started, so
+** that the threads do not race to make the selection.
+*/
+void sha1_init(void){
+  if( iSha1Impl<0 ) sha1_set_impl(sha1_best_impl());
+}
+
+/*
+** Initial value of xSha1Blocks.  Pick an implementation and then use it.
+*/
+static void sha1_blocks_init(
+  unsigned int state[5],
+  const unsigned char *data,
+  unsigned int nBlock
+){
+  sha1_init();
+  xSha1Blocks(state, data, nBlock);
+}
 
 
 /*
@@ -167,9 +438,11 @@ static void SHA1Update(
     j = (j >> 3) & 63;
     if ((j + len) > 63) {
         (void)memcpy(&context->buffer[j], data, (i = 64-j));
-        SHA1Transform(context->state, context->buffer);
-        for ( ; i + 63 < len; i += 64)
-            SHA1Transform(context->state, &data[i]);
+        xSha1Blocks(context->state, context->buffer, 1);
+        if (i + 63 < len) {
+            xSha1Blocks(context->state, &data[i], (len-i)/64);
+            i += (len-i) & ~63;
+        }
         j = 0;
     } else {
         i = 0;
@@ -271,6 +544,39 @@ char *sha1sum_finish(Blob *pOut){
 }
 
 
+/*
+** Begin an incremental SHA1 checksum that is independent of the one
+** above, so that it can be carried on while other checksums are
+** computed.  The returned object is freed by sha1sum_ctx_finish().
+*/
+void *sha1sum_ctx_new(void){
+  SHA1Context *pCtx = fossil_malloc(sizeof(*pCtx));
+  SHA1Init(pCtx);
+  return pCtx;
+}
+
+/*
+** Add nBytes of zText to a checksum begun by sha1sum_ctx_new().
+*/
+void sha1sum_ctx_step(void *pCtx, const char *zText, int nBytes){
+  SHA1Update((SHA1Context*)pCtx, (unsigned char*)zText, nBytes);
+}
+
+/*
+** Finish a checksum begun by sha1sum_ctx_new() and free it.  Store the
+** result in blob pOut if pOut!=0.
+*/
+void sha1sum_ctx_finish(void *pCtx, Blob *pOut){
+  unsigned char zResult[20];
+  SHA1Final((SHA1Context*)pCtx, zResult);
+  fossil_free(pCtx);
+  if( pOut ){
+    blob_zero(pOut);
+    blob_resize(pOut, 40);
+    DigestToBase16(zResult, blob_buffer(pOut));
+  }
+}
+
 /*
 ** Compute the SHA1 checksum of a file on disk.  Store the resulting
 ** checksum in the blob pCksum.  pCksum is assumed to be initialized.
@@ -278,12 +584,21 @@ char *sha1sum_finish(Blob *pOut){
 ** Return the number of errors.
 */
 int sha1sum_file(const char *zFilename, Blob *pCksum){
+  return sha1sum_wd_file(zFilename, file_wd_islink(zFilename), pCksum);
+}
+
+/*
+** Like sha1sum_file() except that the caller says whether or not
+** zFilename is a symlink to be hashed as such.  This routine does not
+** touch the stat cache in file.c, so it may be run from a worker thread.
+*/
+int sha1sum_wd_file(const char *zFilename, int isLink, Blob *pCksum){
   FILE *in;
   SHA1Context ctx;
   unsigned char zResult[20];
   char zBuf[10240];
 
-  if( file_wd_islink(zFilename) ){
+  if( isLink ){
     /* Instead of file content, return sha1 of link destination path */
     Blob destinationPath;
     int rc;
@@ -337,6 +652,157 @@ int sha1sum_blob(const Blob *pIn, Blob *pCksum){
   return 0;
 }
 
+#ifdef SHA1_HAVE_X86
+/*
+** A message being hashed by sha1_blobs_x4().  Blocks before nFull come
+** straight from the message.  The rest, holding the tail of the message
+** and the padding, are in aTail[].
+*/
+struct Sha1Lane {
+  int iMsg;                  /* Index of the message.  -1 if idle */
+  const unsigned char *z;    /* Content of the message */
+  int nFull;                 /* Number of complete blocks in z[] */
+  int nBlk;                  /* Total number of blocks, with padding */
+  int iBlk;                  /* Next block to hash */
+  unsigned char aTail[128];  /* Last one or two blocks */
+};
+
+/*
+** Begin hashing message iMsg, which is pIn, in lane k.
+*/
+static void sha1_lane_start(
+  struct Sha1Lane *p,
+  unsigned int st[5][4],
+  int k,
+  int iMsg,
+  const Blob *pIn
+){
+  int n = blob_size(pIn);
+  int nRem = n%64;
+  int nTail = nRem<56 ? 64 : 128;
+  u64 nBit = (u64)n*8;
+  int i;
+  p->iMsg = iMsg;
+  p->z = (const unsigned char*)blob_buffer(pIn);
+  p->nFull = n/64;
+  p->nBlk = p->nFull + nTail/64;
+  p->iBlk = 0;
+  memset(p->aTail, 0, sizeof(p->aTail));
+  memcpy(p->aTail, p->z + p->nFull*64, nRem);
+  p->aTail[nRem] = 0x80;
+  for(i=0; i<8; i++){
+    p->aTail[nTail-1-i] = (unsigned char)(nBit>>(i*8));
+  }
+  st[0][k] = 0x67452301;
+  st[1][k] = 0xEFCDAB89;
+  st[2][k] = 0x98BADCFE;
+  st[3][k] = 0x10325476;
+  st[4][k] = 0xC3D2E1F0;
+}
+
+/*
+** Compute the SHA1 digests of aIn[0] through aIn[n-1], four at a time.
+*/
+static void sha1_blobs_x4(int n, const Blob *aIn, unsigned char (*aDigest)[20]){
+  static const unsigned char aIdle[64];
+  struct Sha1Lane aLane[4];
+  unsigned int st[5][4];
+  int nNext = 0;
+  int nActive = 0;
+  int i, k;
+
+  memset(st, 0, sizeof(st));
+  for(k=0; k<4; k++){
+    if( nNext<n ){
+      sha1_lane_start(&aLane[k], st, k, nNext, &aIn[nNext]);
+      nNext++;
+      nActive++;
+    }else{
+      aLane[k].iMsg = -1;
+    }
+  }
+  while( nActive>0 ){
+    const unsigned char *apBlk[4];
+    if( nActive==1 && nNext>=n ){
+      /* Finish the last message on its own rather than with three idle
+      ** lanes. */
+      unsigned int state[5];
+      struct Sha1Lane *p;
+      for(k=0; aLane[k].iMsg<0; k++){}
+      p = &aLane[k];
+      for(i=0; i<5; i++) state[i] = st[i][k];
+      if( p->iBlk<p->nFull ){
+        sha1_blocks_portable(state, p->z + p->iBlk*64, p->nFull - p->iBlk);
+        p->iBlk = p->nFull;
+      }
+      sha1_blocks_portable(state, &p->aTail[(p->iBlk - p->nFull)*64],
+                           p->nBlk - p->iBlk);
+      for(i=0; i<5; i++) st[i][k] = state[i];
+      p->iBlk = p->nBlk;
+    }else{
+      for(k=0; k<4; k++){
+        struct Sha1Lane *p = &aLane[k];
+        if( p->iMsg<0 ){
+          apBlk[k] = aIdle;
+        }else if( p->iBlk<p->nFull ){
+          apBlk[k] = p->z + p->iBlk*64;
+        }else{
+          apBlk[k] = &p->aTail[(p->iBlk - p->nFull)*64];
+        }
+      }
+      sha1_x4_ssse3(st, apBlk);
+      for(k=0; k<4; k++){
+        if( aLane[k].iMsg>=0 ) aLane[k].iBlk++;
+      }
+    }
+    for(k=0; k<4; k++){
+      struct Sha1Lane *p = &aLane[k];
+      if( p->iMsg<0 || p->iBlk<p->nBlk ) continue;
+      for(i=0; i<20; i++){
+        aDigest[p->iMsg][i] = (unsigned char)(st[i>>2][k] >> ((3-(i&3))*8));
+      }
+      if( nNext<n ){
+        sha1_lane_start(p, st, k, nNext, &aIn[nNext]);
+        nNext++;
+      }else{
+        p->iMsg = -1;
+        nActive--;
+      }
+    }
+  }
+}
+#endif /* SHA1_HAVE_X86 */
+
+/*
+** Compute the SHA1 checksums of the n blobs aIn[0] through aIn[n-1] and
+** store them in aCksum[0] through aCksum[n-1].  The aCksum[] blobs are
+** assumed to be uninitialized.
+**
+** The results are the same as calling sha1sum_blob() on each blob, but
+** some processors can hash several blobs at once faster than one at a
+** time, so callers that have many blobs to hash should use this routine.
+*/
+void sha1sum_blobs(int n, const Blob *aIn, Blob *aCksum){
+  int i;
+  sha1_init();
+#ifdef SHA1_HAVE_X86
+  if( iSha1Impl==SHA1_IMPL_SSSE3 && n>1 ){
+    unsigned char (*aDigest)[20] = fossil_malloc( n*20 );
+    sha1_blobs_x4(n, aIn, aDigest);
+    for(i=0; i<n; i++){
+      blob_zero(&aCksum[i]);
+      blob_resize(&aCksum[i], 40);
+      DigestToBase16(aDigest[i], blob_buffer(&aCksum[i]));
+    }
+    fossil_free(aDigest);
+    return;
+  }
+#endif
+  for(i=0; i<n; i++){
+    sha1sum_blob(&aIn[i], &aCksum[i]);
+  }
+}
+
 /*
 ** Compute the SHA1 checksum of a zero-terminated string.  The
 ** result is held in memory obtained from mprintf().
@@ -462,3 +928,89 @@ void sha1sum_test(void){
     blob_reset(&cksum);
   }
 }
+
+/*
+** COMMAND: test-sha1-bench
+**
+** Usage: %fossil test-sha1-bench ?OPTIONS?
+**
+** Measure the speed of each SHA1 implementation that this build and
+** processor support, hashing blobs one at a time with sha1sum_blob() and
+** in bulk with sha1sum_blobs().  Throughput is reported in megabytes
+** per second of CPU time.  All implementations must agree.
+**
+** Options:
+**    --size N         Size of each blob.  Default: 4000
+**    --count N        Number of blobs.  Default: 2500
+**    --iterations N   Repeat each measurement N times.  Default: 5
+*/
+void sha1_bench_cmd(void){
+  const char *zSize = find_option("size",0,1);
+  const char *zCount = find_option("count",0,1);
+  const char *zIter = find_option("iterations",0,1);
+  int sz = zSize ? atoi(zSize) : 4000;
+  int nBlob = zCount ? atoi(zCount) : 2500;
+  int nIter = zIter ? atoi(zIter) : 5;
+  int iBest = sha1_best_impl();
+  unsigned x = 1;
+  int i, j, iImpl, iTimer;
+  Blob *aIn, *aExpect, *aCksum;
+  sqlite3_uint64 tmOne, tmBatch;
+  double mb;
+
+  verify_all_options();
+  if( sz<0 ) sz = 0;
+  if( nBlob<1 ) nBlob = 1;
+  if( nIter<1 ) nIter = 1;
+  aIn = fossil_malloc( sizeof(Blob)*nBlob*3 );
+  aExpect = &aIn[nBlob];
+  aCksum = &aIn[nBlob*2];
+  for(i=0; i<nBlob; i++){
+    /* Vary the sizes a little so that lanes finish at different times */
+    int n = sz + (i%7)*13;
+    blob_zero(&aIn[i]);
+    blob_resize(&aIn[i], n);
+    for(j=0; j<n; j++){
+      x = x*1103515245 + 12345;
+      blob_buffer(&aIn[i])[j] = (char)(x>>16);
+    }
+  }
+  sha1_set_impl(SHA1_IMPL_PORTABLE);
+  for(i=0; i<nBlob; i++) sha1sum_blob(&aIn[i], &aExpect[i]);
+  mb = (double)nIter*(sz + 39)*nBlob/1000000.0;
+  fossil_print("%-10s %14s  %14s\n", "impl", "one-at-a-time", "batch");
+  for(iImpl=SHA1_IMPL_PORTABLE; iImpl<=iBest; iImpl++){
+    sha1_set_impl(iImpl);
+    iTimer = fossil_timer_start();
+    for(j=0; j<nIter; j++){
+      for(i=0; i<nBlob; i++){
+        sha1sum_blob(&aIn[i], &aCksum[i]);
+        if( blob_compare(&aCksum[i], &aExpect[i]) ){
+          fossil_fatal("%s: wrong hash for blob %d", azSha1Impl[iImpl], i);
+        }
+        blob_reset(&aCksum[i]);
+      }
+    }
+    tmOne = fossil_timer_reset(iTimer);
+    for(j=0; j<nIter; j++){
+      sha1sum_blobs(nBlob, aIn, aCksum);
+      for(i=0; i<nBlob; i++){
+        if( blob_compare(&aCksum[i], &aExpect[i]) ){
+          fossil_fatal("%s: wrong batch hash for blob %d",
+                       azSha1Impl[iImpl], i);
+        }
+        blob_reset(&aCksum[i]);
+      }
+    }
+    tmBatch = fossil_timer_stop(iTimer);
+    fossil_print("%-10s %9.1f MB/s  %9.1f MB/s\n", azSha1Impl[iImpl],
+                 mb/((tmOne ? tmOne : 1)/1000000.0),
+                 mb/((tmBatch ? tmBatch : 1)/1000000.0));
+  }
+  sha1_set_impl(iBest);
+  for(i=0; i<nBlob; i++){
+    blob_reset(&aIn[i]);
+    blob_reset(&aExpect[i]);
+  }
+  fossil_free(aIn);
+}
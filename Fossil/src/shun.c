@@ -194,6 +194,7 @@ void shun_artifacts(void){
      "CREATE TEMP TABLE toshun(rid INTEGER PRIMARY KEY);"
      "INSERT INTO toshun SELECT rid FROM blob, shun WHERE blob.uuid=shun.uuid;"
   );
+  if( db_exists("SELECT 1 FROM toshun") ) clone_pack_invalidate();
   db_prepare(&q,
      "SELECT rid FROM delta WHERE srcid IN toshun"
   );
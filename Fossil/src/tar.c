@@ -31,6 +31,7 @@ static struct tarball_t {
   char *zPrevDir;           /* Name of directory for previous entry */
   int nPrevDirAlloc;        /* size of zPrevDir */
   Blob pax;                 /* PAX data */
+  int isStream;             /* Send output with cgi_stream() as it is made */
 } tball;
 
 
@@ -45,8 +46,9 @@ static struct tarball_t {
 ** Begin the process of generating a tarball.
 **
 ** Initialize the GZIP compressor and the table of directory names.
+** The tarball is compressed using nThread worker threads.
 */
-static void tar_begin(sqlite3_int64 mTime){
+static void tar_begin(sqlite3_int64 mTime, int nThread){
   assert( tball.aHdr==0 );
   tball.aHdr = fossil_malloc(512+512);
   memset(tball.aHdr, 0, 512+512);
@@ -62,7 +64,7 @@ static void tar_begin(sqlite3_int64 mTime){
   memcpy(&tball.aHdr[257], "ustar\00000", 8);  /* POSIX.1 format */
   memcpy(&tball.aHdr[265], "nobody", 7);   /* Owner name */
   memcpy(&tball.aHdr[297], "nobody", 7);   /* Group name */
-  gzip_begin(mTime);
+  gzip_begin_parallel(mTime, nThread);
   db_multi_exec(
     "CREATE TEMP TABLE dir(name UNIQUE);"
   );
@@ -397,15 +399,36 @@ static void tar_add_file(
   }
 }
 
+/*
+** When streaming, send the compressed output generated so far.
+*/
+static void tar_flush(void){
+  if( tball.isStream ){
+    Blob out;
+    gzip_take(&out);
+    cgi_stream(blob_buffer(&out), blob_size(&out));
+    blob_reset(&out);
+  }
+}
+
 /*
 ** Finish constructing the tarball.  Put the content of the tarball
-** in Blob pOut.
+** in Blob pOut.  When streaming, the remainder of the tarball is sent
+** instead and pOut may be NULL.
 */
 static void tar_finish(Blob *pOut){
+  Blob out;
   db_multi_exec("DROP TABLE dir");
   gzip_step(tball.zSpaces, 512);
   gzip_step(tball.zSpaces, 512);
-  gzip_finish(pOut);
+  gzip_finish(&out);
+  if( tball.isStream ){
+    cgi_stream(blob_buffer(&out), blob_size(&out));
+    blob_reset(&out);
+  }else{
+    *pOut = out;
+  }
+  tball.isStream = 0;
   fossil_free(tball.aHdr);
   tball.aHdr = 0;
   fossil_free(tball.zPrevDir);
@@ -429,7 +452,7 @@ void test_tarball_cmd(void){
     usage("ARCHIVE FILE....");
   }
   sqlite3_open(":memory:", &g.db);
-  tar_begin(-1);
+  tar_begin(-1, 1);
   for(i=3; i<g.argc; i++){
     blob_zero(&file);
     blob_read_from_file(&file, g.argv[i]);
@@ -458,8 +481,15 @@ void test_tarball_cmd(void){
 ** politely expands into a subdir instead of filling your current dir
 ** with source files. For example, pass a UUID or "ProjectName".
 **
+** If pTar is NULL, the tarball is sent with cgi_stream() as each file
+** is added, so that only one file at a time is held in memory.  The
+** caller must bracket the call with cgi_stream_begin() and
+** cgi_stream_end().
+**
+** If nThread is more than 1, the tarball is compressed in independent
+** blocks on that many worker threads.
 */
-void tarball_of_checkin(int rid, Blob *pTar, const char *zDir){
+void tarball_of_checkin(int rid, Blob *pTar, const char *zDir, int nThread){
   Blob mfile, hash, file;
   Manifest *pManifest;
   ManifestFile *pFile;
@@ -470,7 +500,7 @@ void tarball_of_checkin(int rid, Blob *pTar, const char *zDir){
 
   content_get(rid, &mfile);
   if( blob_size(&mfile)==0 ){
-    blob_zero(pTar);
+    if( pTar ) blob_zero(pTar);
     return;
   }
   blob_zero(&hash);
@@ -484,7 +514,8 @@ void tarball_of_checkin(int rid, Blob *pTar, const char *zDir){
   pManifest = manifest_get(rid, CFTYPE_MANIFEST, 0);
   if( pManifest ){
     mTime = (pManifest->rDate - 2440587.5)*86400.0;
-    tar_begin(mTime);
+    tar_begin(mTime, nThread);
+    tball.isStream = pTar==0;
     if( db_get_boolean("manifest", 0) ){
       blob_append(&filename, "manifest", -1);
       zName = blob_str(&filename);
@@ -508,6 +539,7 @@ void tarball_of_checkin(int rid, Blob *pTar, const char *zDir){
         zName = blob_str(&filename);
         tar_add_file(zName, &file, manifest_file_mperm(pFile), mTime);
         blob_reset(&file);
+        tar_flush();
       }
     }
   }else{
@@ -515,7 +547,8 @@ void tarball_of_checkin(int rid, Blob *pTar, const char *zDir){
     blob_append(&filename, blob_str(&hash), 16);
     zName = blob_str(&filename);
     mTime = db_int64(0, "SELECT (julianday('now') -  2440587.5)*86400.0;");
-    tar_begin(mTime);
+    tar_begin(mTime, nThread);
+    tball.isStream = pTar==0;
     tar_add_file(zName, &mfile, 0, mTime);
   }
   manifest_destroy(pManifest);
@@ -534,12 +567,17 @@ void tarball_of_checkin(int rid, Blob *pTar, const char *zDir){
 ** in the resulting tarball.  If --name is omitted, the top-level directory
 ** named is derived from the project name, the check-in date and time, and
 ** the artifact ID of the check-in.
+**
+** With --threads N, the tarball is compressed on N threads, 0 meaning one
+** per CPU.  The default comes from the "threads" setting.
 */
 void tarball_cmd(void){
   int rid;
   Blob tarball;
   const char *zName;
+  const char *zThreads;
   zName = find_option("name", 0, 1);
+  zThreads = find_option("threads", 0, 1);
   db_find_and_open_repository(0, 0);
   if( g.argc!=4 ){
     usage("VERSION OUTPUTFILE");
@@ -561,7 +599,7 @@ void tarball_cmd(void){
        db_get("project-name", "unnamed"), rid, rid
     );
   }
-  tarball_of_checkin(rid, &tarball, zName);
+  tarball_of_checkin(rid, &tarball, zName, threadpool_size(zThreads));
   blob_write_to_file(&tarball, g.argv[3]);
   blob_reset(&tarball);
 }
@@ -572,12 +610,14 @@ void tarball_cmd(void){
 **
 ** Generate a compressed tarball for a checkin.
 ** Return that tarball as the HTTP reply content.
+**
+** The reply is taken from the archive cache (see cache.c) when it has
+** been made before and the "archive-cache-size" setting is on.
 */
 void tarball_page(void){
   int rid;
-  char *zName, *zRid;
-  int nName, nRid;
-  Blob tarball;
+  char *zName, *zRid, *zKey, *zETag;
+  int nName, nRid, nThread;
 
   login_check_credentials();
   if( !g.perm.Zip ){ login_needed(); return; }
@@ -605,9 +645,25 @@ void tarball_page(void){
     return;
   }
   if( nRid==0 && nName>10 ) zName[10] = 0;
-  tarball_of_checkin(rid, &tarball, zName);
+  /* Compression on more than one thread gives different (but equally
+  ** valid) output, and the "manifest" setting decides whether the
+  ** manifest is included, so the key records both. */
+  nThread = threadpool_size(0);
+  zKey = mprintf("tar/%z/%s/%c/%d", db_text(0,
+                  "SELECT uuid FROM blob WHERE rid=%d", rid), zName,
+                  nThread>1 ? 'p' : 's', db_get_boolean("manifest", 0));
+  cgi_set_content_type("application/x-compressed");
+  zETag = sha1sum(zKey);
+  cgi_check_etag(zETag);
+  fossil_free(zETag);
+  if( !cache_serve(zKey) ){
+    cache_capture_begin(zKey);
+    cgi_stream_begin();
+    tarball_of_checkin(rid, 0, zName, nThread);
+    cgi_stream_end();
+    cache_capture_end();
+  }
+  free( zKey );
   free( zName );
   free( zRid );
-  cgi_set_content(&tarball);
-  cgi_set_content_type("application/x-compressed");
 }
@@ -0,0 +1,234 @@
+/*
+** Copyright (c) 2013 D. Richard Hipp
+**
+** This program is free software; you can redistribute it and/or
+** modify it under the terms of the Simplified BSD License (also
+** known as the "2-Clause License" or "FreeBSD License".)
+
+** This program is distributed in the hope that it will be useful,
+** but without any warranty; without even the implied warranty of
+** merchantability or fitness for a particular purpose.
+**
+** Author contact information:
+**   drh@hwaci.com
+**   http://www.hwaci.com/drh/
+**
+*******************************************************************************
+**
+** This file implements a simple pool of worker threads.
+**
+** Fossil is single-threaded.  The database connection, the "g" global
+** and most other state belong to the main thread and must never be
+** touched by a worker.  The pool is only for pure computations, such as
+** inflating and applying deltas or hashing a buffer, that the main thread
+** hands off and later collects.  A task communicates only through the
+** object passed as its argument.
+**
+** When Fossil is built without thread support, or when the pool has
+** just one thread, every task runs synchronously inside threadpool_add().
+** Callers therefore see the same results either way.
+*/
+#include "config.h"
+#include "threadpool.h"
+
+#if defined(HAVE_PTHREAD_CREATE) && !defined(_WIN32)
+# include <pthread.h>
+# define FOSSIL_HAVE_THREADS 1
+#endif
+
+#if INTERFACE
+/*
+** A pool of worker threads.  The definition is private to threadpool.c.
+*/
+typedef struct ThreadPool ThreadPool;
+#endif
+
+/*
+** One queued task
+*/
+struct ThreadPoolTask {
+  void (*xTask)(void*);   /* Function to run */
+  void *pArg;             /* Argument to xTask */
+};
+
+struct ThreadPool {
+  int nThread;                 /* Number of worker threads.  0 for inline */
+  int nTask;                   /* Number of entries used in aTask[] */
+  int nAlloc;                  /* Number of slots allocated in aTask[] */
+  int iNext;                   /* Next entry of aTask[] to be run */
+  int nBusy;                   /* Tasks taken from aTask[] but not finished */
+  int isShutdown;              /* True when workers should exit */
+  struct ThreadPoolTask *aTask;  /* Queue of tasks waiting to be run */
+#ifdef FOSSIL_HAVE_THREADS
+  pthread_mutex_t mutex;       /* Protects every field above */
+  pthread_cond_t cvWork;       /* Signalled when work is queued */
+  pthread_cond_t cvIdle;       /* Signalled when the pool becomes idle */
+  pthread_t *aThread;          /* The worker threads */
+#endif
+};
+
+/*
+** Return the number of processors available, or 1 if unknown.
+*/
+int threadpool_ncpu(void){
+#if defined(FOSSIL_HAVE_THREADS) && defined(_SC_NPROCESSORS_ONLN)
+  long n = sysconf(_SC_NPROCESSORS_ONLN);
+  if( n>0 ) return n>256 ? 256 : (int)n;
+#endif
+  return 1;
+}
+
+/*
+** Work out how many threads an operation should use.  zThreads is the
+** argument to a --threads command-line option, or NULL if there was none,
+** in which case the "threads" setting is consulted.  A value of 0 means
+** one thread per processor.
+**
+** The result is always 1 if Fossil was built without thread support.
+*/
+int threadpool_size(const char *zThreads){
+  int n;
+  if( zThreads ){
+    n = atoi(zThreads);
+  }else{
+    n = db_get_int("threads", 1);
+  }
+#ifdef FOSSIL_HAVE_THREADS
+  if( n<=0 ) n = threadpool_ncpu();
+  if( n>256 ) n = 256;
+#else
+  n = 1;
+#endif
+  return n;
+}
+
+#ifdef FOSSIL_HAVE_THREADS
+/*
+** The main loop of each worker thread.
+*/
+static void *threadpool_worker(void *pArg){
+  ThreadPool *p = (ThreadPool*)pArg;
+  pthread_mutex_lock(&p->mutex);
+  for(;;){
+    struct ThreadPoolTask t;
+    while( p->iNext>=p->nTask && !p->isShutdown ){
+      pthread_cond_wait(&p->cvWork, &p->mutex);
+    }
+    if( p->iNext>=p->nTask ) break;
+    t = p->aTask[p->iNext++];
+    p->nBusy++;
+    pthread_mutex_unlock(&p->mutex);
+    t.xTask(t.pArg);
+    pthread_mutex_lock(&p->mutex);
+    p->nBusy--;
+    if( p->nBusy==0 && p->iNext>=p->nTask ){
+      p->iNext = p->nTask = 0;
+      pthread_cond_broadcast(&p->cvIdle);
+    }
+  }
+  pthread_mutex_unlock(&p->mutex);
+  return 0;
+}
+#endif
+
+/*
+** Create a new pool with nThread worker threads.  If nThread is 1 or
+** less, or if threads are unavailable, the pool runs each task
+** synchronously when it is added.
+*/
+ThreadPool *threadpool_new(int nThread){
+  ThreadPool *p = fossil_malloc( sizeof(*p) );
+  memset(p, 0, sizeof(*p));
+#ifdef FOSSIL_HAVE_THREADS
+  if( nThread>1 ){
+    int i;
+    sha1_init();   /* Tasks may hash.  See sha1_init() */
+    pthread_mutex_init(&p->mutex, 0);
+    pthread_cond_init(&p->cvWork, 0);
+    pthread_cond_init(&p->cvIdle, 0);
+    p->aThread = fossil_malloc( sizeof(p->aThread[0])*nThread );
+    for(i=0; i<nThread; i++){
+      if( pthread_create(&p->aThread[i], 0, threadpool_worker, p) ) break;
+    }
+    p->nThread = i;
+    if( i==0 ){
+      fossil_free(p->aThread);
+      p->aThread = 0;
+      pthread_cond_destroy(&p->cvIdle);
+      pthread_cond_destroy(&p->cvWork);
+      pthread_mutex_destroy(&p->mutex);
+    }
+  }
+#endif
+  return p;
+}
+
+/*
+** Return the number of worker threads in the pool.  Zero means that
+** tasks run synchronously.
+*/
+int threadpool_nthread(ThreadPool *p){
+  return p->nThread;
+}
+
+/*
+** Arrange for xTask(pArg) to be run by one of the workers.
+*/
+void threadpool_add(ThreadPool *p, void (*xTask)(void*), void *pArg){
+  if( p->nThread==0 ){
+    xTask(pArg);
+    return;
+  }
+#ifdef FOSSIL_HAVE_THREADS
+  pthread_mutex_lock(&p->mutex);
+  if( p->nTask>=p->nAlloc ){
+    p->nAlloc = p->nAlloc*2 + 20;
+    p->aTask = fossil_realloc(p->aTask, sizeof(p->aTask[0])*p->nAlloc);
+  }
+  p->aTask[p->nTask].xTask = xTask;
+  p->aTask[p->nTask].pArg = pArg;
+  p->nTask++;
+  pthread_cond_signal(&p->cvWork);
+  pthread_mutex_unlock(&p->mutex);
+#endif
+}
+
+/*
+** Wait until every task that has been added to the pool has finished.
+*/
+void threadpool_wait(ThreadPool *p){
+  if( p->nThread==0 ) return;
+#ifdef FOSSIL_HAVE_THREADS
+  pthread_mutex_lock(&p->mutex);
+  while( p->nBusy>0 || p->iNext<p->nTask ){
+    pthread_cond_wait(&p->cvIdle, &p->mutex);
+  }
+  pthread_mutex_unlock(&p->mutex);
+#endif
+}
+
+/*
+** Wait for all outstanding tasks, stop the workers and free the pool.
+*/
+void threadpool_free(ThreadPool *p){
+  if( p==0 ) return;
+#ifdef FOSSIL_HAVE_THREADS
+  if( p->nThread>0 ){
+    int i;
+    threadpool_wait(p);
+    pthread_mutex_lock(&p->mutex);
+    p->isShutdown = 1;
+    pthread_cond_broadcast(&p->cvWork);
+    pthread_mutex_unlock(&p->mutex);
+    for(i=0; i<p->nThread; i++){
+      pthread_join(p->aThread[i], 0);
+    }
+    fossil_free(p->aThread);
+    pthread_cond_destroy(&p->cvIdle);
+    pthread_cond_destroy(&p->cvWork);
+    pthread_mutex_destroy(&p->mutex);
+  }
+#endif
+  fossil_free(p->aTask);
+  fossil_free(p);
+}
@@ -308,6 +308,7 @@ void ticket_rebuild_entry(const char *zTktUuid){
     createFlag = 0;
   }
   db_finalize(&q);
+  search_doc_touch('t', tagid, zTktUuid);
 }
 
 
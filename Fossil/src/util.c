@@ -151,6 +151,23 @@ int fossil_stricmp(const char *zA, const char *zB){
   return rc;
 }
 
+/*
+** Return the current wall-clock time in milliseconds.  Only the
+** difference between two values is meaningful.
+*/
+sqlite3_int64 fossil_wallclock_ms(void){
+  sqlite3_vfs *pVfs = sqlite3_vfs_find(0);
+  sqlite3_int64 t = 0;
+  if( pVfs->iVersion>=2 && pVfs->xCurrentTimeInt64 ){
+    pVfs->xCurrentTimeInt64(pVfs, &t);
+  }else{
+    double r = 0.0;
+    pVfs->xCurrentTime(pVfs, &r);
+    t = (sqlite3_int64)(r*86400000.0);
+  }
+  return t;
+}
+
 /*
 ** Get user and kernel times in microseconds.
 */
@@ -213,8 +230,7 @@ int fossil_timer_start(){
   static char once = 0;
   if(!once){
     once = 1;
-    memset(&fossilTimerList, 0,
-           count(fossilTimerList));
+    memset(&fossilTimerList, 0, sizeof(fossilTimerList));
   }
   for( i = 0; i < FOSSIL_TIMER_COUNT; ++i ){
     struct FossilTimer * ft = &fossilTimerList[i];
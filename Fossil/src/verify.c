@@ -29,32 +29,53 @@
 #include <assert.h>
 
 /*
-** Load the record identify by rid.  Make sure we can reproduce it
-** without error.
+** Number of records that verify_at_commit() loads and hashes at once
+*/
+#define VERIFY_BATCH 16
+
+/*
+** Load the records identified by aRid[0] through aRid[n-1].  Make sure
+** we can reproduce them without error.
 **
 ** Panic if anything goes wrong.  If this procedure returns it means
 ** that everything is OK.
 */
-static void verify_rid(int rid){
-  Blob uuid, hash, content;
-  if( content_size(rid, 0)<0 ){
-    return;  /* No way to verify phantoms */
-  }
-  blob_zero(&uuid);
-  db_blob(&uuid, "SELECT uuid FROM blob WHERE rid=%d", rid);
-  if( blob_size(&uuid)!=UUID_SIZE ){
-    fossil_fatal("not a valid rid: %d", rid);
+static void verify_rids(int n, const int *aRid){
+  Blob aUuid[VERIFY_BATCH], aContent[VERIFY_BATCH], aHash[VERIFY_BATCH];
+  int aOk[VERIFY_BATCH];
+  int i, nContent = 0;
+  assert( n<=VERIFY_BATCH );
+  for(i=0; i<VERIFY_BATCH; i++) blob_zero(&aContent[i]);
+  for(i=0; i<n; i++){
+    int rid = aRid[i];
+    aOk[i] = 0;
+    if( content_size(rid, 0)<0 ){
+      continue;  /* No way to verify phantoms */
+    }
+    blob_zero(&aUuid[nContent]);
+    db_blob(&aUuid[nContent], "SELECT uuid FROM blob WHERE rid=%d", rid);
+    if( blob_size(&aUuid[nContent])!=UUID_SIZE ){
+      fossil_fatal("not a valid rid: %d", rid);
+    }
+    if( content_get(rid, &aContent[nContent]) ){
+      aOk[i] = 1;
+      nContent++;
+    }else{
+      blob_reset(&aUuid[nContent]);
+    }
   }
-  if( content_get(rid, &content) ){
-    sha1sum_blob(&content, &hash);
-    blob_reset(&content);
-    if( blob_compare(&uuid, &hash) ){
+  sha1sum_blobs(nContent, aContent, aHash);
+  for(i=nContent=0; i<n; i++){
+    if( !aOk[i] ) continue;
+    if( blob_compare(&aUuid[nContent], &aHash[nContent]) ){
       fossil_fatal("hash of rid %d (%b) does not match its uuid (%b)",
-                    rid, &hash, &uuid);
+                    aRid[i], &aHash[nContent], &aUuid[nContent]);
     }
-    blob_reset(&hash);
+    blob_reset(&aContent[nContent]);
+    blob_reset(&aHash[nContent]);
+    blob_reset(&aUuid[nContent]);
+    nContent++;
   }
-  blob_reset(&uuid);
 }
 
 /*
@@ -67,18 +88,25 @@ static int inFinalVerify = 0;
 /*
 ** This routine is called just prior to each commit operation.  
 **
-** Invoke verify_rid() on every record that has been added or modified
+** Invoke verify_rids() on every record that has been added or modified
 ** in the repository, in order to make sure that the repository is sane.
 */
 static int verify_at_commit(void){
   int rid;
+  int aRid[VERIFY_BATCH];
+  int n = 0;
   content_clear_cache();
   inFinalVerify = 1;
   rid = bag_first(&toVerify);
   while( rid>0 ){
-    verify_rid(rid);
+    aRid[n++] = rid;
+    if( n==VERIFY_BATCH ){
+      verify_rids(n, aRid);
+      n = 0;
+    }
     rid = bag_next(&toVerify, rid);
   }
+  if( n>0 ) verify_rids(n, aRid);
   bag_clear(&toVerify);
   inFinalVerify = 0;
   return 0;
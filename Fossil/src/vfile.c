@@ -133,6 +133,84 @@ void load_vfile_from_rid(int vid){
 
 #endif /* INTERFACE */
 
+/*
+** Minimum number of files in a check-out before vfile_check_signature()
+** bothers to use worker threads.
+*/
+#define VFILE_SIG_MIN_THREADED 256
+
+/*
+** State for checking the signature of a single VFILE entry.  The input
+** fields are filled in from the database by the main thread.  The output
+** fields are computed by vfile_sig_check(), possibly in a worker thread.
+*/
+typedef struct VfileSig VfileSig;
+struct VfileSig {
+  int id;              /* VFILE.ID */
+  int rid;             /* VFILE.MRID */
+  int isDeleted;       /* VFILE.DELETED */
+  int oldChnged;       /* VFILE.CHNGED before the check */
+  int useMtime;        /* True to trust an unchanged mtime */
+  char *zName;         /* Full pathname of the file on disk */
+  char *zUuid;         /* SHA1 hash of the checked-out content, or NULL */
+  i64 origSize;        /* Size of the checked-out content */
+  i64 oldMtime;        /* VFILE.MTIME before the check */
+  int chnged;          /* OUT: New value for VFILE.CHNGED */
+  int notFile;         /* OUT: Exists but is not a file or symlink */
+  i64 currentMtime;    /* OUT: Current mtime of the file on disk */
+};
+
+/*
+** Decide whether or not the file described by pArg has changed.  This
+** routine touches only its VfileSig object and the filesystem, so it
+** may run on any thread.
+*/
+static void vfile_sig_check(void *pArg){
+  VfileSig *p = (VfileSig*)pArg;
+  int chnged = p->oldChnged;
+  int type;
+  i64 currentSize;
+  Blob fileCksum;
+
+  file_wd_stat(p->zName, &currentSize, &p->currentMtime, &type);
+  if( chnged==0 && (p->isDeleted || p->rid==0) ){
+    /* "fossil rm" or "fossil add" always change the file */
+    chnged = 1;
+  }else if( type==0 && currentSize>=0 ){
+    p->notFile = 1;
+    chnged = 1;
+  }
+  if( p->origSize!=currentSize ){
+    if( chnged!=1 ){
+      /* A file size change is definitive - the file has changed.  No
+      ** need to check the mtime or sha1sum */
+      chnged = 1;
+    }
+  }else if( chnged==1 && p->rid!=0 && !p->isDeleted ){
+    /* File is believed to have changed but it is the same size.
+    ** Double check that it really has changed by looking at content. */
+    if( sha1sum_wd_file(p->zName, type==2, &fileCksum) ){
+      blob_zero(&fileCksum);
+    }
+    if( fossil_strcmp(blob_str(&fileCksum), p->zUuid)==0 ) chnged = 0;
+    blob_reset(&fileCksum);
+  }else if( (chnged==0 || chnged==2 || chnged==4)
+         && (p->useMtime==0 || p->currentMtime!=p->oldMtime) ){
+    /* For files that were formerly believed to be unchanged or that were
+    ** changed by merging, if their mtime changes, or unconditionally
+    ** if --sha1sum is used, check to see if they have been edited by
+    ** looking at their SHA1 sum */
+    if( sha1sum_wd_file(p->zName, type==2, &fileCksum) ){
+      blob_zero(&fileCksum);
+    }
+    if( fossil_strcmp(blob_str(&fileCksum), p->zUuid)!=0 ){
+      chnged = 1;
+    }
+    blob_reset(&fileCksum);
+  }
+  p->chnged = chnged;
+}
+
 /*
 ** Look at every VFILE entry with the given vid and update
 ** VFILE.CHNGED field according to whether or not
@@ -158,98 +236,100 @@ void load_vfile_from_rid(int vid){
 ** If the mtime is used, it is used only to determine if files are the same.
 ** If the mtime of a file has changed, we still examine the on-disk content
 ** to see whether or not the edit was a null-edit.
+**
+** If "fossil monitor" is running and has been since the last check, only
+** files that it saw change, or whose VFILE entries were altered, are
+** examined.  The files are examined by as many worker threads as the
+** "threads" setting allows.  Warnings and VFILE updates are still issued
+** in order by the main thread, so the results do not depend on the
+** thread count.
 */
 void vfile_check_signature(int vid, unsigned int cksigFlags){
   int nErr = 0;
   Stmt q;
-  Blob fileCksum, origCksum;
   int useMtime = (cksigFlags & CKSIG_SHA1)==0
                     && db_get_boolean("mtime-changes", 1);
-
+  int nFile = 0;
+  int nAlloc = 0;
+  int i;
+  VfileSig *aFile = 0;
+  ThreadPool *pPool;
+  int iDirty = -1;
+  int isPartial = 0;
+
+  /* A running "fossil monitor" can tell us which files might have
+  ** changed.  Not-a-file warnings and --setmtime need every file. */
+  if( useMtime && (cksigFlags & (CKSIG_ENOTFILE|CKSIG_SETMTIME))==0 ){
+    iDirty = monitor_sync();
+  }
   db_begin_transaction();
+  if( iDirty>=0 ) isPartial = monitor_select_changed(vid);
   db_prepare(&q, "SELECT id, %Q || pathname,"
                  "       vfile.mrid, deleted, chnged, uuid, size, mtime"
                  "  FROM vfile LEFT JOIN blob ON vfile.mrid=blob.rid"
-                 " WHERE vid=%d ", g.zLocalRoot, vid);
+                 " WHERE vid=%d %s", g.zLocalRoot, vid,
+                 isPartial ? "AND vfile.id IN vmonitor_id" : "");
   while( db_step(&q)==SQLITE_ROW ){
-    int id, rid, isDeleted;
-    const char *zName;
-    int chnged = 0;
-    int oldChnged;
-    i64 oldMtime;
-    i64 currentMtime;
-    i64 origSize;
-    i64 currentSize;
-
-    id = db_column_int(&q, 0);
-    zName = db_column_text(&q, 1);
-    rid = db_column_int(&q, 2);
-    isDeleted = db_column_int(&q, 3);
-    oldChnged = chnged = db_column_int(&q, 4);
-    oldMtime = db_column_int64(&q, 7);
-    currentSize = file_wd_size(zName);
-    origSize = db_column_int64(&q, 6);
-    currentMtime = file_wd_mtime(0);
-    if( chnged==0 && (isDeleted || rid==0) ){
-      /* "fossil rm" or "fossil add" always change the file */
-      chnged = 1;
-    }else if( !file_wd_isfile_or_link(0) && currentSize>=0 ){
-      if( cksigFlags & CKSIG_ENOTFILE ){
-        fossil_warning("not an ordinary file: %s", zName);
-        nErr++;
-      }
-      chnged = 1;
+    VfileSig *p;
+    if( nFile>=nAlloc ){
+      nAlloc = nAlloc*2 + 100;
+      aFile = fossil_realloc(aFile, sizeof(aFile[0])*nAlloc);
     }
-    if( origSize!=currentSize ){
-      if( chnged!=1 ){
-        /* A file size change is definitive - the file has changed.  No
-        ** need to check the mtime or sha1sum */
-        chnged = 1;
-      }
-    }else if( chnged==1 && rid!=0 && !isDeleted ){
-      /* File is believed to have changed but it is the same size.
-      ** Double check that it really has changed by looking at content. */
-      assert( origSize==currentSize );
-      db_ephemeral_blob(&q, 5, &origCksum);
-      if( sha1sum_file(zName, &fileCksum) ){
-        blob_zero(&fileCksum);
-      }
-      if( blob_compare(&fileCksum, &origCksum)==0 ) chnged = 0;
-      blob_reset(&origCksum);
-      blob_reset(&fileCksum);
-    }else if( (chnged==0 || chnged==2 || chnged==4)
-           && (useMtime==0 || currentMtime!=oldMtime) ){
-      /* For files that were formerly believed to be unchanged or that were
-      ** changed by merging, if their mtime changes, or unconditionally
-      ** if --sha1sum is used, check to see if they have been edited by
-      ** looking at their SHA1 sum */
-      assert( origSize==currentSize );
-      db_ephemeral_blob(&q, 5, &origCksum);
-      if( sha1sum_file(zName, &fileCksum) ){
-        blob_zero(&fileCksum);
-      }
-      if( blob_compare(&fileCksum, &origCksum) ){
-        chnged = 1;
-      }
-      blob_reset(&origCksum);
-      blob_reset(&fileCksum);
+    p = &aFile[nFile++];
+    memset(p, 0, sizeof(*p));
+    p->useMtime = useMtime;
+    p->id = db_column_int(&q, 0);
+    p->zName = fossil_strdup(db_column_text(&q, 1));
+    p->rid = db_column_int(&q, 2);
+    p->isDeleted = db_column_int(&q, 3);
+    p->oldChnged = db_column_int(&q, 4);
+    p->zUuid = fossil_strdup(db_column_text(&q, 5));
+    if( p->zUuid==0 ) p->zUuid = fossil_strdup("");
+    p->origSize = db_column_int64(&q, 6);
+    p->oldMtime = db_column_int64(&q, 7);
+  }
+  db_finalize(&q);
+
+  /* The stat() and SHA1 work for each file is independent of every other
+  ** file and of the database, so it can be farmed out to worker threads.
+  ** Small checkouts are not worth the cost of starting the threads. */
+  if( nFile>=VFILE_SIG_MIN_THREADED ){
+    pPool = threadpool_new(threadpool_size(0));
+  }else{
+    pPool = threadpool_new(1);
+  }
+  for(i=0; i<nFile; i++){
+    threadpool_add(pPool, vfile_sig_check, &aFile[i]);
+  }
+  threadpool_free(pPool);
+
+  for(i=0; i<nFile; i++){
+    VfileSig *p = &aFile[i];
+    int chnged = p->chnged;
+    i64 currentMtime = p->currentMtime;
+    if( p->notFile && (cksigFlags & CKSIG_ENOTFILE) ){
+      fossil_warning("not an ordinary file: %s", p->zName);
+      nErr++;
     }
     if( (cksigFlags & CKSIG_SETMTIME) && (chnged==0 || chnged==2 || chnged==4) ){
       i64 desiredMtime;
-      if( mtime_of_manifest_file(vid,rid,&desiredMtime)==0 ){
+      if( mtime_of_manifest_file(vid,p->rid,&desiredMtime)==0 ){
         if( currentMtime!=desiredMtime ){
-          file_set_mtime(zName, desiredMtime);
-          currentMtime = file_wd_mtime(zName);
+          file_set_mtime(p->zName, desiredMtime);
+          currentMtime = file_wd_mtime(p->zName);
         }
       }
     }
-    if( currentMtime!=oldMtime || chnged!=oldChnged ){
+    if( currentMtime!=p->oldMtime || chnged!=p->oldChnged ){
       db_multi_exec("UPDATE vfile SET mtime=%lld, chnged=%d WHERE id=%d",
-                    currentMtime, chnged, id);
+                    currentMtime, chnged, p->id);
     }
+    fossil_free(p->zName);
+    fossil_free(p->zUuid);
   }
-  db_finalize(&q);
+  fossil_free(aFile);
   if( nErr ) fossil_fatal("abort due to prior errors");
+  if( iDirty>=0 ) monitor_checked(vid, iDirty, isPartial);
   db_end_transaction(0);
 }
 
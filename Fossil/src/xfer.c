@@ -34,7 +34,7 @@
 */
 typedef struct Xfer Xfer;
 struct Xfer {
-  Blob *pIn;          /* Input text from the other side */
+  XferIn *pIn;        /* Input text from the other side */
   Blob *pOut;         /* Compose our reply here */
   Blob line;          /* The current line of input */
   Blob aToken[6];     /* Tokenized version of line */
@@ -51,9 +51,19 @@ struct Xfer {
   int resync;         /* Send igot cards for all holdings */
   u8 syncPrivate;     /* True to enable syncing private content */
   u8 nextIsPrivate;   /* If true, next "file" received is a private */
+  u8 skipInReply;     /* Do not request artifacts in the "inreply" table */
   time_t maxTime;     /* Time when this transfer should be finished */
+  Bitmap igotSent;    /* Artifacts already announced by send_unclustered() */
+  Bag *pGimme;        /* If not NULL, add artifacts requested by "gimme" */
 };
 
+/*
+** Limits on the reply size that a client may ask for with the
+** "pragma reply-size" card
+*/
+#define XFER_MIN_REPLY    100000   /* Smallest reply size requested */
+#define XFER_REPLY_MSEC     2000   /* Shortest reply worth asking for, in ms */
+
 
 /*
 ** The input blob contains a UUID.  Convert it into a record ID.
@@ -81,18 +91,20 @@ static int rid_from_uuid(Blob *pUuid, int phantomize, int isPrivate){
   return rid;
 }
 
+/*
+** Artifacts that the other side of the connection is known to have.
+** A sync can involve every artifact in the repository, so this is a
+** bitmap rather than a table, to keep the cost of remote_has() and of
+** the check in send_file() down to a few instructions.
+*/
+static Bitmap onRemote;
+
 /*
 ** Remember that the other side of the connection already has a copy
 ** of the file rid.
 */
 static void remote_has(int rid){
-  if( rid ){
-    static Stmt q;
-    db_static_prepare(&q, "INSERT OR IGNORE INTO onremote VALUES(:r)");
-    db_bind_int(&q, ":r", rid);
-    db_step(&q);
-    db_reset(&q);
-  }
+  if( rid ) bitmap_insert(&onRemote, rid);
 }
 
 /*
@@ -114,12 +126,15 @@ static void remote_has(int rid){
 **
 ** Any artifact successfully received by this routine is considered to
 ** be public and is therefore removed from the "private" table.
+**
+** The file is only queued by content_batch_put().  Errors found when
+** it is written by content_batch_flush() are added to pErr then.
 */
 static void xfer_accept_file(Xfer *pXfer, int cloneFlag){
   int n;
   int rid;
   int srcid = 0;
-  Blob content, hash;
+  Blob content;
   int isPriv;
   
   isPriv = pXfer->nextIsPrivate;
@@ -135,8 +150,7 @@ static void xfer_accept_file(Xfer *pXfer, int cloneFlag){
     return;
   }
   blob_zero(&content);
-  blob_zero(&hash);
-  blob_extract(pXfer->pIn, n, &content);
+  xferin_extract(pXfer->pIn, n, &content);
   if( !cloneFlag && uuid_is_shunned(blob_str(&pXfer->aToken[1])) ){
     /* Ignore files that have been shunned */
     blob_reset(&content);
@@ -148,21 +162,22 @@ static void xfer_accept_file(Xfer *pXfer, int cloneFlag){
     return;
   }
   if( cloneFlag ){
+    const char *zSrc = 0;
     if( pXfer->nToken==4 ){
-      srcid = rid_from_uuid(&pXfer->aToken[2], 1, isPriv);
+      zSrc = blob_str(&pXfer->aToken[2]);
       pXfer->nDeltaRcvd++;
     }else{
-      srcid = 0;
       pXfer->nFileRcvd++;
     }
-    rid = content_put_ex(&content, blob_str(&pXfer->aToken[1]), srcid,
-                         0, isPriv);
-    remote_has(rid);
-    blob_reset(&content);
+    content_batch_put(&content, blob_str(&pXfer->aToken[1]), zSrc,
+                      0, isPriv, 0);
     return;
   }
   if( pXfer->nToken==4 ){
     Blob src, next;
+    if( content_batch_pending(blob_str(&pXfer->aToken[2])) ){
+      content_batch_flush();
+    }
     srcid = rid_from_uuid(&pXfer->aToken[2], 1, isPriv);
     if( content_get(srcid, &src)==0 ){
       rid = content_put_ex(&content, blob_str(&pXfer->aToken[1]), srcid,
@@ -182,21 +197,8 @@ static void xfer_accept_file(Xfer *pXfer, int cloneFlag){
   }else{
     pXfer->nFileRcvd++;
   }
-  sha1sum_blob(&content, &hash);
-  if( !blob_eq_str(&pXfer->aToken[1], blob_str(&hash), -1) ){
-    blob_appendf(&pXfer->err, "content does not match sha1 hash");
-  }
-  rid = content_put_ex(&content, blob_str(&hash), 0, 0, isPriv);
-  blob_reset(&hash);
-  if( rid==0 ){
-    blob_appendf(&pXfer->err, "%s", g.zErrMsg);
-    blob_reset(&content);
-  }else{
-    if( !isPriv ) content_make_public(rid);
-    manifest_crosslink(rid, &content, MC_NONE);
-  }
-  assert( blob_is_reset(&content) );
-  remote_has(rid);
+  content_batch_put(&content, blob_str(&pXfer->aToken[1]), 0, 0, isPriv,
+                    CBATCH_VERIFY|CBATCH_CROSSLINK|(isPriv ? 0 : CBATCH_PUBLIC));
 }
 
 /*
@@ -221,12 +223,13 @@ static void xfer_accept_file(Xfer *pXfer, int cloneFlag){
 **
 ** Any artifact successfully received by this routine is considered to
 ** be public and is therefore removed from the "private" table.
+**
+** As with xfer_accept_file(), the file is only queued here.
 */
 static void xfer_accept_compressed_file(Xfer *pXfer){
   int szC;   /* CSIZE */
   int szU;   /* USIZE */
-  int rid;
-  int srcid = 0;
+  const char *zSrc = 0;
   Blob content;
   int isPriv;
   
@@ -248,23 +251,54 @@ static void xfer_accept_compressed_file(Xfer *pXfer){
     return;
   }
   blob_zero(&content);
-  blob_extract(pXfer->pIn, szC, &content);
+  xferin_extract(pXfer->pIn, szC, &content);
   if( uuid_is_shunned(blob_str(&pXfer->aToken[1])) ){
     /* Ignore files that have been shunned */
     blob_reset(&content);
     return;
   }
   if( pXfer->nToken==5 ){
-    srcid = rid_from_uuid(&pXfer->aToken[2], 1, isPriv);
+    zSrc = blob_str(&pXfer->aToken[2]);
     pXfer->nDeltaRcvd++;
   }else{
-    srcid = 0;
     pXfer->nFileRcvd++;
   }
-  rid = content_put_ex(&content, blob_str(&pXfer->aToken[1]), srcid,
-                       szC, isPriv);
+  content_batch_put(&content, blob_str(&pXfer->aToken[1]), zSrc,
+                    szC, isPriv, 0);
+}
+
+/*
+** Called by content_batch_flush() for each file received by
+** xfer_accept_file() or xfer_accept_compressed_file() once it has been
+** stored as artifact rid.
+*/
+static void xfer_file_stored(void *pArg, int rid, int isBad){
+  Xfer *pXfer = (Xfer*)pArg;
+  if( isBad ){
+    blob_appendf(&pXfer->err, "content does not match sha1 hash");
+  }
   remote_has(rid);
-  blob_reset(&content);
+}
+
+/*
+** Return true if the current card is a file, or the "private" card that
+** can come before one.  Received files are stored in batches, so any
+** other card has to wait until the files before it have been stored.
+*/
+static int xfer_card_is_file(Xfer *pXfer){
+  return blob_eq(&pXfer->aToken[0], "file")
+      || blob_eq(&pXfer->aToken[0], "cfile")
+      || blob_eq(&pXfer->aToken[0], "private");
+}
+
+/*
+** Store the files that have been received but not yet written to the
+** repository.  Return non-zero if any of them was in error, in which
+** case the error is described in pXfer->err.
+*/
+static int xfer_store_files(Xfer *pXfer){
+  content_batch_flush();
+  return blob_size(&pXfer->err)>0;
 }
 
 /*
@@ -385,7 +419,7 @@ static void send_file(Xfer *pXfer, int rid, Blob *pUuid, int nativeDelta){
   int isPriv = content_is_private(rid);
 
   if( pXfer->syncPrivate==0 && isPriv ) return;
-  if( db_exists("SELECT 1 FROM onremote WHERE rid=%d", rid) ){
+  if( bitmap_find(&onRemote, rid) ){
      return;
   }
   blob_zero(&uuid);
@@ -509,24 +543,42 @@ static void send_compressed_file(Xfer *pXfer, int rid){
   db_reset(&q1);
 }
 
+/*
+** Append to pOut the "cfile" card that would be sent for artifact rid
+** in reply to a "clone" request that does not include private
+** artifacts.  Nothing is appended for an artifact that would not be
+** sent.  This is how the clone pack is built.
+*/
+void xfer_clone_card(Blob *pOut, int rid){
+  Xfer x;
+  memset(&x, 0, sizeof(x));
+  x.pOut = pOut;
+  send_compressed_file(&x, rid);
+}
+
 /*
 ** Send a gimme message for every phantom.
 **
 ** Except: do not request shunned artifacts.  And do not request
 ** private artifacts if we are not doing a private transfer.
+**
+** The artifacts requested are added to pXfer->pGimme if it is not NULL.
 */
 static void request_phantoms(Xfer *pXfer, int maxReq){
   Stmt q;
   db_prepare(&q, 
-    "SELECT uuid FROM phantom JOIN blob USING(rid)"
-    " WHERE NOT EXISTS(SELECT 1 FROM shun WHERE uuid=blob.uuid) %s",
+    "SELECT uuid, rid FROM phantom JOIN blob USING(rid)"
+    " WHERE NOT EXISTS(SELECT 1 FROM shun WHERE uuid=blob.uuid) %s %s",
     (pXfer->syncPrivate ? "" :
-         "   AND NOT EXISTS(SELECT 1 FROM private WHERE rid=blob.rid)")
+         "   AND NOT EXISTS(SELECT 1 FROM private WHERE rid=blob.rid)"),
+    (pXfer->skipInReply==0 ? "" :
+         "   AND NOT EXISTS(SELECT 1 FROM inreply WHERE uuid=blob.uuid)")
   );
   while( db_step(&q)==SQLITE_ROW && maxReq-- > 0 ){
     const char *zUuid = db_column_text(&q, 0);
     blob_appendf(pXfer->pOut, "gimme %s\n", zUuid);
     pXfer->nGimmeSent++;
+    if( pXfer->pGimme ) bag_insert(pXfer->pGimme, db_column_int(&q, 1));
   }
   db_finalize(&q);
 }
@@ -534,12 +586,20 @@ static void request_phantoms(Xfer *pXfer, int maxReq){
 /*
 ** Compute an SHA1 hash on the tail of pMsg.  Verify that it matches the
 ** the hash given in pHash.  Return non-zero for an error and 0 on success.
+**
+** If the tail of pMsg is still arriving, the check is deferred until
+** xferin_verify() is called once the message has been processed, and
+** until then it is assumed to succeed.
 */
-static int check_tail_hash(Blob *pHash, Blob *pMsg){
+static int check_tail_hash(Blob *pHash, XferIn *pMsg){
   Blob tail;
   Blob h2;
   int rc;
-  blob_tail(pMsg, &tail);
+  if( !xferin_eof(pMsg) && xferin_expect_hash(pMsg, blob_str(pHash))==0 ){
+    return 0;
+  }
+  xferin_read_all(pMsg);
+  xferin_rest(pMsg, &tail);
   sha1sum_blob(&tail, &h2);
   rc = blob_compare(pHash, &h2);
   blob_reset(&h2);
@@ -735,6 +795,10 @@ static int send_private(Xfer *pXfer){
 /*
 ** Send an igot message for every entry in unclustered table.
 ** Return the number of cards sent.
+**
+** Every artifact received during a sync is added to the unclustered
+** table, so an igot card is sent for each artifact only once during
+** a sync.  The other side has learned of it already.
 */
 static int send_unclustered(Xfer *pXfer){
   Stmt q;
@@ -751,13 +815,18 @@ static int send_unclustered(Xfer *pXfer){
     );
   }else{
     db_prepare(&q, 
-      "SELECT uuid FROM unclustered JOIN blob USING(rid)"
+      "SELECT uuid, rid FROM unclustered JOIN blob USING(rid)"
       " WHERE NOT EXISTS(SELECT 1 FROM shun WHERE uuid=blob.uuid)"
       "   AND NOT EXISTS(SELECT 1 FROM phantom WHERE rid=blob.rid)"
       "   AND NOT EXISTS(SELECT 1 FROM private WHERE rid=blob.rid)"
     );
   }
   while( db_step(&q)==SQLITE_ROW ){
+    if( !pXfer->resync
+     && !bitmap_insert(&pXfer->igotSent, db_column_int(&q, 1))
+    ){
+      continue;
+    }
     blob_appendf(pXfer->pOut, "igot %s\n", db_column_text(&q, 0));
     cnt++;
     if( pXfer->resync && pXfer->mxSend<blob_size(pXfer->pOut) ){
@@ -902,14 +971,17 @@ static int disableLogin = 0;
 ** WEBPAGE: xfer
 **
 ** This is the transfer handler on the server side.  The transfer
-** message has been uncompressed and placed in the g.cgiIn blob.
-** Process this message and form an appropriate reply.
+** message is read and uncompressed as its cards are processed, or it
+** has already been placed in the g.cgiIn blob.  Process this message
+** and form an appropriate reply.
 */
 void page_xfer(void){
   int isPull = 0;
   int isPush = 0;
   int nErr = 0;
   Xfer xfer;
+  XferIn in;
+  int nUnread, isCompressed;
   int deltaFlag = 0;
   int isClone = 0;
   int nGimme = 0;
@@ -933,7 +1005,14 @@ void page_xfer(void){
     return;
   }
   blob_zero(&xfer.err);
-  xfer.pIn = &g.cgiIn;
+  blob_zero(&xfer.line);
+  nUnread = cgi_xfer_content(&isCompressed);
+  if( nUnread>0 ){
+    xferin_init(&in, cgi_read_xfer_content, 0, nUnread, isCompressed);
+  }else{
+    xferin_init_blob(&in, &g.cgiIn);
+  }
+  xfer.pIn = &in;
   xfer.pOut = cgi_output_blob();
   xfer.mxSend = db_get_int("max-download", 5000000);
   xfer.maxTime = db_get_int("max-download-time", 30);
@@ -942,20 +1021,25 @@ void page_xfer(void){
   g.xferPanic = 1;
 
   db_begin_transaction();
-  db_multi_exec(
-     "CREATE TEMP TABLE onremote(rid INTEGER PRIMARY KEY);"
-  );
+  bitmap_clear(&onRemote);
   manifest_crosslink_begin();
+  content_batch_begin(xfer_file_stored, &xfer);
   rc = xfer_run_common_script();
   if( rc==TH_ERROR ){
     cgi_reset_content();
     @ error common\sscript\sfailed:\s%F(g.zErrMsg)
     nErr++;
   }
-  while( blob_line(xfer.pIn, &xfer.line) ){
+  while( xferin_line(xfer.pIn, &xfer.line) ){
     if( blob_buffer(&xfer.line)[0]=='#' ) continue;
     if( blob_size(&xfer.line)==0 ) continue;
     xfer.nToken = blob_tokenize(&xfer.line, xfer.aToken, count(xfer.aToken));
+    if( !xfer_card_is_file(&xfer) && xfer_store_files(&xfer) ){
+      cgi_reset_content();
+      @ error %T(blob_str(&xfer.err))
+      nErr++;
+      break;
+    }
 
     /*   file UUID SIZE \n CONTENT
     **   file UUID DELTASRC SIZE \n CONTENT
@@ -1107,6 +1191,11 @@ void page_xfer(void){
         }
         blob_is_int(&xfer.aToken[2], &seqno);
         max = db_int(0, "SELECT max(rid) FROM blob");
+        if( iVers>=3 && !xfer.syncPrivate ){
+          /* Send as much as possible straight from the clone pack */
+          xfer.mxSend -= clone_pack_send(&seqno,
+                                         xfer.mxSend - blob_size(xfer.pOut));
+        }
         while( xfer.mxSend>blob_size(xfer.pOut) && seqno<=max){
           if( time(NULL) >= xfer.maxTime ) break;
           if( iVers>=3 ){
@@ -1180,7 +1269,7 @@ void page_xfer(void){
       const char *zName = blob_str(&xfer.aToken[1]);
       Blob content;
       blob_zero(&content);
-      blob_extract(xfer.pIn, size, &content);
+      xferin_extract(xfer.pIn, size, &content);
       if( !g.perm.Admin ){
         cgi_reset_content();
         @ error not\sauthorized\sto\spush\sconfiguration
@@ -1193,7 +1282,7 @@ void page_xfer(void){
       }
       configure_receive(zName, &content, CONFIGSET_ALL);
       blob_reset(&content);
-      blob_seek(xfer.pIn, 1, BLOB_SEEK_CUR);
+      xferin_skip(xfer.pIn, 1);
     }else
 
       
@@ -1262,6 +1351,35 @@ void page_xfer(void){
       if( blob_eq(&xfer.aToken[1], "send-catalog") ){
         xfer.resync = 0x7fffffff;
       }
+
+      /*   pragma pipeline
+      **
+      ** The client would like to send its next request before it has
+      ** finished processing the reply to this one.  Requests on a
+      ** persistent connection are always answered in order, so all the
+      ** server does is confirm that it understands.
+      */
+      if( blob_eq(&xfer.aToken[1], "pipeline") ){
+        @ pragma pipeline
+      }
+
+      /*   pragma reply-size N
+      **
+      ** The client has measured the bandwidth and latency of the link
+      ** and would like replies of about N bytes, or 0 for the default.
+      ** The reply is never made larger than the "max-download" limit.
+      ** The server answers with the reply size it will use, which the
+      ** client needs in order to decide how many artifacts to request.
+      */
+      if( blob_eq(&xfer.aToken[1], "reply-size") && xfer.nToken==3 ){
+        int n;
+        if( blob_is_int(&xfer.aToken[2], &n)
+         && n>=XFER_MIN_REPLY && n<xfer.mxSend
+        ){
+          xfer.mxSend = n;
+        }
+        @ pragma reply-size %d(xfer.mxSend)
+      }
     }else
 
     /* Unknown message
@@ -1273,6 +1391,34 @@ void page_xfer(void){
     blobarray_reset(xfer.aToken, xfer.nToken);
     blob_reset(&xfer.line);
   }
+  if( nErr==0 && xfer_store_files(&xfer) ){
+    cgi_reset_content();
+    @ error %T(blob_str(&xfer.err))
+    nErr++;
+  }
+  content_batch_end();
+  if( xferin_error(xfer.pIn) ){
+    /* The request ended early, so what was done on its account is
+    ** incomplete.  Undo it all. */
+    xferin_close(&in);
+    cgi_reset_content();
+    @ error incomplete\srequest
+    manifest_crosslink_end(MC_NONE);
+    db_end_transaction(1);
+    return;
+  }
+  if( xferin_verify(xfer.pIn) ){
+    /* A login card was accepted before the rest of the message, which
+    ** its signature covers, had arrived.  The message does not match
+    ** the signature, so undo everything done on its authority. */
+    xferin_close(&in);
+    cgi_reset_content();
+    @ error login\sfailed
+    manifest_crosslink_end(MC_NONE);
+    db_end_transaction(1);
+    return;
+  }
+  xferin_close(&in);
   if( isPush ){
     if( rc==TH_OK ){
       rc = xfer_run_script(xfer_push_code(), 0);
@@ -1302,7 +1448,8 @@ void page_xfer(void){
   if( recvConfig ){
     configure_finalize_receive();
   }
-  db_multi_exec("DROP TABLE onremote");
+  bitmap_clear(&onRemote);
+  bitmap_clear(&xfer.igotSent);
   manifest_crosslink_end(MC_PERMIT_HOOKS);
 
   /* Send the server timestamp last, in case prior processing happened
@@ -1314,6 +1461,7 @@ void page_xfer(void){
 
   db_end_transaction(0);
   configure_rebuild();
+  cgi_page_keep_alive();
 }
 
 /*
@@ -1355,6 +1503,8 @@ static const char zLabelFormat[] = "%-10s %10s %10s %10s %10s\n";
 static const char zValueFormat[] = "\r%-10s %10d %10d %10d %10d\n";
 static const char zBriefFormat[] =
    "Round-trips: %d   Artifacts sent: %d  received: %d\r";
+static const char zTuneFormat[] =
+   "%-10s %d ms wait, %d KB/s; next: %d gimme, %d byte reply\n";
 
 #if INTERFACE
 /*
@@ -1368,6 +1518,14 @@ static const char zBriefFormat[] =
 #define SYNC_RESYNC    0x0020
 #endif
 
+/*
+** While cloning, commit what has been received whenever this many bytes
+** have arrived or this many milliseconds have passed since the last
+** commit, so that an interrupted clone can be resumed.
+*/
+#define CLONE_CHECKPOINT_BYTES  10000000
+#define CLONE_CHECKPOINT_MSEC      10000
+
 /*
 ** Floating-point absolute value
 */
@@ -1375,6 +1533,138 @@ static double fossil_fabs(double x){
   return x>0.0 ? x : -x;
 }
 
+/*
+** Work out how many phantoms to request in the next "gimme" cards.
+** nFile artifacts arrived in a reply of szRecv bytes that answered
+** nGimme requests.  szReply is the reply size the server announced, or
+** 0 if unknown, and mxReply the reply size requested, or 0.
+*/
+static int client_batch_size(
+  int nFile,
+  int szRecv,
+  int nGimme,
+  int szReply,
+  int mxReply
+){
+  int n;
+  if( szReply>0 && nFile>0 ){
+    /* Ask for a little more than the next reply can hold, judging by
+    ** the average size of the artifacts just received, so that it is
+    ** full but few requests spill over into "igot" cards. */
+    int sz = mxReply>0 && mxReply<szReply ? mxReply : szReply;
+    int szAvg = szRecv/nFile + 1;
+    n = sz/szAvg + sz/szAvg/4 + 1;
+  }else if( nGimme>0 && nFile<nGimme ){
+    /* The reply filled up before every request was answered */
+    n = nFile + nFile/4 + 1;
+  }else{
+    n = nFile*2;
+    if( n<200 ) n = 200;
+  }
+  if( n<20 ) n = 20;
+  if( n>20000 ) n = 20000;
+  return n;
+}
+
+/*
+** Look ahead through pIn, the part of a reply that has arrived but has
+** not yet been processed, for what is needed to compose the next
+** request of a pipelined pull or clone.  Phantoms are created for
+** artifacts announced by "igot" cards and their number is added to
+** *pnPhantom.  The artifacts delivered by the reply are recorded in the
+** "inreply" table so that they are not requested again, and their
+** number is added to *pnFile.  The next clone sequence number is written
+** into *pCloneSeqno.
+**
+** Return false if the reply contains an error, in which case the next
+** request must wait until the reply has been processed.
+*/
+static int client_prescan(
+  Blob *pIn,
+  unsigned syncFlags,
+  int *pnFile,
+  int *pnPhantom,
+  int *pCloneSeqno
+){
+  Blob line;
+  Blob aToken[6];
+  int nToken;
+  int size;
+  int rc = 1;
+
+  db_multi_exec("DELETE FROM inreply");
+  while( rc && blob_line(pIn, &line) ){
+    if( blob_buffer(&line)[0]=='#' ) continue;
+    nToken = blob_tokenize(&line, aToken, count(aToken));
+    if( nToken==0 ){
+      /* Ignore blank lines */
+    }else if( (blob_eq(&aToken[0],"file") || blob_eq(&aToken[0],"cfile"))
+     && nToken>=3
+     && blob_is_uuid(&aToken[1])
+     && blob_is_int(&aToken[nToken-1], &size)
+    ){
+      db_multi_exec("INSERT OR IGNORE INTO inreply VALUES(%B)", &aToken[1]);
+      blob_seek(pIn, size, BLOB_SEEK_CUR);
+      (*pnFile)++;
+    }else if( blob_eq(&aToken[0],"config") && nToken==3
+     && blob_is_int(&aToken[2], &size)
+    ){
+      blob_seek(pIn, size+1, BLOB_SEEK_CUR);
+    }else if( blob_eq(&aToken[0],"igot") && nToken>=2
+     && blob_is_uuid(&aToken[1])
+     && (syncFlags & SYNC_PULL)!=0
+    ){
+      int isPriv = nToken>=3 && blob_eq(&aToken[2],"1");
+      if( rid_from_uuid(&aToken[1], 0, 0)==0 && (!isPriv || g.perm.Private)
+       && content_new(blob_str(&aToken[1]), isPriv)
+      ){
+        (*pnPhantom)++;
+      }
+    }else if( blob_eq(&aToken[0],"clone_seqno") && nToken==2 ){
+      blob_is_int(&aToken[1], pCloneSeqno);
+    }else if( blob_eq(&aToken[0],"error")
+           || blob_str(&aToken[0])[0]=='<' ){
+      rc = 0;
+    }
+    blobarray_reset(aToken, nToken);
+    blob_reset(&line);
+  }
+  return rc;
+}
+
+/*
+** Append to pOut the cards that begin each request after the first.
+** Return the number of cards that are not pragmas.
+*/
+static int client_request_start(
+  Blob *pOut,
+  unsigned syncFlags,
+  int mxReply,
+  const char *zSCode,
+  const char *zPCode
+){
+  int nCard = 0;
+
+  /* Send the send-private pragma if we are trying to sync private data */
+  if( syncFlags & SYNC_PRIVATE ){
+    blob_append(pOut, "pragma send-private\n", -1);
+  }
+
+  /* Ask for replies of the size that suits the link */
+  blob_appendf(pOut, "pragma reply-size %d\n", mxReply);
+
+  /* Then the pull or push cards */
+  if( syncFlags & SYNC_PULL ){
+    blob_appendf(pOut, "pull %s %s\n", zSCode, zPCode);
+    nCard++;
+  }
+  if( syncFlags & SYNC_PUSH ){
+    blob_appendf(pOut, "push %s %s\n", zSCode, zPCode);
+    nCard++;
+  }
+  return nCard;
+}
+
 /*
 ** Sync to the host identified in g.urlName and g.urlPath.  This
 ** routine is called by the client.
@@ -1382,6 +1672,13 @@ static double fossil_fabs(double x){
 ** Records are pushed to the server if pushFlag is true.  Records
 ** are pulled if pullFlag is true.  A full sync occurs if both are
 ** true.
+**
+** Each reply is processed as it arrives.  A pull or clone over HTTP or
+** HTTPS is also pipelined when the server supports it:  as soon as the
+** last of a reply has arrived, the next request is composed from a
+** quick scan of the part not yet processed and sent.  The server
+** prepares the next reply while the client finishes storing and
+** crosslinking the artifacts of the current one.
 */
 int client_sync(
   unsigned syncFlags,     /* Mask of SYNC_* flags */
@@ -1396,11 +1693,16 @@ int client_sync(
   int origConfigRcvMask;  /* Original value of configRcvMask */
   int nFileRecv;          /* Number of files received */
   int mxPhantomReq = 200; /* Max number of phantoms to request per comm */
+  int nGimmeReq = 0;      /* Gimme cards in the request last answered */
+  int mxReply = 0;        /* Reply size to ask for.  0 for server default */
+  int szReply = 0;        /* Reply size the server uses.  0 if unknown */
+  int msRtt = 0;          /* Shortest wait for a reply, in milliseconds */
+  double rRate = 0.0;     /* Estimated bytes per second from the server */
   const char *zCookie;    /* Server cookie */
   i64 nSent, nRcvd;       /* Bytes sent and received (after compression) */
   int cloneSeqno = 1;     /* Sequence number for clones */
   Blob send;              /* Text we are sending to the server */
-  Blob recv;              /* Reply we got back from the server */
+  XferIn recv;            /* Reply we got back from the server */
   Xfer xfer;              /* Transfer data */
   int pctDone;            /* Percentage done with a message */
   int lastPctDone = -1;   /* Last displayed pctDone */
@@ -1413,6 +1715,16 @@ int client_sync(
   int nArtifactRcvd = 0;  /* Total artifacts received */
   const char *zOpType = 0;/* Push, Pull, Sync, Clone */
   double rSkew = 0.0;     /* Maximum time skew */
+  int canPipeline;        /* True if this sync might be pipelined */
+  int usePipeline = 0;    /* True if the server agreed to pipelining */
+  int inFlight = 0;       /* True if pipe has been sent but not answered */
+  Blob pipe;              /* Request sent before the prior reply was used */
+  Bag gimmeSent;          /* Artifacts asked for by the request answered */
+  Bag gimmeNext;          /* Artifacts asked for by the next request */
+  int replyDone;          /* True once all of the reply has arrived */
+  int stopReply;          /* True to stop processing the reply */
+  i64 nCkptBytes = 0;     /* Bytes received since the last clone checkpoint */
+  sqlite3_int64 msCkpt;   /* Time of the last clone checkpoint */
 
   if( db_get_boolean("dont-push", 0) ) syncFlags &= ~SYNC_PUSH;
   if( (syncFlags & (SYNC_PUSH|SYNC_PULL|SYNC_CLONE))==0 
@@ -1432,15 +1744,22 @@ int client_sync(
 
   db_begin_transaction();
   db_record_repository_filename(0);
-  db_multi_exec(
-    "CREATE TEMP TABLE onremote(rid INTEGER PRIMARY KEY);"
-  );
+  bitmap_clear(&onRemote);
+  canPipeline = (syncFlags & SYNC_PUSH)==0 && configSendMask==0
+                && !g.urlIsFile && !g.urlIsSsh;
+  if( canPipeline ){
+    db_multi_exec("CREATE TEMP TABLE inreply(uuid TEXT PRIMARY KEY);");
+  }
   blobarray_zero(xfer.aToken, count(xfer.aToken));
   blob_zero(&send);
-  blob_zero(&recv);
+  xferin_init_blob(&recv, 0);
+  blob_zero(&pipe);
+  bag_init(&gimmeSent);
+  bag_init(&gimmeNext);
   blob_zero(&xfer.err);
   blob_zero(&xfer.line);
   origConfigRcvMask = 0;
+  msCkpt = fossil_wallclock_ms();
 
 
   /* Send the send-private pragma if we are trying to sync private data */
@@ -1448,10 +1767,20 @@ int client_sync(
     blob_append(&send, "pragma send-private\n", -1);
   }
 
+  /* Ask whether the server understands pipelined requests */
+  if( canPipeline ){
+    blob_append(&send, "pragma pipeline\n", -1);
+  }
+
+  /* Learn how large the replies of the server will be */
+  blob_append(&send, "pragma reply-size 0\n", -1);
+
   /*
   ** Always begin with a clone, pull, or push message
   */
   if( syncFlags & SYNC_CLONE ){
+    /* A clone that was interrupted resumes where it stopped */
+    cloneSeqno = db_get_int("clone-seqno", 1);
     blob_appendf(&send, "clone 3 %d\n", cloneSeqno);
     syncFlags &= ~(SYNC_PUSH|SYNC_PULL);
     nCardSent++;
@@ -1474,6 +1803,7 @@ int client_sync(
     if( (syncFlags & SYNC_RESYNC)!=0 ) xfer.resync = 0x7fffffff;
   }
   manifest_crosslink_begin();
+  content_batch_begin(xfer_file_stored, &xfer);
   if( syncFlags & SYNC_VERBOSE ){
     fossil_print(zLabelFormat, "", "Bytes", "Cards", "Artifacts", "Deltas");
   }
@@ -1482,6 +1812,24 @@ int client_sync(
     int newPhantom = 0;
     char *zRandomness;
 
+    if( inFlight ){
+      /* The request was sent before the previous reply was processed.
+      ** All that remains is to collect its reply. */
+      blob_reset(&send);
+      send = pipe;
+      blob_zero(&pipe);
+      inFlight = 0;
+      if( syncFlags & SYNC_VERBOSE ){
+        fossil_print("waiting for server...");
+      }
+      fflush(stdout);
+      if( http_exchange_end(&send, &recv, 1, MAX_REDIRECTS) ){
+        nErr++;
+        break;
+      }
+      goto reply_received;
+    }
+
     /* Send make the most recently received cookie.  Let the server
     ** figure out if this is a cookie that it cares about.
     */
@@ -1493,10 +1841,13 @@ int client_sync(
     /* Generate gimme cards for phantoms and leaf cards
     ** for all leaves.
     */
+    bag_clear(&gimmeNext);
     if( (syncFlags & SYNC_PULL)!=0
      || ((syncFlags & SYNC_CLONE)!=0 && cloneSeqno==1)
     ){
+      xfer.pGimme = &gimmeNext;
       request_phantoms(&xfer, mxPhantomReq);
+      xfer.pGimme = 0;
     }
     if( syncFlags & SYNC_PUSH ){
       send_unsent(&xfer);
@@ -1563,6 +1914,12 @@ int client_sync(
       break;
     }
 
+reply_received:
+    nGimmeReq = xfer.nGimmeSent;
+    bag_clear(&gimmeSent);
+    gimmeSent = gimmeNext;
+    bag_init(&gimmeNext);
+
     /* Output current stats */
     if( syncFlags & SYNC_VERBOSE ){
       fossil_print(zValueFormat, "Sent:",
@@ -1583,27 +1940,133 @@ int client_sync(
     lastPctDone = -1;
     blob_reset(&send);
     rArrivalTime = db_double(0.0, "SELECT julianday('now')");
+    go = 0;
+    replyDone = 0;
+    stopReply = 0;
 
-    /* Send the send-private pragma if we are trying to sync private data */
-    if( syncFlags & SYNC_PRIVATE ){
-      blob_append(&send, "pragma send-private\n", -1);
-    }
-
-    /* Begin constructing the next message (which might never be
-    ** sent) by beginning with the pull or push cards
+    /* Process the reply that came back from the server as it arrives.
+    ** Cards for the next message (which might never be sent) are
+    ** appended to send as the reply is processed.
     */
-    if( syncFlags & SYNC_PULL ){
-      blob_appendf(&send, "pull %s %s\n", zSCode, zPCode);
-      nCardSent++;
-    }
-    if( syncFlags & SYNC_PUSH ){
-      blob_appendf(&send, "push %s %s\n", zSCode, zPCode);
-      nCardSent++;
-    }
-    go = 0;
+    for(;;){
+      int nLine = stopReply ? 0 : xferin_line(&recv, &xfer.line);
+
+      /* Once all of the reply has arrived, or processing has stopped,
+      ** measure the link and put the cards that begin every request at
+      ** the start of the next message.
+      */
+      if( !replyDone && (nLine==0 || xferin_eof(&recv)) ){
+        Blob next;
+        replyDone = 1;
+        content_batch_flush();
+
+        /* The shortest wait for a reply approximates the round-trip time
+        ** plus the server's own work.  The bandwidth is estimated from
+        ** replies large enough to be timed.
+        */
+        if( xferin_eof(&recv) ){
+          int msWait, msXfer, nWire;
+          http_exchange_stats(&msWait, &msXfer, &nWire);
+          if( msWait>0 && (msRtt==0 || msWait<msRtt) ) msRtt = msWait;
+          if( nWire>=32768 ){
+            double r = nWire*1000.0/(msXfer<10 ? 10 : msXfer);
+            rRate = rRate==0.0 ? r : (rRate*3.0 + r)/4.0;
+          }
+          nCkptBytes += nWire;
+        }
+
+        /* Ask for replies sized to the link.  Each reply should take at
+        ** least four round trips to receive, so that no more than about a
+        ** fifth of each cycle is spent waiting, and no less than
+        ** XFER_REPLY_MSEC, so that fast links are not slowed by the cost
+        ** of each request.  Only slow links end up asking for less than
+        ** the server's default.
+        */
+        if( rRate>0.0 && msRtt>0 ){
+          int msCycle = msRtt*4;
+          double r;
+          if( msCycle<XFER_REPLY_MSEC ) msCycle = XFER_REPLY_MSEC;
+          r = rRate*msCycle/1000.0;
+          mxReply = r>2000000000.0 ? 2000000000 : (int)r;
+          if( mxReply<XFER_MIN_REPLY ) mxReply = XFER_MIN_REPLY;
+        }
+        blob_zero(&next);
+        nCardSent += client_request_start(&next, syncFlags, mxReply,
+                                          zSCode, zPCode);
+
+        /* When pipelining, compose and send the next request before the
+        ** rest of this reply is processed.  The first round of a clone is
+        ** never pipelined because its reply supplies the project code
+        ** that the login card of the next request depends on.
+        **
+        ** A pull is only pipelined while it makes progress, and only if
+        ** the next request asks for an artifact that the request being
+        ** answered did not.  Artifacts asked for again because this
+        ** reply did not deliver them might be missing from the server
+        ** as well.  Whether to ask for them again is left to the usual
+        ** test at the end of the round, which stops once a round brings
+        ** neither files nor new phantoms.
+        */
+        if( usePipeline && nCycle>0 && !stopReply && transport_is_open() ){
+          int nextSeqno = cloneSeqno;
+          int nInReply = xfer.nFileRcvd + xfer.nDeltaRcvd + xfer.nDanglingFile;
+          int nPhantom = 0;
+          Blob rest;
+          xferin_rest(&recv, &rest);
+          if( client_prescan(&rest, syncFlags, &nInReply, &nPhantom,
+                             &nextSeqno) ){
+            if( nPhantom>0 ) newPhantom = 1;
+            blob_append(&pipe, blob_buffer(&next), blob_size(&next));
+            if( syncFlags & SYNC_CLONE ){
+              if( nextSeqno>0 ){
+                blob_appendf(&pipe, "clone 3 %d\n", nextSeqno);
+                inFlight = 1;
+              }
+            }else if( nInReply>0 || newPhantom ){
+              int nGimme = xfer.nGimmeSent;
+              int rid;
+              if( nInReply>0 ){
+                mxPhantomReq = client_batch_size(nInReply,
+                                                 (int)xferin_size(&recv),
+                                                 nGimmeReq, szReply, mxReply);
+              }
+              xfer.pOut = &pipe;
+              xfer.skipInReply = 1;
+              xfer.pGimme = &gimmeNext;
+              request_phantoms(&xfer, mxPhantomReq);
+              xfer.pGimme = 0;
+              xfer.skipInReply = 0;
+              xfer.pOut = &send;
+              for(rid=bag_first(&gimmeNext); rid>0 && !inFlight;
+                  rid=bag_next(&gimmeNext, rid)){
+                inFlight = !bag_find(&gimmeSent, rid);
+              }
+              if( !inFlight ){
+                xfer.nGimmeSent = nGimme;
+                bag_clear(&gimmeNext);
+              }
+            }
+            if( inFlight ){
+              zCookie = db_get("cookie", 0);
+              if( zCookie ) blob_appendf(&pipe, "cookie %s\n", zCookie);
+              zRandomness = db_text(0, "SELECT hex(randomblob(20))");
+              blob_appendf(&pipe, "# %s\n", zRandomness);
+              free(zRandomness);
+              if( http_exchange_begin(&pipe, 1) ){
+                inFlight = 0;
+                bag_clear(&gimmeNext);
+              }
+            }
+            if( !inFlight ) blob_reset(&pipe);
+          }
+          blob_reset(&rest);
+        }
+        blob_append(&next, blob_buffer(&send), blob_size(&send));
+        blob_reset(&send);
+        send = next;
+      }
+      if( nLine==0 ) break;
 
-    /* Process the reply that came back from the server */
-    while( blob_line(&recv, &xfer.line) ){
       if( blob_buffer(&xfer.line)[0]=='#' ){
         const char *zLine = blob_buffer(&xfer.line);
         if( memcmp(zLine, "# timestamp ", 12)==0 ){
@@ -1613,7 +2076,9 @@ int client_sync(
           rDiff = db_double(9e99, "SELECT julianday('%q') - %.17g",
                             zTime, rArrivalTime);
           if( rDiff>9e98 || rDiff<-9e98 ) rDiff = 0.0;
-          if( rDiff*24.0*3600.0 >= -(blob_size(&recv)/5000.0 + 20) ) rDiff = 0.0;
+          if( rDiff*24.0*3600.0 >= -(xferin_size(&recv)/5000.0 + 20) ){
+            rDiff = 0.0;
+          }
           if( fossil_fabs(rDiff)>fossil_fabs(rSkew) ) rSkew = rDiff;
         }
         nCardRcvd++;
@@ -1621,9 +2086,10 @@ int client_sync(
       }
       xfer.nToken = blob_tokenize(&xfer.line, xfer.aToken, count(xfer.aToken));
       nCardRcvd++;
-      if( (syncFlags & SYNC_VERBOSE)!=0 && recv.nUsed>0 ){
-        pctDone = (recv.iCursor*100)/recv.nUsed;
-        if( pctDone!=lastPctDone ){
+      if( !xfer_card_is_file(&xfer) ) content_batch_flush();
+      if( (syncFlags & SYNC_VERBOSE)!=0 ){
+        pctDone = xferin_percent(&recv);
+        if( pctDone>=0 && pctDone!=lastPctDone ){
           fossil_print("\rprocessed: %d%%         ", pctDone);
           lastPctDone = pctDone;
           fflush(stdout);
@@ -1731,13 +2197,13 @@ int client_sync(
         const char *zName = blob_str(&xfer.aToken[1]);
         Blob content;
         blob_zero(&content);
-        blob_extract(xfer.pIn, size, &content);
+        xferin_extract(xfer.pIn, size, &content);
         g.perm.Admin = g.perm.RdAddr = 1;
         configure_receive(zName, &content, origConfigRcvMask);
         nCardRcvd++;
         nArtifactRcvd++;
         blob_reset(&content);
-        blob_seek(xfer.pIn, 1, BLOB_SEEK_CUR);
+        xferin_skip(xfer.pIn, 1);
       }else
 
       
@@ -1803,6 +2269,22 @@ int client_sync(
       ** silently ignored.
       */
       if( blob_eq(&xfer.aToken[0], "pragma") && xfer.nToken>=2 ){
+        /*   pragma pipeline
+        **
+        ** The server accepts requests sent before the reply to the
+        ** previous request has been processed.
+        */
+        if( blob_eq(&xfer.aToken[1], "pipeline") && canPipeline ){
+          usePipeline = 1;
+        }
+
+        /*   pragma reply-size N
+        **
+        ** The server makes replies of up to N bytes.
+        */
+        if( blob_eq(&xfer.aToken[1], "reply-size") && xfer.nToken==3 ){
+          blob_is_int(&xfer.aToken[2], &szReply);
+        }
       }else
 
       /*   error MESSAGE
@@ -1837,19 +2319,24 @@ int client_sync(
             blob_appendf(&xfer.err, "server says: %s\n", zMsg);
             nErr++;
           }
-          break;
+          stopReply = 1;
+          continue;
         }
       }else
 
       /* Unknown message */
       if( xfer.nToken>0 ){
         if( blob_str(&xfer.aToken[0])[0]=='<' ){
+          Blob rest;
+          xferin_read_all(&recv);
+          xferin_rest(&recv, &rest);
           fossil_warning(
-            "server replies with HTML instead of fossil sync protocol:\n%b",
-            &recv
+            "server replies with HTML instead of fossil sync protocol:\n%b%b",
+            &xfer.line, &rest
           );
           nErr++;
-          break;
+          stopReply = 1;
+          continue;
         }
         blob_appendf(&xfer.err, "unknown command: [%b]\n", &xfer.aToken[0]);
       }
@@ -1858,11 +2345,17 @@ int client_sync(
         fossil_force_newline();
         fossil_warning("%b", &xfer.err);
         nErr++;
-        break;
+        stopReply = 1;
+        continue;
       }
       blobarray_reset(xfer.aToken, xfer.nToken);
       blob_reset(&xfer.line);
     }
+    if( xfer_store_files(&xfer) && !stopReply ){
+      fossil_force_newline();
+      fossil_warning("%b", &xfer.err);
+      nErr++;
+    }
     if( (configRcvMask & (CONFIGSET_USER|CONFIGSET_TKT))!=0
      && (configRcvMask & CONFIGSET_OLDFORMAT)!=0
     ){
@@ -1871,12 +2364,11 @@ int client_sync(
     origConfigRcvMask = 0;
     if( nCardRcvd>0 && (syncFlags & SYNC_VERBOSE) ){
       fossil_print(zValueFormat, "Received:",
-                   blob_size(&recv), nCardRcvd,
+                   (int)xferin_size(&recv), nCardRcvd,
                    xfer.nFileRcvd, xfer.nDeltaRcvd + xfer.nDanglingFile);
     }else{
       fossil_print(zBriefFormat, nRoundtrip, nArtifactSent, nArtifactRcvd);
     }
-    blob_reset(&recv);
     nCycle++;
 
     /* If we received one or more files on the previous exchange but
@@ -1885,11 +2377,12 @@ int client_sync(
     nFileRecv = xfer.nFileRcvd + xfer.nDeltaRcvd + xfer.nDanglingFile;
     if( (nFileRecv>0 || newPhantom) && db_exists("SELECT 1 FROM phantom") ){
       go = 1;
-      mxPhantomReq = nFileRecv*2;
-      if( mxPhantomReq<200 ) mxPhantomReq = 200;
+      mxPhantomReq = client_batch_size(nFileRecv, (int)xferin_size(&recv),
+                                       nGimmeReq, szReply, mxReply);
     }else if( (syncFlags & SYNC_CLONE)!=0 && nFileRecv>0 ){
       go = 1;
     }
+    xferin_close(&recv);
     nCardRcvd = 0;
     xfer.nFileRcvd = 0;
     xfer.nDeltaRcvd = 0;
@@ -1905,12 +2398,45 @@ int client_sync(
     /* If this is a clone, the go at least two rounds */
     if( (syncFlags & SYNC_CLONE)!=0 && nCycle==1 ) go = 1;
 
+    /* A reply that ended early is missing whatever it should have held
+    ** after that point, so stop with an error. */
+    if( xferin_error(&recv) ){
+      fossil_force_newline();
+      fossil_warning("the reply from the server is incomplete");
+      nErr++;
+      go = 0;
+    }
+
     /* Stop the cycle if the server sends a "clone_seqno 0" card and
     ** we have gone at least two rounds.  Always go at least two rounds
     ** on a clone in order to be sure to retrieve the configuration
     ** information which is only sent on the second round.
     */
     if( cloneSeqno<=0 && nCycle>1 ) go = 0;   
+
+    /* Remember how far a clone has got, so that "fossil clone --resume"
+    ** can continue from there, and commit what has arrived every so
+    ** often.  The configuration arrives in the second round, so nothing
+    ** is recorded before that.
+    */
+    if( (syncFlags & SYNC_CLONE)!=0 && nCycle>1 && nErr==0 ){
+      db_set_int("clone-seqno", cloneSeqno>0 ? cloneSeqno : 0, 0);
+      if( go && (nCkptBytes>=CLONE_CHECKPOINT_BYTES
+                 || fossil_wallclock_ms()-msCkpt>=CLONE_CHECKPOINT_MSEC) ){
+        verify_cancel();
+        db_commit_and_continue();
+        nCkptBytes = 0;
+        msCkpt = fossil_wallclock_ms();
+      }
+    }
+
+    /* A request that is already in flight must have its reply read */
+    if( inFlight && nErr==0 ) go = 1;
+
+    if( go && (syncFlags & SYNC_VERBOSE) ){
+      fossil_print(zTuneFormat, "Measured:", msRtt, (int)(rRate/1000.0),
+                   mxPhantomReq, mxReply);
+    }
   };
   transport_stats(&nSent, &nRcvd, 1);
   if( (rSkew*24.0*3600.0) > 10.0 ){
@@ -1929,7 +2455,13 @@ int client_sync(
      zOpType, nSent, nRcvd);
   transport_close(GLOBAL_URL());
   transport_global_shutdown(GLOBAL_URL());
-  db_multi_exec("DROP TABLE onremote");
+  bitmap_clear(&onRemote);
+  bitmap_clear(&xfer.igotSent);
+  if( canPipeline ) db_multi_exec("DROP TABLE inreply");
+  blob_reset(&pipe);
+  bag_clear(&gimmeSent);
+  bag_clear(&gimmeNext);
+  content_batch_end();
   manifest_crosslink_end(MC_PERMIT_HOOKS);
   content_enable_dephantomize(1);
   db_end_transaction(0);
@@ -0,0 +1,370 @@
+/*
+** Copyright (c) 2014 D. Richard Hipp
+**
+** This program is free software; you can redistribute it and/or
+** modify it under the terms of the Simplified BSD License (also
+** known as the "2-Clause License" or "FreeBSD License".)
+
+** This program is distributed in the hope that it will be useful,
+** but without any warranty; without even the implied warranty of
+** merchantability or fitness for a particular purpose.
+**
+** Author contact information:
+**   drh@hwaci.com
+**   http://www.hwaci.com/drh/
+**
+*******************************************************************************
+**
+** This file contains code used to read an incoming sync protocol
+** message a piece at a time.
+**
+** A message is read from its source, and inflated if it is compressed,
+** only as fast as its cards are processed.  The cards at the beginning
+** of a message can therefore be acted upon while the rest of it is
+** still arriving, and only a small part of a large message is held in
+** memory at any one time.
+*/
+#include "config.h"
+#include "xferin.h"
+#include <zlib.h>
+#include <assert.h>
+
+/*
+** Number of bytes of the raw message read from the source at a time
+*/
+#define XFERIN_CHUNK  65536
+
+#if INTERFACE
+/*
+** An incoming sync message
+*/
+struct XferIn {
+  Blob buf;             /* Inflated content.  Unread part begins at iCursor */
+  int (*xRead)(void*,char*,int);  /* Read raw message bytes.  0 at end */
+  void *pArg;           /* First argument to xRead */
+  int nExpect;          /* Size of the raw message, or -1 if not known */
+  i64 nRaw;             /* Raw bytes read so far */
+  i64 nTotal;           /* Inflated bytes produced so far */
+  char *aRaw;           /* Raw bytes not yet inflated */
+  void *pZ;             /* Inflate state, or NULL for uncompressed input */
+  int nHdr;             /* Bytes of the 4-byte size prefix seen so far */
+  u8 eof;               /* True when the whole message has been read */
+  u8 isErr;             /* True if the message ended early */
+  int iHash;            /* Offset in buf of the first byte not yet hashed */
+  void *pHash;          /* Checksum of the tail of the message, or NULL */
+  char zWant[41];       /* The checksum the tail should have */
+};
+#endif
+
+/*
+** Begin reading a message using xRead(pArg, zBuf, N), which reads up
+** to N more bytes of the raw message into zBuf and returns the number
+** of bytes read, zero at the end of the message, or -1 if the source
+** failed before the end.  nExpect is the size of the raw message if it
+** is known, or -1.  A message that ends before nExpect bytes arrive, or
+** whose compressed data is incomplete, is reported by xferin_error().
+*/
+void xferin_init(
+  XferIn *p,                      /* The message to be read */
+  int (*xRead)(void*,char*,int),  /* Source of the raw message */
+  void *pArg,                     /* First argument to xRead */
+  int nExpect,                    /* Raw message size, or -1 */
+  int isCompressed                /* True if the message is compressed */
+){
+  memset(p, 0, sizeof(*p));
+  blob_zero(&p->buf);
+  p->xRead = xRead;
+  p->pArg = pArg;
+  p->nExpect = nExpect;
+  p->aRaw = fossil_malloc(XFERIN_CHUNK);
+  if( isCompressed ){
+    z_stream *pZ = fossil_malloc(sizeof(*pZ));
+    memset(pZ, 0, sizeof(*pZ));
+    inflateInit(pZ);
+    p->pZ = pZ;
+  }
+}
+
+/*
+** Read a message that is already held, uncompressed, in pMsg, or an
+** empty message if pMsg is NULL.  The blob pMsg must not be changed
+** until the message has been read.
+*/
+void xferin_init_blob(XferIn *p, Blob *pMsg){
+  memset(p, 0, sizeof(*p));
+  blob_zero(&p->buf);
+  if( pMsg && blob_size(pMsg)>0 ){
+    blob_init(&p->buf, blob_buffer(pMsg), blob_size(pMsg));
+  }
+  p->nExpect = blob_size(&p->buf);
+  p->nRaw = p->nTotal = blob_size(&p->buf);
+  p->eof = 1;
+}
+
+/*
+** Add the bytes of the message between p->iHash and iEnd to the
+** checksum of the tail of the message.
+*/
+static void xferin_hash_to(XferIn *p, int iEnd){
+  if( p->pHash && iEnd>p->iHash ){
+    sha1sum_ctx_step(p->pHash, blob_buffer(&p->buf)+p->iHash, iEnd-p->iHash);
+    p->iHash = iEnd;
+  }
+}
+
+/*
+** Read more of the message and append it to p->buf, after discarding
+** the part of p->buf that has already been read.  Return the number
+** of bytes added, which is zero only at the end of the message, or when
+** the message is found to have ended early.
+**
+** Blobs previously returned by xferin_extract() refer to p->buf and
+** are no longer valid after this routine runs.
+*/
+static int xferin_more(XferIn *p){
+  int nAdded = 0;
+  if( p->eof ) return 0;
+  if( p->buf.iCursor>0 ){
+    int nLeft = blob_size(&p->buf) - p->buf.iCursor;
+    char *z = blob_buffer(&p->buf);
+    xferin_hash_to(p, p->buf.iCursor);
+    memmove(z, &z[p->buf.iCursor], nLeft);
+    p->buf.nUsed = nLeft;
+    p->buf.iCursor = 0;
+    p->iHash = 0;
+  }
+  while( nAdded==0 && !p->eof ){
+    z_stream *pZ = (z_stream*)p->pZ;
+    if( pZ==0 ){
+      int got = p->xRead(p->pArg, p->aRaw, XFERIN_CHUNK);
+      if( got<=0 ){
+        p->eof = 1;
+        if( got<0 || (p->nExpect>=0 && p->nRaw<p->nExpect) ) p->isErr = 1;
+      }else{
+        p->nRaw += got;
+        blob_append(&p->buf, p->aRaw, got);
+        nAdded = got;
+      }
+    }else{
+      unsigned char aOut[XFERIN_CHUNK];
+      int rc;
+      if( pZ->avail_in==0 ){
+        int got = p->xRead(p->pArg, p->aRaw, XFERIN_CHUNK);
+        if( got<=0 ){
+          /* The compressed data should have ended first */
+          p->eof = 1;
+          p->isErr = 1;
+          break;
+        }
+        p->nRaw += got;
+        pZ->next_in = (unsigned char*)p->aRaw;
+        pZ->avail_in = got;
+      }
+      /* Skip the uncompressed size that precedes the compressed data */
+      while( p->nHdr<4 && pZ->avail_in>0 ){
+        p->nHdr++;
+        pZ->next_in++;
+        pZ->avail_in--;
+      }
+      if( pZ->avail_in==0 ) continue;
+      pZ->next_out = aOut;
+      pZ->avail_out = sizeof(aOut);
+      rc = inflate(pZ, Z_NO_FLUSH);
+      nAdded = (int)(sizeof(aOut) - pZ->avail_out);
+      blob_append(&p->buf, (char*)aOut, nAdded);
+      if( rc==Z_STREAM_END || (rc!=Z_OK && rc!=Z_BUF_ERROR) ){
+        /* Anything that follows the compressed data is ignored, but it
+        ** is read so that the source is finished with */
+        int got;
+        while( (got = p->xRead(p->pArg, p->aRaw, XFERIN_CHUNK))>0 ){}
+        p->eof = 1;
+        if( rc!=Z_STREAM_END || got<0 ) p->isErr = 1;
+      }
+    }
+  }
+  p->nTotal += nAdded;
+  return nAdded;
+}
+
+/*
+** Return true if the whole message has been read from its source.
+** The part that has not yet been processed is held in memory.
+*/
+int xferin_eof(XferIn *p){
+  return p->eof;
+}
+
+/*
+** Return true if the message was found to have ended early, because
+** its source failed or its compressed data was incomplete or corrupt.
+** The part of the message that did arrive has been read normally, so
+** the caller should undo or disregard whatever it did on account of it.
+*/
+int xferin_error(XferIn *p){
+  return p->isErr;
+}
+
+/*
+** Read the rest of the message into memory.
+*/
+void xferin_read_all(XferIn *p){
+  if( p->eof ) return;
+  while( xferin_more(p) ){}
+}
+
+/*
+** Make pRest refer to the part of the message that has been read but
+** not yet processed.  pRest is valid until the next call to any other
+** routine in this file.
+*/
+void xferin_rest(XferIn *p, Blob *pRest){
+  int n = blob_size(&p->buf) - p->buf.iCursor;
+  if( n>0 ){
+    blob_init(pRest, blob_buffer(&p->buf)+p->buf.iCursor, n);
+  }else{
+    blob_zero(pRest);
+  }
+}
+
+/*
+** Read the next line of the message, including its newline, into
+** pLine, which must have been initialized, replacing whatever it held
+** before.  pLine holds its own copy of the line, so it and the tokens
+** it is split into remain valid as the message is read further.
+** Return the length of the line, or 0 at the end of the message.
+*/
+int xferin_line(XferIn *p, Blob *pLine){
+  int iStart = 0;
+  int n;
+  char *z;
+  blob_reset(pLine);
+  for(;;){
+    int nLeft = blob_size(&p->buf) - p->buf.iCursor - iStart;
+    z = blob_buffer(&p->buf) + p->buf.iCursor;
+    if( nLeft>0 ){
+      char *zEol = memchr(&z[iStart], '\n', nLeft);
+      if( zEol ){
+        n = (int)(zEol - z) + 1;
+        break;
+      }
+      iStart += nLeft;
+    }
+    if( xferin_more(p)==0 ){
+      n = iStart;
+      z = blob_buffer(&p->buf) + p->buf.iCursor;
+      break;
+    }
+  }
+  if( n>0 ) blob_append(pLine, z, n);
+  p->buf.iCursor += n;
+  return n;
+}
+
+/*
+** Make sure that at least N bytes of the message that have not yet
+** been processed are held in memory, unless the message ends sooner.
+** Return the number of such bytes.
+*/
+static int xferin_need(XferIn *p, int N){
+  while( blob_size(&p->buf) - p->buf.iCursor < N && xferin_more(p) ){}
+  return blob_size(&p->buf) - p->buf.iCursor;
+}
+
+/*
+** Extract the next N bytes of the message into pTo, or as many as
+** remain if the message is shorter.  pTo refers to memory belonging to
+** p and is valid only until the next call to any other routine in this
+** file.  Return the number of bytes extracted.
+*/
+int xferin_extract(XferIn *p, int N, Blob *pTo){
+  xferin_need(p, N);
+  return blob_extract(&p->buf, N, pTo);
+}
+
+/*
+** Skip over the next N bytes of the message.
+*/
+void xferin_skip(XferIn *p, int N){
+  int n = xferin_need(p, N);
+  p->buf.iCursor += n<N ? n : N;
+}
+
+/*
+** Return the number of bytes of the message inflated so far.
+*/
+i64 xferin_size(XferIn *p){
+  return p->nTotal;
+}
+
+/*
+** Return how much of the message has been read from its source, as a
+** percentage, or -1 if the size of the message is not known.
+*/
+int xferin_percent(XferIn *p){
+  if( p->nExpect<=0 ) return -1;
+  return (int)(p->nRaw*100/p->nExpect);
+}
+
+/*
+** Arrange for the SHA1 checksum of the rest of the message, starting
+** at the current position, to be compared against zHash once the
+** message has been read.  This is how the signature of a "login" card
+** that covers the rest of the message is checked without having to
+** wait for all of it to arrive.  The comparison is made by
+** xferin_verify().
+**
+** Only one checksum can be pending.  Return non-zero if one already is.
+*/
+int xferin_expect_hash(XferIn *p, const char *zHash){
+  if( p->pHash ) return 1;
+  p->pHash = sha1sum_ctx_new();
+  p->iHash = p->buf.iCursor;
+  sqlite3_snprintf(sizeof(p->zWant), p->zWant, "%s", zHash);
+  return 0;
+}
+
+/*
+** Read the rest of the message and, if xferin_expect_hash() was called,
+** compare the checksum of its tail.  Return zero if no checksum was
+** pending or it matched, and non-zero if it did not match.
+*/
+int xferin_verify(XferIn *p){
+  Blob hash;
+  int rc;
+  if( p->pHash==0 ) return 0;
+  do{
+    xferin_hash_to(p, blob_size(&p->buf));
+    p->buf.iCursor = blob_size(&p->buf);
+  }while( xferin_more(p) );
+  blob_zero(&hash);
+  sha1sum_ctx_finish(p->pHash, &hash);
+  p->pHash = 0;
+  rc = fossil_strcmp(blob_str(&hash), p->zWant);
+  blob_reset(&hash);
+  return rc;
+}
+
+/*
+** Read and discard whatever remains of the message, so that the
+** connection it arrived on is ready for the next one, and free all
+** memory held by p.
+*/
+void xferin_close(XferIn *p){
+  while( !p->eof ){
+    p->buf.iCursor = blob_size(&p->buf);
+    p->iHash = p->buf.iCursor;
+    xferin_more(p);
+  }
+  if( p->pZ ){
+    inflateEnd((z_stream*)p->pZ);
+    fossil_free(p->pZ);
+    p->pZ = 0;
+  }
+  if( p->pHash ){
+    sha1sum_ctx_finish(p->pHash, 0);
+    p->pHash = 0;
+  }
+  fossil_free(p->aRaw);
+  p->aRaw = 0;
+  blob_reset(&p->buf);
+}
@@ -41,6 +41,8 @@ static void put32(char *z, int v){
 */
 static Blob body;    /* The body of the ZIP archive */
 static Blob toc;     /* The table of contents */
+static int isStream; /* Send the body with cgi_stream() instead of to body */
+static unsigned int iOffset;  /* Size of the body written so far */
 static int nEntry;   /* Number of files */
 static int dosTime;  /* DOS-format time */
 static int dosDate;  /* DOS-format date */
@@ -54,12 +56,28 @@ static char **azDir; /* Directory names already added to the archive */
 void zip_open(void){
   blob_zero(&body);
   blob_zero(&toc);
+  isStream = 0;
+  iOffset = 0;
   nEntry = 0;
   dosTime = 0;
   dosDate = 0;
   unixTime = 0;
 }
 
+/*
+** Append n bytes to the body of the ZIP archive.  When streaming, the
+** bytes go straight to the HTTP reply and only the table of contents is
+** kept in memory.
+*/
+static void zip_emit(const char *z, int n){
+  if( isStream ){
+    cgi_stream(z, n);
+  }else{
+    blob_append(&body, z, n);
+  }
+  iOffset += n;
+}
+
 /*
 ** Set the date and time values from an ISO8601 date string.
 */
@@ -114,34 +132,93 @@ void zip_add_folders(char *zName){
 }
 
 /*
-** Append a single file to a growing ZIP archive.
-**
-** pFile is the file to be appended.  zName is the name
-** that the file should be saved as.
+** A file waiting to be added to the archive
 */
-void zip_add_file(const char *zName, const Blob *pFile, int mPerm){
+struct ZipEntry {
+  char *zName;          /* Name of the file in the archive */
+  Blob content;         /* Uncompressed content.  Empty for a directory */
+  int mPerm;            /* Permissions of the file */
+  Blob data;            /* Compressed content */
+  int iCRC;             /* CRC of the uncompressed content */
+};
+
+/*
+** Worker threads and the files queued for them.  Files are compressed
+** in batches and then written to the archive in the order added.
+*/
+static ThreadPool *pPool;        /* Worker threads.  NULL if serial */
+static struct ZipEntry *aQueue;  /* Files waiting to be compressed */
+static int nQueue;               /* Number of entries used in aQueue[] */
+static int nQueueAlloc;          /* Number of entries allocated */
+static i64 szQueue;              /* Bytes of content in aQueue[] */
+static i64 szQueueLimit;         /* Compress the batch at this size */
+
+/*
+** Bytes of uncompressed content to queue for each worker thread before
+** a batch is compressed.
+*/
+#define ZIP_BATCH_PER_THREAD 4000000
+
+/*
+** Compress the content of a single file.  This runs on a worker thread
+** when there are any.
+*/
+static void zip_deflate_entry(void *pArg){
+  struct ZipEntry *p = (struct ZipEntry*)pArg;
   z_stream stream;
+  int toOut;
+  char zOutBuf[100000];
+
+  blob_zero(&p->data);
+  p->iCRC = 0;
+  if( blob_size(&p->content)==0 ) return;
+  stream.zalloc = (alloc_func)0;
+  stream.zfree = (free_func)0;
+  stream.opaque = 0;
+  stream.avail_in = blob_size(&p->content);
+  stream.next_in = (unsigned char*)blob_buffer(&p->content);
+  stream.avail_out = sizeof(zOutBuf);
+  stream.next_out = (unsigned char*)zOutBuf;
+  deflateInit2(&stream, 9, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY);
+  p->iCRC = crc32(0, stream.next_in, stream.avail_in);
+  while( stream.avail_in>0 ){
+    deflate(&stream, 0);
+    toOut = sizeof(zOutBuf) - stream.avail_out;
+    blob_append(&p->data, zOutBuf, toOut);
+    stream.avail_out = sizeof(zOutBuf);
+    stream.next_out = (unsigned char*)zOutBuf;
+  }
+  do{
+    stream.avail_out = sizeof(zOutBuf);
+    stream.next_out = (unsigned char*)zOutBuf;
+    deflate(&stream, Z_FINISH);
+    toOut = sizeof(zOutBuf) - stream.avail_out;
+    blob_append(&p->data, zOutBuf, toOut);
+  }while( stream.avail_out==0 );
+  deflateEnd(&stream);
+}
+
+/*
+** Write a file whose content has been compressed into the archive.
+*/
+static void zip_write_entry(struct ZipEntry *p){
   int nameLen;
-  int toOut = 0;
-  int iStart;
-  int iCRC = 0;
-  int nByte = 0;
-  int nByteCompr = 0;
-  int nBlob;                 /* Size of the blob */
+  unsigned int iStart;
+  int nByte = blob_size(&p->content);
+  int nByteCompr = blob_size(&p->data);
   int iMethod;               /* Compression method. */
   int iMode = 0644;          /* Access permissions */
-  char *z;
   char zHdr[30];
   char zExTime[13];
   char zBuf[100];
-  char zOutBuf[100000];
 
-  /* Fill in as much of the header as we know.
+  /* Fill in the header.  The file is compressed before the header is
+  ** written so that the header can hold the sizes and the archive can be
+  ** sent without going back to patch it.
   */
-  nBlob = pFile ? blob_size(pFile) : 0;
-  if( nBlob>0 ){
+  if( nByte>0 ){
     iMethod = 8;
-    switch( mPerm ){
+    switch( p->mPerm ){
       case PERM_LNK:   iMode = 0120755;   break;
       case PERM_EXE:   iMode = 0100755;   break;
       default:         iMode = 0100644;   break;
@@ -150,7 +227,7 @@ void zip_add_file(const char *zName, const Blob *pFile, int mPerm){
     iMethod = 0;
     iMode = 040755;
   }
-  nameLen = strlen(zName);
+  nameLen = strlen(p->zName);
   memset(zHdr, 0, sizeof(zHdr));
   put32(&zHdr[0], 0x04034b50);
   put16(&zHdr[4], 0x000a);
@@ -158,6 +235,9 @@ void zip_add_file(const char *zName, const Blob *pFile, int mPerm){
   put16(&zHdr[8], iMethod);
   put16(&zHdr[10], dosTime);
   put16(&zHdr[12], dosDate);
+  put32(&zHdr[14], p->iCRC);
+  put32(&zHdr[18], nByteCompr);
+  put32(&zHdr[22], nByte);
   put16(&zHdr[26], nameLen);
   put16(&zHdr[28], 13);
   
@@ -166,52 +246,14 @@ void zip_add_file(const char *zName, const Blob *pFile, int mPerm){
   zExTime[4] = 3;
   put32(&zExTime[5], unixTime);
   put32(&zExTime[9], unixTime);
-  
 
-  /* Write the header and filename.
+  /* Write the header, filename and compressed file.
   */
-  iStart = blob_size(&body);
-  blob_append(&body, zHdr, 30);
-  blob_append(&body, zName, nameLen);
-  blob_append(&body, zExTime, 13);
-
-  if( nBlob>0 ){
-    /* Write the compressed file.  Compute the CRC as we progress.
-    */
-    stream.zalloc = (alloc_func)0;
-    stream.zfree = (free_func)0;
-    stream.opaque = 0;
-    stream.avail_in = blob_size(pFile);
-    stream.next_in = (unsigned char*)blob_buffer(pFile);
-    stream.avail_out = sizeof(zOutBuf);
-    stream.next_out = (unsigned char*)zOutBuf;
-    deflateInit2(&stream, 9, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY);
-    iCRC = crc32(0, stream.next_in, stream.avail_in);
-    while( stream.avail_in>0 ){
-      deflate(&stream, 0);
-      toOut = sizeof(zOutBuf) - stream.avail_out;
-      blob_append(&body, zOutBuf, toOut);
-      stream.avail_out = sizeof(zOutBuf);
-      stream.next_out = (unsigned char*)zOutBuf;
-    }
-    do{
-      stream.avail_out = sizeof(zOutBuf);
-      stream.next_out = (unsigned char*)zOutBuf;
-      deflate(&stream, Z_FINISH);
-      toOut = sizeof(zOutBuf) - stream.avail_out;
-      blob_append(&body, zOutBuf, toOut);
-    }while( stream.avail_out==0 );
-    nByte = stream.total_in;
-    nByteCompr = stream.total_out;
-    deflateEnd(&stream);
-  
-    /* Go back and write the header, now that we know the compressed file size.
-    */
-    z = &blob_buffer(&body)[iStart];
-    put32(&z[14], iCRC);
-    put32(&z[18], nByteCompr);
-    put32(&z[22], nByte);
-  }
+  iStart = iOffset;
+  zip_emit(zHdr, 30);
+  zip_emit(p->zName, nameLen);
+  zip_emit(zExTime, 13);
+  zip_emit(blob_buffer(&p->data), nByteCompr);
   
   /* Make an entry in the tables of contents
   */
@@ -223,7 +265,7 @@ void zip_add_file(const char *zName, const Blob *pFile, int mPerm){
   put16(&zBuf[10], iMethod);
   put16(&zBuf[12], dosTime);
   put16(&zBuf[14], dosDate);
-  put32(&zBuf[16], iCRC);
+  put32(&zBuf[16], p->iCRC);
   put32(&zBuf[20], nByteCompr);
   put32(&zBuf[24], nByte);
   put16(&zBuf[28], nameLen);
@@ -234,25 +276,100 @@ void zip_add_file(const char *zName, const Blob *pFile, int mPerm){
   put32(&zBuf[38], ((unsigned)iMode)<<16);
   put32(&zBuf[42], iStart);
   blob_append(&toc, zBuf, 46);
-  blob_append(&toc, zName, nameLen);
+  blob_append(&toc, p->zName, nameLen);
   put16(&zExTime[2], 5);
   blob_append(&toc, zExTime, 9);
   nEntry++;
 }
 
+/*
+** Compress all queued files on the worker threads, then write them to
+** the archive in order.
+*/
+static void zip_flush_queue(void){
+  int i;
+  for(i=0; i<nQueue; i++){
+    threadpool_add(pPool, zip_deflate_entry, &aQueue[i]);
+  }
+  threadpool_wait(pPool);
+  for(i=0; i<nQueue; i++){
+    struct ZipEntry *p = &aQueue[i];
+    zip_write_entry(p);
+    fossil_free(p->zName);
+    blob_reset(&p->content);
+    blob_reset(&p->data);
+  }
+  nQueue = 0;
+  szQueue = 0;
+}
+
+/*
+** Compress the files of the archive on nThread worker threads.  This
+** must follow zip_open().  zip_close() shuts the threads down.
+*/
+static void zip_begin_threads(int nThread){
+  if( nThread>1 ){
+    pPool = threadpool_new(nThread);
+    szQueueLimit = (i64)nThread*ZIP_BATCH_PER_THREAD;
+  }
+}
+
+/*
+** Append a single file to a growing ZIP archive.
+**
+** pFile is the file to be appended.  zName is the name
+** that the file should be saved as.
+*/
+void zip_add_file(const char *zName, const Blob *pFile, int mPerm){
+  struct ZipEntry x;
+  if( pPool ){
+    if( nQueue>=nQueueAlloc ){
+      nQueueAlloc = nQueueAlloc*2 + 20;
+      aQueue = fossil_realloc(aQueue, sizeof(aQueue[0])*nQueueAlloc);
+    }
+    x.zName = mprintf("%s", zName);
+    blob_zero(&x.content);
+    if( pFile ) blob_append(&x.content, blob_buffer(pFile), blob_size(pFile));
+    x.mPerm = mPerm;
+    aQueue[nQueue++] = x;
+    szQueue += blob_size(&x.content);
+    if( szQueue>=szQueueLimit ) zip_flush_queue();
+    return;
+  }
+  x.zName = (char*)zName;
+  if( pFile ){
+    x.content = *pFile;
+  }else{
+    blob_zero(&x.content);
+  }
+  x.mPerm = mPerm;
+  zip_deflate_entry(&x);
+  zip_write_entry(&x);
+  blob_reset(&x.data);
+}
+
 
 /*
-** Write the ZIP archive into the given BLOB.
+** Write the ZIP archive into the given BLOB.  If the archive is being
+** streamed, pZip is not used and may be NULL.
 */
 void zip_close(Blob *pZip){
-  int iTocStart;
-  int iTocEnd;
+  unsigned int iTocStart;
+  unsigned int iTocEnd;
   int i;
   char zBuf[30];
 
-  iTocStart = blob_size(&body);
-  blob_append(&body, blob_buffer(&toc), blob_size(&toc));
-  iTocEnd = blob_size(&body);
+  if( pPool ){
+    zip_flush_queue();
+    threadpool_free(pPool);
+    pPool = 0;
+    fossil_free(aQueue);
+    aQueue = 0;
+    nQueueAlloc = 0;
+  }
+  iTocStart = iOffset;
+  zip_emit(blob_buffer(&toc), blob_size(&toc));
+  iTocEnd = iOffset;
 
   memset(zBuf, 0, sizeof(zBuf));
   put32(&zBuf[0], 0x06054b50);
@@ -263,10 +380,11 @@ void zip_close(Blob *pZip){
   put32(&zBuf[12], iTocEnd - iTocStart);
   put32(&zBuf[16], iTocStart);
   put16(&zBuf[20], 0);
-  blob_append(&body, zBuf, 22);
+  zip_emit(zBuf, 22);
   blob_reset(&toc);
-  *pZip = body;
+  if( pZip ) *pZip = body;
   blob_zero(&body);
+  isStream = 0;
   nEntry = 0;
   for(i=0; i<nDir; i++){
     free(azDir[i]);
@@ -317,8 +435,15 @@ void filezip_cmd(void){
 ** politely expands into a subdir instead of filling your current dir
 ** with source files. For example, pass a UUID or "ProjectName".
 **
+** If pZip is NULL, the archive is sent with cgi_stream() as each file
+** is added, so that only one file at a time is held in memory.  The
+** caller must bracket the call with cgi_stream_begin() and
+** cgi_stream_end().
+**
+** If nThread is more than 1, files are compressed concurrently on that
+** many worker threads.  The archive is the same either way.
 */
-void zip_of_baseline(int rid, Blob *pZip, const char *zDir){
+void zip_of_baseline(int rid, Blob *pZip, const char *zDir, int nThread){
   Blob mfile, hash, file;
   Manifest *pManifest;
   ManifestFile *pFile;
@@ -327,12 +452,14 @@ void zip_of_baseline(int rid, Blob *pZip, const char *zDir){
   
   content_get(rid, &mfile);
   if( blob_size(&mfile)==0 ){
-    blob_zero(pZip);
+    if( pZip ) blob_zero(pZip);
     return;
   }
   blob_zero(&hash);
   blob_zero(&filename);
   zip_open();
+  isStream = pZip==0;
+  zip_begin_threads(nThread);
 
   if( zDir && zDir[0] ){
     blob_appendf(&filename, "%s/", zDir);
@@ -388,12 +515,17 @@ void zip_of_baseline(int rid, Blob *pZip, const char *zDir){
 ** resulting ZIP archive.  If --name is omitted, the top-level directory
 ** named is derived from the project name, the check-in date and time, and
 ** the artifact ID of the check-in.
+**
+** With --threads N, files are compressed on N threads, 0 meaning one per
+** CPU.  The default comes from the "threads" setting.
 */
 void baseline_zip_cmd(void){
   int rid;
   Blob zip;
   const char *zName;
+  const char *zThreads;
   zName = find_option("name", 0, 1);
+  zThreads = find_option("threads", 0, 1);
   db_find_and_open_repository(0, 0);
   if( g.argc!=4 ){
     usage("VERSION OUTPUTFILE");
@@ -410,7 +542,7 @@ void baseline_zip_cmd(void){
        db_get("project-name", "unnamed"), rid, rid
     );
   }
-  zip_of_baseline(rid, &zip, zName);
+  zip_of_baseline(rid, &zip, zName, threadpool_size(zThreads));
   blob_write_to_file(&zip, g.argv[3]);
 }
 
@@ -420,12 +552,14 @@ void baseline_zip_cmd(void){
 **
 ** Generate a ZIP archive for the baseline.
 ** Return that ZIP archive as the HTTP reply content.
+**
+** The reply is taken from the archive cache (see cache.c) when it has
+** been made before and the "archive-cache-size" setting is on.
 */
 void baseline_zip_page(void){
   int rid;
-  char *zName, *zRid;
+  char *zName, *zRid, *zKey, *zETag;
   int nName, nRid;
-  Blob zip;
 
   login_check_credentials();
   if( !g.perm.Zip ){ login_needed(); return; }
@@ -445,9 +579,23 @@ void baseline_zip_page(void){
     return;
   }
   if( nRid==0 && nName>10 ) zName[10] = 0;
-  zip_of_baseline(rid, &zip, zName);
+  /* The "manifest" setting decides whether the archive holds the
+  ** manifest, so the key records it. */
+  zKey = mprintf("zip/%z/%s/%d", db_text(0,
+                  "SELECT uuid FROM blob WHERE rid=%d", rid), zName,
+                  db_get_boolean("manifest", 0));
+  cgi_set_content_type("application/zip");
+  zETag = sha1sum(zKey);
+  cgi_check_etag(zETag);
+  fossil_free(zETag);
+  if( !cache_serve(zKey) ){
+    cache_capture_begin(zKey);
+    cgi_stream_begin();
+    zip_of_baseline(rid, 0, zName, threadpool_size(0));
+    cgi_stream_end();
+    cache_capture_end();
+  }
+  free( zKey );
   free( zName );
   free( zRid );
-  cgi_set_content(&zip);
-  cgi_set_content_type("application/zip");
 }